@@ -0,0 +1,31 @@
+#!/bin/bash
+
+# Compile time of std::visit against fp::visit, for one large variant and for
+# double dispatch over two variants. Each case is compiled at -O2 and timed
+
+# Source which visits a variant with 64 alternatives, and a pair of variants
+# with 16 alternatives each, using whichever visit VISIT names
+cat > match_compile_bench.cpp << 'SOURCE'
+#include "fp_cpp.h"
+template <int index> struct alternative { double value; };
+template <int... index> std::variant<alternative<index>...> make_variant(std::integer_sequence<int, index...>);
+using large_variant = decltype(make_variant(std::make_integer_sequence<int, 64>{}));
+using small_variant = decltype(make_variant(std::make_integer_sequence<int, 16>{}));
+double visit_large(const large_variant& v)
+{
+    return VISIT([](const auto& a){ return a.value * sizeof(a); }, v);
+}
+double visit_pair(const small_variant& a, const small_variant& b)
+{
+    return VISIT([](const auto& x, const auto& y){ return x.value - y.value; }, a, b);
+}
+int main() {}
+SOURCE
+
+for visit in std::visit fp::visit
+do
+    echo "$visit compile time:"
+    time g++-9 -std=gnu++2a -O2 -pthread -DVISIT=$visit -o match_compile_bench match_compile_bench.cpp
+done
+
+rm -f match_compile_bench match_compile_bench.cpp
@@ -1,7 +1,11 @@
 #!/bin/bash
 
-# Remove old program executable
-rm -rf fp_cpp
+# Remove old program executables
+rm -rf fp_cpp fp_bench
 
-# Compile the program
-g++-8 -std=gnu++2a -o fp_cpp fp_test.cpp
+# Compile the program (with tracing compiled in, so the tests can show the trace reports)
+g++-9 -std=gnu++2a -DFP_INSTRUMENTATION -pthread -o fp_cpp fp_test.cpp
+
+# Compile the benchmarks (optimized, since they measure performance; sqrt
+# only vectorizes when it does not have to set errno)
+g++-9 -std=gnu++2a -O2 -fno-math-errno -pthread -o fp_bench fp_bench.cpp
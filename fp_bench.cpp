@@ -0,0 +1,1240 @@
+#include "fp_cpp.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Usage: fp_bench [--filter text] [--json file] [--baseline file] [--threshold fraction]
+//   --filter     only run benchmarks whose name contains the text
+//   --json       write every result to a JSON file (which can be a later baseline)
+//   --baseline   compare the median ns/element of each benchmark with a saved JSON file
+//   --threshold  allowed slowdown against the baseline before it counts as a
+//                regression (default 0.10, 10%)
+// The exit code is 1 when any benchmark regressed, and 2 for bad arguments
+
+// Bytes currently allocated through operator new, for the memory comparisons,
+// and the number of calls to it (each one a malloc).
+// Each block carries its size in a header, so delete can subtract it. They are
+// kept out of line, so GCC does not match the malloc/free inside them against
+// the new/delete at each call site
+std::atomic<std::size_t> allocated_bytes{0};
+std::atomic<std::size_t> allocation_count{0};
+constexpr std::size_t allocation_header = alignof(std::max_align_t);
+
+__attribute__((noinline)) void* operator new(std::size_t size)
+{
+    char* block = static_cast<char*>(std::malloc(size + allocation_header));
+    if (!block)
+        throw std::bad_alloc();
+    *reinterpret_cast<std::size_t*>(block) = size;
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return block + allocation_header;
+}
+
+__attribute__((noinline)) void operator delete(void* pointer) noexcept
+{
+    if (!pointer)
+        return;
+    char* block = static_cast<char*>(pointer) - allocation_header;
+    allocated_bytes.fetch_sub(*reinterpret_cast<std::size_t*>(block), std::memory_order_relaxed);
+    std::free(block);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept { operator delete(pointer); }
+
+// Over aligned blocks (and std::pmr::new_delete_resource, which passes its
+// alignment on) keep the header in a whole alignment unit before the block
+__attribute__((noinline)) void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    std::size_t header = std::max(allocation_header, std::size_t(alignment));
+    std::size_t bytes = (size + header + std::size_t(alignment) - 1) / std::size_t(alignment) * std::size_t(alignment);
+    char* block = static_cast<char*>(std::aligned_alloc(std::size_t(alignment), bytes));
+    if (!block)
+        throw std::bad_alloc();
+    *reinterpret_cast<std::size_t*>(block) = size;
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return block + header;
+}
+
+__attribute__((noinline)) void operator delete(void* pointer, std::align_val_t alignment) noexcept
+{
+    if (!pointer)
+        return;
+    char* block = static_cast<char*>(pointer) - std::max(allocation_header, std::size_t(alignment));
+    allocated_bytes.fetch_sub(*reinterpret_cast<std::size_t*>(block), std::memory_order_relaxed);
+    std::free(block);
+}
+
+void operator delete(void* pointer, std::size_t, std::align_val_t alignment) noexcept { operator delete(pointer, alignment); }
+
+// Keep the optimizer from discarding a result that is never used
+template <typename T>
+void do_not_optimize(const T& value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+// The result of one benchmark. Latencies are per element, over the timed samples
+struct bench_result
+{
+    std::string name;
+    std::size_t elements = 0;
+    int repetitions = 0;
+    double ns_per_element = 0;
+    double elements_per_second = 0;
+    double p50_ns = 0;
+    double p90_ns = 0;
+    double p99_ns = 0;
+};
+
+// Settings from the command line, and the results gathered so far
+struct bench_session
+{
+    std::string filter;
+    std::vector<bench_result> results;
+};
+
+bench_session& session()
+{
+    static bench_session current;
+    return current;
+}
+
+// Benchmarks (and the notes printed alongside them) only run when their name
+// contains the --filter text
+bool selected(const std::string& bench_name)
+{
+    return bench_name.find(session().filter) != std::string::npos;
+}
+
+// Nearest rank percentile of sorted samples (0 < p <= 1)
+double percentile(const std::vector<double>& sorted_samples, double p)
+{
+    std::size_t rank = std::size_t(std::ceil(p * double(sorted_samples.size())));
+    return sorted_samples[std::max<std::size_t>(rank, 1) - 1];
+}
+
+// Time a callable over a number of repetitions and report nanoseconds per
+// element, throughput and percentile latencies. The repetitions are split into
+// up to 25 timed samples, so short callables are not measured one clock read
+// at a time. One untimed run first warms the caches
+template <typename F>
+void run_benchmark(std::string bench_name, std::size_t elements, int repetitions, F f)
+{
+    if (!selected(bench_name))
+        return;
+    int sample_count = std::min(repetitions, 25);
+    int repetitions_per_sample = std::max(1, repetitions / sample_count);
+    do_not_optimize(f());
+
+    std::vector<double> samples;
+    double total_ns = 0;
+    for (int sample = 0; sample < sample_count; sample++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int rep = 0; rep < repetitions_per_sample; rep++)
+            do_not_optimize(f());
+        auto stop = std::chrono::steady_clock::now();
+        double sample_ns = std::chrono::duration<double, std::nano>(stop - start).count();
+        total_ns += sample_ns;
+        samples.push_back(sample_ns / (double(elements) * repetitions_per_sample));
+    }
+    std::sort(samples.begin(), samples.end());
+
+    bench_result result;
+    result.name = bench_name;
+    result.elements = elements;
+    result.repetitions = sample_count * repetitions_per_sample;
+    result.ns_per_element = total_ns / (double(elements) * result.repetitions);
+    result.elements_per_second = 1e9 / result.ns_per_element;
+    result.p50_ns = percentile(samples, 0.50);
+    result.p90_ns = percentile(samples, 0.90);
+    result.p99_ns = percentile(samples, 0.99);
+    std::cout << bench_name << " (" << elements << " elements): "
+              << result.ns_per_element << " ns/element, "
+              << result.elements_per_second / 1e6 << " M elements/s, p50/p90/p99 "
+              << result.p50_ns << "/" << result.p90_ns << "/" << result.p99_ns << " ns/element" << std::endl;
+    session().results.push_back(result);
+}
+
+// Benchmarks are matched with their baseline by name and element count
+std::string result_key(const std::string& name, std::size_t elements)
+{
+    return name + " (" + std::to_string(elements) + " elements)";
+}
+
+// One benchmark per line, so the baseline reader does not need a JSON parser
+void write_json(std::ostream& out, const std::vector<bench_result>& results)
+{
+    out << "{\"benchmarks\": [\n";
+    for (std::size_t i = 0; i < results.size(); i++)
+    {
+        const bench_result& result = results[i];
+        out << "{\"name\": \"" << result.name << "\", \"elements\": " << result.elements
+            << ", \"repetitions\": " << result.repetitions
+            << ", \"ns_per_element\": " << result.ns_per_element
+            << ", \"elements_per_second\": " << result.elements_per_second
+            << ", \"p50_ns_per_element\": " << result.p50_ns
+            << ", \"p90_ns_per_element\": " << result.p90_ns
+            << ", \"p99_ns_per_element\": " << result.p99_ns << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]}\n";
+}
+
+// Read the median ns/element of each benchmark from a file written by write_json
+bool read_baseline(const std::string& file_name, std::map<std::string, double>& baseline)
+{
+    std::ifstream in(file_name);
+    if (!in)
+        return false;
+    auto number_after = [](const std::string& line, const std::string& key)
+    {
+        std::size_t at = line.find("\"" + key + "\": ");
+        return (at == std::string::npos) ? -1.0 : std::strtod(line.c_str() + at + key.size() + 4, nullptr);
+    };
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::size_t name_start = line.find("\"name\": \"");
+        if (name_start == std::string::npos)
+            continue;
+        name_start += 9;
+        std::string name = line.substr(name_start, line.find('"', name_start) - name_start);
+        baseline[result_key(name, std::size_t(number_after(line, "elements")))] =
+            number_after(line, "p50_ns_per_element");
+    }
+    return true;
+}
+
+// Compare each result with the baseline, and return the number of regressions
+int compare_with_baseline(const std::map<std::string, double>& baseline, double threshold)
+{
+    int regressions = 0;
+    std::cout << std::endl << "Baseline comparison (median ns/element, threshold "
+              << threshold * 100 << "%)" << std::endl;
+    for (const bench_result& result : session().results)
+    {
+        auto found = baseline.find(result_key(result.name, result.elements));
+        if (found == baseline.end() || found->second <= 0)
+            continue;
+        double change = result.p50_ns / found->second - 1.0;
+        bool regressed = change > threshold;
+        regressions += regressed ? 1 : 0;
+        std::cout << (regressed ? "REGRESSION " : "ok         ") << result_key(result.name, result.elements)
+                  << ": " << found->second << " -> " << result.p50_ns << " ns/element ("
+                  << (change >= 0 ? "+" : "") << change * 100 << "%)" << std::endl;
+    }
+    std::cout << regressions << " regressions" << std::endl;
+    return regressions;
+}
+
+// Compare the recursive sumlist versions against the reduction engine
+template <typename T>
+void sumlist_benchmarks(std::string type_name)
+{
+    // Recursive versions are limited to sizes which fit on the stack
+    for (std::size_t elements : {1000, 10000, 100000})
+    {
+        std::vector<T> list(elements, T{1});
+        int repetitions = int(10000000 / elements);
+        run_benchmark("sumlist_recursive<" + type_name + ">", elements, repetitions, [&]{
+            return sumlist_recursive<T, typename std::vector<T>::iterator>(list.begin(), list.end()); });
+        run_benchmark("sumlist_tail_recursive<" + type_name + ">", elements, repetitions, [&]{
+            return sumlist_tail_recursive<T, typename std::vector<T>::iterator>(list.begin(), list.end()); });
+        run_benchmark("sumlist_trampoline<" + type_name + ">", elements, repetitions, [&]{
+            return sumlist_trampoline<T>(list.begin(), list.end()).run(); });
+        run_benchmark("sumlist<" + type_name + ">", elements, repetitions, [&]{
+            return sumlist<T, typename std::vector<T>::iterator>(list.begin(), list.end()); });
+    }
+
+    // The engine also handles lists far past the recursion limit
+    std::vector<T> large_list(10000000, T{1});
+    run_benchmark("std::accumulate<" + type_name + ">", large_list.size(), 10, [&]{
+        return std::accumulate(large_list.begin(), large_list.end(), T{0}); });
+    run_benchmark("sumlist<" + type_name + ">", large_list.size(), 10, [&]{
+        return sumlist<T, typename std::vector<T>::iterator>(large_list.begin(), large_list.end()); });
+    run_benchmark("sumlist_trampoline<" + type_name + ">", large_list.size(), 10, [&]{
+        return sumlist_trampoline<T>(large_list.begin(), large_list.end()).run(); });
+    if (selected("sumlist_trampoline<" + type_name + ">"))
+    {
+        std::size_t heap_before = allocated_bytes.load();
+        do_not_optimize(sumlist_trampoline<T>(large_list.begin(), large_list.end()).run());
+        std::cout << "Heap allocated by sumlist_trampoline<" << type_name << "> over "
+                  << large_list.size() << " steps: " << allocated_bytes.load() - heap_before << " bytes" << std::endl;
+    }
+    run_benchmark("fp::reduce max<" + type_name + ">", large_list.size(), 10, [&]{
+        return fp::reduce(large_list.begin(), large_list.end(), T{0}, fp::maximum{}); });
+}
+
+// Compare the old double seeded sumlist_HOF against the typed monoid folds
+template <typename T>
+void monoid_benchmarks(std::string type_name)
+{
+    std::vector<T> list(10000000, T{1});
+    run_benchmark("std::accumulate (0.0 seed)<" + type_name + ">", list.size(), 10, [&]{
+        return T(std::accumulate(list.begin(), list.end(), 0.0, [](T a, T b){return a + b;})); });
+    run_benchmark("sumlist_HOF<" + type_name + ">", list.size(), 10, [&]{
+        return sumlist_HOF<T>(list); });
+    run_benchmark("fp::mconcat product<" + type_name + ">", list.size(), 10, [&]{
+        return fp::mconcat<fp::monoid::product>(list); });
+    run_benchmark("fp::mconcat min<" + type_name + ">", list.size(), 10, [&]{
+        return fp::mconcat<fp::monoid::min>(list); });
+    if constexpr (std::is_integral_v<T>)
+        run_benchmark("fp::mconcat bit_xor<" + type_name + ">", list.size(), 10, [&]{
+            return fp::mconcat<fp::monoid::bit_xor>(list); });
+}
+
+// Compare the sequential HOFs against the parallel map and fold for several pool sizes
+void parallel_HOF_benchmarks()
+{
+    std::vector<double> list(20000000, 1.0);
+    run_benchmark("inclist_HOF<double>", list.size(), 5, [&]{
+        inclist_HOF<double>(list); return list[0]; });
+    run_benchmark("sumlist_HOF<double>", list.size(), 5, [&]{
+        return sumlist_HOF<double>(list); });
+
+    std::size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        fp::ThreadPool pool(threads);
+        fp::parallel_options options{0, 0, &pool};
+        std::string suffix = " (" + std::to_string(threads) + " threads)";
+        run_benchmark("fp::map<double>" + suffix, list.size(), 5, [&]{
+            fp::map(list, [](double& x){x = x + 1;}, options); return list[0]; });
+        run_benchmark("fp::fold<double>" + suffix, list.size(), 5, [&]{
+            return fp::fold(list, 0.0, std::plus<>{}, options); });
+    }
+}
+
+// Summing doubles: std::accumulate and the fast folds against the reproducible
+// sum, for speed and for the error against the exact sum
+void reproducible_sum_benchmarks()
+{
+    // Multiples of 2^-20 over many magnitudes and both signs. Each is exact in
+    // a double, and so is their sum in 128 bit integer units of 2^-20
+    std::size_t elements = 10000000;
+    std::vector<double> list(elements);
+    std::mt19937_64 random(42);
+    __int128 exact_units = 0;
+    for (auto& x : list)
+    {
+        int64_t units = int64_t(random() >> 11) >> (random() % 50);
+        units = (random() & 1) ? -units : units;
+        exact_units += units;
+        x = std::ldexp(double(units), -20);
+    }
+    double exact = std::ldexp(double(exact_units), -20);
+
+    std::map<std::string, double> results;
+    auto sum_benchmark = [&](std::string name, auto f) {
+        run_benchmark("summation: " + name, elements, 10, [&]{ return results[name] = f(); }); };
+    sum_benchmark("std::accumulate", [&]{ return std::accumulate(list.begin(), list.end(), 0.0); });
+    sum_benchmark("sumlist_HOF (fast)", [&]{ return sumlist_HOF<double>(list); });
+    std::size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        fp::ThreadPool pool(threads);
+        std::string suffix = " (" + std::to_string(threads) + " threads)";
+        sum_benchmark("fp::fold" + suffix, [&]{ return fp::fold(list, 0.0, std::plus<>{}, fp::parallel_options{0, 0, &pool}); });
+        sum_benchmark("fp::reproducible_sum" + suffix, [&]{
+            return fp::reproducible_sum(list, fp::parallel_options{0, 0, &pool}); });
+    }
+    if (selected("summation: "))
+    {
+        std::cout << "Relative error against the exact sum " << exact << ":" << std::endl;
+        for (const auto& [name, result] : results)
+            std::cout << "    " << name << ": " << std::fabs(result - exact) / std::fabs(exact)
+                      << (result == exact ? " (exact)" : "") << std::endl;
+    }
+}
+
+// Non-destructive updates which keep every version: a persistent vector against
+// copy on write std::vectors (each update copies the whole list)
+void persistent_vector_benchmarks()
+{
+    std::size_t elements = 100000;
+    std::size_t updates = 1000;
+    std::vector<double> values(elements, 1.0);
+    fp::PersistentVector<double> list(values);
+
+    std::size_t before = allocated_bytes.load();
+    std::vector<std::shared_ptr<const std::vector<double>>> cow_versions;
+    cow_versions.push_back(std::make_shared<const std::vector<double>>(values));
+    for (std::size_t i = 0; i < updates; i++)
+    {
+        auto next = std::make_shared<std::vector<double>>(*cow_versions.back());
+        (*next)[(i * 7919) % elements] = double(i);
+        cow_versions.push_back(std::move(next));
+    }
+    std::size_t cow_bytes = allocated_bytes.load() - before;
+    cow_versions.clear();
+
+    before = allocated_bytes.load();
+    std::vector<fp::PersistentVector<double>> versions = {list};
+    for (std::size_t i = 0; i < updates; i++)
+        versions.push_back(versions.back().set((i * 7919) % elements, double(i)));
+    std::size_t persistent_bytes = allocated_bytes.load() - before;
+    versions.clear();
+    if (selected("PersistentVector"))
+        std::cout << "Memory for " << updates << " updated versions of " << elements << " doubles: copy on write "
+                  << cow_bytes / 1024 << " KiB, PersistentVector " << persistent_bytes / 1024 << " KiB" << std::endl;
+
+    run_benchmark("copy on write std::vector set (100000 doubles)", updates, 5, [&]{
+        std::shared_ptr<const std::vector<double>> current = std::make_shared<const std::vector<double>>(values);
+        for (std::size_t i = 0; i < updates; i++)
+        {
+            auto next = std::make_shared<std::vector<double>>(*current);
+            (*next)[(i * 7919) % elements] = double(i);
+            current = std::move(next);
+        }
+        return (*current)[0]; });
+    run_benchmark("PersistentVector set (100000 doubles)", updates, 5, [&]{
+        fp::PersistentVector<double> current = list;
+        for (std::size_t i = 0; i < updates; i++)
+            current = current.set((i * 7919) % elements, double(i));
+        return current[0]; });
+    run_benchmark("PersistentVector transient set (100000 doubles)", updates, 5, [&]{
+        auto current = list.transient();
+        for (std::size_t i = 0; i < updates; i++)
+            current.set((i * 7919) % elements, double(i));
+        return std::move(current).persistent()[0]; });
+
+    run_benchmark("std::vector push_back", elements, 20, [&]{
+        std::vector<double> built;
+        for (std::size_t i = 0; i < elements; i++)
+            built.push_back(double(i));
+        return built.back(); });
+    run_benchmark("PersistentVector push_back", elements, 20, [&]{
+        fp::PersistentVector<double> built;
+        for (std::size_t i = 0; i < elements; i++)
+            built = built.push_back(double(i));
+        return built[0]; });
+    run_benchmark("PersistentVector transient push_back", elements, 20, [&]{
+        fp::PersistentVector<double>::Transient built;
+        for (std::size_t i = 0; i < elements; i++)
+            built.push_back(double(i));
+        return std::move(built).persistent()[0]; });
+
+    run_benchmark("sumlist_HOF<double> (std::vector)", elements, 100, [&]{
+        return sumlist_HOF<double>(values); });
+    run_benchmark("sumlist_HOF<double> (PersistentVector)", elements, 100, [&]{
+        return sumlist_HOF<double>(list); });
+    run_benchmark("random reads (std::vector)", elements, 100, [&]{
+        double sum = 0; for (std::size_t i = 0; i < elements; i++) sum += values[(i * 7919) % elements]; return sum; });
+    run_benchmark("random reads (PersistentVector)", elements, 100, [&]{
+        double sum = 0; for (std::size_t i = 0; i < elements; i++) sum += list[(i * 7919) % elements]; return sum; });
+}
+
+// Summing a binary file of doubles: read into a std::vector first, against the
+// memory mapped file and the chunked reader (the file is in the page cache)
+void mapped_array_benchmarks()
+{
+    std::size_t elements = 10000000;
+    std::string path = "fp_bench_doubles.bin";
+    {
+        std::vector<double> list(elements, 1.0);
+        std::ofstream out(path, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(list.data()), std::streamsize(elements * sizeof(double)));
+    }
+    std::size_t peak_bytes = 0;
+    run_benchmark("file: read into std::vector, sumlist_HOF", elements, 5, [&]{
+        std::size_t before = allocated_bytes.load();
+        std::ifstream in(path, std::ios::binary);
+        std::vector<double> list(elements);
+        in.read(reinterpret_cast<char*>(list.data()), std::streamsize(elements * sizeof(double)));
+        peak_bytes = allocated_bytes.load() - before;
+        return sumlist_HOF<double>(list); });
+    run_benchmark("file: MappedArray, sumlist_HOF", elements, 5, [&]{
+        fp::MappedArray<double> list(path);
+        return sumlist_HOF(list); });
+    run_benchmark("file: MappedArray, sumlist_HOF (parallel)", elements, 5, [&]{
+        fp::MappedArray<double> list(path);
+        return sumlist_HOF(list, fp::parallel_options{}); });
+    run_benchmark("file: ChunkedFileReader (8 MiB chunks), fold", elements, 5, [&]{
+        fp::ChunkedFileReader<double> list(path);
+        return fp::fold(list, 0.0); });
+    if (selected("file:"))
+        std::cout << "Heap used to sum the file: std::vector " << peak_bytes / 1024
+                  << " KiB, MappedArray 0 KiB, ChunkedFileReader " << (8 << 10) << " KiB" << std::endl;
+    std::remove(path.c_str());
+}
+
+// compute_area as it was written with std::visit, as the baseline for fp::match
+double compute_area_std_visit(const adt_shape& shape)
+{
+    double area;
+    std::visit(overloaded
+    {
+        [&area](const Shape::circle& circle) { area = M_PI * pow(circle.radius, 2.0); },
+        [&area](const Shape::square& square) { area = pow(square.side, 2.0); },
+        [&area](const Shape::rectangle& rectangle) { area = rectangle.length * rectangle.width; },
+        [&area](const Shape::ellipse& ellipse) { area = M_PI * ellipse.axis_1 * ellipse.axis_2; },
+        [&area](const Shape::cylinder& cylinder) {
+            area = 2 * M_PI * cylinder.radius * (cylinder.radius + cylinder.height); }
+    }, shape);
+    return area;
+}
+
+// A sum type with 32 alternatives, for dispatch over large variants
+template <int index>
+struct numbered_shape
+{
+    static constexpr int number = index;
+    double size;
+};
+template <int... index>
+std::variant<numbered_shape<index>...> numbered_variant(std::integer_sequence<int, index...>);
+using large_variant = decltype(numbered_variant(std::make_integer_sequence<int, 32>{}));
+
+template <int... index>
+large_variant make_numbered_shape(int which, double size, std::integer_sequence<int, index...>)
+{
+    large_variant shapes[] = {numbered_shape<index>{size}...};
+    return shapes[which];
+}
+
+// std::visit against fp::visit, for the 5 shape ADT and for a 32 alternative variant
+void match_benchmarks()
+{
+    std::size_t elements = 1000000;
+    std::vector<adt_shape> shapes;
+    std::vector<large_variant> large_shapes;
+    unsigned seed = 12345;
+    for (std::size_t i = 0; i < elements; i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        double x = (seed >> 8) % 1000 / 10.0;
+        switch ((seed >> 16) % 5)
+        {
+        case 0: shapes.push_back(Shape::circle{x}); break;
+        case 1: shapes.push_back(Shape::square{x}); break;
+        case 2: shapes.push_back(Shape::rectangle{x, x + 1}); break;
+        case 3: shapes.push_back(Shape::ellipse{x, x / 2}); break;
+        default: shapes.push_back(Shape::cylinder{x, 3.0}); break;
+        }
+        large_shapes.push_back(make_numbered_shape(int((seed >> 20) % 32), x, std::make_integer_sequence<int, 32>{}));
+    }
+    std::vector<double> areas(elements);
+    run_benchmark("compute_area: std::visit writing a captured result", elements, 20, [&]{
+        for (std::size_t i = 0; i < elements; i++)
+            areas[i] = compute_area_std_visit(shapes[i]);
+        return areas[0]; });
+    run_benchmark("compute_area: fp::match returning the result", elements, 20, [&]{
+        for (std::size_t i = 0; i < elements; i++)
+            areas[i] = compute_area(shapes[i]);
+        return areas[0]; });
+
+    // Every alternative computes something different, so the cases can not be merged
+    auto scaled_size = [](const auto& shape)
+    {
+        return shape.size * (std::decay_t<decltype(shape)>::number + 1);
+    };
+    run_benchmark("32 alternative variant: std::visit", elements, 20, [&]{
+        for (std::size_t i = 0; i < elements; i++)
+            areas[i] = std::visit(scaled_size, large_shapes[i]);
+        return areas[0]; });
+    run_benchmark("32 alternative variant: fp::visit", elements, 20, [&]{
+        for (std::size_t i = 0; i < elements; i++)
+            areas[i] = fp::visit(scaled_size, large_shapes[i]);
+        return areas[0]; });
+}
+
+// Compare compute_area over a vector of variants against the columnar batch kernels
+// Shapes of every alternative in an unpredictable order
+std::vector<adt_shape> random_shapes(std::size_t elements)
+{
+    std::vector<adt_shape> shapes;
+    unsigned seed = 12345;
+    for (std::size_t i = 0; i < elements; i++)
+    {
+        // Simple linear congruential generator, so the alternatives come in an unpredictable order
+        seed = seed * 1103515245u + 12345u;
+        double x = (seed >> 8) % 1000 / 10.0;
+        switch ((seed >> 16) % 5)
+        {
+        case 0: shapes.push_back(Shape::circle{x}); break;
+        case 1: shapes.push_back(Shape::square{x}); break;
+        case 2: shapes.push_back(Shape::rectangle{x, x + 1}); break;
+        case 3: shapes.push_back(Shape::ellipse{x, x / 2}); break;
+        default: shapes.push_back(Shape::cylinder{x, 3.0}); break;
+        }
+    }
+    return shapes;
+}
+
+void compute_area_benchmarks()
+{
+    std::size_t elements = 1000000;
+    std::vector<adt_shape> shapes = random_shapes(elements);
+    ShapeColumns columns(shapes);
+    std::vector<double> areas(elements);
+
+    // Small sizes stay in cache, the largest one streams from memory
+    for (std::size_t sweep_elements : {1000, 100000, 1000000})
+    {
+        std::vector<adt_shape> sweep_shapes(shapes.begin(), shapes.begin() + sweep_elements);
+        ShapeColumns sweep_columns(sweep_shapes);
+        int repetitions = int(20000000 / sweep_elements);
+        run_benchmark("compute_area (fp::match)", sweep_elements, repetitions, [&]{
+            for (std::size_t i = 0; i < sweep_elements; i++)
+                areas[i] = compute_area(sweep_shapes[i]);
+            return areas[0]; });
+        run_benchmark("compute_areas (ShapeColumns)", sweep_elements, repetitions, [&]{
+            compute_areas(sweep_columns, areas.data()); return areas[0]; });
+    }
+    std::size_t column_bytes = columns.tags().size()
+        + sizeof(double) * (columns.circles().radius.size() + columns.squares().side.size()
+                            + 2 * columns.rectangles().length.size() + 2 * columns.ellipses().axis_1.size()
+                            + 2 * columns.cylinders().radius.size());
+    if (selected("ShapeColumns"))
+        std::cout << "Memory per shape: std::vector<adt_shape> " << sizeof(adt_shape)
+                  << " bytes, ShapeColumns " << double(column_bytes) / elements << " bytes" << std::endl;
+}
+
+// Saving and loading a million shapes, then computing their areas: as text,
+// as one record per variant (tag then fields), and as a shape file which is
+// mapped and read in place (the files are in the page cache)
+void shape_file_benchmarks()
+{
+    std::size_t elements = 1000000;
+    std::vector<adt_shape> shapes = random_shapes(elements);
+    std::vector<double> areas(elements);
+    std::string path = "fp_bench_shapes";
+    auto fields = [](const adt_shape& shape) {
+        return fp::match(shape)(
+            [](const Shape::circle& c) { return std::array<double, 2>{c.radius, 0}; },
+            [](const Shape::square& s) { return std::array<double, 2>{s.side, 0}; },
+            [](const Shape::rectangle& r) { return std::array<double, 2>{r.length, r.width}; },
+            [](const Shape::ellipse& e) { return std::array<double, 2>{e.axis_1, e.axis_2}; },
+            [](const Shape::cylinder& c) { return std::array<double, 2>{c.radius, c.height}; }); };
+    auto make_shape = [](int tag, double a, double b) -> adt_shape {
+        switch (tag)
+        {
+        case 0: return Shape::circle{a};
+        case 1: return Shape::square{a};
+        case 2: return Shape::rectangle{a, b};
+        case 3: return Shape::ellipse{a, b};
+        default: return Shape::cylinder{a, b};
+        } };
+
+    run_benchmark("shape file: text, write", elements, 3, [&]{
+        std::ofstream out(path + ".txt");
+        for (const auto& shape : shapes)
+        {
+            auto f = fields(shape);
+            out << shape.index() << ' ' << f[0] << ' ' << f[1] << '\n';
+        }
+        return 0; });
+    run_benchmark("shape file: text, read and compute_area", elements, 3, [&]{
+        std::ifstream in(path + ".txt");
+        std::vector<adt_shape> loaded;
+        int tag;
+        double a, b;
+        while (in >> tag >> a >> b)
+            loaded.push_back(make_shape(tag, a, b));
+        for (std::size_t i = 0; i < loaded.size(); i++)
+            areas[i] = compute_area(loaded[i]);
+        return areas[0]; });
+
+    run_benchmark("shape file: per variant records, write", elements, 5, [&]{
+        std::ofstream out(path + ".records", std::ios::binary);
+        for (const auto& shape : shapes)
+        {
+            auto f = fields(shape);
+            char tag = char(shape.index());
+            out.write(&tag, 1);
+            out.write(reinterpret_cast<const char*>(f.data()), (tag == 0 || tag == 1) ? 8 : 16);
+        }
+        return 0; });
+    run_benchmark("shape file: per variant records, read and compute_area", elements, 5, [&]{
+        std::ifstream in(path + ".records", std::ios::binary);
+        std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::vector<adt_shape> loaded;
+        for (std::size_t offset = 0; offset < bytes.size();)
+        {
+            int tag = bytes[offset++];
+            double f[2] = {0, 0};
+            std::size_t size = (tag == 0 || tag == 1) ? 8 : 16;
+            std::memcpy(f, &bytes[offset], size);
+            offset += size;
+            loaded.push_back(make_shape(tag, f[0], f[1]));
+        }
+        for (std::size_t i = 0; i < loaded.size(); i++)
+            areas[i] = compute_area(loaded[i]);
+        return areas[0]; });
+
+    run_benchmark("shape file: ShapeFileWriter, write", elements, 5, [&]{
+        fp::ShapeFileWriter writer(path + ".shapes");
+        for (const auto& shape : shapes)
+            writer.push_back(shape);
+        writer.flush();
+        return writer.size(); });
+    std::size_t view_heap_bytes = 0;
+    run_benchmark("shape file: ShapeFileView, compute_areas", elements, 20, [&]{
+        std::size_t before = allocated_bytes.load();
+        fp::ShapeFileView file(path + ".shapes");
+        compute_areas(file, areas.data());
+        view_heap_bytes = allocated_bytes.load() - before;
+        return areas[0]; });
+
+    if (selected("shape file: "))
+    {
+        auto file_size = [](const std::string& name) { std::ifstream in(name, std::ios::binary | std::ios::ate); return std::size_t(in.tellg()); };
+        std::cout << "Bytes per shape on disk: text " << double(file_size(path + ".txt")) / elements
+                  << ", per variant records " << double(file_size(path + ".records")) / elements
+                  << ", shape file " << double(file_size(path + ".shapes")) / elements << std::endl;
+        std::cout << "Heap used to open and read the shape file: " << view_heap_bytes << " bytes" << std::endl;
+    }
+    for (const char* extension : {".txt", ".records", ".shapes"})
+        std::remove((path + extension).c_str());
+}
+
+// A report of area, perimeter and volume per shape with totals per alternative:
+// one pass per metric plus one to group, against analyze_shapes
+void shape_analytics_benchmarks()
+{
+    std::size_t elements = 1000000;
+    std::vector<adt_shape> shapes = random_shapes(elements);
+    std::vector<double> areas(elements), perimeters(elements), volumes(elements);
+    run_benchmark("shape report: one pass per metric", elements, 5, [&]{
+        for (std::size_t i = 0; i < elements; i++)
+            areas[i] = compute_area(shapes[i]);
+        for (std::size_t i = 0; i < elements; i++)
+            perimeters[i] = compute_perimeter(shapes[i]);
+        for (std::size_t i = 0; i < elements; i++)
+            volumes[i] = compute_volume(shapes[i]);
+        std::array<fp::shape_group_totals, std::variant_size_v<adt_shape>> groups{};
+        for (std::size_t i = 0; i < elements; i++)
+        {
+            auto& group = groups[shapes[i].index()];
+            group.count++;
+            group.area += areas[i];
+            group.perimeter += perimeters[i];
+            group.volume += volumes[i];
+            group.histogram[areas[i] > 0 ? std::clamp(std::ilogb(areas[i]) + 32, 0, 63) : 0]++;
+        }
+        return groups[0].area; });
+
+    std::size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        fp::ThreadPool pool(threads);
+        fp::shape_report_options options;
+        options.parallel.pool = &pool;
+        run_benchmark("shape report: analyze_shapes (" + std::to_string(threads) + " threads)", elements, 5, [&]{
+            return fp::analyze_shapes(shapes, options).groups[0].area; });
+    }
+}
+
+// The fused inc | times2 | compute_avg_tip pipeline against a hand written loop,
+// and against the same chain built from std::function
+void composition_benchmarks()
+{
+    std::vector<double> bills(10000000);
+    std::iota(bills.begin(), bills.end(), 0.0);
+    std::vector<double> tips(bills.size());
+    run_benchmark("hand written loop: inc, times2, avg tip", bills.size(), 10, [&]{
+        for (std::size_t i = 0; i < bills.size(); i++)
+            tips[i] = 0.15 * ((bills[i] + 1.0) * 2.0);
+        return tips[1]; });
+    run_benchmark("std::function chain: inc, times2, avg tip", bills.size(), 10, [&]{
+        std::function<double(double)> first = inc;
+        std::function<double(double)> second = [&](double x){ return times2(first(x)); };
+        std::function<double(double)> third = [&](double x){ return compute_avg_tip(second(x)); };
+        std::transform(bills.begin(), bills.end(), tips.begin(), third);
+        return tips[1]; });
+    run_benchmark("fp::apply_all fused pipeline: inc, times2, avg tip", bills.size(), 10, [&]{
+        fp::apply_all(bills.begin(), bills.end(), tips.begin(), avg_tip_pipeline);
+        return tips[1]; });
+}
+
+// Tips on ten million line items: compute_tip on doubles (as is, and rounded
+// to the cent as a bill needs), against Money one at a time and in a batch
+void money_benchmarks()
+{
+    std::size_t elements = 10000000;
+    std::vector<double> subtotals(elements), tips(elements);
+    std::vector<fp::Money> money_subtotals(elements), money_tips(elements);
+    uint64_t seed = 42;
+    for (std::size_t i = 0; i < elements; i++)
+    {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        int64_t cents = int64_t((seed >> 33) % 100000);
+        money_subtotals[i] = fp::Money::from_units(cents);
+        subtotals[i] = double(cents) / 100.0;
+    }
+    auto tip_percent = 15.0;
+    auto money_tip = compute_money_tip(tip_percent);
+
+    run_benchmark("money: compute_tip on doubles", elements, 10, [&]{
+        fp::apply_all(subtotals.begin(), subtotals.end(), tips.begin(), compute_tip(tip_percent));
+        return tips[1]; });
+    auto rounded_tip = [tip = compute_tip(tip_percent)](double subtotal) { return std::nearbyint(tip(subtotal) * 100.0) / 100.0; };
+    run_benchmark("money: compute_tip on doubles, rounded to the cent", elements, 10, [&]{
+        fp::apply_all(subtotals.begin(), subtotals.end(), tips.begin(), rounded_tip);
+        return tips[1]; });
+    run_benchmark("money: fp::money::tip, one at a time", elements, 10, [&]{
+        for (std::size_t i = 0; i < elements; i++)
+            money_tips[i] = money_tip(money_subtotals[i]);
+        return money_tips[1]; });
+    run_benchmark("money: fp::money::tip, batch (integer SIMD)", elements, 10, [&]{
+        money_tip(money_subtotals.data(), money_tips.data(), elements);
+        return money_tips[1]; });
+
+    if (selected("money: "))
+    {
+        // Cents where the rounded double differs from the exact decimal tip,
+        // and what the day's tips add up to each way
+        std::size_t wrong_cents = 0;
+        fp::Money money_total;
+        double double_total = 0;
+        for (std::size_t i = 0; i < elements; i++)
+        {
+            double tip = rounded_tip(subtotals[i]);
+            wrong_cents += (fp::Money::from_double(tip) != money_tips[i]);
+            money_total += money_tips[i];
+            double_total += compute_tip(tip_percent)(subtotals[i]);
+        }
+        std::cout << "Line items where the rounded double tip is off by a cent: " << wrong_cents << " of " << elements << std::endl;
+        std::cout << "Total of the tips: " << money_total << " as Money, " << std::fixed << std::setprecision(6)
+                  << double_total << " as unrounded doubles" << std::defaultfloat << std::endl;
+    }
+}
+
+// Cold and warm lookup latency of the Fibonacci engine, against the lazy Fibonacci class
+// The Fibonacci class as it was before the compile time table, as the baseline:
+// every object starts from {0, 1} and computes its numbers at runtime
+class RuntimeFibonacci
+{
+public:
+    uint64_t get_fib_num(uint16_t fib_index) { return get_fib_step(fib_index).run(); }
+
+private:
+    fp::trampoline<uint64_t> get_fib_step(uint16_t fib_index)
+    {
+        if ((m_fibonacci.size() - 1) >= fib_index)
+            return m_fibonacci[fib_index];
+        m_fibonacci.push_back(m_fibonacci[m_fibonacci.size() - 1] + m_fibonacci[m_fibonacci.size() - 2]);
+        return fp::tail_call(&RuntimeFibonacci::get_fib_step, this, fib_index);
+    }
+
+    std::vector<uint64_t> m_fibonacci = {0, 1};
+};
+
+void fibonacci_benchmarks()
+{
+    // Startup (creating the object) and the first lookup from a new object,
+    // with the sequence computed at runtime and read from the compile time table
+    run_benchmark("Fibonacci class startup (runtime table)", 1, 100000, [&]{
+        RuntimeFibonacci fib; do_not_optimize(fib); return 0; });
+    run_benchmark("Fibonacci class startup (compile time table)", 1, 100000, [&]{
+        Fibonacci fib; do_not_optimize(fib); return 0; });
+    for (uint16_t fib_index : {10, 90})
+    {
+        std::string suffix = " (index " + std::to_string(fib_index) + ")";
+        run_benchmark("Fibonacci class first lookup, runtime table" + suffix, 1, 10000, [&]{
+            RuntimeFibonacci fib; return fib.get_fib_num(fib_index); });
+        run_benchmark("Fibonacci class first lookup, compile time table" + suffix, 1, 10000, [&]{
+            Fibonacci fib; return fib.get_fib_num(fib_index); });
+    }
+
+    fp::FibonacciEngine engine;
+    run_benchmark("fp::FibonacciEngine lookup (index 90)", 1, 100000, [&]{
+        return engine.get_fib_uint64(90); });
+    for (uint64_t fib_index : {1000, 10000, 100000})
+    {
+        std::string suffix = " (index " + std::to_string(fib_index) + ")";
+        int cold_repetitions = (fib_index >= 100000) ? 3 : 100;
+        run_benchmark("fp::FibonacciEngine cold lookup" + suffix, 1, cold_repetitions, [&]{
+            engine.clear_memo(); return engine.get_fib_big(fib_index); });
+        run_benchmark("fp::FibonacciEngine warm lookup" + suffix, 1, 1000, [&]{
+            return engine.get_fib_big(fib_index); });
+    }
+}
+
+// Cost of a memo hit for each memoize policy, against calling the function
+void memoize_benchmarks()
+{
+    auto slow_function = [](int x)
+    {
+        double result = x;
+        for (int i = 0; i < 1000; i++)
+            result = std::sqrt(result + i);
+        return result;
+    };
+    auto unbounded = fp::memoize(slow_function);
+    auto lru = fp::memoize(slow_function, fp::memo_policy::lru{4096});
+    auto sharded = fp::memoize(slow_function, fp::memo_policy::sharded{16, 4096});
+    int keys = 1000;
+    for (int x = 0; x < keys; x++)
+    {
+        unbounded(x);
+        lru(x);
+        sharded(x);
+    }
+    run_benchmark("memoize: direct call", keys, 100, [&]{
+        double sum = 0; for (int x = 0; x < keys; x++) sum += slow_function(x); return sum; });
+    run_benchmark("memoize: unbounded hit", keys, 100, [&]{
+        double sum = 0; for (int x = 0; x < keys; x++) sum += unbounded(x); return sum; });
+    run_benchmark("memoize: lru hit", keys, 100, [&]{
+        double sum = 0; for (int x = 0; x < keys; x++) sum += lru(x); return sum; });
+    run_benchmark("memoize: sharded hit", keys, 100, [&]{
+        double sum = 0; for (int x = 0; x < keys; x++) sum += sharded(x); return sum; });
+}
+
+// Fused stream pipeline against the staged version built from vector HOFs
+void lazy_stream_benchmarks()
+{
+    std::vector<int> list(10000000);
+    std::iota(list.begin(), list.end(), 0);
+    auto is_even = [](int x){ return x % 2 == 0; };
+    run_benchmark("staged vectors: increment, filter, sum", list.size(), 5, [&]{
+        std::vector<int> incremented = list;
+        inclist_HOF<int>(incremented);
+        std::vector<int> even;
+        std::copy_if(incremented.begin(), incremented.end(), std::back_inserter(even), is_even);
+        return sumlist_HOF<int>(even); });
+    run_benchmark("fused stream: increment, filter, sum", list.size(), 5, [&]{
+        return fp::stream::from(list).map([](int x){ return x + 1; }).filter(is_even).fold(0, std::plus<>{}); });
+}
+
+// The same chain as a transducer: sequential, on the thread pool, and over a
+// mapped file (in the page cache)
+void transducer_benchmarks()
+{
+    std::vector<int> list(10000000);
+    std::iota(list.begin(), list.end(), 0);
+    auto inc_even = fp::mapping([](int x){ return x + 1; }) | fp::filtering([](int x){ return x % 2 == 0; });
+    run_benchmark("transducer: increment, filter, sum", list.size(), 5, [&]{
+        return sumlist_HOF(list, inc_even); });
+    run_benchmark("transducer: increment, filter, take 1000", 1000, 1000, [&]{
+        return fp::transduce(inc_even | fp::taking(1000), std::plus<>{}, 0, list); });
+
+    std::size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        fp::ThreadPool pool(threads);
+        fp::parallel_options options{0, 0, &pool};
+        run_benchmark("transducer: increment, filter, sum (" + std::to_string(threads) + " threads)", list.size(), 5, [&]{
+            return fp::transduce(inc_even, std::plus<>{}, 0, list, options); });
+    }
+
+    std::string path = "fp_bench_transduce.bin";
+    {
+        std::ofstream out(path, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(list.data()), std::streamsize(list.size() * sizeof(int)));
+    }
+    fp::MappedArray<int> mapped(path);
+    run_benchmark("transducer: increment, filter, sum (mapped file)", list.size(), 5, [&]{
+        return fp::transduce(inc_even, std::plus<>{}, 0, mapped); });
+    std::remove(path.c_str());
+}
+
+#if __has_include(<memory_resource>)
+// A request scoped batch job: build a list and a batch of shapes, run the list
+// HOFs and compute_areas over them, then drop everything. The same job on the
+// global heap, a std::pmr::monotonic_buffer_resource made per request, and an
+// fp::Arena and an fp::SizeClassPool kept from one request to the next
+double shape_request(std::pmr::memory_resource* resource, std::size_t request)
+{
+    constexpr std::size_t shape_count = 256;
+    std::pmr::vector<adt_shape> shapes(resource);
+    for (std::size_t i = 0; i < shape_count; i++)
+    {
+        double x = double((request + i) % 100);
+        if (i % 2)
+            shapes.push_back(Shape::circle{x});
+        else
+            shapes.push_back(Shape::rectangle{x, x + 1});
+    }
+    ShapeColumns columns(shapes, resource);
+    std::pmr::vector<double> areas(columns.size(), resource);
+    compute_areas(columns, areas.data());
+    std::pmr::vector<double> list(resource);
+    for (std::size_t i = 0; i < 1024; i++)
+        list.push_back(areas[i % shape_count]);
+    inclist_HOF<double>(list);
+    auto halves = fp::apply_all(list, [](double x){ return x * 0.5; });
+    return sumlist_HOF<double>(halves);
+}
+
+void memory_resource_benchmarks()
+{
+    std::size_t requests = 10000;
+    fp::Arena arena;
+    fp::SizeClassPool pool;
+    std::map<std::string, std::function<double(std::size_t)>> variants{
+        {"memory: default allocator", [](std::size_t request) {
+            return shape_request(std::pmr::new_delete_resource(), request); }},
+        {"memory: std::pmr::monotonic_buffer_resource", [](std::size_t request) {
+            std::pmr::monotonic_buffer_resource monotonic;
+            return shape_request(&monotonic, request); }},
+        {"memory: fp::Arena", [&arena](std::size_t request) {
+            double result = shape_request(&arena, request);
+            arena.reset();
+            return result; }},
+        {"memory: fp::SizeClassPool", [&pool](std::size_t request) {
+            double result = shape_request(&pool, request);
+            pool.reset();
+            return result; }}};
+    for (auto& [name, job] : variants)
+    {
+        run_benchmark(name, requests, 5, [&, &job = job]{
+            double total = 0;
+            for (std::size_t request = 0; request < requests; request++)
+                total += job(request);
+            return total; });
+        if (selected(name))
+        {
+            std::size_t before = allocation_count.load();
+            for (std::size_t request = 0; request < requests; request++)
+                do_not_optimize(job(request));
+            std::cout << name << ": " << double(allocation_count.load() - before) / requests
+                      << " mallocs per request" << std::endl;
+        }
+    }
+}
+#endif
+
+// Maybe chain over a million inputs: one optional per element against the batch bitmask
+void maybe_batch_benchmarks()
+{
+    std::size_t elements = 1000000;
+    std::vector<double> nums(elements);
+    std::vector<double> denoms(elements);
+    unsigned seed = 12345;
+    for (std::size_t i = 0; i < elements; i++)
+    {
+        // Random inputs, so which stage fails can not be predicted
+        seed = seed * 1103515245u + 12345u;
+        nums[i] = double((seed >> 8) % 100) - 10.0;
+        denoms[i] = ((seed >> 20) % 8 == 0) ? 0.0 : 2.0;
+    }
+    std::vector<std::optional<double>> results(elements);
+    for (std::size_t sweep_elements : {1000, 100000, 1000000})
+    {
+        std::vector<double> sweep_nums(nums.begin(), nums.begin() + sweep_elements);
+        std::vector<double> sweep_denoms(denoms.begin(), denoms.begin() + sweep_elements);
+        int repetitions = int(10000000 / sweep_elements);
+        run_benchmark("Maybe chain (std::optional per element)", sweep_elements, repetitions, [&]{
+            for (std::size_t i = 0; i < sweep_elements; i++)
+                results[i] = divide(sweep_nums[i], sweep_denoms[i]) | square_root | double_opt;
+            return results[1]; });
+        run_benchmark("Maybe chain (MaybeBatch bitmask)", sweep_elements, repetitions, [&]{
+            return (divide_batch(sweep_nums, sweep_denoms) | square_root_kernel | double_kernel).count_valid(); });
+    }
+}
+
+// The Maybe example chain with exceptions in place of a return value for the error
+double divide_or_throw(double num, double denom)
+{
+    if (denom == 0.0)
+        throw std::domain_error("divide by zero");
+    return num / denom;
+}
+
+double square_root_or_throw(double num)
+{
+    if (num < 0)
+        throw std::domain_error("negative square root");
+    return sqrt(num);
+}
+
+// Either chain against the optional chain, and against exceptions, for inputs
+// which all succeed, inputs which fail at random (about 1 in 2), and inputs
+// which all fail
+void either_benchmarks()
+{
+    std::size_t elements = 1000000;
+    std::vector<double> nums(elements);
+    std::vector<double> denoms(elements);
+    unsigned seed = 12345;
+    for (std::size_t i = 0; i < elements; i++)
+    {
+        seed = seed * 1103515245u + 12345u;
+        nums[i] = double((seed >> 8) % 100) - 10.0;
+        denoms[i] = ((seed >> 20) % 8 == 0) ? 0.0 : 2.0;
+    }
+    std::vector<double> success_nums(elements);
+    for (std::size_t i = 0; i < elements; i++)
+        success_nums[i] = double(i % 100);
+    std::vector<double> success_denoms(elements, 2.0);
+    std::vector<double> failure_denoms(elements, 0.0);
+
+    std::vector<std::optional<double>> maybe_results(elements);
+    std::vector<fp::Either<math_error, double>> either_results(elements);
+    std::vector<double> values(elements);
+    std::vector<math_error> errors(elements);
+    auto run_cases = [&](const std::string& inputs, const std::vector<double>& in_nums,
+                         const std::vector<double>& in_denoms, int repetitions) {
+        run_benchmark("Maybe chain, " + inputs + " (std::optional)", elements, repetitions, [&]{
+            for (std::size_t i = 0; i < elements; i++)
+                maybe_results[i] = divide(in_nums[i], in_denoms[i]) | square_root | double_opt;
+            return maybe_results[1]; });
+        run_benchmark("Either chain, " + inputs + " (fp::Either)", elements, repetitions, [&]{
+            for (std::size_t i = 0; i < elements; i++)
+                either_results[i] = divide_either(in_nums[i], in_denoms[i]) | square_root_either | double_either;
+            return either_results[1]; });
+        run_benchmark("Either chain, " + inputs + " (exceptions)", elements, repetitions, [&]{
+            for (std::size_t i = 0; i < elements; i++)
+            {
+                try
+                {
+                    values[i] = square_root_or_throw(divide_or_throw(in_nums[i], in_denoms[i])) * 2;
+                    errors[i] = math_error::none;
+                }
+                catch (const std::domain_error& e)
+                {
+                    errors[i] = (e.what()[0] == 'd') ? math_error::divide_by_zero : math_error::negative_square_root;
+                }
+            }
+            return errors[1]; });
+        run_benchmark("Either chain, " + inputs + " (EitherBatch error codes)", elements, repetitions, [&]{
+            return (divide_either_batch(in_nums, in_denoms) | square_root_either_kernel | double_either_kernel)
+                .count_valid(); });
+    };
+    run_cases("all succeed", success_nums, success_denoms, 10);
+    run_cases("random failures", nums, denoms, 3);
+    run_cases("all fail", nums, failure_denoms, 3);
+}
+
+// The synchronous Maybe chain against the same chain of fp::Task stages, for
+// CPU bound stages and for chains with an I/O bound stage (a 50 us wait),
+// where the pool overlaps the waits. For the I/O chains the latency of each
+// chain, from launch to result with every chain in flight, is reported too
+void async_maybe_benchmarks()
+{
+    std::size_t elements = 100000;
+    std::vector<std::optional<double>> results(elements);
+    run_benchmark("async Maybe chain: synchronous", elements, 10, [&]{
+        for (std::size_t i = 0; i < elements; i++)
+            results[i] = divide(double(i % 100), 2.0) | square_root | double_opt;
+        return results[1]; });
+    std::size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        fp::ThreadPool pool(threads);
+        run_benchmark("async Maybe chain: fp::Task (" + std::to_string(threads) + " threads)", elements, 3, [&]{
+            std::vector<fp::Task<std::optional<double>>> chains;
+            chains.reserve(elements);
+            for (std::size_t i = 0; i < elements; i++)
+                chains.push_back(fp::async_task(pool, divide, double(i % 100), 2.0) | square_root | double_opt);
+            for (std::size_t i = 0; i < elements; i++)
+                results[i] = chains[i].get();
+            return results[1]; });
+    }
+
+    std::size_t io_chains = 1000;
+    auto io_stage = [](double x) -> std::optional<double> {
+        std::this_thread::sleep_for(std::chrono::microseconds(50)); return x; };
+    run_benchmark("async Maybe chain, I/O stage: synchronous", io_chains, 1, [&]{
+        for (std::size_t i = 0; i < io_chains; i++)
+            results[i] = divide(double(i % 100), 2.0) | io_stage | square_root | double_opt;
+        return results[1]; });
+    for (std::size_t threads : {8, 64, 256})
+    {
+        fp::ThreadPool pool(threads);
+        std::string name = "async Maybe chain, I/O stage: fp::Task (" + std::to_string(threads) + " threads)";
+        std::vector<double> latencies_us(io_chains);
+        run_benchmark(name, io_chains, 3, [&]{
+            auto launch = std::chrono::steady_clock::now();
+            std::vector<fp::Task<std::optional<double>>> chains;
+            for (std::size_t i = 0; i < io_chains; i++)
+                chains.push_back(fp::async_task(pool, divide, double(i % 100), 2.0) | io_stage | square_root
+                    | [&, i](double x) -> std::optional<double> {
+                        latencies_us[i] = std::chrono::duration<double, std::micro>(
+                            std::chrono::steady_clock::now() - launch).count();
+                        return double_opt(x).value(); });
+            for (std::size_t i = 0; i < io_chains; i++)
+                results[i] = chains[i].get();
+            return results[1]; });
+        if (selected(name))
+        {
+            std::sort(latencies_us.begin(), latencies_us.end());
+            std::cout << "    chain latency under load: p50 " << percentile(latencies_us, 0.50)
+                      << " us, p99 " << percentile(latencies_us, 0.99) << " us" << std::endl;
+        }
+    }
+}
+
+int main (int argc, char** argv)
+{
+    std::string json_file;
+    std::string baseline_file;
+    double threshold = 0.10;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return 2;
+        }
+        if (arg == "--filter")
+            session().filter = argv[++i];
+        else if (arg == "--json")
+            json_file = argv[++i];
+        else if (arg == "--baseline")
+            baseline_file = argv[++i];
+        else if (arg == "--threshold")
+            threshold = std::atof(argv[++i]);
+        else
+        {
+            std::cerr << "Unknown argument " << arg << std::endl;
+            return 2;
+        }
+    }
+    std::map<std::string, double> baseline;
+    if (!baseline_file.empty() && !read_baseline(baseline_file, baseline))
+    {
+        std::cerr << "Can not read baseline " << baseline_file << std::endl;
+        return 2;
+    }
+
+    sumlist_benchmarks<int>("int");
+    sumlist_benchmarks<double>("double");
+    monoid_benchmarks<int8_t>("int8_t");
+    monoid_benchmarks<int32_t>("int32_t");
+    monoid_benchmarks<int64_t>("int64_t");
+    monoid_benchmarks<float>("float");
+    monoid_benchmarks<double>("double");
+    parallel_HOF_benchmarks();
+    reproducible_sum_benchmarks();
+    persistent_vector_benchmarks();
+    mapped_array_benchmarks();
+    compute_area_benchmarks();
+    shape_file_benchmarks();
+    shape_analytics_benchmarks();
+    match_benchmarks();
+    composition_benchmarks();
+    money_benchmarks();
+    fibonacci_benchmarks();
+    memoize_benchmarks();
+    lazy_stream_benchmarks();
+    transducer_benchmarks();
+#if __has_include(<memory_resource>)
+    memory_resource_benchmarks();
+#endif
+    maybe_batch_benchmarks();
+    either_benchmarks();
+    async_maybe_benchmarks();
+
+    if (!json_file.empty())
+    {
+        std::ofstream out(json_file);
+        write_json(out, session().results);
+    }
+    if (!baseline_file.empty() && compare_with_baseline(baseline, threshold) > 0)
+        return 1;
+    return 0;
+}
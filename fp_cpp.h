@@ -8,261 +8,7203 @@
 #include <cmath>
 #include <optional>
 #include <functional>
+#include <type_traits>
+#include <cstring>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <limits>
+#include <shared_mutex>
+#include <unordered_map>
+#include <string>
+#include <list>
+#include <tuple>
+#include <new>
+#include <array>
+#include <chrono>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <initializer_list>
+#include <system_error>
+#include <utility>
+#include <cerrno>
+#include <cstdlib>
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#endif
+#if __has_include(<sys/mman.h>)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// Instrumentation. Call counts, latency histograms and Maybe short circuits
+//////////////////////////////////////////////////////////////////////////////
+
+// Tracing is compiled in with -DFP_INSTRUMENTATION. Without it the FP_TRACE
+// macros expand to nothing, so the traced functions cost exactly what they did
+// before: no clock reads, no buffers, no branches
+//
+// When enabled, each thread records events into its own lock-free ring buffer.
+// A collector thread drains the buffers into per trace point statistics, and
+// hands them to a sink (text or JSON) instead of printing on every call
+#ifdef FP_INSTRUMENTATION
+#define FP_TRACE_CONCAT_INNER(a, b) a##b
+#define FP_TRACE_CONCAT(a, b) FP_TRACE_CONCAT_INNER(a, b)
+// Count a call and time it until the end of the enclosing scope
+#define FP_TRACE_SCOPE(point_name) \
+    static const uint16_t FP_TRACE_CONCAT(fp_trace_point_, __LINE__) = fp::trace::register_point(point_name); \
+    fp::trace::ScopedTimer FP_TRACE_CONCAT(fp_trace_timer_, __LINE__)(FP_TRACE_CONCAT(fp_trace_point_, __LINE__))
+// Count skipped work (a Maybe chain stage not run because an earlier stage failed)
+#define FP_TRACE_SHORT_CIRCUIT(point_name, skipped) \
+    do { \
+        static const uint16_t fp_trace_point = fp::trace::register_point(point_name); \
+        fp::trace::record(fp_trace_point, fp::trace::event_kind::short_circuit, (skipped)); \
+    } while (false)
+#else
+#define FP_TRACE_SCOPE(point_name) ((void)0)
+#define FP_TRACE_SHORT_CIRCUIT(point_name, skipped) ((void)0)
+#endif
+
+namespace fp::trace
+{
+#ifdef FP_INSTRUMENTATION
+constexpr bool enabled = true;
+#else
+constexpr bool enabled = false;
+#endif
+
+// Latency histogram bucket b holds calls which took [2^(b-1), 2^b) nanoseconds
+// (bucket 0 is under 1ns). The last bucket holds everything slower
+constexpr std::size_t histogram_buckets = 40;
+
+enum class event_kind : uint8_t { call, short_circuit };
+
+// One recorded event. value is the duration in nanoseconds for a call, and the
+// number of skipped stages for a short circuit
+struct event
+{
+    uint16_t point;
+    event_kind kind;
+    uint64_t value;
+};
+
+// Aggregated statistics for one trace point
+struct point_stats
+{
+    std::string name;
+    uint64_t calls = 0;
+    uint64_t short_circuits = 0;
+    uint64_t total_ns = 0;
+    std::array<uint64_t, histogram_buckets> latency_histogram{};
+
+    // Upper bound of the histogram bucket which holds the p-th percentile (0 < p <= 1)
+    uint64_t percentile_ns(double p) const
+    {
+        uint64_t target = uint64_t(std::ceil(p * double(calls)));
+        uint64_t seen = 0;
+        for (std::size_t bucket = 0; bucket < histogram_buckets; bucket++)
+        {
+            seen += latency_histogram[bucket];
+            if (seen >= target && seen > 0)
+                return uint64_t(1) << bucket;
+        }
+        return 0;
+    }
+};
+
+// Everything drained so far. Points which never fired are left out
+struct snapshot
+{
+    std::vector<point_stats> points;
+    uint64_t dropped_events = 0;
+
+    const point_stats* find(const std::string& name) const
+    {
+        for (const auto& point : points)
+            if (point.name == name)
+                return &point;
+        return nullptr;
+    }
+};
+
+// A sink receives each snapshot the collector produces
+using sink = std::function<void(const snapshot&)>;
+
+namespace detail
+{
+inline std::size_t latency_bucket(uint64_t ns)
+{
+    std::size_t bucket = (ns == 0) ? 0 : std::size_t(64 - __builtin_clzll(ns));
+    return std::min(bucket, histogram_buckets - 1);
+}
+
+// Single producer, single consumer ring buffer. Only the owning thread pushes
+// and only the collector drains, so neither side ever takes a lock. A full
+// buffer drops the event and counts it, rather than block the traced code
+class EventBuffer
+{
+public:
+    static constexpr std::size_t capacity = 4096;
+
+    void push(const event& e) noexcept
+    {
+        std::size_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) == capacity)
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        m_events[head % capacity] = e;
+        m_head.store(head + 1, std::memory_order_release);
+    }
+
+    template <typename F>
+    void drain(F&& f)
+    {
+        std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        std::size_t head = m_head.load(std::memory_order_acquire);
+        for (; tail != head; tail++)
+            f(m_events[tail % capacity]);
+        m_tail.store(tail, std::memory_order_release);
+    }
+
+    uint64_t take_dropped() { return m_dropped.exchange(0, std::memory_order_relaxed); }
+
+private:
+    std::array<event, capacity> m_events;
+    // Producer and consumer indices on separate cache lines
+    alignas(64) std::atomic<std::size_t> m_head{0};
+    alignas(64) std::atomic<std::size_t> m_tail{0};
+    std::atomic<uint64_t> m_dropped{0};
+};
+} // namespace detail
+
+// Collector. Owns the trace point names, the per thread buffers and the
+// aggregated statistics. Threads and trace points register once under a lock;
+// recording an event never locks
+class Collector
+{
+public:
+    static Collector& instance()
+    {
+        static Collector collector;
+        return collector;
+    }
+
+    ~Collector() { stop(); }
+
+    uint16_t register_point(const char* name)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (std::size_t i = 0; i < m_stats.size(); i++)
+            if (m_stats[i].name == name)
+                return uint16_t(i);
+        m_stats.push_back(point_stats{name});
+        return uint16_t(m_stats.size() - 1);
+    }
+
+    // The calling thread's buffer. The collector keeps its own reference, so
+    // events recorded just before a thread exits are still drained
+    detail::EventBuffer& local_buffer()
+    {
+        thread_local std::shared_ptr<detail::EventBuffer> buffer = add_buffer();
+        return *buffer;
+    }
+
+    // Move every buffered event into the statistics
+    void drain()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        drain_locked();
+    }
+
+    // Drain, then return a copy of the statistics. The events it reports do
+    // not count as new for the background sink
+    snapshot take_snapshot()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        drain_locked();
+        m_new_events = false;
+        return snapshot_locked();
+    }
+
+    // Drain and write the statistics to a sink
+    void flush(const sink& output) { output(take_snapshot()); }
+
+    // Drop all statistics gathered so far. Trace points stay registered
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        drain_locked();
+        for (auto& stats : m_stats)
+            stats = point_stats{stats.name};
+        m_dropped = 0;
+        m_new_events = false;
+    }
+
+    // Start draining in the background. Every interval the buffers are drained,
+    // and the sink (when given) receives a snapshot if anything new arrived.
+    // stop() drains and writes a final snapshot
+    void start(sink output = nullptr, std::chrono::milliseconds interval = std::chrono::milliseconds(100))
+    {
+        stop();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_sink = std::move(output);
+        m_new_events = false;
+        m_running = true;
+        m_drainer = std::thread([this, interval]{ drain_loop(interval); });
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_running)
+                return;
+            m_running = false;
+        }
+        m_wake.notify_all();
+        m_drainer.join();
+        if (m_sink)
+            flush(m_sink);
+        m_sink = nullptr;
+    }
+
+private:
+    Collector() = default;
+
+    std::shared_ptr<detail::EventBuffer> add_buffer()
+    {
+        auto buffer = std::make_shared<detail::EventBuffer>();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_buffers.push_back(buffer);
+        return buffer;
+    }
+
+    void drain_locked()
+    {
+        // A buffer only the collector still holds belongs to a finished thread.
+        // Which buffers those are is decided before draining, so a thread which
+        // pushes its last events and exits during the drain keeps its buffer
+        // until the next one. The fence makes the finished threads' pushes visible
+        std::vector<bool> finished;
+        finished.reserve(m_buffers.size());
+        for (const auto& buffer : m_buffers)
+            finished.push_back(buffer.use_count() == 1);
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        for (auto& buffer : m_buffers)
+        {
+            buffer->drain([this](const event& e)
+            {
+                m_new_events = true;
+                point_stats& stats = m_stats[e.point];
+                if (e.kind == event_kind::short_circuit)
+                {
+                    stats.short_circuits += e.value;
+                    return;
+                }
+                stats.calls++;
+                stats.total_ns += e.value;
+                stats.latency_histogram[detail::latency_bucket(e.value)]++;
+            });
+            m_dropped += buffer->take_dropped();
+        }
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i < m_buffers.size(); i++)
+            if (!finished[i])
+                m_buffers[kept++] = std::move(m_buffers[i]);
+        m_buffers.resize(kept);
+    }
+
+    snapshot snapshot_locked() const
+    {
+        snapshot result;
+        result.dropped_events = m_dropped;
+        for (const auto& stats : m_stats)
+            if (stats.calls > 0 || stats.short_circuits > 0)
+                result.points.push_back(stats);
+        return result;
+    }
+
+    void drain_loop(std::chrono::milliseconds interval)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (m_running)
+        {
+            m_wake.wait_for(lock, interval);
+            drain_locked();
+            if (m_sink && m_new_events)
+            {
+                m_new_events = false;
+                snapshot current = snapshot_locked();
+                // The sink may be slow, so it runs without the lock
+                lock.unlock();
+                m_sink(current);
+                lock.lock();
+            }
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::vector<point_stats> m_stats;
+    std::vector<std::shared_ptr<detail::EventBuffer>> m_buffers;
+    uint64_t m_dropped = 0;
+    bool m_new_events = false;
+    bool m_running = false;
+    sink m_sink;
+    std::thread m_drainer;
+};
+
+inline uint16_t register_point(const char* name) { return Collector::instance().register_point(name); }
+
+inline void record(uint16_t point, event_kind kind, uint64_t value)
+{
+    Collector::instance().local_buffer().push(event{point, kind, value});
+}
+
+// Records a call of a trace point, and its latency, when it goes out of scope
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(uint16_t point) : m_point(point), m_start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer()
+    {
+        auto elapsed = std::chrono::steady_clock::now() - m_start;
+        record(m_point, event_kind::call,
+               uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+private:
+    uint16_t m_point;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+// Text sink. One line per trace point
+inline sink text_sink(std::ostream& out)
+{
+    return [&out](const snapshot& current)
+    {
+        for (const auto& point : current.points)
+        {
+            out << point.name << ": calls=" << point.calls
+                << " short_circuits=" << point.short_circuits;
+            if (point.calls > 0)
+                out << " mean_ns=" << point.total_ns / point.calls
+                    << " p50_ns<=" << point.percentile_ns(0.5)
+                    << " p99_ns<=" << point.percentile_ns(0.99);
+            out << '\n';
+        }
+        if (current.dropped_events > 0)
+            out << "dropped events: " << current.dropped_events << '\n';
+        out.flush();
+    };
+}
+
+// JSON sink. One object per snapshot, on a single line
+inline sink json_sink(std::ostream& out)
+{
+    return [&out](const snapshot& current)
+    {
+        auto write_string = [&out](const std::string& text)
+        {
+            out << '"';
+            for (char c : text)
+            {
+                if (c == '"' || c == '\\')
+                    out << '\\';
+                out << c;
+            }
+            out << '"';
+        };
+        out << "{\"dropped_events\":" << current.dropped_events << ",\"points\":[";
+        for (std::size_t i = 0; i < current.points.size(); i++)
+        {
+            const point_stats& point = current.points[i];
+            out << (i == 0 ? "" : ",") << "{\"name\":";
+            write_string(point.name);
+            out << ",\"calls\":" << point.calls
+                << ",\"short_circuits\":" << point.short_circuits
+                << ",\"total_ns\":" << point.total_ns
+                << ",\"latency_histogram_log2_ns\":[";
+            for (std::size_t bucket = 0; bucket < histogram_buckets; bucket++)
+                out << (bucket == 0 ? "" : ",") << point.latency_histogram[bucket];
+            out << "]}";
+        }
+        out << "]}\n";
+        out.flush();
+    };
+}
+} // namespace fp::trace
+
+//////////////////////////////////////////////////////////////////////////////
+// Memory resources. Arenas and pools for request scoped lists
+//////////////////////////////////////////////////////////////////////////////
+
+namespace fp
+{
+namespace detail
+{
+// Lists held inside the library's own classes (ShapeColumns, Fibonacci). With
+// <memory_resource> (libstdc++ 9 and later) they take their memory from a
+// std::pmr::memory_resource, which is the global heap unless the class is
+// given another one
+#if __has_include(<memory_resource>)
+template <typename T>
+using resource_vector = std::pmr::vector<T>;
+#else
+template <typename T>
+using resource_vector = std::vector<T>;
+#endif
+} // namespace detail
+
+#if __has_include(<memory_resource>)
+// Arena. A monotonic memory resource for request scoped work
+// Allocation bumps a pointer through a block of memory, and deallocation does
+// nothing. reset() frees everything at once. Blocks grow geometrically when
+// the current one is full, and reset() merges them into one block of the
+// total size. After that a loop of requests no bigger than the largest so far
+// never calls the upstream resource again, and each reset is constant time.
+// Not thread safe: use one arena per request or per thread
+class Arena : public std::pmr::memory_resource
+{
+public:
+    explicit Arena(std::size_t initial_bytes = 64 * 1024,
+                   std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+        : m_upstream(upstream), m_next_block_bytes(std::max<std::size_t>(initial_bytes, 1024))
+    {
+    }
+
+    ~Arena() { release(); }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Free everything allocated from the arena, keeping its memory
+    void reset()
+    {
+        if (m_blocks && m_blocks->next)
+        {
+            std::size_t total = 0;
+            for (Block* block = m_blocks; block; block = block->next)
+                total += block->bytes;
+            release();
+            add_block(total);
+        }
+        if (m_blocks)
+        {
+            m_position = m_blocks->data();
+            m_end = m_position + m_blocks->bytes;
+        }
+        m_bytes_allocated = 0;
+    }
+
+    // Free everything, and give the memory back to the upstream resource
+    void release()
+    {
+        while (m_blocks)
+        {
+            Block* next = m_blocks->next;
+            m_upstream->deallocate(m_blocks, sizeof(Block) + m_blocks->bytes, alignof(Block));
+            m_blocks = next;
+        }
+        m_position = m_end = nullptr;
+        m_bytes_allocated = 0;
+        m_block_count = 0;
+    }
+
+    // Bytes handed out since the last reset
+    std::size_t bytes_allocated() const { return m_bytes_allocated; }
+    // Blocks taken from the upstream resource and not yet given back
+    std::size_t block_count() const { return m_block_count; }
+
+private:
+    // Each block starts with this header, and its memory follows
+    struct alignas(std::max_align_t) Block
+    {
+        Block* next;
+        std::size_t bytes;
+
+        char* data() { return reinterpret_cast<char*>(this + 1); }
+    };
+
+    void add_block(std::size_t bytes)
+    {
+        void* memory = m_upstream->allocate(sizeof(Block) + bytes, alignof(Block));
+        m_blocks = ::new (memory) Block{m_blocks, bytes};
+        m_position = m_blocks->data();
+        m_end = m_position + bytes;
+        m_block_count++;
+    }
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        std::uintptr_t position = (reinterpret_cast<std::uintptr_t>(m_position) + alignment - 1) & ~(alignment - 1);
+        if (!m_position || position + bytes > reinterpret_cast<std::uintptr_t>(m_end))
+        {
+            add_block(std::max(m_next_block_bytes, bytes + alignment));
+            m_next_block_bytes *= 2;
+            position = (reinterpret_cast<std::uintptr_t>(m_position) + alignment - 1) & ~(alignment - 1);
+        }
+        m_position = reinterpret_cast<char*>(position + bytes);
+        m_bytes_allocated += bytes;
+        return reinterpret_cast<void*>(position);
+    }
+
+    void do_deallocate(void*, std::size_t, std::size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+    std::pmr::memory_resource* m_upstream;
+    Block* m_blocks = nullptr;
+    char* m_position = nullptr;
+    char* m_end = nullptr;
+    std::size_t m_next_block_bytes;
+    std::size_t m_bytes_allocated = 0;
+    std::size_t m_block_count = 0;
+};
+
+// SizeClassPool. A memory resource for request scoped lists which grow and shrink
+// Each allocation is rounded up to a size class (powers of two from 16 bytes
+// to 64 KiB). A freed block goes on its class's free list and is reused by the
+// next allocation of that class, so a list which grows reuses the memory the
+// lists before it gave up. Blocks come from an Arena of the pool's own, and
+// reset() empties the free lists and resets the arena, freeing the whole
+// batch in constant time. Larger or over aligned allocations come from the
+// arena directly and are only freed by reset(). Not thread safe
+class SizeClassPool : public std::pmr::memory_resource
+{
+public:
+    explicit SizeClassPool(std::size_t initial_bytes = 64 * 1024,
+                           std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+        : m_arena(initial_bytes, upstream)
+    {
+    }
+
+    // Free everything allocated from the pool, keeping its memory
+    void reset()
+    {
+        m_free.fill(nullptr);
+        m_arena.reset();
+    }
+
+    const Arena& arena() const { return m_arena; }
+
+private:
+    static constexpr std::size_t smallest_class_shift = 4;
+    static constexpr std::size_t largest_class_shift = 16;
+    static constexpr std::size_t block_alignment = alignof(std::max_align_t);
+
+    struct FreeBlock { FreeBlock* next; };
+
+    static bool is_pooled(std::size_t bytes, std::size_t alignment)
+    {
+        return bytes <= (std::size_t(1) << largest_class_shift) && alignment <= block_alignment;
+    }
+
+    // Smallest class which holds bytes
+    static std::size_t size_class(std::size_t bytes)
+    {
+        if (bytes <= (std::size_t(1) << smallest_class_shift))
+            return 0;
+        std::size_t shift = std::size_t(64 - __builtin_clzll((unsigned long long)(bytes - 1)));
+        return shift - smallest_class_shift;
+    }
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        if (!is_pooled(bytes, alignment))
+            return m_arena.allocate(bytes, alignment);
+        std::size_t index = size_class(bytes);
+        if (FreeBlock* block = m_free[index])
+        {
+            m_free[index] = block->next;
+            return block;
+        }
+        return m_arena.allocate(std::size_t(1) << (index + smallest_class_shift), block_alignment);
+    }
+
+    void do_deallocate(void* pointer, std::size_t bytes, std::size_t alignment) override
+    {
+        if (!is_pooled(bytes, alignment))
+            return;
+        std::size_t index = size_class(bytes);
+        m_free[index] = ::new (pointer) FreeBlock{m_free[index]};
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+    Arena m_arena;
+    std::array<FreeBlock*, largest_class_shift - smallest_class_shift + 1> m_free{};
+};
+#endif
+} // namespace fp
+
+//////////////////////////////////////////////////////////////////////////////
+// Reduction Engine. Constant stack, vectorized fold behind the list functions
+//////////////////////////////////////////////////////////////////////////////
+
+namespace fp
+{
+// Lanewise minimum and maximum operators. Written with < and ?: only, so the
+// same operator works on a scalar and on a whole vector register
+struct minimum
+{
+    template <typename T>
+    constexpr T operator()(const T& a, const T& b) const { return (b < a) ? b : a; }
+};
+
+struct maximum
+{
+    template <typename T>
+    constexpr T operator()(const T& a, const T& b) const { return (a < b) ? b : a; }
+};
+
+namespace detail
+{
+// Element types which can be packed into a vector register
+template <typename T>
+constexpr bool is_vector_lane = (std::is_integral_v<T> && !std::is_same_v<T, bool>)
+                                || std::is_same_v<T, float> || std::is_same_v<T, double>;
+
+// Iterators which are known to walk contiguous memory, so the engine can
+// hand the underlying array to the vector loop. Output iterators such as
+// std::back_insert_iterator have a void value_type, and never are
+template <typename input_iterator>
+constexpr bool is_contiguous_iterator = []
+{
+    using value_type = typename std::iterator_traits<input_iterator>::value_type;
+    if constexpr (std::is_void_v<value_type>)
+        return false;
+    else
+        return std::is_pointer_v<input_iterator>
+            || std::is_same_v<input_iterator, typename std::vector<value_type>::iterator>
+            || std::is_same_v<input_iterator, typename std::vector<value_type>::const_iterator>
+#if __has_include(<memory_resource>)
+            || std::is_same_v<input_iterator, typename std::pmr::vector<value_type>::iterator>
+            || std::is_same_v<input_iterator, typename std::pmr::vector<value_type>::const_iterator>
+#endif
+            ;
+}();
+
+// Lanewise versions of the operators the vector loop understands. The vector
+// loop combines elements out of order, so only operators which are commutative
+// as well as associative are listed here. Registers are passed by reference to
+// keep vector types out of the calling convention
+struct lanewise_none {};
+struct lanewise_plus
+{
+    template <typename V>
+    __attribute__((always_inline)) static inline void apply(V& a, const V& b) { a = a + b; }
+};
+struct lanewise_multiplies
+{
+    template <typename V>
+    __attribute__((always_inline)) static inline void apply(V& a, const V& b) { a = a * b; }
+};
+struct lanewise_minimum
+{
+    template <typename V>
+    __attribute__((always_inline)) static inline void apply(V& a, const V& b) { a = (b < a) ? b : a; }
+};
+struct lanewise_maximum
+{
+    template <typename V>
+    __attribute__((always_inline)) static inline void apply(V& a, const V& b) { a = (a < b) ? b : a; }
+};
+struct lanewise_bit_and
+{
+    template <typename V>
+    __attribute__((always_inline)) static inline void apply(V& a, const V& b) { a = a & b; }
+};
+struct lanewise_bit_or
+{
+    template <typename V>
+    __attribute__((always_inline)) static inline void apply(V& a, const V& b) { a = a | b; }
+};
+struct lanewise_bit_xor
+{
+    template <typename V>
+    __attribute__((always_inline)) static inline void apply(V& a, const V& b) { a = a ^ b; }
+};
+
+// Map a user operator to its lanewise version. Anything not listed falls back
+// to the scalar loop
+template <typename binary_op, typename T, typename = void>
+struct lanewise_op { using type = lanewise_none; };
+template <typename T> struct lanewise_op<std::plus<T>, T> { using type = lanewise_plus; };
+template <typename T> struct lanewise_op<std::plus<>, T> { using type = lanewise_plus; };
+template <typename T> struct lanewise_op<std::multiplies<T>, T> { using type = lanewise_multiplies; };
+template <typename T> struct lanewise_op<std::multiplies<>, T> { using type = lanewise_multiplies; };
+template <typename T> struct lanewise_op<minimum, T> { using type = lanewise_minimum; };
+template <typename T> struct lanewise_op<maximum, T> { using type = lanewise_maximum; };
+template <typename T> struct lanewise_op<std::bit_and<T>, T, std::enable_if_t<std::is_integral_v<T>>> { using type = lanewise_bit_and; };
+template <typename T> struct lanewise_op<std::bit_and<>, T, std::enable_if_t<std::is_integral_v<T>>> { using type = lanewise_bit_and; };
+template <typename T> struct lanewise_op<std::bit_or<T>, T, std::enable_if_t<std::is_integral_v<T>>> { using type = lanewise_bit_or; };
+template <typename T> struct lanewise_op<std::bit_or<>, T, std::enable_if_t<std::is_integral_v<T>>> { using type = lanewise_bit_or; };
+template <typename T> struct lanewise_op<std::bit_xor<T>, T, std::enable_if_t<std::is_integral_v<T>>> { using type = lanewise_bit_xor; };
+template <typename T> struct lanewise_op<std::bit_xor<>, T, std::enable_if_t<std::is_integral_v<T>>> { using type = lanewise_bit_xor; };
+
+// Chunked vector loop over a contiguous array. Four registers of width bytes
+// are kept in flight to hide the latency of the combine, and the leftover
+// elements that do not fill a whole chunk go through the scalar operator
+template <std::size_t width, typename lanewise, typename T, typename binary_op>
+__attribute__((always_inline)) inline T reduce_chunked(const T* data, std::size_t count, T init, binary_op op)
+{
+    typedef T lane_vector __attribute__((vector_size(width)));
+    constexpr std::size_t lanes = width / sizeof(T);
+    constexpr std::size_t unroll = 4;
+    constexpr std::size_t chunk = lanes * unroll;
+
+    const std::size_t vector_count = (count / chunk) * chunk;
+    if (vector_count != 0)
+    {
+        lane_vector acc[unroll];
+        for (std::size_t u = 0; u < unroll; ++u)
+            std::memcpy(&acc[u], data + u * lanes, sizeof(lane_vector));
+        for (std::size_t i = chunk; i < vector_count; i += chunk)
+        {
+            for (std::size_t u = 0; u < unroll; ++u)
+            {
+                lane_vector next;
+                std::memcpy(&next, data + i + u * lanes, sizeof(lane_vector));
+                lanewise::apply(acc[u], next);
+            }
+        }
+        for (std::size_t u = 1; u < unroll; ++u)
+            lanewise::apply(acc[0], acc[u]);
+        for (std::size_t lane = 0; lane < lanes; ++lane)
+            init = op(init, static_cast<T>(acc[0][lane]));
+    }
+    for (std::size_t i = vector_count; i < count; ++i)
+        init = op(init, data[i]);
+    return init;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// AVX2 build of the chunked loop (256 bit registers)
+template <typename lanewise, typename T, typename binary_op>
+__attribute__((target("avx2"))) T reduce_avx2(const T* data, std::size_t count, T init, binary_op op)
+{
+    return reduce_chunked<32, lanewise>(data, count, init, op);
+}
+
+// SSE build of the chunked loop (128 bit registers)
+template <typename lanewise, typename T, typename binary_op>
+__attribute__((target("sse2"))) T reduce_sse(const T* data, std::size_t count, T init, binary_op op)
+{
+    return reduce_chunked<16, lanewise>(data, count, init, op);
+}
+
+// The CPU is only queried once per process
+inline bool cpu_has_avx2()
+{
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2;
+}
+#endif
+
+// Pick the widest vector loop the running CPU supports
+template <typename lanewise, typename T, typename binary_op>
+T reduce_contiguous(const T* data, std::size_t count, T init, binary_op op)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    if (cpu_has_avx2())
+        return reduce_avx2<lanewise>(data, count, init, op);
+    return reduce_sse<lanewise>(data, count, init, op);
+#else
+    return reduce_chunked<16, lanewise>(data, count, init, op);
+#endif
+}
+
+// Elementwise kernel over two contiguous input columns: kernel(out[i], a[i], b[i]).
+// The kernel is a generic callable which must work on a scalar and on a vector
+// register, and take all of its arguments by reference
+template <std::size_t width, typename T, typename kernel_type>
+__attribute__((always_inline)) inline void transform_chunked(const T* a, const T* b, T* out,
+                                                             std::size_t count, kernel_type kernel)
+{
+    typedef T lane_vector __attribute__((vector_size(width)));
+    constexpr std::size_t lanes = width / sizeof(T);
+
+    const std::size_t vector_count = (count / lanes) * lanes;
+    for (std::size_t i = 0; i < vector_count; i += lanes)
+    {
+        lane_vector lane_a, lane_b, lane_out;
+        std::memcpy(&lane_a, a + i, sizeof(lane_vector));
+        std::memcpy(&lane_b, b + i, sizeof(lane_vector));
+        kernel(lane_out, lane_a, lane_b);
+        std::memcpy(out + i, &lane_out, sizeof(lane_vector));
+    }
+    for (std::size_t i = vector_count; i < count; ++i)
+        kernel(out[i], a[i], b[i]);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+template <typename T, typename kernel_type>
+__attribute__((target("avx2"))) void transform_avx2(const T* a, const T* b, T* out,
+                                                    std::size_t count, kernel_type kernel)
+{
+    transform_chunked<32>(a, b, out, count, kernel);
+}
+
+template <typename T, typename kernel_type>
+__attribute__((target("sse2"))) void transform_sse(const T* a, const T* b, T* out,
+                                                   std::size_t count, kernel_type kernel)
+{
+    transform_chunked<16>(a, b, out, count, kernel);
+}
+#endif
+
+// Pick the widest elementwise loop the running CPU supports
+template <typename T, typename kernel_type>
+void transform_contiguous(const T* a, const T* b, T* out, std::size_t count, kernel_type kernel)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    if (cpu_has_avx2())
+        return transform_avx2(a, b, out, count, kernel);
+    return transform_sse(a, b, out, count, kernel);
+#else
+    transform_chunked<16>(a, b, out, count, kernel);
+#endif
+}
+} // namespace detail
+
+// reduce. Fold a list with any associative operator, starting from init
+// A plain loop is used in place of recursion, so the stack stays the same size
+// for any length of list and at any optimization level.
+// Contiguous lists of arithmetic types combined with a known operator
+// (std::plus, std::multiplies, fp::minimum, fp::maximum and the bitwise
+// operators) run through a chunked SSE/AVX2 loop chosen at runtime
+template <typename T, typename input_iterator, typename binary_op = std::plus<>>
+T reduce(input_iterator list_head, input_iterator list_end, T init = T{}, binary_op op = binary_op{})
+{
+    using value_type = typename std::iterator_traits<input_iterator>::value_type;
+    using lanewise = typename detail::lanewise_op<binary_op, T>::type;
+    if constexpr (detail::is_contiguous_iterator<input_iterator>
+                  && std::is_same_v<value_type, T>
+                  && detail::is_vector_lane<T>
+                  && !std::is_same_v<lanewise, detail::lanewise_none>)
+    {
+        if (list_head == list_end)
+            return init;
+        return detail::reduce_contiguous<lanewise>(std::addressof(*list_head),
+                                                   static_cast<std::size_t>(list_end - list_head),
+                                                   init, op);
+    }
+    else
+    {
+        for (; list_head != list_end; ++list_head)
+            init = op(init, *list_head);
+        return init;
+    }
+}
+} // namespace fp
+
+//////////////////////////////////////////////////////////////////////////////
+// Monoids. Associative operators with an identity, for typed folds
+//////////////////////////////////////////////////////////////////////////////
+
+namespace fp
+{
+// A monoid is an associative combine operation and its identity element.
+// Each monoid is a type with two constexpr traits:
+//     identity<T>()   the value which leaves any other value unchanged
+//     combine(a, b)   the associative operation
+// Monoids may also name an operator_type, which lets the reduction engine pick
+// a vectorized loop for it. Both traits work in the element type itself, so a
+// fold never converts its elements
+namespace monoid
+{
+struct sum
+{
+    using operator_type = std::plus<>;
+    template <typename T> static constexpr T identity() { return T(0); }
+    template <typename T> static constexpr T combine(const T& a, const T& b) { return a + b; }
+};
+
+struct product
+{
+    using operator_type = std::multiplies<>;
+    template <typename T> static constexpr T identity() { return T(1); }
+    template <typename T> static constexpr T combine(const T& a, const T& b) { return a * b; }
+};
+
+// Identity is the largest value of the type (infinity for floating point)
+struct min
+{
+    using operator_type = fp::minimum;
+    template <typename T> static constexpr T identity()
+    {
+        if constexpr (std::numeric_limits<T>::has_infinity)
+            return std::numeric_limits<T>::infinity();
+        else
+            return std::numeric_limits<T>::max();
+    }
+    template <typename T> static constexpr T combine(const T& a, const T& b) { return fp::minimum{}(a, b); }
+};
+
+// Identity is the smallest value of the type (-infinity for floating point)
+struct max
+{
+    using operator_type = fp::maximum;
+    template <typename T> static constexpr T identity()
+    {
+        if constexpr (std::numeric_limits<T>::has_infinity)
+            return -std::numeric_limits<T>::infinity();
+        else
+            return std::numeric_limits<T>::lowest();
+    }
+    template <typename T> static constexpr T combine(const T& a, const T& b) { return fp::maximum{}(a, b); }
+};
+
+struct bit_and
+{
+    using operator_type = std::bit_and<>;
+    template <typename T> static constexpr T identity() { return T(~T(0)); }
+    template <typename T> static constexpr T combine(const T& a, const T& b) { return a & b; }
+};
+
+struct bit_or
+{
+    using operator_type = std::bit_or<>;
+    template <typename T> static constexpr T identity() { return T(0); }
+    template <typename T> static constexpr T combine(const T& a, const T& b) { return a | b; }
+};
+
+struct bit_xor
+{
+    using operator_type = std::bit_xor<>;
+    template <typename T> static constexpr T identity() { return T(0); }
+    template <typename T> static constexpr T combine(const T& a, const T& b) { return a ^ b; }
+};
+} // namespace monoid
+
+namespace detail
+{
+// Operator which calls a monoid's combine, for monoids without an operator_type
+template <typename monoid_type>
+struct monoid_combine
+{
+    template <typename T>
+    constexpr T operator()(const T& a, const T& b) const { return monoid_type::combine(a, b); }
+};
+
+template <typename monoid_type, typename = void>
+struct monoid_operator { using type = monoid_combine<monoid_type>; };
+template <typename monoid_type>
+struct monoid_operator<monoid_type, std::void_t<typename monoid_type::operator_type>>
+{
+    using type = typename monoid_type::operator_type;
+};
+} // namespace detail
+
+// mconcat. Fold a list with a monoid (Haskell mconcat equivalent)
+// The fold starts from the monoid's identity in the list's own element type,
+// and runs on the reduction engine without allocating
+template <typename monoid_type, typename input_iterator>
+auto mconcat(input_iterator list_head, input_iterator list_end)
+{
+    using T = typename std::iterator_traits<input_iterator>::value_type;
+    using operator_type = typename detail::monoid_operator<monoid_type>::type;
+    return fp::reduce(list_head, list_end, monoid_type::template identity<T>(), operator_type{});
+}
+
+template <typename monoid_type, typename T, typename allocator_type>
+T mconcat(const std::vector<T, allocator_type>& in_list)
+{
+    return mconcat<monoid_type>(in_list.begin(), in_list.end());
+}
+} // namespace fp
 
 //////////////////////////////////////////////////////////////////////////////
 // List Recursion
 //////////////////////////////////////////////////////////////////////////////
 
-// sumlist. Compute the sum of all of the elements of a list
-// Uses list recursion
-// Use iterators to track the head of the list
-template<typename T, typename input_iterator>
-T sumlist(input_iterator list_head, input_iterator list_end)
+// sumlist_recursive. Compute the sum of all of the elements of a list
+// Uses list recursion
+// Use iterators to track the head of the list
+// Note: every element adds a stack frame. Kept as the reference version of sumlist
+template<typename T, typename input_iterator>
+T sumlist_recursive(input_iterator list_head, input_iterator list_end)
+{
+    // When the head and end iterators equal, we have finished our recursion (base case)
+    // Otherwise add the head to the recursive result of the remainder of the list to compute sum
+    return (list_head == list_end)  ? 0
+                                    : *list_head + sumlist_recursive<T, input_iterator>(list_head+1, list_end); 
+}
+
+// sumlist. Compute the sum of all of the elements of a list
+// Same iterator API as sumlist_recursive, but runs on the reduction engine,
+// so it is safe for lists of any length
+template<typename T, typename input_iterator>
+T sumlist(input_iterator list_head, input_iterator list_end)
+{
+    return fp::reduce<T>(list_head, list_end, T{0}, std::plus<T>{});
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// List Tail Recursion
+//////////////////////////////////////////////////////////////////////////////
+
+// sumlist_tail_recursive. Compute the sum of all of the elements of a list
+// Uses tail recursion on the list
+// Use iterators to track the head of the list
+// Note: only stays flat if the compiler performs tail call elimination. Kept as
+// the reference version of sumlist_tail
+template<typename T, typename input_iterator>
+T sumlist_tail_recursive(input_iterator list_head, input_iterator list_end, T accumulator = 0)
+{
+    // When the head and end iterators equal, we have finished our recursion (base case)
+    // Otherwise add the head to the current result in an accumulator, while recursively working through the list 
+    return (list_head == list_end)  ? accumulator
+                                    : sumlist_tail_recursive<T, input_iterator>(list_head+1, list_end, *list_head + accumulator); 
+}
+
+// sumlist_tail. Compute the sum of all of the elements of a list
+// The accumulator is the starting value of the reduction engine's loop, which
+// is exactly what the tail call would carry along
+template<typename T, typename input_iterator>
+T sumlist_tail(input_iterator list_head, input_iterator list_end, T accumulator = 0)
+{
+    return fp::reduce<T>(list_head, list_end, accumulator, std::plus<T>{});
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Trampolines. Recursion in constant stack, at any optimization level
+//////////////////////////////////////////////////////////////////////////////
+
+namespace fp
+{
+namespace detail
+{
+// A call saved for later: the function and its arguments
+template <typename F, typename... Args>
+struct bound_call
+{
+    F f;
+    std::tuple<Args...> args;
+    decltype(auto) operator()() { return std::apply(f, std::move(args)); }
+};
+
+// A call to a function known at compile time, which can be inlined into the
+// trampoline's loop
+template <auto f, typename... Args>
+struct bound_static_call
+{
+    std::tuple<Args...> args;
+    decltype(auto) operator()() { return std::apply(f, std::move(args)); }
+};
+} // namespace detail
+
+// tail_call. Return this in place of calling f(args...) in tail position. The
+// call is saved in the returned trampoline, and made by the trampoline's loop
+// after the calling function has returned, so the stack never grows
+template <typename F, typename... Args>
+detail::bound_call<std::decay_t<F>, std::decay_t<Args>...> tail_call(F&& f, Args&&... args)
+{
+    return {std::forward<F>(f), {std::forward<Args>(args)...}};
+}
+
+// tail_call<f>. The same, for a function named at compile time. The trampoline
+// loop can then inline f, as the compiler does when it eliminates a tail call
+template <auto f, typename... Args>
+detail::bound_static_call<f, std::decay_t<Args>...> tail_call(Args&&... args)
+{
+    return {{std::forward<Args>(args)...}};
+}
+
+// trampoline. The result of one step of a recursive function returning R:
+// either the finished result, or the tail call still to be made.
+// run() makes the tail calls in a loop until a result comes back. Each tail
+// call (any callable returning a trampoline<R>) is kept in a buffer of
+// buffer_size bytes inside the trampoline, so no step allocates. A tail call
+// which does not fit the buffer is a compile error
+template <typename R, std::size_t buffer_size = 64>
+class trampoline
+{
+public:
+    // A finished computation
+    trampoline(R result) : m_result(std::move(result)) {}
+
+    // One more step to run
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, trampoline>
+                                                      && !std::is_convertible_v<F, R>>>
+    trampoline(F&& f) : m_ops(ops<std::decay_t<F>>())
+    {
+        using thunk_type = std::decay_t<F>;
+        static_assert(sizeof(thunk_type) <= buffer_size && alignof(thunk_type) <= alignof(std::max_align_t),
+                      "tail call does not fit the trampoline buffer, raise buffer_size");
+        new (m_buffer) thunk_type(std::forward<F>(f));
+    }
+
+    trampoline(trampoline&& other) noexcept : m_result(std::move(other.m_result)) { take_thunk(other); }
+    trampoline& operator=(trampoline&& other) noexcept
+    {
+        if (this != &other)
+        {
+            destroy_thunk();
+            m_result = std::move(other.m_result);
+            take_thunk(other);
+        }
+        return *this;
+    }
+    trampoline(const trampoline&) = delete;
+    trampoline& operator=(const trampoline&) = delete;
+    ~trampoline() { destroy_thunk(); }
+
+    bool done() const { return m_ops == nullptr; }
+
+    // Make tail calls until the result is known
+    R run()
+    {
+        while (m_ops)
+            m_ops->step(*this);
+        return std::move(*m_result);
+    }
+
+private:
+    // What the trampoline needs to know about a stored tail call. Trivially
+    // copyable calls (plain functions over iterators and numbers) leave
+    // relocate and destroy empty, and are moved with a memcpy
+    struct thunk_ops
+    {
+        void (*step)(trampoline& self);
+        void (*relocate)(void* to, void* from);
+        void (*destroy)(void* thunk);
+    };
+
+    template <typename F>
+    static const thunk_ops* ops()
+    {
+        if constexpr (std::is_trivially_copyable_v<F>)
+        {
+            static constexpr thunk_ops table{&step<F>, nullptr, nullptr};
+            return &table;
+        }
+        else
+        {
+            static constexpr thunk_ops table{
+                &step<F>,
+                [](void* to, void* from) { new (to) F(std::move(*static_cast<F*>(from))); static_cast<F*>(from)->~F(); },
+                [](void* thunk) { static_cast<F*>(thunk)->~F(); }};
+            return &table;
+        }
+    }
+
+    // Make the stored tail call. While it keeps returning tail calls of the
+    // same type (a function calling itself), they are made here, where the
+    // call is known and can be inlined, instead of going back through run()
+    template <typename F>
+    static void step(trampoline& self)
+    {
+        F call = std::move(*reinterpret_cast<F*>(self.m_buffer));
+        self.destroy_thunk();
+        for (;;)
+        {
+            trampoline next = call();
+            if (next.m_ops != ops<F>())
+            {
+                self = std::move(next);
+                return;
+            }
+            call = std::move(*reinterpret_cast<F*>(next.m_buffer));
+        }
+    }
+
+    void take_thunk(trampoline& other)
+    {
+        m_ops = other.m_ops;
+        if (m_ops && m_ops->relocate)
+            m_ops->relocate(m_buffer, other.m_buffer);
+        else if (m_ops)
+            std::memcpy(m_buffer, other.m_buffer, buffer_size);
+        other.m_ops = nullptr;
+    }
+
+    void destroy_thunk()
+    {
+        if (m_ops && m_ops->destroy)
+            m_ops->destroy(m_buffer);
+        m_ops = nullptr;
+    }
+
+    alignas(std::max_align_t) unsigned char m_buffer[buffer_size];
+    const thunk_ops* m_ops = nullptr;
+    std::optional<R> m_result;
+};
+} // namespace fp
+
+// sumlist_trampoline. Compute the sum of all of the elements of a list
+// sumlist_tail_recursive written for a trampoline: the recursive call is
+// returned as a tail_call, so the stack stays flat in debug builds too
+// Call .run() on the result to compute the sum
+template<typename T, typename input_iterator>
+fp::trampoline<T> sumlist_trampoline(input_iterator list_head, input_iterator list_end, T accumulator = 0)
+{
+    // When the head and end iterators equal, we have finished our recursion (base case)
+    // Otherwise add the head to the accumulator, and return the call for the rest of the list
+    return (list_head == list_end)  ? fp::trampoline<T>(accumulator)
+                                    : fp::tail_call<sumlist_trampoline<T, input_iterator>>(list_head+1, list_end, *list_head + accumulator);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// High Order FUnctions (HOF). Haskell map and foldr equivalent
+//////////////////////////////////////////////////////////////////////////////
+
+// inclist_HOF. increment each element of a list by 1
+// Uses a High Order Function (HOF) to complete task. for_each is equivalent to Haskell map
+// Lists with any allocator are accepted (std::pmr::vector, see Memory resources)
+template<typename T, typename allocator_type>
+void inclist_HOF(std::vector<T, allocator_type>& in_list)
+{
+    // apply the lambda function (which increments the element) over the entire list
+    // Applying a function in for_each is equivalent to applying a function via Haskell map.
+    // The function will be applied to each element of the list
+    std::for_each(in_list.begin(), in_list.end(), [](T& x){x = x + 1;});
+}
+
+// sumlist_HOF. Compute the sum of all of the elements of a list
+// Uses a High Order Function (HOF) to complete task. mconcat is equivelent to Haskell foldr
+// over a monoid
+template<typename T, typename allocator_type>
+T sumlist_HOF(std::vector<T, allocator_type>& in_list)
+{
+    // fold the sum monoid over the entire list
+    // Folding with mconcat is equivalent to applying a function via Haskell foldr
+    // The monoid's combine (addition) will be applied (folding) starting with its identity
+    // (a zero of type T) to each element in the list, so no element is converted
+    return fp::mconcat<fp::monoid::sum>(in_list);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Parallel High Order Functions. map and fold over a work stealing thread pool
+//////////////////////////////////////////////////////////////////////////////
+
+namespace fp
+{
+// Work stealing thread pool
+// Every worker owns a queue. A worker takes its newest task from its own queue,
+// and when that runs dry it steals the oldest task from another worker's queue.
+// Threads waiting on a parallel_for run queued tasks instead of sleeping, so
+// parallel calls may be nested
+class ThreadPool
+{
+public:
+    // A thread count of 0 uses one worker per hardware thread
+    explicit ThreadPool(std::size_t thread_count = 0)
+    {
+        if (thread_count == 0)
+            thread_count = std::max(1u, std::thread::hardware_concurrency());
+        for (std::size_t i = 0; i < thread_count; i++)
+            m_queues.push_back(std::make_unique<WorkQueue>());
+        for (std::size_t i = 0; i < thread_count; i++)
+            m_workers.emplace_back([this, i]{ worker_loop(i); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_wake_mutex);
+            m_stopping = true;
+        }
+        m_wake.notify_all();
+        for (auto& worker : m_workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Pool shared by the parallel HOFs when no pool is given
+    static ThreadPool& shared()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    std::size_t size() const { return m_queues.size(); }
+
+    // Whether the calling thread is one of this pool's workers
+    bool is_worker() const { return current_worker().pool == this; }
+
+    // Queue a task. Tasks submitted from a worker go on that worker's own queue,
+    // others are spread over the queues round robin
+    void submit(std::function<void()> task)
+    {
+        const WorkerIdentity& self = current_worker();
+        std::size_t index = (self.pool == this) ? self.index
+                                                : m_next_queue.fetch_add(1, std::memory_order_relaxed) % size();
+        {
+            std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+            m_queues[index]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_wake_mutex);
+            m_pending++;
+        }
+        m_wake.notify_one();
+    }
+
+    // Run a single queued task on the calling thread. Returns false when every queue is empty
+    bool run_pending_task()
+    {
+        std::function<void()> task;
+        if (!take_task(task))
+            return false;
+        task();
+        return true;
+    }
+
+    // Call f(0) .. f(task_count - 1) in parallel and wait for all of them.
+    // The calling thread runs f(0) itself and then helps with queued tasks.
+    // The first exception thrown by a task is rethrown here
+    template <typename F>
+    void parallel_for(std::size_t task_count, F f)
+    {
+        if (task_count == 0)
+            return;
+        std::atomic<std::size_t> remaining{task_count};
+        std::exception_ptr error;
+        std::mutex error_mutex;
+        auto run = [&](std::size_t i)
+        {
+            try
+            {
+                f(i);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error)
+                    error = std::current_exception();
+            }
+            remaining.fetch_sub(1, std::memory_order_acq_rel);
+        };
+        for (std::size_t i = 1; i < task_count; i++)
+            submit([&run, i]{ run(i); });
+        run(0);
+        while (remaining.load(std::memory_order_acquire) != 0)
+        {
+            if (!run_pending_task())
+                std::this_thread::yield();
+        }
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+private:
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    // Which pool (if any) the current thread works for
+    struct WorkerIdentity
+    {
+        ThreadPool* pool = nullptr;
+        std::size_t index = 0;
+    };
+
+    static WorkerIdentity& current_worker()
+    {
+        thread_local WorkerIdentity identity;
+        return identity;
+    }
+
+    // Take the newest task from our own queue, otherwise steal the oldest task
+    // from the other queues. Threads outside the pool only steal
+    bool take_task(std::function<void()>& task)
+    {
+        const WorkerIdentity& self = current_worker();
+        bool is_worker = (self.pool == this);
+        std::size_t start = is_worker ? self.index : 0;
+        for (std::size_t offset = 0; offset < size(); offset++)
+        {
+            WorkQueue& queue = *m_queues[(start + offset) % size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty())
+                continue;
+            if (is_worker && offset == 0)
+            {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            else
+            {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            m_pending--;
+            return true;
+        }
+        return false;
+    }
+
+    void worker_loop(std::size_t index)
+    {
+        current_worker() = WorkerIdentity{this, index};
+        while (true)
+        {
+            if (run_pending_task())
+                continue;
+            std::unique_lock<std::mutex> lock(m_wake_mutex);
+            m_wake.wait(lock, [this]{ return m_stopping || m_pending > 0; });
+            if (m_stopping && m_pending <= 0)
+                return;
+        }
+    }
+
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+    std::vector<std::thread> m_workers;
+    std::atomic<std::size_t> m_next_queue{0};
+    // Number of queued tasks, used to put idle workers to sleep
+    std::atomic<long> m_pending{0};
+    std::mutex m_wake_mutex;
+    std::condition_variable m_wake;
+    bool m_stopping = false;
+};
+
+// Tuning for the parallel HOFs
+struct parallel_options
+{
+    // Smallest number of elements handed to one task. 0 picks a size from the
+    // list length, so that every thread gets a few tasks to balance the load
+    std::size_t grain_size = 0;
+    // Largest number of threads working on one call. 0 uses the whole pool
+    std::size_t thread_count = 0;
+    // Pool to run on. nullptr uses ThreadPool::shared()
+    ThreadPool* pool = nullptr;
+};
+
+namespace detail
+{
+// Split a list of elements into chunks following the options
+inline std::size_t parallel_chunk_count(std::size_t elements, const parallel_options& options,
+                                        const ThreadPool& pool)
+{
+    if (elements == 0)
+        return 0;
+    std::size_t threads = options.thread_count ? options.thread_count : pool.size();
+    std::size_t grain = options.grain_size ? options.grain_size
+                                           : std::max<std::size_t>(4096, elements / (threads * 4));
+    std::size_t chunks = (elements + grain - 1) / grain;
+    if (options.thread_count)
+        chunks = std::min(chunks, options.thread_count);
+    return std::max<std::size_t>(chunks, 1);
+}
+
+// Parallel fold over any contiguous array (a std::vector, a memory mapped file)
+template <typename T, typename binary_op>
+T parallel_fold_contiguous(const T* data, std::size_t elements, T init, binary_op op, parallel_options options)
+{
+    ThreadPool& pool = options.pool ? *options.pool : ThreadPool::shared();
+    std::size_t chunks = parallel_chunk_count(elements, options, pool);
+    std::vector<std::optional<T>> partials(chunks);
+    pool.parallel_for(chunks, [&](std::size_t chunk)
+    {
+        const T* chunk_head = data + chunk * elements / chunks;
+        const T* chunk_end = data + (chunk + 1) * elements / chunks;
+        if (chunk_head != chunk_end)
+            partials[chunk] = fp::reduce(chunk_head + 1, chunk_end, *chunk_head, op);
+    });
+    for (auto& partial : partials)
+    {
+        if (partial)
+            init = op(init, *partial);
+    }
+    return init;
+}
+} // namespace detail
+
+// map. Apply a function to each element of a list, in parallel
+// Same contract as the for_each used in inclist_HOF: f takes each element by
+// reference. The list is split into chunks which run on the thread pool
+template <typename T, typename allocator_type, typename F>
+void map(std::vector<T, allocator_type>& in_list, F f, parallel_options options = {})
+{
+    ThreadPool& pool = options.pool ? *options.pool : ThreadPool::shared();
+    std::size_t elements = in_list.size();
+    std::size_t chunks = detail::parallel_chunk_count(elements, options, pool);
+    pool.parallel_for(chunks, [&](std::size_t chunk)
+    {
+        auto chunk_head = in_list.begin() + chunk * elements / chunks;
+        auto chunk_end = in_list.begin() + (chunk + 1) * elements / chunks;
+        std::for_each(chunk_head, chunk_end, f);
+    });
+}
+
+// fold. Combine all of the elements of a list with an associative operator, in parallel
+// Every chunk is reduced on the reduction engine, then the chunk results are
+// combined in list order, starting from init
+template <typename T, typename allocator_type, typename binary_op = std::plus<>>
+T fold(const std::vector<T, allocator_type>& in_list, T init, binary_op op = binary_op{}, parallel_options options = {})
+{
+    return detail::parallel_fold_contiguous(in_list.data(), in_list.size(), std::move(init), op, options);
+}
+} // namespace fp
+
+//////////////////////////////////////////////////////////////////////////////
+// Reproducible summation. Floating point sums which do not depend on the threads
+//////////////////////////////////////////////////////////////////////////////
+
+namespace fp
+{
+// How sumlist_HOF adds up a list of floating point numbers
+//     fast          the vectorized reduction engine. The order of the additions
+//                   follows the vector width (and the chunks, when run in
+//                   parallel), and so does the rounding of the result
+//     reproducible  compensated summation over fixed blocks. Bit identical for
+//                   any thread count, grain size and vector width, and about
+//                   twice as precise as the fast sum
+enum class summation { fast, reproducible };
+
+namespace detail
+{
+// Elements in one block. Blocks only depend on the length of the list, so the
+// threads decide which blocks they sum, never how a block is summed
+constexpr std::size_t reproducible_block = 4096;
+// Independent accumulators in a block. Fixed instead of taken from the vector
+// register, so that SSE and AVX2 machines add in exactly the same order
+constexpr std::size_t reproducible_lanes = 16;
+
+// A running sum, and the rounding error its additions have lost so far
+template <typename T>
+struct compensated
+{
+    T sum = 0;
+    T error = 0;
+};
+
+// two_sum. Add x to sum, and the exact rounding error of that addition to
+// error (Knuth). There is no comparison, so it works on a scalar and on a
+// vector register alike, which are passed by reference to keep vector types
+// out of the calling convention. Needs strict IEEE arithmetic: do not build
+// with -ffast-math
+template <typename V>
+__attribute__((always_inline)) inline void two_sum(V& sum, V& error, const V& x)
+{
+    V total = sum + x;
+    V x_part = total - sum;
+    error += (sum - (total - x_part)) + (x - x_part);
+    sum = total;
+}
+
+template <typename T>
+__attribute__((always_inline)) inline void add_compensated(compensated<T>& acc, const compensated<T>& x)
+{
+    two_sum(acc.sum, acc.error, x.sum);
+    acc.error += x.error;
+}
+
+// Sum blocks first_block to last_block of a list, one compensated result per
+// block. Element i of a block goes to lane i % reproducible_lanes, which is
+// spread over as many registers of width bytes as it takes. The lanes are
+// combined in order and the leftover elements are added last
+template <std::size_t width, typename T>
+__attribute__((always_inline)) inline void sum_blocks_chunked(const T* data, std::size_t elements,
+                                                              std::size_t first_block, std::size_t last_block,
+                                                              compensated<T>* partials)
+{
+    typedef T lane_vector __attribute__((vector_size(width)));
+    constexpr std::size_t lanes = width / sizeof(T);
+    constexpr std::size_t registers = reproducible_lanes / lanes;
+    for (std::size_t block = first_block; block < last_block; ++block)
+    {
+        const T* block_head = data + block * reproducible_block;
+        const std::size_t count = std::min(reproducible_block, elements - block * reproducible_block);
+        const std::size_t vector_count = count / reproducible_lanes * reproducible_lanes;
+
+        lane_vector sum[registers] = {}, error[registers] = {};
+        for (std::size_t i = 0; i < vector_count; i += reproducible_lanes)
+        {
+            for (std::size_t r = 0; r < registers; ++r)
+            {
+                lane_vector next;
+                std::memcpy(&next, block_head + i + r * lanes, sizeof(lane_vector));
+                two_sum(sum[r], error[r], next);
+            }
+        }
+        compensated<T> result;
+        for (std::size_t lane = 0; lane < reproducible_lanes; ++lane)
+            add_compensated(result, compensated<T>{sum[lane / lanes][lane % lanes], error[lane / lanes][lane % lanes]});
+        for (std::size_t i = vector_count; i < count; ++i)
+            two_sum(result.sum, result.error, block_head[i]);
+        partials[block] = result;
+    }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// AVX2 and SSE builds of the block loop. Neither target enables FMA, so the
+// compiler can not contract two_sum into fused operations on either path
+template <typename T>
+__attribute__((target("avx2"))) void sum_blocks_avx2(const T* data, std::size_t elements, std::size_t first_block,
+                                                     std::size_t last_block, compensated<T>* partials)
+{
+    sum_blocks_chunked<32>(data, elements, first_block, last_block, partials);
+}
+
+template <typename T>
+__attribute__((target("sse2"))) void sum_blocks_sse(const T* data, std::size_t elements, std::size_t first_block,
+                                                    std::size_t last_block, compensated<T>* partials)
+{
+    sum_blocks_chunked<16>(data, elements, first_block, last_block, partials);
+}
+#endif
+
+template <typename T>
+void sum_blocks(const T* data, std::size_t elements, std::size_t first_block, std::size_t last_block,
+                compensated<T>* partials)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    if (cpu_has_avx2())
+        return sum_blocks_avx2(data, elements, first_block, last_block, partials);
+    return sum_blocks_sse(data, elements, first_block, last_block, partials);
+#else
+    sum_blocks_chunked<16>(data, elements, first_block, last_block, partials);
+#endif
+}
+
+// Reproducible sum of any contiguous array. The blocks are shared out between
+// the threads following the options, and the block results always combined
+// in list order
+template <typename T>
+T reproducible_sum_contiguous(const T* data, std::size_t elements, parallel_options options)
+{
+    static_assert(std::is_floating_point_v<T>, "reproducible_sum is for floating point lists");
+    ThreadPool& pool = options.pool ? *options.pool : ThreadPool::shared();
+    std::size_t blocks = (elements + reproducible_block - 1) / reproducible_block;
+    std::size_t chunks = std::min(parallel_chunk_count(elements, options, pool), blocks);
+    std::vector<compensated<T>> partials(blocks);
+    if (chunks == 1)
+        sum_blocks(data, elements, 0, blocks, partials.data());
+    else if (chunks > 1)
+        pool.parallel_for(chunks, [&](std::size_t chunk) {
+            sum_blocks(data, elements, chunk * blocks / chunks, (chunk + 1) * blocks / chunks, partials.data()); });
+
+    compensated<T> total;
+    for (const auto& partial : partials)
+        add_compensated(total, partial);
+    // An infinite sum has a NaN error (inf - inf), which must not reach the result
+    return std::isfinite(total.sum) ? total.sum + total.error : total.sum;
+}
+} // namespace detail
+
+// reproducible_sum. Sum a list of floating point numbers, in parallel, with
+// the same bits in the result however many threads are used
+template <typename T, typename allocator_type>
+T reproducible_sum(const std::vector<T, allocator_type>& in_list, parallel_options options = {})
+{
+    return detail::reproducible_sum_contiguous(in_list.data(), in_list.size(), options);
+}
+} // namespace fp
+
+// sumlist_HOF with a choice of summation, for lists of floating point numbers
+template<typename T, typename allocator_type>
+T sumlist_HOF(std::vector<T, allocator_type>& in_list, fp::summation mode)
+{
+    if (mode == fp::summation::reproducible)
+        return fp::reproducible_sum(in_list);
+    return sumlist_HOF<T>(in_list);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Persistent Vector. Non-destructive updates which share structure
+//////////////////////////////////////////////////////////////////////////////
+
+namespace fp
+{
+// PersistentVector. An immutable list where push_back and set return a new
+// version in O(log32 n), sharing every untouched node with the old version.
+// Readers holding an older version never see a change.
+// Layout (Clojure style bit partitioned trie): elements live in leaves of 32,
+// internal nodes have 32 children, and the last (up to 32) elements sit in a
+// separate tail so push_back is usually a copy of the tail only.
+// Nodes are reference counted with std::shared_ptr, so versions can be shared
+// between threads. T must be default constructible and copyable
+template <typename T>
+class PersistentVector
+{
+public:
+    static constexpr std::size_t bits = 5;
+    static constexpr std::size_t branching = std::size_t(1) << bits;
+    static constexpr std::size_t mask = branching - 1;
+
+private:
+    // Trie nodes. A transient stamps the nodes it creates with its owner id
+    struct Node
+    {
+        explicit Node(bool leaf) : is_leaf(leaf) {}
+        bool is_leaf;
+        uint64_t owner = 0;
+    };
+    struct Leaf : Node
+    {
+        Leaf() : Node(true) {}
+        std::array<T, branching> values{};
+    };
+    struct Internal : Node
+    {
+        Internal() : Node(false) {}
+        std::array<std::shared_ptr<Node>, branching> children;
+    };
+
+public:
+    class Transient;
+    class const_iterator;
+    using value_type = T;
+
+    PersistentVector() = default;
+    PersistentVector(const PersistentVector&) = default;
+    PersistentVector& operator=(const PersistentVector&) = default;
+
+    // A moved from vector is left empty, and usable
+    PersistentVector(PersistentVector&& other) noexcept
+        : m_size(std::exchange(other.m_size, 0)), m_shift(std::exchange(other.m_shift, bits)),
+          m_root(std::exchange(other.m_root, empty_root())), m_tail(std::move(other.m_tail)) {}
+
+    PersistentVector& operator=(PersistentVector&& other) noexcept
+    {
+        if (this != &other)
+        {
+            m_size = std::exchange(other.m_size, 0);
+            m_shift = std::exchange(other.m_shift, bits);
+            m_root = std::exchange(other.m_root, empty_root());
+            m_tail = std::move(other.m_tail);
+        }
+        return *this;
+    }
+
+    PersistentVector(std::initializer_list<T> values) : PersistentVector(values.begin(), values.end()) {}
+
+    explicit PersistentVector(const std::vector<T>& values) : PersistentVector(values.begin(), values.end()) {}
+
+    template <typename input_iterator>
+    PersistentVector(input_iterator list_head, input_iterator list_end)
+    {
+        Transient builder;
+        for (; list_head != list_end; ++list_head)
+            builder.push_back(*list_head);
+        *this = std::move(builder).persistent();
+    }
+
+    std::size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    const T& operator[](std::size_t index) const { return leaf_for(index)->values[index & mask]; }
+
+    const T& at(std::size_t index) const
+    {
+        if (index >= m_size)
+            throw std::out_of_range("PersistentVector::at");
+        return (*this)[index];
+    }
+
+    // A new version with value appended
+    PersistentVector push_back(T value) const
+    {
+        Transient edit(*this, 0);
+        edit.push_back(std::move(value));
+        return std::move(edit).persistent();
+    }
+
+    // A new version with the element at index replaced
+    PersistentVector set(std::size_t index, T value) const
+    {
+        Transient edit(*this, 0);
+        edit.set(index, std::move(value));
+        return std::move(edit).persistent();
+    }
+
+    // A transient copy for a batch of edits (see Transient)
+    Transient transient() const { return Transient(*this, Transient::next_owner()); }
+
+    // Call f(const T* data, std::size_t count) on each run of contiguous elements,
+    // in order. This is how the folds reach the vectorized reduction engine
+    template <typename F>
+    void for_each_chunk(F&& f) const
+    {
+        std::size_t tail_start = tail_offset();
+        for (std::size_t index = 0; index < tail_start; index += branching)
+            f(leaf_for(index)->values.data(), branching);
+        if (m_size > tail_start)
+            f(m_tail->values.data(), m_size - tail_start);
+    }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, m_size); }
+
+    std::vector<T> to_vector() const
+    {
+        std::vector<T> values;
+        values.reserve(m_size);
+        for_each_chunk([&](const T* data, std::size_t count){ values.insert(values.end(), data, data + count); });
+        return values;
+    }
+
+    // Forward iterator. Looks a leaf up once per 32 elements
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        const_iterator() = default;
+        const_iterator(const PersistentVector* list, std::size_t index) : m_list(list), m_index(index)
+        {
+            if (m_index < m_list->size())
+                m_leaf = m_list->leaf_for(m_index);
+        }
+
+        reference operator*() const { return m_leaf->values[m_index & mask]; }
+        pointer operator->() const { return &**this; }
+
+        const_iterator& operator++()
+        {
+            m_index++;
+            if ((m_index & mask) == 0 && m_index < m_list->size())
+                m_leaf = m_list->leaf_for(m_index);
+            return *this;
+        }
+        const_iterator operator++(int) { const_iterator previous = *this; ++*this; return previous; }
+
+        bool operator==(const const_iterator& other) const { return m_index == other.m_index; }
+        bool operator!=(const const_iterator& other) const { return m_index != other.m_index; }
+
+    private:
+        const PersistentVector* m_list = nullptr;
+        std::size_t m_index = 0;
+        const typename PersistentVector::Leaf* m_leaf = nullptr;
+    };
+
+    // Transient. A PersistentVector open for a batch of edits. Nodes it has
+    // already copied are edited in place, so n edits cost O(n) copies of nodes
+    // in total, not O(n log n). Nodes shared with any persistent version are
+    // never modified. persistent() seals it back into a PersistentVector.
+    // Move only: two copies would share an owner id and edit each other's nodes
+    class Transient
+    {
+    public:
+        Transient() : m_owner(next_owner()) {}
+        Transient(const Transient&) = delete;
+        Transient& operator=(const Transient&) = delete;
+        Transient(Transient&& other) noexcept
+            : m_list(std::move(other.m_list)), m_owner(std::exchange(other.m_owner, 0)) {}
+        Transient& operator=(Transient&& other) noexcept
+        {
+            m_list = std::move(other.m_list);
+            m_owner = std::exchange(other.m_owner, 0);
+            return *this;
+        }
+
+        std::size_t size() const { return m_list.m_size; }
+        const T& operator[](std::size_t index) const { return m_list[index]; }
+
+        Transient& push_back(T value)
+        {
+            PersistentVector& list = m_list;
+            if (list.m_size - list.tail_offset() < branching)
+            {
+                Leaf& tail = editable_tail();
+                tail.values[list.m_size - list.tail_offset()] = std::move(value);
+                list.m_size++;
+                return *this;
+            }
+            // The tail is full: push it into the tree and start a new one
+            std::shared_ptr<Node> full_tail = std::move(list.m_tail);
+            if ((list.m_size >> bits) > (std::size_t(1) << list.m_shift))
+            {
+                auto root = make_internal();
+                root->children[0] = std::move(list.m_root);
+                root->children[1] = new_path(list.m_shift, std::move(full_tail));
+                list.m_root = std::move(root);
+                list.m_shift += bits;
+            }
+            else
+                list.m_root = push_tail(list.m_shift, list.m_root, std::move(full_tail));
+            list.m_tail = make_leaf();
+            list.m_tail->values[0] = std::move(value);
+            list.m_size++;
+            return *this;
+        }
+
+        Transient& set(std::size_t index, T value)
+        {
+            PersistentVector& list = m_list;
+            if (index >= list.m_size)
+                throw std::out_of_range("PersistentVector::set");
+            if (index >= list.tail_offset())
+            {
+                editable_tail().values[index & mask] = std::move(value);
+                return *this;
+            }
+            if (!owns(*list.m_root))
+                list.m_root = editable(list.m_root);
+            Node* node = list.m_root.get();
+            for (std::size_t shift = list.m_shift; shift > 0; shift -= bits)
+            {
+                auto& child = static_cast<Internal*>(node)->children[(index >> shift) & mask];
+                if (!owns(*child))
+                    child = editable(child);
+                node = child.get();
+            }
+            static_cast<Leaf*>(node)->values[index & mask] = std::move(value);
+            return *this;
+        }
+
+        PersistentVector persistent() &&
+        {
+            m_owner = 0;
+            return std::move(m_list);
+        }
+
+    private:
+        friend class PersistentVector;
+
+        Transient(const PersistentVector& list, uint64_t owner) : m_list(list), m_owner(owner) {}
+
+        // Owner ids are never reused, so a node stamped by a finished transient
+        // can not be mistaken for one owned by a new transient. Owner 0 (the
+        // single edits behind push_back and set) owns nothing, so every node on
+        // the edited path is copied
+        static uint64_t next_owner()
+        {
+            static std::atomic<uint64_t> owners{1};
+            return owners.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        std::shared_ptr<Leaf> make_leaf() const
+        {
+            auto leaf = std::make_shared<Leaf>();
+            leaf->owner = m_owner;
+            return leaf;
+        }
+
+        std::shared_ptr<Internal> make_internal() const
+        {
+            auto internal = std::make_shared<Internal>();
+            internal->owner = m_owner;
+            return internal;
+        }
+
+        bool owns(const Node& node) const { return m_owner != 0 && node.owner == m_owner; }
+
+        // The node itself if this transient owns it, otherwise a copy it owns
+        std::shared_ptr<Node> editable(const std::shared_ptr<Node>& node) const
+        {
+            if (owns(*node))
+                return node;
+            std::shared_ptr<Node> copy = node->is_leaf
+                ? std::shared_ptr<Node>(std::make_shared<Leaf>(*static_cast<const Leaf*>(node.get())))
+                : std::shared_ptr<Node>(std::make_shared<Internal>(*static_cast<const Internal*>(node.get())));
+            copy->owner = m_owner;
+            return copy;
+        }
+
+        // Ownership is checked before any shared_ptr is copied, since this runs
+        // on every push_back
+        Leaf& editable_tail()
+        {
+            if (!m_list.m_tail)
+                m_list.m_tail = make_leaf();
+            else if (!owns(*m_list.m_tail))
+                m_list.m_tail = std::static_pointer_cast<Leaf>(editable(m_list.m_tail));
+            return *m_list.m_tail;
+        }
+
+        // A chain of single child internal nodes from level shift down to the leaf
+        std::shared_ptr<Node> new_path(std::size_t shift, std::shared_ptr<Node> leaf) const
+        {
+            if (shift == 0)
+                return leaf;
+            auto internal = make_internal();
+            internal->children[0] = new_path(shift - bits, std::move(leaf));
+            return internal;
+        }
+
+        std::shared_ptr<Node> push_tail(std::size_t shift, const std::shared_ptr<Node>& parent,
+                                        std::shared_ptr<Node> leaf)
+        {
+            auto node = editable(parent);
+            auto& children = static_cast<Internal*>(node.get())->children;
+            std::size_t slot = ((m_list.m_size - 1) >> shift) & mask;
+            if (shift == bits)
+                children[slot] = std::move(leaf);
+            else if (children[slot])
+                children[slot] = push_tail(shift - bits, children[slot], std::move(leaf));
+            else
+                children[slot] = new_path(shift - bits, std::move(leaf));
+            return node;
+        }
+
+        PersistentVector m_list;
+        uint64_t m_owner;
+    };
+
+private:
+    // The root of every empty vector. It has owner 0, so no transient edits it
+    // in place, and an empty vector does not allocate
+    static const std::shared_ptr<Node>& empty_root()
+    {
+        static const std::shared_ptr<Node> root = std::make_shared<Internal>();
+        return root;
+    }
+
+    // Index of the first element in the tail
+    std::size_t tail_offset() const { return (m_size < branching) ? 0 : ((m_size - 1) >> bits) << bits; }
+
+    const Leaf* leaf_for(std::size_t index) const
+    {
+        if (index >= tail_offset())
+            return m_tail.get();
+        const Node* node = m_root.get();
+        for (std::size_t shift = m_shift; shift > 0; shift -= bits)
+            node = static_cast<const Internal*>(node)->children[(index >> shift) & mask].get();
+        return static_cast<const Leaf*>(node);
+    }
+
+    std::size_t m_size = 0;
+    std::size_t m_shift = bits;
+    std::shared_ptr<Node> m_root = empty_root();
+    std::shared_ptr<Leaf> m_tail;
+};
+
+// fold over a persistent vector. Each leaf is an array, so it is reduced on
+// the vectorized reduction engine, and the leaf results combined in order
+template <typename T, typename binary_op = std::plus<>>
+T fold(const PersistentVector<T>& in_list, T init, binary_op op = binary_op{})
+{
+    in_list.for_each_chunk([&](const T* data, std::size_t count) {
+        init = op(init, fp::reduce(data + 1, data + count, data[0], op)); });
+    return init;
+}
+
+// map over a persistent vector. Same contract as map over a std::vector (f
+// takes each element by reference), but the input is left as it was and a new
+// version is returned, built through a transient
+template <typename T, typename F>
+PersistentVector<T> map(const PersistentVector<T>& in_list, F f)
+{
+    typename PersistentVector<T>::Transient out_list;
+    in_list.for_each_chunk([&](const T* data, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; i++)
+        {
+            T value = data[i];
+            f(value);
+            out_list.push_back(std::move(value));
+        }
+    });
+    return std::move(out_list).persistent();
+}
+} // namespace fp
+
+// inclist_HOF for a persistent list. Returns the incremented list as a new
+// version, where the std::vector version has to modify its list in place
+template<typename T>
+fp::PersistentVector<T> inclist_HOF(const fp::PersistentVector<T>& in_list)
+{
+    return fp::map(in_list, [](T& x){x = x + 1;});
+}
+
+// sumlist_HOF for a persistent list, folding the sum monoid leaf by leaf
+template<typename T>
+T sumlist_HOF(const fp::PersistentVector<T>& in_list)
+{
+    return fp::fold(in_list, fp::monoid::sum::identity<T>(), std::plus<T>{});
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Memory mapped arrays. Fold over on-disk binary arrays without loading them
+//////////////////////////////////////////////////////////////////////////////
+
+#if __has_include(<sys/mman.h>)
+namespace fp
+{
+// How a mapped array will be read, passed on to the kernel with madvise
+enum class access_hint { normal, sequential, random, will_need };
+
+namespace detail
+{
+// Owns a file descriptor, closing it when done. Read only unless other open
+// flags are given (files created get mode 0644, less the umask)
+class FileDescriptor
+{
+public:
+    explicit FileDescriptor(const std::string& path, int flags = O_RDONLY)
+        : m_fd(::open(path.c_str(), flags | O_CLOEXEC, 0644))
+    {
+        if (m_fd < 0)
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+    }
+    ~FileDescriptor() { if (m_fd >= 0) ::close(m_fd); }
+    FileDescriptor(FileDescriptor&& other) noexcept : m_fd(std::exchange(other.m_fd, -1)) {}
+    FileDescriptor& operator=(FileDescriptor other) noexcept { std::swap(m_fd, other.m_fd); return *this; }
+
+    int get() const { return m_fd; }
+
+    // Size in bytes, which must hold a whole number of T
+    template <typename T>
+    std::size_t element_count(const std::string& path) const
+    {
+        struct stat file_status;
+        if (::fstat(m_fd, &file_status) != 0)
+            throw std::system_error(errno, std::generic_category(), "fstat " + path);
+        std::size_t bytes = std::size_t(file_status.st_size);
+        if (bytes % sizeof(T) != 0)
+            throw std::runtime_error(path + " does not hold a whole number of elements");
+        return bytes / sizeof(T);
+    }
+
+private:
+    int m_fd;
+};
+
+inline int madvise_flag(access_hint hint)
+{
+    switch (hint)
+    {
+    case access_hint::sequential: return MADV_SEQUENTIAL;
+    case access_hint::random: return MADV_RANDOM;
+    case access_hint::will_need: return MADV_WILLNEED;
+    default: return MADV_NORMAL;
+    }
+}
+} // namespace detail
+
+// MappedArray. A binary file of T (raw, native byte order) mapped read only.
+// begin() and end() are plain pointers, so fp::reduce, fp::mconcat,
+// fp::apply_all and fp::stream::from run over the file with no copy, and the
+// contiguous ones on the vectorized loops. Pages are loaded by the kernel as
+// they are touched and can be dropped again under memory pressure, so peak
+// memory does not grow with the file
+template <typename T>
+class MappedArray
+{
+public:
+    static_assert(std::is_trivially_copyable_v<T>, "MappedArray elements are read straight from the file");
+
+    explicit MappedArray(const std::string& path, access_hint hint = access_hint::sequential)
+    {
+        detail::FileDescriptor file(path);
+        m_size = file.element_count<T>(path);
+        // An empty file can not be mapped, and needs no mapping
+        if (m_size == 0)
+            return;
+        void* mapping = ::mmap(nullptr, bytes(), PROT_READ, MAP_PRIVATE, file.get(), 0);
+        if (mapping == MAP_FAILED)
+            throw std::system_error(errno, std::generic_category(), "mmap " + path);
+        m_data = static_cast<const T*>(mapping);
+        advise(hint);
+    }
+
+    ~MappedArray()
+    {
+        if (m_data)
+            ::munmap(const_cast<T*>(m_data), bytes());
+    }
+
+    MappedArray(MappedArray&& other) noexcept
+        : m_data(std::exchange(other.m_data, nullptr)), m_size(std::exchange(other.m_size, 0)) {}
+    MappedArray& operator=(MappedArray other) noexcept
+    {
+        std::swap(m_data, other.m_data);
+        std::swap(m_size, other.m_size);
+        return *this;
+    }
+
+    // Change the access hint. Advice is only a hint, so a refusal is ignored
+    void advise(access_hint hint) const
+    {
+        if (m_data)
+            ::madvise(const_cast<T*>(m_data), bytes(), detail::madvise_flag(hint));
+    }
+
+    const T* data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    const T& operator[](std::size_t index) const { return m_data[index]; }
+    const T* begin() const { return m_data; }
+    const T* end() const { return m_data + m_size; }
+
+private:
+    std::size_t bytes() const { return m_size * sizeof(T); }
+
+    const T* m_data = nullptr;
+    std::size_t m_size = 0;
+};
+
+// ChunkedFileReader. Streams a binary file of T through one aligned buffer,
+// for inputs which can not be mapped (pipes) or where only one buffer of the
+// file may be resident at a time. After each chunk is read, the kernel is asked
+// to start reading the next one (posix_fadvise WILLNEED), so the disk works
+// while the caller folds the current chunk
+template <typename T>
+class ChunkedFileReader
+{
+public:
+    static_assert(std::is_trivially_copyable_v<T>, "ChunkedFileReader elements are read straight from the file");
+    static constexpr std::size_t alignment = 4096;
+
+    class iterator;
+
+    // The chunk size is rounded to a whole number of pages and of elements
+    explicit ChunkedFileReader(const std::string& path, std::size_t chunk_bytes = std::size_t(8) << 20)
+        : m_path(path), m_file(path)
+    {
+        chunk_bytes = std::max(alignment, chunk_bytes / alignment * alignment);
+        m_chunk_elements = std::max<std::size_t>(1, chunk_bytes / sizeof(T));
+        void* buffer = nullptr;
+        if (::posix_memalign(&buffer, alignment, m_chunk_elements * sizeof(T)) != 0)
+            throw std::bad_alloc();
+        m_buffer.reset(static_cast<T*>(buffer));
+        ::posix_fadvise(m_file.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    // The next chunk as (data, count). A count of 0 means the file is done.
+    // The data stays valid until the next call
+    std::pair<const T*, std::size_t> next_chunk()
+    {
+        std::size_t wanted = m_chunk_elements * sizeof(T);
+        std::size_t filled = 0;
+        char* out = reinterpret_cast<char*>(m_buffer.get());
+        while (filled < wanted)
+        {
+            ssize_t got = ::read(m_file.get(), out + filled, wanted - filled);
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got < 0)
+                throw std::system_error(errno, std::generic_category(), "read " + m_path);
+            if (got == 0)
+                break;
+            filled += std::size_t(got);
+        }
+        if (filled % sizeof(T) != 0)
+            throw std::runtime_error(m_path + " does not hold a whole number of elements");
+        m_offset += filled;
+        if (filled == wanted)
+            ::posix_fadvise(m_file.get(), off_t(m_offset), off_t(wanted), POSIX_FADV_WILLNEED);
+        return {m_buffer.get(), filled / sizeof(T)};
+    }
+
+    // Call f(const T* data, std::size_t count) for each chunk, in file order
+    template <typename F>
+    void for_each_chunk(F&& f)
+    {
+        for (auto chunk = next_chunk(); chunk.second > 0; chunk = next_chunk())
+            f(chunk.first, chunk.second);
+    }
+
+    // Single pass input iterator over the elements, refilling chunk by chunk
+    iterator begin() { return iterator(this); }
+    iterator end() { return iterator(); }
+
+    class iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        iterator() = default;
+        explicit iterator(ChunkedFileReader* reader) : m_reader(reader) { refill(); }
+
+        reference operator*() const { return m_chunk[m_index]; }
+        pointer operator->() const { return m_chunk + m_index; }
+        iterator& operator++()
+        {
+            if (++m_index == m_count)
+                refill();
+            return *this;
+        }
+        void operator++(int) { ++*this; }
+
+        // Only comparison with end() is meaningful, as for any input iterator
+        bool operator==(const iterator& other) const { return m_reader == other.m_reader; }
+        bool operator!=(const iterator& other) const { return m_reader != other.m_reader; }
+
+    private:
+        void refill()
+        {
+            std::tie(m_chunk, m_count) = m_reader->next_chunk();
+            m_index = 0;
+            if (m_count == 0)
+                m_reader = nullptr;
+        }
+
+        ChunkedFileReader* m_reader = nullptr;
+        const T* m_chunk = nullptr;
+        std::size_t m_count = 0;
+        std::size_t m_index = 0;
+    };
+
+private:
+    struct free_deleter { void operator()(T* buffer) const { std::free(buffer); } };
+
+    std::string m_path;
+    detail::FileDescriptor m_file;
+    std::unique_ptr<T, free_deleter> m_buffer;
+    std::size_t m_chunk_elements = 0;
+    std::size_t m_offset = 0;
+};
+
+// fold over a mapped file, in parallel. Each thread folds its own range of
+// pages, so the file is read by all of the threads at once
+template <typename T, typename binary_op = std::plus<>>
+T fold(const MappedArray<T>& in_list, T init, binary_op op = binary_op{}, parallel_options options = {})
+{
+    return detail::parallel_fold_contiguous(in_list.data(), in_list.size(), std::move(init), op, options);
+}
+
+// fold over a streamed file, chunk by chunk on the vectorized reduction engine
+template <typename T, typename binary_op = std::plus<>>
+T fold(ChunkedFileReader<T>& in_list, T init, binary_op op = binary_op{})
+{
+    in_list.for_each_chunk([&](const T* data, std::size_t count) {
+        init = op(init, fp::reduce(data + 1, data + count, data[0], op)); });
+    return init;
+}
+
+// reproducible_sum over a mapped file, in parallel
+template <typename T>
+T reproducible_sum(const MappedArray<T>& in_list, parallel_options options = {})
+{
+    return detail::reproducible_sum_contiguous(in_list.data(), in_list.size(), options);
+}
+} // namespace fp
+
+// sumlist_HOF over a memory mapped file of numbers, with no copy into a vector.
+// Sequential, like sumlist_HOF over a vector, so a floating point sum does not
+// depend on the machine's thread count
+template<typename T>
+T sumlist_HOF(const fp::MappedArray<T>& in_list)
+{
+    return fp::mconcat<fp::monoid::sum>(in_list.begin(), in_list.end());
+}
+
+// The same sum in parallel, chunked over the pool as fp::fold does
+template<typename T>
+T sumlist_HOF(const fp::MappedArray<T>& in_list, fp::parallel_options options)
+{
+    return fp::fold(in_list, fp::monoid::sum::identity<T>(), std::plus<T>{}, options);
+}
+#endif
+
+// Algebraic Data Types (ADTs)
+// ADT for shape
+class Shape
+{
+public:
+    struct circle
+    {
+        double radius;
+    };
+    struct square
+    {
+        double side;
+    };
+    struct rectangle
+    {
+        double length;
+        double width;
+    };
+    struct ellipse
+    {
+        // Axis relative to the center
+        double axis_1;
+        double axis_2;
+    };
+    struct cylinder
+    {
+        double radius;
+        double height;
+    };
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Algebraic Data Types (ADTs) using sum types
+//////////////////////////////////////////////////////////////////////////////
+
+// std::variant used to create an ADT sum type
+// The adt_shape sum type can be any of the shapes referenced below
+using adt_shape = std::variant<Shape::circle, Shape::square, Shape::rectangle, Shape::ellipse, Shape::cylinder>;
+
+// Overloaded function which separates implementations for different sum types
+// Necessary for pattern matching with std::variant
+template <typename... Ts>
+struct overloaded : Ts... { using Ts::operator()...; };
+template <typename... Ts> overloaded(Ts...) -> overloaded<Ts...>;
+
+//////////////////////////////////////////////////////////////////////////////
+// Match engine. Pattern matching dispatch for std::variant, faster than std::visit
+//////////////////////////////////////////////////////////////////////////////
+
+namespace fp
+{
+namespace detail
+{
+// The alternative at index, keeping the value category of the variant. Only
+// called once the index is known, so there is no check left to fail
+template <std::size_t index, typename variant_type>
+__attribute__((always_inline)) constexpr decltype(auto) unchecked_get(variant_type&& v)
+{
+    if constexpr (std::is_lvalue_reference_v<variant_type>)
+        return *std::get_if<index>(&v);
+    else
+        return std::move(*std::get_if<index>(&v));
+}
+
+template <typename variant_type>
+constexpr std::size_t variant_size_v = std::variant_size_v<std::remove_cv_t<std::remove_reference_t<variant_type>>>;
+
+// Split a flat table index into one alternative index per variant (mixed radix,
+// the last variant varying fastest)
+template <std::size_t flat_index, typename... variant_types>
+constexpr std::array<std::size_t, sizeof...(variant_types)> split_index()
+{
+    constexpr std::size_t sizes[] = {variant_size_v<variant_types>...};
+    std::array<std::size_t, sizeof...(variant_types)> indices{};
+    std::size_t rest = flat_index;
+    for (std::size_t i = sizeof...(variant_types); i-- > 0;)
+    {
+        indices[i] = rest % sizes[i];
+        rest /= sizes[i];
+    }
+    return indices;
+}
+
+// The result of calling f on the combination of alternatives at flat_index
+template <std::size_t flat_index, typename F, typename... variant_types>
+struct match_case
+{
+    static constexpr auto indices = split_index<flat_index, variant_types...>();
+
+    template <std::size_t... position>
+    static auto result(std::index_sequence<position...>)
+        -> std::invoke_result_t<F, decltype(unchecked_get<indices[position]>(std::declval<variant_types>()))...>;
+    using type = decltype(result(std::index_sequence_for<variant_types...>{}));
+
+    template <std::size_t... position>
+    __attribute__((always_inline)) static constexpr type call(std::index_sequence<position...>, F&& f,
+                                                              variant_types&&... vs)
+    {
+        return std::invoke(std::forward<F>(f),
+                           unchecked_get<indices[position]>(std::forward<variant_types>(vs))...);
+    }
+};
+
+// Each case may return a different type, as long as they have a common type
+template <typename F, typename flat_indices, typename... variant_types>
+struct match_result;
+template <typename F, std::size_t... flat_index, typename... variant_types>
+struct match_result<F, std::index_sequence<flat_index...>, variant_types...>
+{
+    using type = std::common_type_t<typename match_case<flat_index, F, variant_types...>::type...>;
+};
+
+// Dispatch on the flat index with a switch statement, 32 cases at a time. The
+// compiler builds the jump table for the switch, and unlike a table of
+// function pointers, each case is inlined into it. Cases past the number of
+// combinations are discarded at compile time
+#define FP_MATCH_CASE(offset) \
+    case offset: \
+        if constexpr (base + offset < combinations) \
+            return match_case<base + offset, F, variant_types...>::call( \
+                std::index_sequence_for<variant_types...>{}, std::forward<F>(f), std::forward<variant_types>(vs)...); \
+        else \
+            break;
+#define FP_MATCH_CASES_8(offset) \
+    FP_MATCH_CASE(offset) FP_MATCH_CASE(offset + 1) FP_MATCH_CASE(offset + 2) FP_MATCH_CASE(offset + 3) \
+    FP_MATCH_CASE(offset + 4) FP_MATCH_CASE(offset + 5) FP_MATCH_CASE(offset + 6) FP_MATCH_CASE(offset + 7)
+
+template <typename R, std::size_t base, typename F, typename... variant_types>
+__attribute__((always_inline)) constexpr R match_switch(std::size_t flat_index, F&& f, variant_types&&... vs)
+{
+    constexpr std::size_t combinations = (variant_size_v<variant_types> * ... * 1);
+    switch (flat_index - base)
+    {
+        FP_MATCH_CASES_8(0)
+        FP_MATCH_CASES_8(8)
+        FP_MATCH_CASES_8(16)
+        FP_MATCH_CASES_8(24)
+        default:
+            break;
+    }
+    if constexpr (base + 32 < combinations)
+        return match_switch<R, base + 32>(flat_index, std::forward<F>(f), std::forward<variant_types>(vs)...);
+    else
+        __builtin_unreachable();
+}
+
+#undef FP_MATCH_CASES_8
+#undef FP_MATCH_CASE
+} // namespace detail
+
+// visit. Drop in for std::visit: call f with the alternatives held by each of
+// the variants, and return its result directly (the cases may return different
+// types with a common type). Dispatch is one switch over the combined index of
+// all of the variants, so multi variant (double) dispatch costs the same single
+// jump as one variant. The dispatch is always inlined, so the cases inline into
+// the caller. Usable in constexpr code. Throws
+// std::bad_variant_access for a variant without a value
+template <typename F, typename... variant_types>
+__attribute__((always_inline)) constexpr decltype(auto) visit(F&& f, variant_types&&... vs)
+{
+    constexpr std::size_t combinations = (detail::variant_size_v<variant_types> * ... * 1);
+    using R = typename detail::match_result<F, std::make_index_sequence<combinations>, variant_types...>::type;
+    if ((vs.valueless_by_exception() || ...))
+        throw std::bad_variant_access();
+    std::size_t flat_index = 0;
+    ((flat_index = flat_index * detail::variant_size_v<variant_types> + vs.index()), ...);
+    return detail::match_switch<R, 0>(flat_index, std::forward<F>(f), std::forward<variant_types>(vs)...);
+}
+
+namespace detail
+{
+// The callable returned by match. Lvalue variants are held by reference and
+// rvalue variants by value. A stored matcher is called as an lvalue, and
+// visits its variants without moving from them; only a temporary matcher
+// (the usual fp::match(v)(cases...)) hands its rvalue variants on by move
+template <typename... variant_types>
+class Matcher
+{
+public:
+    constexpr explicit Matcher(variant_types&&... vs) : m_variants(std::forward<variant_types>(vs)...) {}
+
+    template <typename... case_types>
+    constexpr decltype(auto) operator()(case_types&&... cases) const&
+    {
+        return std::apply([&](auto&... variants) -> decltype(auto)
+        {
+            return fp::visit(overloaded{std::forward<case_types>(cases)...}, variants...);
+        }, m_variants);
+    }
+
+    template <typename... case_types>
+    constexpr decltype(auto) operator()(case_types&&... cases) &&
+    {
+        return std::apply([&](auto&&... variants) -> decltype(auto)
+        {
+            return fp::visit(overloaded{std::forward<case_types>(cases)...},
+                             std::forward<decltype(variants)>(variants)...);
+        }, std::move(m_variants));
+    }
+
+private:
+    std::tuple<variant_types...> m_variants;
+};
+} // namespace detail
+
+// match. Pattern matching syntax over visit: the variants come first and the
+// cases (one lambda per alternative, or generic ones) after. As with visit,
+// the cases may return different types; the result is their common type.
+// Lvalue variants are held by reference, rvalue variants are moved into the
+// matcher, so fp::match(make_shape()) can be stored and called later, as many
+// times as needed
+// Example: fp::match(shape)([](const Shape::circle& c){ return ...; },
+//                           [](const Shape::square& s){ return ...; })
+template <typename... variant_types>
+constexpr auto match(variant_types&&... vs)
+{
+    return detail::Matcher<variant_types...>(std::forward<variant_types>(vs)...);
+}
+} // namespace fp
+
+//////////////////////////////////////////////////////////////////////////////
+// Pattern Matching using ADT
+//////////////////////////////////////////////////////////////////////////////
+
+// Compute the area of any of the allowable shapes
+// Pattern matching is used to determine which area computation to use, 
+// depending on the shape. Each case returns its area, and fp::match returns
+// the result of whichever case matched
+double compute_area(const adt_shape& shape)
+{
+    return fp::match(shape)(
+        [](const Shape::circle& circle) { 
+            return M_PI * pow(circle.radius, 2.0); },
+        [](const Shape::square& square) { 
+            return pow(square.side, 2.0); },
+        [](const Shape::rectangle& rectangle) { 
+            return rectangle.length * rectangle.width; },
+        [](const Shape::ellipse& ellipse) { 
+            return M_PI * ellipse.axis_1 * ellipse.axis_2; },
+        [](const Shape::cylinder& cylinder) { 
+            return 2 * M_PI * cylinder.radius * 
+                (cylinder.radius + cylinder.height); }
+    );
+}
+
+namespace fp::detail
+{
+// Metrics of each alternative on its own, for code which has already matched
+// the shape. Areas use the same formulas as compute_area
+inline double shape_area(const Shape::circle& circle) { return M_PI * (circle.radius * circle.radius); }
+inline double shape_area(const Shape::square& square) { return square.side * square.side; }
+inline double shape_area(const Shape::rectangle& rectangle) { return rectangle.length * rectangle.width; }
+inline double shape_area(const Shape::ellipse& ellipse) { return M_PI * ellipse.axis_1 * ellipse.axis_2; }
+inline double shape_area(const Shape::cylinder& cylinder)
+{
+    return 2 * M_PI * cylinder.radius * (cylinder.radius + cylinder.height);
+}
+
+// The perimeter (circumference) of the flat shapes. An ellipse has no closed
+// form, so Ramanujan's second approximation is used (exact for a circle).
+// A cylinder's is the circumference of its base
+inline double shape_perimeter(const Shape::circle& circle) { return 2 * M_PI * circle.radius; }
+inline double shape_perimeter(const Shape::square& square) { return 4 * square.side; }
+inline double shape_perimeter(const Shape::rectangle& rectangle) { return 2 * (rectangle.length + rectangle.width); }
+inline double shape_perimeter(const Shape::ellipse& ellipse)
+{
+    double sum = ellipse.axis_1 + ellipse.axis_2;
+    if (sum == 0)
+        return 0;
+    double h = (ellipse.axis_1 - ellipse.axis_2) * (ellipse.axis_1 - ellipse.axis_2) / (sum * sum);
+    return M_PI * sum * (1 + 3 * h / (10 + std::sqrt(4 - 3 * h)));
+}
+inline double shape_perimeter(const Shape::cylinder& cylinder) { return 2 * M_PI * cylinder.radius; }
+
+// Only a cylinder has a volume. The flat shapes have none
+template <typename shape_type>
+double shape_volume(const shape_type&) { return 0.0; }
+inline double shape_volume(const Shape::cylinder& cylinder)
+{
+    return M_PI * cylinder.radius * cylinder.radius * cylinder.height;
+}
+} // namespace fp::detail
+
+// Compute the perimeter (circumference) of any of the allowable shapes
+double compute_perimeter(const adt_shape& shape)
+{
+    return fp::visit([](const auto& alternative) { return fp::detail::shape_perimeter(alternative); }, shape);
+}
+
+// Compute the volume of any of the allowable shapes (0 for the flat ones)
+double compute_volume(const adt_shape& shape)
+{
+    return fp::visit([](const auto& alternative) { return fp::detail::shape_volume(alternative); }, shape);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Columnar shape store. Struct of arrays layout for batches of shapes
+//////////////////////////////////////////////////////////////////////////////
+
+namespace fp::detail
+{
+// Rebuild the shapes held by a columnar store (ShapeColumns or a view of a
+// shape file), in the order they were added, onto the end of shapes
+template <typename shape_columns, typename allocator_type>
+void append_shapes(const shape_columns& columns, std::vector<adt_shape, allocator_type>& shapes)
+{
+    std::size_t next[std::variant_size_v<adt_shape>] = {};
+    for (uint8_t tag : columns.tags())
+    {
+        std::size_t i = next[tag]++;
+        switch (tag)
+        {
+        case 0: shapes.push_back(Shape::circle{columns.circles().radius[i]}); break;
+        case 1: shapes.push_back(Shape::square{columns.squares().side[i]}); break;
+        case 2: shapes.push_back(Shape::rectangle{columns.rectangles().length[i], columns.rectangles().width[i]}); break;
+        case 3: shapes.push_back(Shape::ellipse{columns.ellipses().axis_1[i], columns.ellipses().axis_2[i]}); break;
+        default: shapes.push_back(Shape::cylinder{columns.cylinders().radius[i], columns.cylinders().height[i]}); break;
+        }
+    }
+}
+} // namespace fp::detail
+
+// ShapeColumns. Stores a batch of adt_shape values with one contiguous array
+// per field of each alternative, and a one byte tag per shape which records
+// the order the shapes were added in. A shape takes its own fields plus the
+// tag, instead of the size of the largest alternative.
+// The columns can take their memory from a std::pmr::memory_resource, such as
+// an fp::Arena which frees a whole batch of shapes at once
+class ShapeColumns
+{
+public:
+    using column = fp::detail::resource_vector<double>;
+    struct circle_columns { column radius; };
+    struct square_columns { column side; };
+    struct rectangle_columns { column length; column width; };
+    struct ellipse_columns { column axis_1; column axis_2; };
+    struct cylinder_columns { column radius; column height; };
+
+    ShapeColumns() = default;
+
+    template <typename allocator_type>
+    explicit ShapeColumns(const std::vector<adt_shape, allocator_type>& shapes)
+    {
+        add_all(shapes);
+    }
+
+#if __has_include(<memory_resource>)
+    explicit ShapeColumns(std::pmr::memory_resource* resource)
+        : m_tags(resource), m_circles{column(resource)}, m_squares{column(resource)},
+          m_rectangles{column(resource), column(resource)}, m_ellipses{column(resource), column(resource)},
+          m_cylinders{column(resource), column(resource)}
+    {
+    }
+
+    template <typename allocator_type>
+    ShapeColumns(const std::vector<adt_shape, allocator_type>& shapes, std::pmr::memory_resource* resource)
+        : ShapeColumns(resource)
+    {
+        add_all(shapes);
+    }
+#endif
+
+    // Add a shape. The variant is matched once here, never again when computing
+    void push_back(const adt_shape& shape)
+    {
+        m_tags.push_back(static_cast<uint8_t>(shape.index()));
+        std::visit(overloaded
+        {
+            [this](const Shape::circle& circle) {
+                m_circles.radius.push_back(circle.radius); },
+            [this](const Shape::square& square) {
+                m_squares.side.push_back(square.side); },
+            [this](const Shape::rectangle& rectangle) {
+                m_rectangles.length.push_back(rectangle.length);
+                m_rectangles.width.push_back(rectangle.width); },
+            [this](const Shape::ellipse& ellipse) {
+                m_ellipses.axis_1.push_back(ellipse.axis_1);
+                m_ellipses.axis_2.push_back(ellipse.axis_2); },
+            [this](const Shape::cylinder& cylinder) {
+                m_cylinders.radius.push_back(cylinder.radius);
+                m_cylinders.height.push_back(cylinder.height); }
+        }, shape);
+    }
+
+    // Rebuild the shapes, in the order they were added, in memory from allocator
+    template <typename allocator_type = std::allocator<adt_shape>>
+    std::vector<adt_shape, allocator_type> to_shapes(const allocator_type& allocator = allocator_type{}) const
+    {
+        std::vector<adt_shape, allocator_type> shapes(allocator);
+        shapes.reserve(size());
+        fp::detail::append_shapes(*this, shapes);
+        return shapes;
+    }
+
+    std::size_t size() const { return m_tags.size(); }
+
+    // Remove every shape. The columns keep their memory resource
+    void clear()
+    {
+        for (column* field : {&m_circles.radius, &m_squares.side, &m_rectangles.length, &m_rectangles.width,
+                              &m_ellipses.axis_1, &m_ellipses.axis_2, &m_cylinders.radius, &m_cylinders.height})
+            field->clear();
+        m_tags.clear();
+    }
+
+    // Variant index of every shape, in the order they were added
+    const fp::detail::resource_vector<uint8_t>& tags() const { return m_tags; }
+    const circle_columns& circles() const { return m_circles; }
+    const square_columns& squares() const { return m_squares; }
+    const rectangle_columns& rectangles() const { return m_rectangles; }
+    const ellipse_columns& ellipses() const { return m_ellipses; }
+    const cylinder_columns& cylinders() const { return m_cylinders; }
+
+private:
+    template <typename allocator_type>
+    void add_all(const std::vector<adt_shape, allocator_type>& shapes)
+    {
+        m_tags.reserve(shapes.size());
+        for (const auto& shape : shapes)
+            push_back(shape);
+    }
+
+    fp::detail::resource_vector<uint8_t> m_tags;
+    circle_columns m_circles;
+    square_columns m_squares;
+    rectangle_columns m_rectangles;
+    ellipse_columns m_ellipses;
+    cylinder_columns m_cylinders;
+};
+
+// compute_areas. Compute the area of every shape in a batch, in the order the
+// shapes were added. Each alternative's columns run through their own vector
+// kernel (same formulas as compute_area), then the tag column puts the results
+// back in order without any branching per shape. Works on a ShapeColumns, and
+// on a segment of a mapped shape file, which has the same columns
+template <typename shape_columns>
+void compute_areas(const shape_columns& shapes, double* areas)
+{
+    const auto& circles = shapes.circles();
+    const auto& squares = shapes.squares();
+    const auto& rectangles = shapes.rectangles();
+    const auto& ellipses = shapes.ellipses();
+    const auto& cylinders = shapes.cylinders();
+
+    // Areas grouped by alternative, in the order of the variant. The buffer is
+    // kept per thread, so repeated batches do not allocate
+    thread_local std::vector<double> grouped;
+    if (grouped.size() < shapes.size())
+        grouped.resize(shapes.size());
+    double* group[std::variant_size_v<adt_shape>];
+    group[0] = grouped.data();
+    group[1] = group[0] + circles.radius.size();
+    group[2] = group[1] + squares.side.size();
+    group[3] = group[2] + rectangles.length.size();
+    group[4] = group[3] + ellipses.axis_1.size();
+
+    fp::detail::transform_contiguous(circles.radius.data(), circles.radius.data(), group[0],
+        circles.radius.size(), [](auto& area, const auto& radius, const auto&)
+            __attribute__((always_inline)) { area = M_PI * (radius * radius); });
+    fp::detail::transform_contiguous(squares.side.data(), squares.side.data(), group[1],
+        squares.side.size(), [](auto& area, const auto& side, const auto&)
+            __attribute__((always_inline)) { area = side * side; });
+    fp::detail::transform_contiguous(rectangles.length.data(), rectangles.width.data(), group[2],
+        rectangles.length.size(), [](auto& area, const auto& length, const auto& width)
+            __attribute__((always_inline)) { area = length * width; });
+    fp::detail::transform_contiguous(ellipses.axis_1.data(), ellipses.axis_2.data(), group[3],
+        ellipses.axis_1.size(), [](auto& area, const auto& axis_1, const auto& axis_2)
+            __attribute__((always_inline)) { area = M_PI * axis_1 * axis_2; });
+    fp::detail::transform_contiguous(cylinders.radius.data(), cylinders.height.data(), group[4],
+        cylinders.radius.size(), [](auto& area, const auto& radius, const auto& height)
+            __attribute__((always_inline)) { area = 2 * M_PI * radius * (radius + height); });
+
+    // Scatter back to the original order
+    const uint8_t* tags = shapes.tags().data();
+    for (std::size_t i = 0; i < shapes.size(); i++)
+        areas[i] = *group[tags[i]]++;
+}
+
+std::vector<double> compute_areas(const ShapeColumns& shapes)
+{
+    std::vector<double> areas(shapes.size());
+    compute_areas(shapes, areas.data());
+    return areas;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Shape analytics. Several metrics per shape in one pass, totals per alternative
+//////////////////////////////////////////////////////////////////////////////
+
+namespace fp
+{
+// Metrics analyze_shapes can compute. Combine them with |
+enum class shape_metric : unsigned
+{
+    none = 0,
+    area = 1,
+    perimeter = 2,
+    volume = 4,
+    all = 7
+};
+
+constexpr shape_metric operator|(shape_metric a, shape_metric b) { return shape_metric(unsigned(a) | unsigned(b)); }
+constexpr bool has_metric(shape_metric set, shape_metric metric) { return (unsigned(set) & unsigned(metric)) != 0; }
+
+// Number of buckets in a shape histogram. Bucket i counts the shapes whose
+// metric is in [2^(i - 32), 2^(i - 31)), and the outer buckets also count the
+// values below and above that range (bucket 0 counts zeros)
+constexpr std::size_t shape_histogram_buckets = 64;
+
+// Totals for the shapes of one alternative
+struct shape_group_totals
+{
+    std::size_t count = 0;
+    double area = 0;
+    double perimeter = 0;
+    double volume = 0;
+    std::array<std::size_t, shape_histogram_buckets> histogram{};
+
+    void merge(const shape_group_totals& other)
+    {
+        count += other.count;
+        area += other.area;
+        perimeter += other.perimeter;
+        volume += other.volume;
+        for (std::size_t bucket = 0; bucket < shape_histogram_buckets; bucket++)
+            histogram[bucket] += other.histogram[bucket];
+    }
+};
+
+// ShapeReport. The result of analyze_shapes, as a struct of arrays
+struct ShapeReport
+{
+    // One value per shape, in the order of the input. Metrics which were not
+    // requested are left empty
+    std::vector<double> area;
+    std::vector<double> perimeter;
+    std::vector<double> volume;
+    // Totals per alternative, in the order of the variant (circle, square, ...)
+    std::array<shape_group_totals, std::variant_size_v<adt_shape>> groups;
+};
+
+struct shape_report_options
+{
+    shape_metric metrics = shape_metric::all;
+    // Metric counted in the histograms. It is always computed, and returned
+    // per shape too, even when it is not in metrics
+    shape_metric histogram_metric = shape_metric::area;
+    // Whether to return the per shape values, or only the totals
+    bool per_shape = true;
+    parallel_options parallel;
+};
+
+namespace detail
+{
+struct shape_values
+{
+    double area = 0;
+    double perimeter = 0;
+    double volume = 0;
+};
+
+// The bucket is the base 2 exponent, read from the bits of the double (what
+// std::ilogb returns for normal numbers, without the library call)
+inline std::size_t shape_histogram_bucket(double value)
+{
+    if (!(value > 0))
+        return 0;
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    int bucket = int((bits >> 52) & 0x7ff) - 1023 + 32;
+    return std::size_t(std::clamp(bucket, 0, int(shape_histogram_buckets) - 1));
+}
+
+// Each chunk of the input adds into its own totals, which are merged in chunk order
+using shape_groups = std::array<shape_group_totals, std::variant_size_v<adt_shape>>;
+
+// analyze_shapes for one set of metrics, known at compile time, so the one
+// visit per shape computes exactly the requested metrics with no tests
+template <unsigned metrics>
+ShapeReport analyze_shapes_with(const adt_shape* shapes, std::size_t count, const shape_report_options& options)
+{
+    constexpr bool want_area = (metrics & unsigned(shape_metric::area)) != 0;
+    constexpr bool want_perimeter = (metrics & unsigned(shape_metric::perimeter)) != 0;
+    constexpr bool want_volume = (metrics & unsigned(shape_metric::volume)) != 0;
+
+    ShapeReport report;
+    if (options.per_shape)
+    {
+        report.area.resize(want_area ? count : 0);
+        report.perimeter.resize(want_perimeter ? count : 0);
+        report.volume.resize(want_volume ? count : 0);
+    }
+    ThreadPool& pool = options.parallel.pool ? *options.parallel.pool : ThreadPool::shared();
+    std::size_t chunks = parallel_chunk_count(count, options.parallel, pool);
+    std::vector<shape_groups> partials(chunks);
+    pool.parallel_for(chunks, [&](std::size_t chunk)
+    {
+        shape_groups& groups = partials[chunk];
+        for (std::size_t i = chunk * count / chunks; i < (chunk + 1) * count / chunks; i++)
+        {
+            shape_values values = fp::visit([](const auto& alternative)
+            {
+                shape_values result;
+                if constexpr (want_area)
+                    result.area = shape_area(alternative);
+                if constexpr (want_perimeter)
+                    result.perimeter = shape_perimeter(alternative);
+                if constexpr (want_volume)
+                    result.volume = shape_volume(alternative);
+                return result;
+            }, shapes[i]);
+
+            if (options.per_shape)
+            {
+                if constexpr (want_area)
+                    report.area[i] = values.area;
+                if constexpr (want_perimeter)
+                    report.perimeter[i] = values.perimeter;
+                if constexpr (want_volume)
+                    report.volume[i] = values.volume;
+            }
+            shape_group_totals& group = groups[shapes[i].index()];
+            group.count++;
+            group.area += values.area;
+            group.perimeter += values.perimeter;
+            group.volume += values.volume;
+            double histogram_value = (options.histogram_metric == shape_metric::perimeter) ? values.perimeter
+                                   : (options.histogram_metric == shape_metric::volume) ? values.volume
+                                   : values.area;
+            group.histogram[shape_histogram_bucket(histogram_value)]++;
+        }
+    });
+    for (const shape_groups& groups : partials)
+    {
+        for (std::size_t alternative = 0; alternative < groups.size(); alternative++)
+            report.groups[alternative].merge(groups[alternative]);
+    }
+    return report;
+}
+
+template <unsigned... metric_sets>
+ShapeReport analyze_shapes_dispatch(unsigned metrics, const adt_shape* shapes, std::size_t count,
+                                    const shape_report_options& options,
+                                    std::integer_sequence<unsigned, metric_sets...>)
+{
+    using analyzer = ShapeReport (*)(const adt_shape*, std::size_t, const shape_report_options&);
+    static constexpr analyzer analyzers[] = {&analyze_shapes_with<metric_sets>...};
+    return analyzers[metrics](shapes, count, options);
+}
+} // namespace detail
+
+// analyze_shapes. Compute the requested metrics of every shape, and their
+// totals and histograms per alternative, in one pass with one visit per shape.
+// The list is split into chunks on the thread pool. Each chunk keeps its own
+// totals, and they are merged in list order at the end, so the totals depend
+// on the chunking but never on the timing of the threads
+template <typename allocator_type>
+ShapeReport analyze_shapes(const std::vector<adt_shape, allocator_type>& shapes, shape_report_options options = {})
+{
+    if (options.histogram_metric != shape_metric::perimeter && options.histogram_metric != shape_metric::volume)
+        options.histogram_metric = shape_metric::area;
+    unsigned metrics = unsigned(options.metrics | options.histogram_metric) & unsigned(shape_metric::all);
+    return detail::analyze_shapes_dispatch(metrics, shapes.data(), shapes.size(), options,
+                                           std::make_integer_sequence<unsigned, unsigned(shape_metric::all) + 1>{});
+}
+} // namespace fp
+
+//////////////////////////////////////////////////////////////////////////////
+// Shape files. A binary columnar format for adt_shape, read in place
+//////////////////////////////////////////////////////////////////////////////
+
+#if __has_include(<sys/mman.h>)
+namespace fp
+{
+// Shape file layout (version 1, native byte order):
+//     file header      magic, version, byte order mark, segment and shape counts
+//     segments         one after another, each starting on a 64 byte boundary
+// A segment holds one batch of shapes:
+//     segment header   shape count, size in bytes, and the offset index: where
+//                      each column starts (from the start of the segment) and
+//                      how many elements it holds
+//     columns          the tag column (the variant index of each shape, one
+//                      byte each), then one column of doubles per field of each
+//                      Shape:: alternative, in the order of the variant. Each
+//                      column starts on a 64 byte boundary
+// Segments are what make appending possible: a writer adds new segments after
+// the last one, and only then updates the counts in the file header, so a
+// reader never sees a partly written segment
+namespace detail
+{
+constexpr char shape_file_magic[8] = {'F', 'P', 'S', 'H', 'A', 'P', 'E', 'S'};
+constexpr uint32_t shape_file_version = 1;
+constexpr uint32_t shape_file_byte_order = 0x01020304;
+constexpr std::size_t shape_file_alignment = 64;
+// The tag column and the 8 field columns
+constexpr std::size_t shape_file_columns = 9;
+
+struct shape_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t segment_count;
+    uint64_t shape_count;
+    uint64_t reserved[4];
+};
+
+struct shape_column_entry
+{
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct shape_segment_header
+{
+    uint64_t shape_count;
+    uint64_t bytes;
+    shape_column_entry columns[shape_file_columns];
+};
+
+constexpr std::size_t align_to_file(std::size_t bytes)
+{
+    return (bytes + shape_file_alignment - 1) / shape_file_alignment * shape_file_alignment;
+}
+
+constexpr std::size_t first_segment_offset = align_to_file(sizeof(shape_file_header));
+
+inline void check_shape_file_header(const shape_file_header& header, const std::string& path)
+{
+    if (std::memcmp(header.magic, shape_file_magic, sizeof(shape_file_magic)) != 0)
+        throw std::runtime_error(path + " is not a shape file");
+    if (header.version != shape_file_version)
+        throw std::runtime_error(path + " is shape file version " + std::to_string(header.version)
+                                 + ", only version " + std::to_string(shape_file_version) + " is supported");
+    if (header.byte_order != shape_file_byte_order)
+        throw std::runtime_error(path + " was written with a different byte order");
+}
+
+// Write all of a buffer at offset, however many calls it takes
+inline void write_all(int fd, const void* data, std::size_t bytes, std::size_t offset, const std::string& path)
+{
+    const char* next = static_cast<const char*>(data);
+    while (bytes != 0)
+    {
+        ssize_t written = ::pwrite(fd, next, bytes, off_t(offset));
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            throw std::system_error(errno, std::generic_category(), "write " + path);
+        next += written;
+        offset += std::size_t(written);
+        bytes -= std::size_t(written);
+    }
+}
+} // namespace detail
+
+// column_view. A read only array inside a mapped file
+template <typename T>
+class column_view
+{
+public:
+    column_view() = default;
+    column_view(const T* data, std::size_t size) : m_data(data), m_size(size) {}
+
+    const T* data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+    const T& operator[](std::size_t index) const { return m_data[index]; }
+    const T* begin() const { return m_data; }
+    const T* end() const { return m_data + m_size; }
+
+private:
+    const T* m_data = nullptr;
+    std::size_t m_size = 0;
+};
+
+// ShapeSegmentView. One segment of a mapped shape file, with the same
+// accessors as ShapeColumns, so compute_areas runs on it directly
+class ShapeSegmentView
+{
+public:
+    struct circle_columns { column_view<double> radius; };
+    struct square_columns { column_view<double> side; };
+    struct rectangle_columns { column_view<double> length; column_view<double> width; };
+    struct ellipse_columns { column_view<double> axis_1; column_view<double> axis_2; };
+    struct cylinder_columns { column_view<double> radius; column_view<double> height; };
+
+    // segment points at a segment header which has been checked against the file
+    explicit ShapeSegmentView(const unsigned char* segment)
+    {
+        detail::shape_segment_header header;
+        std::memcpy(&header, segment, sizeof(header));
+        auto column = [&](std::size_t index) {
+            return column_view<double>(reinterpret_cast<const double*>(segment + header.columns[index].offset),
+                                       header.columns[index].count); };
+        m_tags = column_view<uint8_t>(segment + header.columns[0].offset, header.columns[0].count);
+        m_circles = {column(1)};
+        m_squares = {column(2)};
+        m_rectangles = {column(3), column(4)};
+        m_ellipses = {column(5), column(6)};
+        m_cylinders = {column(7), column(8)};
+    }
+
+    std::size_t size() const { return m_tags.size(); }
+    const column_view<uint8_t>& tags() const { return m_tags; }
+    const circle_columns& circles() const { return m_circles; }
+    const square_columns& squares() const { return m_squares; }
+    const rectangle_columns& rectangles() const { return m_rectangles; }
+    const ellipse_columns& ellipses() const { return m_ellipses; }
+    const cylinder_columns& cylinders() const { return m_cylinders; }
+
+private:
+    column_view<uint8_t> m_tags;
+    circle_columns m_circles;
+    square_columns m_squares;
+    rectangle_columns m_rectangles;
+    ellipse_columns m_ellipses;
+    cylinder_columns m_cylinders;
+};
+
+// ShapeFileView. A shape file mapped read only. Opening it checks the header,
+// every offset index and every tag, so a damaged file throws here rather than
+// being read out of bounds later. After that nothing is parsed, copied or
+// allocated: each segment is a set of column_views into the mapping
+class ShapeFileView
+{
+public:
+    explicit ShapeFileView(const std::string& path, access_hint hint = access_hint::sequential)
+        : m_file(path, hint)
+    {
+        if (m_file.size() < sizeof(detail::shape_file_header))
+            throw std::runtime_error(path + " is not a shape file");
+        std::memcpy(&m_header, m_file.data(), sizeof(m_header));
+        detail::check_shape_file_header(m_header, path);
+        check_segments(path);
+    }
+
+    std::size_t size() const { return m_header.shape_count; }
+    std::size_t segment_count() const { return m_header.segment_count; }
+
+    // Call f(const ShapeSegmentView&) for each segment, in file order
+    template <typename F>
+    void for_each_segment(F f) const
+    {
+        std::size_t offset = detail::first_segment_offset;
+        for (uint64_t segment = 0; segment < m_header.segment_count; segment++)
+        {
+            ShapeSegmentView view(m_file.data() + offset);
+            f(view);
+            offset += segment_bytes(offset);
+        }
+    }
+
+    // Rebuild every shape in the file, in order, in memory from allocator
+    template <typename allocator_type = std::allocator<adt_shape>>
+    std::vector<adt_shape, allocator_type> to_shapes(const allocator_type& allocator = allocator_type{}) const
+    {
+        std::vector<adt_shape, allocator_type> shapes(allocator);
+        shapes.reserve(size());
+        for_each_segment([&](const ShapeSegmentView& segment) { detail::append_shapes(segment, shapes); });
+        return shapes;
+    }
+
+private:
+    std::size_t segment_bytes(std::size_t offset) const
+    {
+        uint64_t bytes;
+        std::memcpy(&bytes, m_file.data() + offset + offsetof(detail::shape_segment_header, bytes), sizeof(bytes));
+        return std::size_t(bytes);
+    }
+
+    void check_segments(const std::string& path)
+    {
+        auto damaged = [&path]{ return std::runtime_error(path + " is a damaged shape file"); };
+        constexpr std::size_t field_columns[std::variant_size_v<adt_shape>][2] = {{1, 1}, {2, 2}, {3, 4}, {5, 6}, {7, 8}};
+        // Every segment holds at least its own header, and its columns start after it
+        constexpr std::size_t min_segment_bytes = detail::align_to_file(sizeof(detail::shape_segment_header));
+        std::size_t offset = detail::first_segment_offset;
+        if (m_header.segment_count != 0
+            && (m_file.size() < offset || m_header.segment_count > (m_file.size() - offset) / min_segment_bytes))
+            throw damaged();
+        uint64_t shapes = 0;
+        for (uint64_t segment = 0; segment < m_header.segment_count; segment++)
+        {
+            detail::shape_segment_header header;
+            if (offset > m_file.size() || m_file.size() - offset < sizeof(header))
+                throw damaged();
+            std::memcpy(&header, m_file.data() + offset, sizeof(header));
+            if (header.bytes < min_segment_bytes || header.bytes > m_file.size() - offset
+                || header.bytes % detail::shape_file_alignment != 0 || header.columns[0].count != header.shape_count)
+                throw damaged();
+            for (std::size_t column = 0; column < detail::shape_file_columns; column++)
+            {
+                std::size_t element_size = (column == 0) ? 1 : sizeof(double);
+                const auto& entry = header.columns[column];
+                if (entry.offset % detail::shape_file_alignment != 0 || entry.offset < min_segment_bytes
+                    || entry.offset > header.bytes || entry.count > (header.bytes - entry.offset) / element_size)
+                    throw damaged();
+            }
+            // Every tag names an alternative, and each alternative has as many
+            // fields in its columns as it has tags
+            uint64_t tag_counts[std::variant_size_v<adt_shape>] = {};
+            const unsigned char* tags = m_file.data() + offset + header.columns[0].offset;
+            for (uint64_t i = 0; i < header.shape_count; i++)
+            {
+                if (tags[i] >= std::variant_size_v<adt_shape>)
+                    throw damaged();
+                tag_counts[tags[i]]++;
+            }
+            for (std::size_t alternative = 0; alternative < std::variant_size_v<adt_shape>; alternative++)
+                for (std::size_t column : field_columns[alternative])
+                    if (header.columns[column].count != tag_counts[alternative])
+                        throw damaged();
+            shapes += header.shape_count;
+            offset += header.bytes;
+        }
+        if (shapes != m_header.shape_count)
+            throw damaged();
+        m_end = offset;
+    }
+
+    friend class ShapeFileWriter;
+
+    MappedArray<unsigned char> m_file;
+    detail::shape_file_header m_header;
+    // Where the last whole segment ends
+    std::size_t m_end = 0;
+};
+
+// ShapeFileWriter. Writes shapes to a shape file as they arrive. Shapes are
+// gathered into a ShapeColumns, and written as one segment when segment_shapes
+// have arrived, on flush(), and when the writer is destroyed.
+// With append set, an existing shape file keeps its shapes and new segments
+// go after them (a file which does not exist yet is created)
+class ShapeFileWriter
+{
+public:
+    static constexpr std::size_t default_segment_shapes = 65536;
+
+    explicit ShapeFileWriter(const std::string& path, bool append = false,
+                             std::size_t segment_shapes = default_segment_shapes)
+        : m_file(path, O_RDWR | O_CREAT | (append ? 0 : O_TRUNC)), m_path(path),
+          m_segment_shapes(std::max<std::size_t>(segment_shapes, 1))
+    {
+        struct stat file_status;
+        if (::fstat(m_file.get(), &file_status) != 0)
+            throw std::system_error(errno, std::generic_category(), "fstat " + path);
+        if (file_status.st_size == 0)
+        {
+            std::memcpy(m_header.magic, detail::shape_file_magic, sizeof(m_header.magic));
+            m_header.version = detail::shape_file_version;
+            m_header.byte_order = detail::shape_file_byte_order;
+            write_header();
+            m_end = detail::first_segment_offset;
+            return;
+        }
+        // Appending: carry on after the last whole segment. Anything after it
+        // (a segment cut short by a crash) is written over
+        ShapeFileView existing(path);
+        m_header = existing.m_header;
+        m_end = existing.m_end;
+    }
+
+    // Flush what is left. Errors can not be reported from a destructor, so
+    // call flush() first where they matter
+    ~ShapeFileWriter()
+    {
+        try
+        {
+            flush();
+        }
+        catch (...)
+        {
+        }
+    }
+
+    ShapeFileWriter(const ShapeFileWriter&) = delete;
+    ShapeFileWriter& operator=(const ShapeFileWriter&) = delete;
+
+    void push_back(const adt_shape& shape)
+    {
+        m_pending.push_back(shape);
+        if (m_pending.size() >= m_segment_shapes)
+            flush();
+    }
+
+    // Write a whole batch as one segment, after any shapes still pending
+    void write(const ShapeColumns& shapes)
+    {
+        flush();
+        write_segment(shapes);
+    }
+
+    // Write the pending shapes as a segment
+    void flush()
+    {
+        if (m_pending.size() == 0)
+            return;
+        write_segment(m_pending);
+        m_pending.clear();
+    }
+
+    // Shapes in the file, and still pending
+    std::size_t size() const { return m_header.shape_count + m_pending.size(); }
+
+private:
+    void write_header()
+    {
+        detail::write_all(m_file.get(), &m_header, sizeof(m_header), 0, m_path);
+    }
+
+    // Columns first, then the segment header, then the file header, so the
+    // file header only ever counts whole segments
+    void write_segment(const ShapeColumns& shapes)
+    {
+        if (shapes.size() == 0)
+            return;
+        const ShapeColumns::column* fields[detail::shape_file_columns - 1] = {
+            &shapes.circles().radius, &shapes.squares().side,
+            &shapes.rectangles().length, &shapes.rectangles().width,
+            &shapes.ellipses().axis_1, &shapes.ellipses().axis_2,
+            &shapes.cylinders().radius, &shapes.cylinders().height};
+
+        detail::shape_segment_header header{};
+        header.shape_count = shapes.size();
+        std::size_t offset = detail::align_to_file(sizeof(header));
+        header.columns[0] = {offset, shapes.size()};
+        detail::write_all(m_file.get(), shapes.tags().data(), shapes.size(), m_end + offset, m_path);
+        offset = detail::align_to_file(offset + shapes.size());
+        for (std::size_t field = 0; field < detail::shape_file_columns - 1; field++)
+        {
+            header.columns[field + 1] = {offset, fields[field]->size()};
+            detail::write_all(m_file.get(), fields[field]->data(), fields[field]->size() * sizeof(double),
+                              m_end + offset, m_path);
+            offset = detail::align_to_file(offset + fields[field]->size() * sizeof(double));
+        }
+        header.bytes = offset;
+        // The last column may end short of the boundary. Pad the file out to it,
+        // so the next segment, or the end of the file, is where bytes says
+        if (::ftruncate(m_file.get(), off_t(m_end + offset)) != 0)
+            throw std::system_error(errno, std::generic_category(), "truncate " + m_path);
+        detail::write_all(m_file.get(), &header, sizeof(header), m_end, m_path);
+
+        m_end += offset;
+        m_header.segment_count++;
+        m_header.shape_count += shapes.size();
+        write_header();
+    }
+
+    detail::FileDescriptor m_file;
+    std::string m_path;
+    std::size_t m_segment_shapes;
+    detail::shape_file_header m_header{};
+    std::size_t m_end = 0;
+    ShapeColumns m_pending;
+};
+
+} // namespace fp
+
+// compute_areas over a whole mapped shape file, segment by segment, straight
+// from the mapped columns
+void compute_areas(const fp::ShapeFileView& shapes, double* areas)
+{
+    shapes.for_each_segment([&areas](const fp::ShapeSegmentView& segment) {
+        compute_areas(segment, areas);
+        areas += segment.size(); });
+}
+
+std::vector<double> compute_areas(const fp::ShapeFileView& shapes)
+{
+    std::vector<double> areas(shapes.size());
+    compute_areas(shapes, areas.data());
+    return areas;
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+// Function Currying. Create functions that return functions that can be curried
+//////////////////////////////////////////////////////////////////////////////
+
+namespace fp
+{
+namespace detail
+{
+// Number of parameters of a callable with a single signature (a function, a
+// function pointer, or a class with one non template operator()). -1 for
+// generic lambdas and overloaded function objects, whose arity is unknown
+template <typename F, typename = void> struct function_arity : std::integral_constant<int, -1> {};
+template <typename R, typename... A>
+struct function_arity<R(A...), void> : std::integral_constant<int, int(sizeof...(A))> {};
+template <typename R, typename... A>
+struct function_arity<R(*)(A...), void> : std::integral_constant<int, int(sizeof...(A))> {};
+template <typename C, typename R, typename... A>
+struct function_arity<R(C::*)(A...), void> : std::integral_constant<int, int(sizeof...(A))> {};
+template <typename C, typename R, typename... A>
+struct function_arity<R(C::*)(A...) const, void> : std::integral_constant<int, int(sizeof...(A))> {};
+template <typename C, typename R, typename... A>
+struct function_arity<R(C::*)(A...) noexcept, void> : std::integral_constant<int, int(sizeof...(A))> {};
+template <typename C, typename R, typename... A>
+struct function_arity<R(C::*)(A...) const noexcept, void> : std::integral_constant<int, int(sizeof...(A))> {};
+template <typename F>
+struct function_arity<F, std::void_t<decltype(&F::operator())>> : function_arity<decltype(&F::operator())> {};
+} // namespace detail
+
+// Curried. A function with some of its arguments already bound. Calling it
+// with enough arguments runs the function; calling it with too few binds them
+// and returns another Curried. Everything is stored by value and typed
+// statically, so the call inlines like a plain lambda. When the arity of the
+// function is known, a call with too many arguments, or arguments of the wrong
+// type, is a compile error. A generic function (such as std::plus<>) has no
+// known arity, so any call it can not take binds its arguments
+template <typename F, typename... Bound>
+class Curried
+{
+public:
+    constexpr Curried(F f, std::tuple<Bound...> bound) : m_f(std::move(f)), m_bound(std::move(bound)) {}
+
+    template <typename... Args>
+    constexpr auto operator()(Args&&... args) const
+    {
+        if constexpr (std::is_invocable_v<const F&, const Bound&..., Args&&...>)
+            return std::apply([&](const Bound&... bound) {
+                return std::invoke(m_f, bound..., std::forward<Args>(args)...); }, m_bound);
+        else
+        {
+            constexpr int arity = detail::function_arity<F>::value;
+            static_assert(arity < 0 || int(sizeof...(Bound) + sizeof...(Args)) < arity,
+                          "Curried function called with too many arguments, or with arguments of the wrong type");
+            return Curried<F, Bound..., std::decay_t<Args>...>(
+                m_f, std::tuple_cat(m_bound, std::make_tuple(std::forward<Args>(args)...)));
+        }
+    }
+
+private:
+    F m_f;
+    std::tuple<Bound...> m_bound;
+};
+
+// curry. Turn any function into one which takes its arguments one (or more) at a time
+// Example: curry(f)(a)(b, c) == curry(f)(a, b)(c) == f(a, b, c)
+template <typename F>
+constexpr auto curry(F f)
+{
+    return Curried<F>(std::move(f), std::tuple<>{});
+}
+} // namespace fp
+
+// Curry Function. Create an output lambda function that adds the number
+// passed in from the original with whatever else is used as the output function argument
+template<typename T>
+auto add(T first_in)
+{
+    return [first_in](T second_in) {return first_in + second_in;};
+}
+
+// Use currying to eaily create new functions
+auto inc = add(1.0);
+auto add2 = add(2.0);
+auto add3 = add(3.0);
+
+// Curry Function. Create an output lambda function that multiplies the number
+// passed in from the original with whatever else is used as the output function argument
+template<typename T>
+auto mult(T first_in)
+{
+    return [first_in](T second_in) {return first_in * second_in;};
+}
+
+// Use currying to eaily create new functions
+auto times2 = mult(2.0);
+auto triple = mult(3.0);
+auto quadruple = mult(4.0);
+
+// Curry Function. Create an output lambda function that computes a tip based the number (percentage)
+// passed in from the original with whatever else is used as the output function argument (total)
+auto compute_tip(double tip_percent)
+{
+    return [tip_percent](double subtotal) {return (tip_percent / 100.0) * subtotal;};
+}
+
+// Use currying to eaily create new functions
+auto compute_low_tip = compute_tip(10.0);
+auto compute_avg_tip = compute_tip(15.0);
+auto compute_high_tip = compute_tip(20.0);
+
+//////////////////////////////////////////////////////////////////////////////
+// Function Composition. Fuse a chain of functions into one statically typed functor
+//////////////////////////////////////////////////////////////////////////////
+
+namespace fp
+{
+// Pipeline. Applies its functions left to right: Pipeline(f, g, h)(x) == h(g(f(x)))
+// A pipeline with no functions is the identity. It is one object holding
+// the functions by value, with no std::function or nested lambdas, so the
+// compiler inlines the whole chain into its caller
+template <typename... Fs>
+class Pipeline
+{
+public:
+    constexpr explicit Pipeline(std::tuple<Fs...> functions) : m_functions(std::move(functions)) {}
+
+    template <typename T>
+    constexpr auto operator()(T&& value) const
+    {
+        if constexpr (sizeof...(Fs) == 0)
+            return std::forward<T>(value);
+        else
+            return apply_from<0>(std::forward<T>(value));
+    }
+
+    // pipeline | f adds f to the end, in place of the |> operator C++ does not have
+    template <typename F>
+    constexpr auto operator|(F f) const
+    {
+        return Pipeline<Fs..., F>(std::tuple_cat(m_functions, std::make_tuple(std::move(f))));
+    }
+
+    const std::tuple<Fs...>& functions() const { return m_functions; }
+
+private:
+    template <std::size_t index, typename T>
+    constexpr auto apply_from(T&& value) const
+    {
+        if constexpr (index + 1 == sizeof...(Fs))
+            return std::invoke(std::get<index>(m_functions), std::forward<T>(value));
+        else
+            return apply_from<index + 1>(std::invoke(std::get<index>(m_functions), std::forward<T>(value)));
+    }
+
+    std::tuple<Fs...> m_functions;
+};
+
+namespace detail
+{
+template <typename F>
+constexpr auto pipeline_functions(F f) { return std::make_tuple(std::move(f)); }
+
+template <typename... Fs>
+constexpr auto pipeline_functions(Pipeline<Fs...> pipeline) { return pipeline.functions(); }
+
+template <typename... Ts>
+constexpr Pipeline<Ts...> make_pipeline(std::tuple<Ts...> functions) { return Pipeline<Ts...>(std::move(functions)); }
+} // namespace detail
+
+// pipe. Apply the functions left to right: pipe(inc, times2)(x) == times2(inc(x))
+// Pipelines passed in are flattened, so pipe(pipe(f, g), h) is the same type as pipe(f, g, h).
+// pipe() is the identity pipeline
+template <typename... Fs>
+constexpr auto pipe(Fs... fs)
+{
+    return detail::make_pipeline(std::tuple_cat(detail::pipeline_functions(std::move(fs))...));
+}
+
+// compose. Apply the functions right to left, as in maths (and Haskell's .):
+// compose(f, g)(x) == f(g(x))
+template <typename F>
+constexpr auto compose(F f)
+{
+    return pipe(std::move(f));
+}
+
+template <typename F, typename... Fs>
+constexpr auto compose(F f, Fs... fs)
+{
+    return pipe(compose(std::move(fs)...), std::move(f));
+}
+
+namespace detail
+{
+// Run f over a contiguous array in blocks of a constant size. Each block is
+// copied to the stack before it is mapped, and f is a local copy, so the inner
+// loop has a fixed trip count and its reads can not alias its writes. That is
+// what lets the compiler vectorize it (the input and output may be the same array)
+template <std::size_t block, typename T, typename R, typename F>
+__attribute__((always_inline)) inline void apply_blocked(const T* in, R* out, std::size_t count, F f)
+{
+    const std::size_t block_count = (count / block) * block;
+    for (std::size_t i = 0; i < block_count; i += block)
+    {
+        T lanes[block];
+        std::memcpy(lanes, in + i, sizeof(lanes));
+        for (std::size_t lane = 0; lane < block; lane++)
+            out[i + lane] = f(lanes[lane]);
+    }
+    for (std::size_t i = block_count; i < count; i++)
+        out[i] = f(in[i]);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+template <typename T, typename R, typename F>
+__attribute__((target("avx2"))) void apply_avx2(const T* in, R* out, std::size_t count, const F& f)
+{
+    apply_blocked<64>(in, out, count, f);
+}
+
+template <typename T, typename R, typename F>
+__attribute__((target("sse2"))) void apply_sse(const T* in, R* out, std::size_t count, const F& f)
+{
+    apply_blocked<64>(in, out, count, f);
+}
+#endif
+
+// Pick the widest elementwise loop the running CPU supports
+template <typename T, typename R, typename F>
+void apply_contiguous(const T* in, R* out, std::size_t count, const F& f)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    if (cpu_has_avx2())
+        return apply_avx2(in, out, count, f);
+    return apply_sse(in, out, count, f);
+#else
+    apply_blocked<64>(in, out, count, f);
+#endif
+}
+} // namespace detail
+
+// apply_all. Run a function (typically a fused Pipeline) over a range, writing
+// each result to out. Returns the end of the output, like std::transform.
+// Contiguous arrays of arithmetic types run through the blocked SSE/AVX2 loop
+template <typename input_iterator, typename output_iterator, typename F>
+output_iterator apply_all(input_iterator list_head, input_iterator list_end, output_iterator out, F f)
+{
+    using value_type = typename std::iterator_traits<input_iterator>::value_type;
+    using result_type = std::decay_t<std::invoke_result_t<F&, const value_type&>>;
+    if constexpr (detail::is_contiguous_iterator<input_iterator>
+                  && detail::is_contiguous_iterator<output_iterator>
+                  && std::is_same_v<typename std::iterator_traits<output_iterator>::value_type, result_type>
+                  && std::is_arithmetic_v<value_type> && std::is_arithmetic_v<result_type>)
+    {
+        std::size_t count = static_cast<std::size_t>(list_end - list_head);
+        if (count > 0)
+            detail::apply_contiguous(std::addressof(*list_head), std::addressof(*out), count, f);
+        return out + count;
+    }
+    else
+    {
+        for (; list_head != list_end; ++list_head, ++out)
+            *out = std::invoke(f, *list_head);
+        return out;
+    }
+}
+
+// apply_all over a whole vector, returning the results. The results use the
+// list's own allocator, so a list from an arena gives results in the same arena
+template <typename T, typename allocator_type, typename F>
+auto apply_all(const std::vector<T, allocator_type>& in_list, F f)
+{
+    using result_type = std::decay_t<std::invoke_result_t<F&, const T&>>;
+    using result_allocator = typename std::allocator_traits<allocator_type>::template rebind_alloc<result_type>;
+    std::vector<result_type, result_allocator> out_list(in_list.size(), result_allocator(in_list.get_allocator()));
+    apply_all(in_list.begin(), in_list.end(), out_list.begin(), std::move(f));
+    return out_list;
+}
+} // namespace fp
+
+// A bill pipeline built from the curried functions above: increment, double,
+// then take the average tip. The three lambdas fuse into one functor
+auto avg_tip_pipeline = fp::pipe(inc, times2, compute_avg_tip);
+
+// A three argument function curried with fp::curry. The tip and tax
+// percentages can be bound now and the subtotal supplied later
+auto compute_total = fp::curry([](double tip_percent, double tax_percent, double subtotal)
+{
+    return subtotal * (1.0 + (tip_percent + tax_percent) / 100.0);
+});
+
+//////////////////////////////////////////////////////////////////////////////
+// Fixed point money. Exact decimal amounts, curried pricing, batch rates
+//////////////////////////////////////////////////////////////////////////////
+
+namespace fp
+{
+// How a result between two representable amounts is rounded
+enum class rounding
+{
+    half_even,      // to the nearest, ties to the even amount (banker's rounding)
+    half_up,        // to the nearest, ties away from zero
+    toward_zero,    // truncate
+    away_from_zero  // up in magnitude
+};
+
+namespace detail
+{
+constexpr int64_t power_of_ten(int exponent)
+{
+    int64_t result = 1;
+    for (int i = 0; i < exponent; i++)
+        result *= 10;
+    return result;
+}
+
+// quotient = p / denominator, rounded by mode. Written with ?: and lanewise
+// operators only, so the same code runs on an int64_t and on a vector register
+// of them (passed by reference, to keep vector types out of the calling
+// convention). The denominator is a constant, so the division becomes a multiplication
+template <rounding mode, int64_t denominator, typename V>
+__attribute__((always_inline)) inline void divide_rounded(V& quotient, const V& p)
+{
+    quotient = p / denominator;
+    if constexpr (mode != rounding::toward_zero)
+    {
+        V remainder = p - quotient * denominator;
+        V twice = ((remainder < 0) ? -remainder : remainder) * 2;
+        V away = (p >> 63) | 1;
+        V none{};
+        if constexpr (mode == rounding::away_from_zero)
+            quotient += (remainder != 0) ? away : none;
+        else if constexpr (mode == rounding::half_up)
+            quotient += (twice >= denominator) ? away : none;
+        else
+            quotient += ((twice > denominator) | ((twice == denominator) & ((quotient & 1) != 0))) ? away : none;
+    }
+}
+
+template <rounding mode, int64_t denominator>
+int64_t divide_rounded(int64_t p)
+{
+    int64_t quotient;
+    divide_rounded<mode, denominator>(quotient, p);
+    return quotient;
+}
+} // namespace detail
+
+// Decimal. A fixed point decimal number: a count of 10^-scale units in an int64_t
+// Sums and differences are exact, and products with a rate are rounded once,
+// by an explicit rounding mode, so no rounding error builds up over a batch.
+// The range is +-9.2e18 units (+-92 million billion dollars for Money);
+// arithmetic past it overflows like int64_t
+template <int scale>
+class Decimal
+{
+public:
+    static_assert(scale >= 0 && scale <= 18, "Decimal holds up to 18 decimal places");
+    static constexpr int64_t unit = detail::power_of_ten(scale);
+
+    constexpr Decimal() = default;
+
+    static constexpr Decimal from_units(int64_t units)
+    {
+        Decimal result;
+        result.m_units = units;
+        return result;
+    }
+
+    // The nearest value to a double, for amounts coming from binary floating point
+    static Decimal from_double(double value, rounding mode = rounding::half_even)
+    {
+        double scaled = value * double(unit);
+        double whole = std::trunc(scaled);
+        double fraction = std::fabs(scaled - whole);
+        double away = (scaled < 0) ? -1.0 : 1.0;
+        bool round_away = (mode == rounding::away_from_zero) ? fraction > 0
+                        : (mode == rounding::half_up) ? fraction >= 0.5
+                        : (mode == rounding::half_even) ? (fraction > 0.5 || (fraction == 0.5 && std::fmod(whole, 2.0) != 0))
+                        : false;
+        return from_units(int64_t(round_away ? whole + away : whole));
+    }
+
+    constexpr int64_t units() const { return m_units; }
+    double to_double() const { return double(m_units) / double(unit); }
+
+    // Fixed notation with all of the decimal places, e.g. "-12.05"
+    std::string to_string() const
+    {
+        uint64_t magnitude = (m_units < 0) ? uint64_t(0) - uint64_t(m_units) : uint64_t(m_units);
+        std::string text = std::to_string(magnitude / uint64_t(unit));
+        if constexpr (scale > 0)
+        {
+            std::string fraction = std::to_string(magnitude % uint64_t(unit));
+            text += "." + std::string(std::size_t(scale) - fraction.size(), '0') + fraction;
+        }
+        return (m_units < 0) ? "-" + text : text;
+    }
+
+    constexpr Decimal operator-() const { return from_units(-m_units); }
+    constexpr Decimal operator+(Decimal other) const { return from_units(m_units + other.m_units); }
+    constexpr Decimal operator-(Decimal other) const { return from_units(m_units - other.m_units); }
+    constexpr Decimal operator*(int64_t quantity) const { return from_units(m_units * quantity); }
+    constexpr Decimal& operator+=(Decimal other) { m_units += other.m_units; return *this; }
+    constexpr Decimal& operator-=(Decimal other) { m_units -= other.m_units; return *this; }
+
+    constexpr bool operator==(Decimal other) const { return m_units == other.m_units; }
+    constexpr bool operator!=(Decimal other) const { return m_units != other.m_units; }
+    constexpr bool operator<(Decimal other) const { return m_units < other.m_units; }
+    constexpr bool operator<=(Decimal other) const { return m_units <= other.m_units; }
+    constexpr bool operator>(Decimal other) const { return m_units > other.m_units; }
+    constexpr bool operator>=(Decimal other) const { return m_units >= other.m_units; }
+
+private:
+    int64_t m_units = 0;
+};
+
+template <int scale>
+std::ostream& operator<<(std::ostream& out, const Decimal<scale>& value)
+{
+    return out << value.to_string();
+}
+
+// Money counts cents. A Rate is a fraction with six decimal places, enough
+// for any tax rate in use (8.875% is 0.088750)
+using Money = Decimal<2>;
+using Rate = Decimal<6>;
+
+// A rate given as a percentage, e.g. percent(15.67)
+inline Rate percent(double value)
+{
+    return Rate::from_double(value / 100.0);
+}
+
+// amount * rate, rounded once by mode
+template <int scale, int rate_scale>
+Decimal<scale> apply_rate(Decimal<scale> amount, Decimal<rate_scale> rate, rounding mode = rounding::half_even)
+{
+    constexpr int64_t denominator = Decimal<rate_scale>::unit;
+    int64_t product = amount.units() * rate.units();
+    switch (mode)
+    {
+    case rounding::half_up: return Decimal<scale>::from_units(detail::divide_rounded<rounding::half_up, denominator>(product));
+    case rounding::toward_zero: return Decimal<scale>::from_units(detail::divide_rounded<rounding::toward_zero, denominator>(product));
+    case rounding::away_from_zero: return Decimal<scale>::from_units(detail::divide_rounded<rounding::away_from_zero, denominator>(product));
+    default: return Decimal<scale>::from_units(detail::divide_rounded<rounding::half_even, denominator>(product));
+    }
+}
+
+// What a pricing function returns for an amount: the rated part on its own
+// (a tip, a tax, a discount), the amount plus it, or the amount less it
+enum class rate_kind { portion, plus, minus };
+
+namespace detail
+{
+template <rate_kind kind, typename V>
+__attribute__((always_inline)) inline void combine_rated(V& result, const V& amount, const V& part)
+{
+    if constexpr (kind == rate_kind::plus)
+        result = amount + part;
+    else if constexpr (kind == rate_kind::minus)
+        result = amount - part;
+    else
+        result = part;
+}
+
+// Chunked integer vector loop over an array of amounts (in units). The
+// multiply, the rounding and the combine run lanewise on int64_t registers,
+// and the leftover amounts that do not fill a register run the same code on
+// scalars
+template <std::size_t width, rate_kind kind, rounding mode, int64_t denominator>
+__attribute__((always_inline)) inline void rate_chunked(const int64_t* in, int64_t* out, std::size_t count,
+                                                        int64_t numerator)
+{
+    typedef int64_t lane_vector __attribute__((vector_size(width)));
+    constexpr std::size_t lanes = width / sizeof(int64_t);
+
+    const std::size_t vector_count = (count / lanes) * lanes;
+    for (std::size_t i = 0; i < vector_count; i += lanes)
+    {
+        lane_vector amount, part, result;
+        std::memcpy(&amount, in + i, sizeof(lane_vector));
+        divide_rounded<mode, denominator>(part, lane_vector(amount * numerator));
+        combine_rated<kind>(result, amount, part);
+        std::memcpy(out + i, &result, sizeof(lane_vector));
+    }
+    for (std::size_t i = vector_count; i < count; ++i)
+    {
+        int64_t part = divide_rounded<mode, denominator>(in[i] * numerator);
+        combine_rated<kind>(out[i], in[i], part);
+    }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+template <rate_kind kind, rounding mode, int64_t denominator>
+__attribute__((target("avx2"))) void rate_avx2(const int64_t* in, int64_t* out, std::size_t count, int64_t numerator)
+{
+    rate_chunked<32, kind, mode, denominator>(in, out, count, numerator);
+}
+
+template <rate_kind kind, rounding mode, int64_t denominator>
+__attribute__((target("sse2"))) void rate_sse(const int64_t* in, int64_t* out, std::size_t count, int64_t numerator)
+{
+    rate_chunked<16, kind, mode, denominator>(in, out, count, numerator);
+}
+#endif
+
+// Pick the widest vector loop the running CPU supports
+template <rate_kind kind, rounding mode, int64_t denominator>
+void rate_contiguous(const int64_t* in, int64_t* out, std::size_t count, int64_t numerator)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    if (cpu_has_avx2())
+        return rate_avx2<kind, mode, denominator>(in, out, count, numerator);
+    return rate_sse<kind, mode, denominator>(in, out, count, numerator);
+#else
+    rate_chunked<16, kind, mode, denominator>(in, out, count, numerator);
+#endif
+}
+} // namespace detail
+
+// RateFunction. A pricing function with its rate bound, as returned by the
+// curried builders below. Call it on one amount, or on a whole array, which
+// runs the integer SIMD loop. Products of an amount and a rate (in units)
+// must fit in an int64_t: for Money and Rate, amounts up to about $92 billion
+// (9.2e18 / 10^6 cents) at a rate of 100%
+template <rate_kind kind, int scale = 2, int rate_scale = 6>
+struct RateFunction
+{
+    Decimal<rate_scale> rate;
+    rounding mode = rounding::half_even;
+
+    Decimal<scale> operator()(Decimal<scale> amount) const
+    {
+        int64_t result;
+        detail::combine_rated<kind>(result, amount.units(), apply_rate(amount, rate, mode).units());
+        return Decimal<scale>::from_units(result);
+    }
+
+    // out[i] = (*this)(in[i]) for count amounts. in and out may be the same array
+    void operator()(const Decimal<scale>* in, Decimal<scale>* out, std::size_t count) const
+    {
+        static_assert(sizeof(Decimal<scale>) == sizeof(int64_t) && std::is_trivially_copyable_v<Decimal<scale>>);
+        const int64_t* in_units = reinterpret_cast<const int64_t*>(in);
+        int64_t* out_units = reinterpret_cast<int64_t*>(out);
+        constexpr int64_t denominator = Decimal<rate_scale>::unit;
+        switch (mode)
+        {
+        case rounding::half_up:
+            return detail::rate_contiguous<kind, rounding::half_up, denominator>(in_units, out_units, count, rate.units());
+        case rounding::toward_zero:
+            return detail::rate_contiguous<kind, rounding::toward_zero, denominator>(in_units, out_units, count, rate.units());
+        case rounding::away_from_zero:
+            return detail::rate_contiguous<kind, rounding::away_from_zero, denominator>(in_units, out_units, count, rate.units());
+        default:
+            return detail::rate_contiguous<kind, rounding::half_even, denominator>(in_units, out_units, count, rate.units());
+        }
+    }
+};
+
+// apply_all over a list of amounts with a pricing function, on the integer SIMD loop
+template <rate_kind kind, int scale, int rate_scale, typename allocator_type>
+auto apply_all(const std::vector<Decimal<scale>, allocator_type>& in_list, RateFunction<kind, scale, rate_scale> f)
+{
+    std::vector<Decimal<scale>, allocator_type> out_list(in_list.size(), in_list.get_allocator());
+    f(in_list.data(), out_list.data(), in_list.size());
+    return out_list;
+}
+
+// Curried pricing functions on Money. Like compute_tip, each takes its rate
+// (and rounding mode) now and the amount later
+namespace money
+{
+// The tip, tax or discount on an amount, each rounded to the cent
+inline auto tip(Rate rate, rounding mode = rounding::half_even) { return RateFunction<rate_kind::portion>{rate, mode}; }
+inline auto tax(Rate rate, rounding mode = rounding::half_even) { return RateFunction<rate_kind::portion>{rate, mode}; }
+inline auto discount(Rate rate, rounding mode = rounding::half_even) { return RateFunction<rate_kind::portion>{rate, mode}; }
+
+// The amount with the tax added, and the amount with the discount taken off
+inline auto plus_tax(Rate rate, rounding mode = rounding::half_even) { return RateFunction<rate_kind::plus>{rate, mode}; }
+inline auto less_discount(Rate rate, rounding mode = rounding::half_even) { return RateFunction<rate_kind::minus>{rate, mode}; }
+} // namespace money
+} // namespace fp
+
+// compute_tip on Money: the same curried function, with the tip rounded to the cent
+auto compute_money_tip(double tip_percent)
+{
+    return fp::money::tip(fp::percent(tip_percent));
+}
+
+// compute_total on Money. Tip and tax are each rounded to the cent, as they
+// are printed on a receipt, so the total is exactly the sum of the lines
+auto compute_money_total = fp::curry([](fp::Rate tip_rate, fp::Rate tax_rate, fp::Money subtotal)
+{
+    return subtotal + fp::money::tip(tip_rate)(subtotal) + fp::money::tax(tax_rate)(subtotal);
+});
+
+//////////////////////////////////////////////////////////////////////////////
+// Sequence tables. Numeric sequences computed at compile time
+//////////////////////////////////////////////////////////////////////////////
+
+namespace fp
+{
+// make_sequence_table. The first N terms of a sequence, computed by the
+// compiler. term(terms, n) returns term n given terms 0 to n-1, and handles the
+// starting terms itself. Stored in a constexpr variable, the table is part of
+// the program's read only data, so no process ever computes it again
+template <typename T, std::size_t N, typename Term>
+constexpr std::array<T, N> make_sequence_table(Term term = Term{})
+{
+    std::array<T, N> terms{};
+    for (std::size_t n = 0; n < N; n++)
+        terms[n] = term(terms, n);
+    return terms;
+}
+
+namespace sequence
+{
+// Recurrences. Each works on the compile time table and on the runtime list
+// of terms alike
+struct fibonacci_term
+{
+    template <typename Terms>
+    constexpr uint64_t operator()(const Terms& terms, std::size_t n) const
+    {
+        return (n < 2) ? n : terms[n - 1] + terms[n - 2];
+    }
+};
+
+struct factorial_term
+{
+    template <typename Terms>
+    constexpr uint64_t operator()(const Terms& terms, std::size_t n) const
+    {
+        return (n == 0) ? 1 : terms[n - 1] * n;
+    }
+};
+
+template <uint64_t base>
+struct power_term
+{
+    template <typename Terms>
+    constexpr uint64_t operator()(const Terms& terms, std::size_t n) const
+    {
+        return (n == 0) ? 1 : terms[n - 1] * base;
+    }
+};
+
+// Pascal's triangle stored row after row: row r starts at r * (r + 1) / 2
+struct binomial_term
+{
+    template <typename Terms>
+    constexpr uint64_t operator()(const Terms& terms, std::size_t n) const
+    {
+        std::size_t row = 0;
+        while ((row + 1) * (row + 2) / 2 <= n)
+            row++;
+        std::size_t k = n - row * (row + 1) / 2;
+        if (k == 0 || k == row)
+            return 1;
+        std::size_t above = (row - 1) * row / 2;
+        return terms[above + k - 1] + terms[above + k];
+    }
+};
+
+// Number of powers of base which fit in a uint64_t. Throws
+// std::invalid_argument for a base below 2, which has no largest power
+constexpr std::size_t power_count(uint64_t base)
+{
+    if (base < 2)
+        throw std::invalid_argument("fp::sequence::power_count: base must be at least 2");
+    std::size_t count = 1;
+    for (uint64_t power = 1; power <= std::numeric_limits<uint64_t>::max() / base; power *= base)
+        count++;
+    return count;
+}
+
+template <uint64_t base>
+constexpr auto make_powers_table()
+{
+    static_assert(base >= 2, "fp::sequence::powers needs a base of at least 2");
+    return make_sequence_table<uint64_t, power_count(base), power_term<base>>();
+}
+
+// Every term which fits in a uint64_t
+inline constexpr auto fibonacci = make_sequence_table<uint64_t, 94, fibonacci_term>();
+inline constexpr auto factorial = make_sequence_table<uint64_t, 21, factorial_term>();
+template <uint64_t base>
+inline constexpr auto powers = make_powers_table<base>();
+// Rows 0 to 67 of Pascal's triangle (C(67, 33) is the largest binomial
+// coefficient below 2^64)
+constexpr std::size_t binomial_rows = 68;
+inline constexpr auto binomials = make_sequence_table<uint64_t, binomial_rows * (binomial_rows + 1) / 2, binomial_term>();
+
+// binomial. n choose k, from the table. Throws std::out_of_range past row 67
+constexpr uint64_t binomial(std::size_t n, std::size_t k)
+{
+    if (n >= binomial_rows)
+        throw std::out_of_range("binomial: n choose k does not fit in a uint64_t");
+    return (k > n) ? 0 : binomials[n * (n + 1) / 2 + k];
+}
+} // namespace sequence
+
+// LazySequence. A sequence whose first N terms come from a compile time table,
+// and whose later terms are computed at runtime by the same recurrence, only
+// when asked for and only once (as the Fibonacci class does). Like the
+// Fibonacci class, one LazySequence is not shared between threads
+template <typename T, std::size_t N, typename Term>
+class LazySequence
+{
+public:
+    static constexpr std::array<T, N> table = make_sequence_table<T, N, Term>();
+
+    T get(std::size_t n)
+    {
+        if (n < N)
+            return table[n];
+        if (m_terms.empty())
+            m_terms.assign(table.begin(), table.end());
+        while (m_terms.size() <= n)
+            m_terms.push_back(Term{}(m_terms, m_terms.size()));
+        return m_terms[n];
+    }
+
+private:
+    // Terms past the table, after a copy of the table. Empty until needed
+    std::vector<T> m_terms;
+};
+} // namespace fp
+
+//////////////////////////////////////////////////////////////////////////////
+// Lazy evaluation. Only compute fibonacci sequence when needed and not done before
+//////////////////////////////////////////////////////////////////////////////
+
+// Lazy evaluation must be done explicitly in C++,
+// since it is not part of the language
+// A fibonacci class performs a lazy evaluation of the fibonacci sequence
+class Fibonacci
+{
+public: 
+    Fibonacci() = default;
+
+#if __has_include(<memory_resource>)
+    // The stored sequence takes its memory from resource
+    explicit Fibonacci(std::pmr::memory_resource* resource) : m_fibonacci(resource) {}
+#endif
+
+    // when a fibonacci number is requested, it will either be returned (if previously computed)
+    // or the function will add fibonacci numbers to the stored sequence until it computes the number
+    // This prevents any computation until necessary, and recpomputation
+    // Every number which fits in a uint64_t is already in a table built at
+    // compile time (see Sequence tables), so only numbers past it are computed.
+    // The recursion runs on a trampoline (see Trampolines), so the stack stays
+    // flat however many numbers have to be added
+    uint64_t get_fib_num(uint16_t fib_index)
+    {
+        if (fib_index < fp::sequence::fibonacci.size())
+            return fp::sequence::fibonacci[fib_index];
+        if (m_fibonacci.empty())
+            m_fibonacci.assign(fp::sequence::fibonacci.begin(), fp::sequence::fibonacci.end());
+        return get_fib_step(fib_index).run();
+    }
+private:
+    // One step of get_fib_num. Each step and each newly added number is traced
+    // (see Instrumentation), so a trace report shows how much computation the
+    // lookups needed
+    fp::trampoline<uint64_t> get_fib_step(uint16_t fib_index)
+    {
+        FP_TRACE_SCOPE("Fibonacci::get_fib_num");
+        if ((m_fibonacci.size() -1) >=  fib_index)
+        {
+            return m_fibonacci[fib_index];
+        }
+        else
+        {
+            {
+                FP_TRACE_SCOPE("Fibonacci::add_number");
+                m_fibonacci.push_back(m_fibonacci[m_fibonacci.size()-1] + m_fibonacci[m_fibonacci.size()-2]);
+            }
+            return fp::tail_call(&Fibonacci::get_fib_step, this, fib_index);
+        }
+    }
+
+    // A stored sequence is used to prevent re-computation. Starts as a copy of
+    // the compile time table, the first time a number past it is requested
+    fp::detail::resource_vector<uint64_t> m_fibonacci;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Fibonacci engine. O(log n) fast doubling, thread safe memo, big integers
+//////////////////////////////////////////////////////////////////////////////
+
+namespace fp
+{
+// BigUnsigned. Arbitrary precision unsigned integer
+// Stored as 32 bit limbs, least significant first, with no leading zero limbs.
+// Only the operations the Fibonacci engine needs are provided
+class BigUnsigned
+{
+public:
+    BigUnsigned(uint64_t value = 0)
+    {
+        while (value != 0)
+        {
+            m_limbs.push_back(static_cast<uint32_t>(value));
+            value >>= 32;
+        }
+    }
+
+    bool fits_uint64() const { return m_limbs.size() <= 2; }
+
+    // Only meaningful when fits_uint64() is true
+    uint64_t to_uint64() const
+    {
+        uint64_t value = 0;
+        for (std::size_t i = std::min<std::size_t>(m_limbs.size(), 2); i-- > 0;)
+            value = (value << 32) | m_limbs[i];
+        return value;
+    }
+
+    // Decimal digits
+    std::string to_string() const
+    {
+        if (m_limbs.empty())
+            return "0";
+        // Repeatedly divide by 10^9, collecting nine digits at a time
+        std::vector<uint32_t> quotient = m_limbs;
+        std::vector<uint32_t> chunks;
+        while (!quotient.empty())
+        {
+            uint64_t remainder = 0;
+            for (std::size_t i = quotient.size(); i-- > 0;)
+            {
+                uint64_t current = (remainder << 32) | quotient[i];
+                quotient[i] = static_cast<uint32_t>(current / 1000000000u);
+                remainder = current % 1000000000u;
+            }
+            chunks.push_back(static_cast<uint32_t>(remainder));
+            while (!quotient.empty() && quotient.back() == 0)
+                quotient.pop_back();
+        }
+        std::string digits = std::to_string(chunks.back());
+        for (std::size_t i = chunks.size() - 1; i-- > 0;)
+        {
+            std::string chunk = std::to_string(chunks[i]);
+            digits += std::string(9 - chunk.size(), '0') + chunk;
+        }
+        return digits;
+    }
+
+    friend bool operator==(const BigUnsigned& a, const BigUnsigned& b) { return a.m_limbs == b.m_limbs; }
+    friend bool operator!=(const BigUnsigned& a, const BigUnsigned& b) { return !(a == b); }
+
+    friend BigUnsigned operator+(const BigUnsigned& a, const BigUnsigned& b)
+    {
+        const BigUnsigned& longer = (a.m_limbs.size() >= b.m_limbs.size()) ? a : b;
+        const BigUnsigned& shorter = (a.m_limbs.size() >= b.m_limbs.size()) ? b : a;
+        BigUnsigned sum;
+        sum.m_limbs.resize(longer.m_limbs.size());
+        uint64_t carry = 0;
+        for (std::size_t i = 0; i < longer.m_limbs.size(); i++)
+        {
+            carry += longer.m_limbs[i];
+            if (i < shorter.m_limbs.size())
+                carry += shorter.m_limbs[i];
+            sum.m_limbs[i] = static_cast<uint32_t>(carry);
+            carry >>= 32;
+        }
+        if (carry)
+            sum.m_limbs.push_back(static_cast<uint32_t>(carry));
+        return sum;
+    }
+
+    // Requires a >= b
+    friend BigUnsigned operator-(const BigUnsigned& a, const BigUnsigned& b)
+    {
+        BigUnsigned difference;
+        difference.m_limbs.resize(a.m_limbs.size());
+        int64_t borrow = 0;
+        for (std::size_t i = 0; i < a.m_limbs.size(); i++)
+        {
+            int64_t current = int64_t(a.m_limbs[i]) - borrow - (i < b.m_limbs.size() ? int64_t(b.m_limbs[i]) : 0);
+            borrow = (current < 0) ? 1 : 0;
+            difference.m_limbs[i] = static_cast<uint32_t>(current + (borrow << 32));
+        }
+        difference.trim();
+        return difference;
+    }
+
+    // Schoolbook multiplication
+    friend BigUnsigned operator*(const BigUnsigned& a, const BigUnsigned& b)
+    {
+        BigUnsigned product;
+        if (a.m_limbs.empty() || b.m_limbs.empty())
+            return product;
+        product.m_limbs.assign(a.m_limbs.size() + b.m_limbs.size(), 0);
+        for (std::size_t i = 0; i < a.m_limbs.size(); i++)
+        {
+            uint64_t carry = 0;
+            for (std::size_t j = 0; j < b.m_limbs.size(); j++)
+            {
+                uint64_t current = uint64_t(a.m_limbs[i]) * b.m_limbs[j] + product.m_limbs[i + j] + carry;
+                product.m_limbs[i + j] = static_cast<uint32_t>(current);
+                carry = current >> 32;
+            }
+            product.m_limbs[i + b.m_limbs.size()] = static_cast<uint32_t>(carry);
+        }
+        product.trim();
+        return product;
+    }
+
+    friend std::ostream& operator<<(std::ostream& out, const BigUnsigned& value)
+    {
+        return out << value.to_string();
+    }
+
+private:
+    void trim()
+    {
+        while (!m_limbs.empty() && m_limbs.back() == 0)
+            m_limbs.pop_back();
+    }
+
+    std::vector<uint32_t> m_limbs;
+};
+
+namespace detail
+{
+// Fast doubling. Walks the bits of the index from the top, using
+//     F(2k)   = F(k) * (2F(k+1) - F(k))
+//     F(2k+1) = F(k)^2 + F(k+1)^2
+// Works for any number type with +, - and *. Only F(index) is returned, so an
+// overflow of F(index + 1) in a fixed width type does no harm
+template <typename number_type>
+number_type fib_fast_doubling(uint64_t index)
+{
+    number_type fib_k = 0;
+    number_type fib_k1 = 1;
+    int top_bit = 63;
+    while (top_bit >= 0 && !((index >> top_bit) & 1))
+        top_bit--;
+    for (int bit = top_bit; bit >= 0; bit--)
+    {
+        number_type fib_2k = fib_k * (fib_k1 + fib_k1 - fib_k);
+        number_type fib_2k1 = fib_k * fib_k + fib_k1 * fib_k1;
+        if ((index >> bit) & 1)
+        {
+            fib_k = fib_2k1;
+            fib_k1 = fib_2k + fib_2k1;
+        }
+        else
+        {
+            fib_k = fib_2k;
+            fib_k1 = fib_2k1;
+        }
+    }
+    return fib_k;
+}
+} // namespace detail
+
+// FibonacciEngine. Answers any Fibonacci index in O(log n) steps
+// Indexes up to 93 fit in uint64_t and are computed directly. Larger indexes
+// are computed as BigUnsigned and kept in a bounded memo. The memo is split
+// into shards, each behind its own reader/writer lock, so threads reading
+// different (or the same) entries never wait on each other
+class FibonacciEngine
+{
+public:
+    // Largest index whose Fibonacci number fits in uint64_t
+    static constexpr uint64_t max_uint64_index = 93;
+
+    // uint64_t while the number fits, BigUnsigned past that
+    using fib_number = std::variant<uint64_t, BigUnsigned>;
+
+    // memo_capacity is the most BigUnsigned results kept at once. It is shared
+    // out over the shards, so a small capacity leaves some shards without a memo
+    explicit FibonacciEngine(std::size_t memo_capacity = 1024)
+    {
+        for (std::size_t i = 0; i < shard_count; i++)
+            m_shards[i].capacity = memo_capacity / shard_count + (i < memo_capacity % shard_count ? 1 : 0);
+    }
+
+    fib_number get_fib_num(uint64_t fib_index) const
+    {
+        if (fib_index <= max_uint64_index)
+            return detail::fib_fast_doubling<uint64_t>(fib_index);
+        return get_fib_big(fib_index);
+    }
+
+    // Returns an empty optional when the number does not fit in uint64_t
+    std::optional<uint64_t> get_fib_uint64(uint64_t fib_index) const
+    {
+        if (fib_index > max_uint64_index)
+            return std::nullopt;
+        return detail::fib_fast_doubling<uint64_t>(fib_index);
+    }
+
+    BigUnsigned get_fib_big(uint64_t fib_index) const
+    {
+        if (fib_index <= max_uint64_index)
+            return BigUnsigned(detail::fib_fast_doubling<uint64_t>(fib_index));
+
+        MemoShard& shard = m_shards[fib_index % shard_count];
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            auto found = shard.values.find(fib_index);
+            if (found != shard.values.end())
+                return found->second;
+        }
+
+        // Computed outside of any lock, so a slow computation never blocks readers
+        BigUnsigned value = detail::fib_fast_doubling<BigUnsigned>(fib_index);
+        if (shard.capacity != 0)
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            if (shard.values.emplace(fib_index, value).second)
+            {
+                // Oldest entry is evicted first
+                shard.order.push_back(fib_index);
+                if (shard.order.size() > shard.capacity)
+                {
+                    shard.values.erase(shard.order.front());
+                    shard.order.pop_front();
+                }
+            }
+        }
+        return value;
+    }
+
+    // Number of BigUnsigned results currently held
+    std::size_t memo_size() const
+    {
+        std::size_t size = 0;
+        for (auto& shard : m_shards)
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            size += shard.values.size();
+        }
+        return size;
+    }
+
+    void clear_memo()
+    {
+        for (auto& shard : m_shards)
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            shard.values.clear();
+            shard.order.clear();
+        }
+    }
+
+private:
+    static constexpr std::size_t shard_count = 16;
+
+    struct MemoShard
+    {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<uint64_t, BigUnsigned> values;
+        std::deque<uint64_t> order;
+        std::size_t capacity = 0;
+    };
+
+    mutable MemoShard m_shards[shard_count];
+};
+} // namespace fp
+
+//////////////////////////////////////////////////////////////////////////////
+// Memoization. Lazy evaluation with a cache, for any pure function
+//////////////////////////////////////////////////////////////////////////////
+
+namespace fp
+{
+// Cache policies for memoize
+namespace memo_policy
+{
+// Keep every result forever. Not thread safe
+struct unbounded {};
+
+// Evict the least recently used result once there are more than capacity
+// results, or once their estimated size passes memory_budget bytes (0 for no
+// budget). Not thread safe
+struct lru
+{
+    std::size_t capacity = 1024;
+    std::size_t memory_budget = 0;
+};
+
+// Safe to call from many threads at once. Results are spread over shards by
+// their hash, and each shard is an LRU cache behind its own mutex. The
+// capacity and memory budget (0 for no limit) are for the whole cache
+struct sharded
+{
+    std::size_t shard_count = 16;
+    std::size_t capacity = 0;
+    std::size_t memory_budget = 0;
+};
+} // namespace memo_policy
+
+// Counters for sizing caches
+struct memo_stats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    std::size_t entries = 0;
+    std::size_t bytes = 0;
+};
+
+namespace detail
+{
+// Argument and result types of a callable with a single (non template) signature
+template <typename F>
+struct callable_traits : callable_traits<decltype(&F::operator())> {};
+template <typename R, typename... Args>
+struct callable_traits<R(Args...)>
+{
+    using result_type = R;
+    using arguments = std::tuple<Args...>;
+};
+template <typename R, typename... Args>
+struct callable_traits<R(*)(Args...)> : callable_traits<R(Args...)> {};
+template <typename C, typename R, typename... Args>
+struct callable_traits<R(C::*)(Args...)> : callable_traits<R(Args...)> {};
+template <typename C, typename R, typename... Args>
+struct callable_traits<R(C::*)(Args...) const> : callable_traits<R(Args...)> {};
+
+// Hash of a packed argument tuple, combining the hash of every element
+struct tuple_hash
+{
+    template <typename... Ts>
+    std::size_t operator()(const std::tuple<Ts...>& key) const
+    {
+        std::size_t seed = 0;
+        std::apply([&seed](const auto&... element)
+        {
+            ((seed ^= std::hash<std::decay_t<decltype(element)>>{}(element)
+                      + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2)), ...);
+        }, key);
+        return seed;
+    }
+};
+
+// Estimated bytes held by a value, counting the heap buffer of strings and vectors
+template <typename T>
+std::size_t approximate_size(const T& value)
+{
+    if constexpr (std::is_same_v<T, std::string>)
+        return sizeof(T) + value.capacity();
+    else
+        return sizeof(T);
+}
+
+template <typename... Ts>
+std::size_t approximate_size(const std::tuple<Ts...>& key)
+{
+    return std::apply([](const auto&... element){ return (std::size_t{0} + ... + approximate_size(element)); }, key);
+}
+
+template <typename T>
+std::size_t approximate_size(const std::vector<T>& value)
+{
+    return sizeof(value) + value.capacity() * sizeof(T);
+}
+
+// Unbounded memo cache
+template <typename key_type, typename value_type>
+class UnboundedCache
+{
+public:
+    explicit UnboundedCache(memo_policy::unbounded) {}
+
+    std::optional<value_type> lookup(const key_type& key)
+    {
+        auto found = m_values.find(key);
+        if (found == m_values.end())
+        {
+            m_stats.misses++;
+            return std::nullopt;
+        }
+        m_stats.hits++;
+        return found->second;
+    }
+
+    void insert(key_type key, value_type value)
+    {
+        std::size_t bytes = approximate_size(key) + approximate_size(value);
+        if (m_values.emplace(std::move(key), std::move(value)).second)
+            m_stats.bytes += bytes;
+    }
+
+    memo_stats stats() const
+    {
+        memo_stats stats = m_stats;
+        stats.entries = m_values.size();
+        return stats;
+    }
+
+    void clear()
+    {
+        m_values.clear();
+        m_stats = memo_stats{};
+    }
+
+private:
+    std::unordered_map<key_type, value_type, tuple_hash> m_values;
+    memo_stats m_stats;
+};
+
+// Least recently used memo cache. The list holds the entries from most to
+// least recently used, and the map finds an entry's place in the list
+template <typename key_type, typename value_type>
+class LruCache
+{
+public:
+    explicit LruCache(memo_policy::lru policy)
+        : m_capacity(policy.capacity), m_memory_budget(policy.memory_budget)
+    {
+    }
+
+    std::optional<value_type> lookup(const key_type& key)
+    {
+        auto found = m_index.find(key);
+        if (found == m_index.end())
+        {
+            m_stats.misses++;
+            return std::nullopt;
+        }
+        m_stats.hits++;
+        m_entries.splice(m_entries.begin(), m_entries, found->second);
+        return found->second->value;
+    }
+
+    void insert(key_type key, value_type value)
+    {
+        if (m_index.count(key))
+            return;
+        std::size_t bytes = approximate_size(key) + approximate_size(value)
+                          + sizeof(Entry) + sizeof(typename index_type::value_type) + 4 * sizeof(void*);
+        m_entries.push_front(Entry{key, std::move(value), bytes});
+        m_index.emplace(std::move(key), m_entries.begin());
+        m_stats.bytes += bytes;
+        while (!m_entries.empty() && over_limit())
+        {
+            m_stats.bytes -= m_entries.back().bytes;
+            m_index.erase(m_entries.back().key);
+            m_entries.pop_back();
+            m_stats.evictions++;
+        }
+    }
+
+    memo_stats stats() const
+    {
+        memo_stats stats = m_stats;
+        stats.entries = m_entries.size();
+        return stats;
+    }
+
+    void clear()
+    {
+        m_entries.clear();
+        m_index.clear();
+        m_stats = memo_stats{};
+    }
+
+private:
+    struct Entry
+    {
+        key_type key;
+        value_type value;
+        std::size_t bytes;
+    };
+    using index_type = std::unordered_map<key_type, typename std::list<Entry>::iterator, tuple_hash>;
+
+    bool over_limit() const
+    {
+        return (m_capacity != 0 && m_entries.size() > m_capacity)
+            || (m_memory_budget != 0 && m_stats.bytes > m_memory_budget);
+    }
+
+    std::size_t m_capacity;
+    std::size_t m_memory_budget;
+    std::list<Entry> m_entries;
+    index_type m_index;
+    memo_stats m_stats;
+};
+
+// Sharded memo cache for concurrent callers
+template <typename key_type, typename value_type>
+class ShardedCache
+{
+public:
+    // The limits are shared out exactly: limit % shard_count shards take one
+    // more than the others. There are never more shards than the capacity (or
+    // budget), since a shard's limit of 0 would mean no limit
+    explicit ShardedCache(memo_policy::sharded policy)
+    {
+        std::size_t shard_count = std::max<std::size_t>(1, policy.shard_count);
+        if (policy.capacity != 0)
+            shard_count = std::min(shard_count, policy.capacity);
+        if (policy.memory_budget != 0)
+            shard_count = std::min(shard_count, policy.memory_budget);
+        auto share = [shard_count](std::size_t limit, std::size_t shard)
+        {
+            return limit / shard_count + (shard < limit % shard_count ? 1 : 0);
+        };
+        for (std::size_t i = 0; i < shard_count; i++)
+            m_shards.push_back(std::make_unique<Shard>(
+                memo_policy::lru{share(policy.capacity, i), share(policy.memory_budget, i)}));
+    }
+
+    std::optional<value_type> lookup(const key_type& key)
+    {
+        Shard& shard = shard_for(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        return shard.cache.lookup(key);
+    }
+
+    void insert(key_type key, value_type value)
+    {
+        Shard& shard = shard_for(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.cache.insert(std::move(key), std::move(value));
+    }
+
+    memo_stats stats() const
+    {
+        memo_stats total;
+        for (auto& shard : m_shards)
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            memo_stats stats = shard->cache.stats();
+            total.hits += stats.hits;
+            total.misses += stats.misses;
+            total.evictions += stats.evictions;
+            total.entries += stats.entries;
+            total.bytes += stats.bytes;
+        }
+        return total;
+    }
+
+    void clear()
+    {
+        for (auto& shard : m_shards)
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            shard->cache.clear();
+        }
+    }
+
+private:
+    struct Shard
+    {
+        explicit Shard(memo_policy::lru policy) : cache(policy) {}
+        mutable std::mutex mutex;
+        LruCache<key_type, value_type> cache;
+    };
+
+    Shard& shard_for(const key_type& key)
+    {
+        return *m_shards[tuple_hash{}(key) % m_shards.size()];
+    }
+
+    std::vector<std::unique_ptr<Shard>> m_shards;
+};
+
+template <typename policy_type, typename key_type, typename value_type>
+struct memo_cache;
+template <typename key_type, typename value_type>
+struct memo_cache<memo_policy::unbounded, key_type, value_type> { using type = UnboundedCache<key_type, value_type>; };
+template <typename key_type, typename value_type>
+struct memo_cache<memo_policy::lru, key_type, value_type> { using type = LruCache<key_type, value_type>; };
+template <typename key_type, typename value_type>
+struct memo_cache<memo_policy::sharded, key_type, value_type> { using type = ShardedCache<key_type, value_type>; };
+
+// Memoized. Callable returned by memoize
+// Copies share one cache, so a memoized function can be passed around by value.
+// With the unbounded and lru policies the cache has no lock: the function and
+// all of its copies must be called from one thread at a time. Use the sharded
+// policy for calls from several threads
+template <typename F, typename policy_type, typename R, typename... Args>
+class Memoized
+{
+public:
+    using key_type = std::tuple<std::decay_t<Args>...>;
+    using cache_type = typename memo_cache<policy_type, key_type, R>::type;
+
+    Memoized(F f, policy_type policy)
+        : m_state(std::make_shared<State>(std::move(f), policy))
+    {
+    }
+
+    R operator()(Args... args) const
+    {
+        key_type key(args...);
+        if (auto cached = m_state->cache.lookup(key))
+            return std::move(*cached);
+        // The function runs outside of any cache lock
+        R result = std::invoke(m_state->function, std::forward<Args>(args)...);
+        m_state->cache.insert(std::move(key), result);
+        return result;
+    }
+
+    memo_stats stats() const { return m_state->cache.stats(); }
+
+    void clear() { m_state->cache.clear(); }
+
+private:
+    struct State
+    {
+        State(F f, policy_type policy) : function(std::move(f)), cache(policy) {}
+        F function;
+        cache_type cache;
+    };
+
+    std::shared_ptr<State> m_state;
+};
+
+template <typename F, typename policy_type, typename R, typename arguments>
+struct memoized_type;
+template <typename F, typename policy_type, typename R, typename... Args>
+struct memoized_type<F, policy_type, R, std::tuple<Args...>> { using type = Memoized<F, policy_type, R, Args...>; };
+} // namespace detail
+
+// memoize. Wrap a pure function so each distinct set of arguments is only
+// computed once. The arguments are packed into a tuple which keys a hashed
+// cache, chosen by the policy (memo_policy::unbounded, lru or sharded).
+// Only the sharded policy may be called from several threads at once.
+// f needs a single signature (no generic lambdas), a non void result, and
+// arguments which can be hashed with std::hash and compared with ==
+template <typename F, typename policy_type = memo_policy::unbounded>
+auto memoize(F f, policy_type policy = {})
+{
+    using traits = detail::callable_traits<F>;
+    using result_type = typename traits::result_type;
+    static_assert(!std::is_void_v<result_type> && !std::is_reference_v<result_type>,
+                  "memoize needs a function which returns a value");
+    using memoized = typename detail::memoized_type<F, policy_type, result_type, typename traits::arguments>::type;
+    return memoized(std::move(f), policy);
+}
+} // namespace fp
+
+//////////////////////////////////////////////////////////////////////////////
+// Lazy Streams. Fused map/filter/take pipelines over finite and infinite lists
+//////////////////////////////////////////////////////////////////////////////
+
+namespace fp
+{
+// A generator produces a sequence one element at a time. It names its
+// value_type and has a next() which returns the next element, or an empty
+// optional once the sequence has ended. Every stream stage is a generator
+// which holds the stage before it by value, so a pipeline is one object on the
+// stack: nothing is computed until a terminal operation (fold, to_vector, ...)
+// pulls elements through, and each element passes through every stage in one go
+namespace detail
+{
+// Elements of an existing list. The list is not copied
+template <typename input_iterator>
+struct RangeGenerator
+{
+    using value_type = typename std::iterator_traits<input_iterator>::value_type;
+    input_iterator head;
+    input_iterator end;
+
+    std::optional<value_type> next()
+    {
+        if (head == end)
+            return std::nullopt;
+        return *head++;
+    }
+};
+
+// seed, f(seed), f(f(seed)), ... (infinite)
+template <typename T, typename F>
+struct IterateGenerator
+{
+    using value_type = T;
+    T current;
+    F f;
+    bool started = false;
+
+    std::optional<value_type> next()
+    {
+        if (started)
+            current = std::invoke(f, current);
+        started = true;
+        return current;
+    }
+};
+
+template <typename generator_type, typename F>
+struct MapGenerator
+{
+    using value_type = std::decay_t<std::invoke_result_t<F&, typename generator_type::value_type>>;
+    generator_type upstream;
+    F f;
+
+    std::optional<value_type> next()
+    {
+        if (auto value = upstream.next())
+            return std::invoke(f, std::move(*value));
+        return std::nullopt;
+    }
+};
+
+template <typename generator_type, typename predicate_type>
+struct FilterGenerator
+{
+    using value_type = typename generator_type::value_type;
+    generator_type upstream;
+    predicate_type predicate;
+
+    std::optional<value_type> next()
+    {
+        while (auto value = upstream.next())
+        {
+            if (std::invoke(predicate, *value))
+                return value;
+        }
+        return std::nullopt;
+    }
+};
+
+// Stops without pulling from upstream once count elements are produced, so
+// infinite streams end
+template <typename generator_type>
+struct TakeGenerator
+{
+    using value_type = typename generator_type::value_type;
+    generator_type upstream;
+    std::size_t remaining;
+
+    std::optional<value_type> next()
+    {
+        if (remaining == 0)
+            return std::nullopt;
+        remaining--;
+        return upstream.next();
+    }
+};
+
+template <typename generator_type, typename predicate_type>
+struct TakeWhileGenerator
+{
+    using value_type = typename generator_type::value_type;
+    generator_type upstream;
+    predicate_type predicate;
+    bool done = false;
+
+    std::optional<value_type> next()
+    {
+        if (done)
+            return std::nullopt;
+        auto value = upstream.next();
+        if (!value || !std::invoke(predicate, *value))
+        {
+            done = true;
+            return std::nullopt;
+        }
+        return value;
+    }
+};
+
+// Pairs of elements from two streams, ending with the shorter one
+template <typename first_generator, typename second_generator>
+struct ZipGenerator
+{
+    using value_type = std::pair<typename first_generator::value_type, typename second_generator::value_type>;
+    first_generator first;
+    second_generator second;
+
+    std::optional<value_type> next()
+    {
+        auto first_value = first.next();
+        if (!first_value)
+            return std::nullopt;
+        auto second_value = second.next();
+        if (!second_value)
+            return std::nullopt;
+        return value_type{std::move(*first_value), std::move(*second_value)};
+    }
+};
+} // namespace detail
+
+// Stream. A lazy sequence built from a generator
+// Stages return a new stream which wraps this one, terminal operations pull
+// every element through all of the stages in a single pass
+template <typename generator_type>
+class Stream
+{
+public:
+    using value_type = typename generator_type::value_type;
+
+    explicit Stream(generator_type generator) : m_generator(std::move(generator)) {}
+
+    // Stages (lazy)
+    template <typename F>
+    auto map(F f) const
+    {
+        using stage = detail::MapGenerator<generator_type, F>;
+        return Stream<stage>(stage{m_generator, std::move(f)});
+    }
+
+    template <typename predicate_type>
+    auto filter(predicate_type predicate) const
+    {
+        using stage = detail::FilterGenerator<generator_type, predicate_type>;
+        return Stream<stage>(stage{m_generator, std::move(predicate)});
+    }
+
+    auto take(std::size_t count) const
+    {
+        using stage = detail::TakeGenerator<generator_type>;
+        return Stream<stage>(stage{m_generator, count});
+    }
+
+    template <typename predicate_type>
+    auto take_while(predicate_type predicate) const
+    {
+        using stage = detail::TakeWhileGenerator<generator_type, predicate_type>;
+        return Stream<stage>(stage{m_generator, std::move(predicate)});
+    }
+
+    template <typename other_generator>
+    auto zip(const Stream<other_generator>& other) const
+    {
+        using stage = detail::ZipGenerator<generator_type, other_generator>;
+        return Stream<stage>(stage{m_generator, other.generator()});
+    }
+
+    // Terminal operations (run the pipeline). Streams without an end must be
+    // limited with take or take_while first
+    template <typename T, typename binary_op>
+    T fold(T init, binary_op op) const
+    {
+        generator_type generator = m_generator;
+        while (auto value = generator.next())
+            init = std::invoke(op, std::move(init), std::move(*value));
+        return init;
+    }
+
+    template <typename monoid_type>
+    value_type mconcat() const
+    {
+        return fold(monoid_type::template identity<value_type>(),
+                    [](const value_type& a, const value_type& b){ return monoid_type::combine(a, b); });
+    }
+
+    template <typename F>
+    void for_each(F f) const
+    {
+        generator_type generator = m_generator;
+        while (auto value = generator.next())
+            std::invoke(f, std::move(*value));
+    }
+
+    std::vector<value_type> to_vector() const
+    {
+        std::vector<value_type> out_list;
+        for_each([&out_list](value_type value){ out_list.push_back(std::move(value)); });
+        return out_list;
+    }
+
+    std::size_t count() const
+    {
+        return fold(std::size_t{0}, [](std::size_t n, const value_type&){ return n + 1; });
+    }
+
+    // Input iterator, so a stream can be used in a range based for loop
+    class iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = typename Stream::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const value_type*;
+        using reference = const value_type&;
+
+        iterator() = default;
+        explicit iterator(generator_type generator)
+            : m_generator(std::move(generator)), m_current(m_generator->next())
+        {
+        }
+
+        reference operator*() const { return *m_current; }
+        pointer operator->() const { return &*m_current; }
+        iterator& operator++() { m_current = m_generator->next(); return *this; }
+        void operator++(int) { ++*this; }
+        bool operator==(const iterator& other) const { return !m_current && !other.m_current; }
+        bool operator!=(const iterator& other) const { return !(*this == other); }
+
+    private:
+        std::optional<generator_type> m_generator;
+        std::optional<value_type> m_current;
+    };
+
+    iterator begin() const { return iterator(m_generator); }
+    iterator end() const { return iterator(); }
+
+    const generator_type& generator() const { return m_generator; }
+
+private:
+    generator_type m_generator;
+};
+
+// Stream sources
+namespace stream
+{
+// Elements of a list, in order. The list must outlive the stream
+template <typename input_iterator>
+auto from(input_iterator list_head, input_iterator list_end)
+{
+    using generator_type = detail::RangeGenerator<input_iterator>;
+    return Stream<generator_type>(generator_type{list_head, list_end});
+}
+
+template <typename T, typename allocator_type>
+auto from(const std::vector<T, allocator_type>& in_list)
+{
+    return from(in_list.begin(), in_list.end());
+}
+
+// seed, f(seed), f(f(seed)), ... without end
+template <typename T, typename F>
+auto iterate(T seed, F f)
+{
+    using generator_type = detail::IterateGenerator<T, F>;
+    return Stream<generator_type>(generator_type{std::move(seed), std::move(f)});
+}
+
+// start, start + 1, start + 2, ... without end
+template <typename T>
+auto iota(T start)
+{
+    return iterate(start, [](const T& value){ return value + 1; });
+}
+
+// The Fibonacci sequence without end (0, 1, 1, 2, 3, 5, ...)
+// Values past index 93 overflow uint64_t, so take at most 94 elements
+inline auto fibonacci()
+{
+    return iterate(std::pair<uint64_t, uint64_t>{0, 1},
+                   [](const std::pair<uint64_t, uint64_t>& fib){ return std::pair<uint64_t, uint64_t>{fib.second, fib.first + fib.second}; })
+          .map([](const std::pair<uint64_t, uint64_t>& fib){ return fib.first; });
+}
+} // namespace stream
+} // namespace fp
+
+//////////////////////////////////////////////////////////////////////////////
+// Transducers. Composable map/filter/take stages which run inside any fold
+//////////////////////////////////////////////////////////////////////////////
+
+namespace fp
+{
+// A transducer turns one reducing step into another: mapping(f) turns
+// step(acc, x) into step(acc, f(x)), filtering(p) skips the x for which p(x)
+// is false, and so on. A chain of them wraps the fold's own operator, so it
+// runs inside whatever loop feeds the fold (a vector, a stream, a mapped or
+// streamed file, a chunk of a parallel fold). Each element goes through every
+// stage in one go, and no list is built between the stages.
+// Within a chain a step is step(acc, x) -> bool. It updates acc in place and
+// returns false once it wants no more elements, which lets taking() end the
+// loop early (and end infinite streams)
+namespace detail
+{
+// The fold's own operator, at the end of every chain
+template <typename binary_op>
+struct FoldStep
+{
+    binary_op op;
+
+    template <typename T, typename V>
+    bool operator()(T& acc, V&& value)
+    {
+        acc = std::invoke(op, std::move(acc), std::forward<V>(value));
+        return true;
+    }
+};
+
+// End of the chain for the chunks of a parallel fold, which start from their
+// first element in place of init (as in parallel_fold_contiguous)
+template <typename binary_op>
+struct SeededFoldStep
+{
+    binary_op op;
+
+    template <typename T, typename V>
+    bool operator()(std::optional<T>& acc, V&& value)
+    {
+        if (acc)
+            *acc = std::invoke(op, std::move(*acc), std::forward<V>(value));
+        else
+            acc.emplace(std::forward<V>(value));
+        return true;
+    }
+};
+
+template <typename F, typename next_step>
+struct MappingStep
+{
+    F f;
+    next_step next;
+
+    template <typename T, typename V>
+    bool operator()(T& acc, V&& value)
+    {
+        return next(acc, std::invoke(f, std::forward<V>(value)));
+    }
+};
+
+template <typename predicate_type, typename next_step>
+struct FilteringStep
+{
+    predicate_type predicate;
+    next_step next;
+
+    template <typename T, typename V>
+    bool operator()(T& acc, V&& value)
+    {
+        if (!std::invoke(predicate, std::as_const(value)))
+            return true;
+        return next(acc, std::forward<V>(value));
+    }
+};
+
+// Asks for no more elements as soon as the last one is passed on, so the
+// source is never read past it
+template <typename next_step>
+struct TakingStep
+{
+    std::size_t remaining;
+    next_step next;
+
+    template <typename T, typename V>
+    bool operator()(T& acc, V&& value)
+    {
+        if (remaining == 0)
+            return false;
+        remaining--;
+        return next(acc, std::forward<V>(value)) && remaining != 0;
+    }
+};
+
+// Skips elements equal to the one before them, so each run of equal elements
+// is passed on once
+template <typename value_type, typename next_step>
+struct DeduplicatingStep
+{
+    std::optional<value_type> last;
+    next_step next;
+
+    template <typename T, typename V>
+    bool operator()(T& acc, V&& value)
+    {
+        if (last && *last == value)
+            return true;
+        last = value;
+        return next(acc, std::forward<V>(value));
+    }
+};
+
+// Stage descriptions. Each one names the type it passes on for an input type,
+// whether it keeps state from one element to the next, and builds its step
+// around the next one
+template <typename F>
+struct mapping_stage
+{
+    template <typename input_type>
+    using output_type = std::decay_t<std::invoke_result_t<const F&, const input_type&>>;
+    static constexpr bool is_stateless = true;
+    F f;
+
+    template <typename input_type, typename next_step>
+    auto wrap(next_step next) const { return MappingStep<F, next_step>{f, std::move(next)}; }
+};
+
+template <typename predicate_type>
+struct filtering_stage
+{
+    template <typename input_type>
+    using output_type = input_type;
+    static constexpr bool is_stateless = true;
+    predicate_type predicate;
+
+    template <typename input_type, typename next_step>
+    auto wrap(next_step next) const { return FilteringStep<predicate_type, next_step>{predicate, std::move(next)}; }
+};
+
+struct taking_stage
+{
+    template <typename input_type>
+    using output_type = input_type;
+    static constexpr bool is_stateless = false;
+    std::size_t count;
+
+    template <typename input_type, typename next_step>
+    auto wrap(next_step next) const { return TakingStep<next_step>{count, std::move(next)}; }
+};
+
+struct deduplicating_stage
+{
+    template <typename input_type>
+    using output_type = input_type;
+    static constexpr bool is_stateless = false;
+
+    template <typename input_type, typename next_step>
+    auto wrap(next_step next) const { return DeduplicatingStep<input_type, next_step>{std::nullopt, std::move(next)}; }
+};
+
+// Type reaching the fold after a list of stages
+template <typename input_type, typename... Stages>
+struct chain_output { using type = input_type; };
+template <typename input_type, typename Stage, typename... Stages>
+struct chain_output<input_type, Stage, Stages...>
+{
+    using type = typename chain_output<typename Stage::template output_type<input_type>, Stages...>::type;
+};
+
+// Element type of any list with begin() and end()
+template <typename list_type>
+using list_value_t = std::decay_t<decltype(*std::begin(std::declval<list_type&>()))>;
+} // namespace detail
+
+// Transducer. A chain of stages, applied left to right
+// Like Pipeline it is one object holding its stages by value, so a whole
+// chain inlines into the loop of the fold it runs in. Every run builds its
+// steps afresh, so stateful stages (taking, deduplicating) start over each time
+template <typename... Stages>
+class Transducer
+{
+public:
+    constexpr explicit Transducer(std::tuple<Stages...> stages) : m_stages(std::move(stages)) {}
+
+    // Type of the elements reaching the fold, for elements of input_type
+    template <typename input_type>
+    using output_type = typename detail::chain_output<input_type, Stages...>::type;
+
+    // Whether no stage keeps state between elements, so separate chunks of a
+    // list can run the chain independently (in parallel)
+    static constexpr bool is_stateless = (Stages::is_stateless && ...);
+
+    // xform | other runs other's stages after this one's
+    template <typename... Others>
+    constexpr auto operator|(const Transducer<Others...>& other) const
+    {
+        return Transducer<Stages..., Others...>(std::tuple_cat(m_stages, other.stages()));
+    }
+
+    // The chain around a final step, for elements of input_type
+    template <typename input_type, typename final_step>
+    auto wrap(final_step last) const
+    {
+        return wrap_from<0, input_type>(std::move(last));
+    }
+
+    // The chain around a fold operator: acc = op(acc, x) for each x reaching the end
+    template <typename input_type, typename binary_op>
+    auto step(binary_op op) const
+    {
+        return wrap<input_type>(detail::FoldStep<binary_op>{std::move(op)});
+    }
+
+    const std::tuple<Stages...>& stages() const { return m_stages; }
+
+private:
+    template <std::size_t index, typename input_type, typename final_step>
+    auto wrap_from(final_step last) const
+    {
+        if constexpr (index == sizeof...(Stages))
+            return last;
+        else
+        {
+            using stage = std::tuple_element_t<index, std::tuple<Stages...>>;
+            return std::get<index>(m_stages).template wrap<input_type>(
+                wrap_from<index + 1, typename stage::template output_type<input_type>>(std::move(last)));
+        }
+    }
+
+    std::tuple<Stages...> m_stages;
+};
+
+template <typename T>
+constexpr bool is_transducer_v = false;
+template <typename... Stages>
+constexpr bool is_transducer_v<Transducer<Stages...>> = true;
+
+// Transducer stages
+// f(x) in place of each element x
+template <typename F>
+auto mapping(F f)
+{
+    return Transducer<detail::mapping_stage<F>>(std::make_tuple(detail::mapping_stage<F>{std::move(f)}));
+}
+
+// Only the elements for which predicate(x) is true
+template <typename predicate_type>
+auto filtering(predicate_type predicate)
+{
+    using stage = detail::filtering_stage<predicate_type>;
+    return Transducer<stage>(std::make_tuple(stage{std::move(predicate)}));
+}
+
+// The first count elements, after which the fold stops reading its list
+inline auto taking(std::size_t count)
+{
+    return Transducer<detail::taking_stage>(std::make_tuple(detail::taking_stage{count}));
+}
+
+// Each run of equal elements once (compared with ==)
+inline auto deduplicating()
+{
+    return Transducer<detail::deduplicating_stage>(std::make_tuple(detail::deduplicating_stage{}));
+}
+
+namespace detail
+{
+// Feed [head, end) to a step. Returns false if the step stopped early
+template <typename step_type, typename T, typename input_iterator>
+bool transduce_range(step_type& step, T& acc, input_iterator head, input_iterator end)
+{
+    for (; head != end; ++head)
+    {
+        if (!step(acc, *head))
+            return false;
+    }
+    return true;
+}
+
+// Parallel transduce over any contiguous array. Each chunk runs its own copy
+// of the chain into its own partial result, and the partial results are
+// combined in list order, starting from init
+template <typename transducer_type, typename binary_op, typename T, typename U>
+T parallel_transduce_contiguous(const transducer_type& xform, binary_op op, T init,
+                                const U* data, std::size_t elements, parallel_options options)
+{
+    static_assert(transducer_type::is_stateless,
+                  "Only chains of mapping and filtering can be split over threads");
+    ThreadPool& pool = options.pool ? *options.pool : ThreadPool::shared();
+    std::size_t chunks = parallel_chunk_count(elements, options, pool);
+    std::vector<std::optional<T>> partials(chunks);
+    pool.parallel_for(chunks, [&](std::size_t chunk)
+    {
+        auto step = xform.template wrap<U>(SeededFoldStep<binary_op>{op});
+        transduce_range(step, partials[chunk], data + chunk * elements / chunks,
+                        data + (chunk + 1) * elements / chunks);
+    });
+    for (auto& partial : partials)
+    {
+        if (partial)
+            init = op(std::move(init), std::move(*partial));
+    }
+    return init;
+}
+} // namespace detail
+
+// transduce. Fold a list through a transducer chain, in one pass
+// op sees the elements as they leave the chain: with
+// mapping(f) | filtering(p) the result is init op f(x1) op f(x2) ... over the
+// x for which p(f(x)) is true. Reading stops as soon as the chain is done
+template <typename transducer_type, typename binary_op, typename T, typename input_iterator>
+T transduce(const transducer_type& xform, binary_op op, T init, input_iterator list_head, input_iterator list_end)
+{
+    using value_type = typename std::iterator_traits<input_iterator>::value_type;
+    auto step = xform.template step<value_type>(std::move(op));
+    detail::transduce_range(step, init, list_head, list_end);
+    return init;
+}
+
+// Any list with begin() and end(): std::vector, MappedArray, ...
+template <typename transducer_type, typename binary_op, typename T, typename list_type>
+T transduce(const transducer_type& xform, binary_op op, T init, const list_type& in_list)
+{
+    return transduce(xform, std::move(op), std::move(init), std::begin(in_list), std::end(in_list));
+}
+
+// A lazy stream, pulled straight from its generator. Chains which stop (with
+// taking) can run over infinite streams
+template <typename transducer_type, typename binary_op, typename T, typename generator_type>
+T transduce(const transducer_type& xform, binary_op op, T init, const Stream<generator_type>& in_list)
+{
+    auto step = xform.template step<typename generator_type::value_type>(std::move(op));
+    generator_type generator = in_list.generator();
+    while (auto value = generator.next())
+    {
+        if (!step(init, std::move(*value)))
+            break;
+    }
+    return init;
+}
+
+// transduce over a list in parallel. Only stateless chains (mapping and
+// filtering) can run like this, and op must be associative, as for fp::fold
+template <typename transducer_type, typename binary_op, typename T, typename U, typename allocator_type>
+T transduce(const transducer_type& xform, binary_op op, T init, const std::vector<U, allocator_type>& in_list,
+            parallel_options options)
+{
+    return detail::parallel_transduce_contiguous(xform, std::move(op), std::move(init),
+                                                 in_list.data(), in_list.size(), options);
+}
+
+#if __has_include(<sys/mman.h>)
+// A mapped file, in parallel
+template <typename transducer_type, typename binary_op, typename T, typename U>
+T transduce(const transducer_type& xform, binary_op op, T init, const MappedArray<U>& in_list,
+            parallel_options options)
+{
+    return detail::parallel_transduce_contiguous(xform, std::move(op), std::move(init),
+                                                 in_list.data(), in_list.size(), options);
+}
+
+// A streamed file, chunk by chunk. Reading stops as soon as the chain is done
+template <typename transducer_type, typename binary_op, typename T, typename U>
+T transduce(const transducer_type& xform, binary_op op, T init, ChunkedFileReader<U>& in_list)
+{
+    auto step = xform.template step<U>(std::move(op));
+    for (auto chunk = in_list.next_chunk(); chunk.second > 0; chunk = in_list.next_chunk())
+    {
+        if (!detail::transduce_range(step, init, chunk.first, chunk.first + chunk.second))
+            break;
+    }
+    return init;
+}
+#endif
+
+// into_vector. The elements leaving a transducer chain, as a new list. The
+// list takes its memory from allocator (std::allocator by default)
+template <typename transducer_type, typename list_type,
+          typename allocator_type = std::allocator<typename transducer_type::template output_type<detail::list_value_t<list_type>>>>
+auto into_vector(const transducer_type& xform, list_type&& in_list, const allocator_type& allocator = allocator_type{})
+{
+    using value_type = typename transducer_type::template output_type<detail::list_value_t<list_type>>;
+    using out_type = std::vector<value_type, allocator_type>;
+    return transduce(xform, [](out_type out_list, value_type value)
+                     {
+                         out_list.push_back(std::move(value));
+                         return out_list;
+                     },
+                     out_type(allocator), in_list);
+}
+} // namespace fp
+
+// sumlist_HOF through a transducer chain, e.g. the sum of the squares of the
+// even elements, in one pass with no list built in between
+template<typename T, typename allocator_type, typename... Stages>
+auto sumlist_HOF(std::vector<T, allocator_type>& in_list, const fp::Transducer<Stages...>& xform)
+{
+    using sum_type = typename fp::Transducer<Stages...>::template output_type<T>;
+    return fp::transduce(xform, std::plus<sum_type>{}, fp::monoid::sum::identity<sum_type>(), in_list);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Maybe Monad. Error handling using std::optional
+//////////////////////////////////////////////////////////////////////////////
+
+namespace fp::detail
+{
+template <typename T> struct is_optional : std::false_type {};
+template <typename T> struct is_optional<std::optional<T>> : std::true_type {};
+template <typename T> constexpr bool is_optional_v = is_optional<T>::value;
+} // namespace fp::detail
+
+// Bind operation for the maybe monad, using std::optional
+// The boilerplate process of checking the optional value, and passing
+// along the value is abstracted in this bind operation
+// The optional and the function are forwarded, so an rvalue optional hands its
+// payload on with a move: a chain of binds never copies the value
+// A skipped stage is traced as a short circuit
+// Credit: Maybe and Either Monads in Plain C++ 17 (Timothy A.V Teatro et. al.)
+template <typename optional_maybe, typename F,
+          typename = std::enable_if_t<fp::detail::is_optional_v<std::decay_t<optional_maybe>>>>
+auto bind_maybe(optional_maybe&& m, F&& f)
+        -> decltype(std::invoke(std::forward<F>(f), *std::forward<optional_maybe>(m))) {
+    if (m)
+        return std::invoke(std::forward<F>(f), *std::forward<optional_maybe>(m));
+    FP_TRACE_SHORT_CIRCUIT("bind_maybe", 1);
+    return {};
+}
+
+// The | operator is used to perform the bind for better syntax
+// Only std::optional on the left hand side takes part
+// Credit: Maybe and Either Monads in Plain C++ 17 (Timothy A.V Teatro et. al.)
+template <typename optional_maybe, typename F,
+          typename = std::enable_if_t<fp::detail::is_optional_v<std::decay_t<optional_maybe>>>>
+auto operator|(optional_maybe &&m, F &&f) {
+    return bind_maybe(std::forward<optional_maybe>(m),
+                    std::forward<F>(f));};
+
+// Divide optional monad function which fails when the demoninator is 0
+std::optional<double> divide(double num, double denom)
+{
+    FP_TRACE_SCOPE("divide");
+    if (denom == 0.0)
+        return std::nullopt;
+    else
+        return num / denom;
+}
+
+// Square root optional monad function which fails when the value to root is negative
+std::optional<double> square_root(double num)
+{
+    FP_TRACE_SCOPE("square_root");
+    if (num < 0)
+        return std::nullopt;
+    else
+        return sqrt(num);
+}
+
+// Double optional monad. No failure. Just performs the double operation
+std::optional<double> double_opt(double num)
+{
+    FP_TRACE_SCOPE("double_opt");
+    return num * 2;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Async Maybe Monad. Maybe chains whose stages run as tasks on a thread pool
+//////////////////////////////////////////////////////////////////////////////
+
+namespace fp
+{
+template <typename T> class Task;
+
+namespace detail
+{
+template <typename T> struct is_task : std::false_type {};
+template <typename T> struct is_task<Task<T>> : std::true_type {};
+
+// State shared by a task and the stage which completes it. The result is
+// written once, before ready is set under the lock, so whoever sees ready can
+// read it without the lock. One continuation may wait for the result
+template <typename T>
+struct TaskState
+{
+    explicit TaskState(ThreadPool& executor) : pool(&executor) {}
+
+    void set_value(T result)
+    {
+        value.emplace(std::move(result));
+        finish();
+    }
+
+    void set_error(std::exception_ptr exception)
+    {
+        error = std::move(exception);
+        finish();
+    }
+
+    // Run f once the result is set: now if it already is, otherwise on the
+    // thread which sets it. f is told which, as f(true) when called by the
+    // stage which set the result. Throws std::logic_error if the task already
+    // has a continuation
+    void on_ready(std::function<void(bool)> f)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (continued)
+                throw std::logic_error("fp::Task: a task can only be continued once");
+            continued = true;
+            if (!ready)
+            {
+                continuation = std::move(f);
+                return;
+            }
+        }
+        f(false);
+    }
+
+    void finish()
+    {
+        std::function<void(bool)> next;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ready = true;
+            next = std::move(continuation);
+        }
+        done.notify_all();
+        if (next)
+            next(true);
+    }
+
+    ThreadPool* pool;
+    std::mutex mutex;
+    std::condition_variable done;
+    bool ready = false;
+    bool continued = false;
+    std::optional<T> value;
+    std::exception_ptr error;
+    std::function<void(bool)> continuation;
+};
+
+// Stages run inline by the current thread, one inside the other. Past
+// max_inline_stages, stages are queued again so the stack stays bounded
+constexpr std::size_t max_inline_stages = 16;
+inline std::size_t& inline_stage_depth()
+{
+    thread_local std::size_t depth = 0;
+    return depth;
+}
+
+// Complete state with the result of f(args...), or with what it threw
+template <typename T, typename F, typename... Args>
+void complete_task(TaskState<T>& state, F& f, Args&&... args)
+{
+    try
+    {
+        state.set_value(std::invoke(f, std::forward<Args>(args)...));
+    }
+    catch (...)
+    {
+        state.set_error(std::current_exception());
+    }
+}
+} // namespace detail
+
+// Task. A value being computed on a thread pool (the task's executor).
+// Chains of Maybe stages are built with |, as for std::optional, and every
+// stage runs as its own task on the executor, so thousands of chains can be in
+// flight at once. A Task is move only: each task is either waited for with
+// get(), or continued with | once
+template <typename T>
+class Task
+{
+public:
+    using value_type = T;
+
+    explicit Task(std::shared_ptr<detail::TaskState<T>> state) : m_state(std::move(state)) {}
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    Task(Task&&) = default;
+    Task& operator=(Task&&) = default;
+
+    bool ready() const
+    {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        return m_state->ready;
+    }
+
+    ThreadPool& executor() const { return *m_state->pool; }
+
+    // Wait for the result and take it. The waiting thread runs queued tasks
+    // while it waits (as parallel_for does), so get() may be called from a
+    // stage. An exception thrown by any stage of the chain is rethrown here
+    T get()
+    {
+        while (!ready())
+        {
+            if (!m_state->pool->run_pending_task())
+            {
+                std::unique_lock<std::mutex> lock(m_state->mutex);
+                m_state->done.wait_for(lock, std::chrono::milliseconds(1), [this]{ return m_state->ready; });
+            }
+        }
+        if (m_state->error)
+            std::rethrow_exception(m_state->error);
+        return std::move(*m_state->value);
+    }
+
+    // The shared state, which the stages chained onto this task wait on
+    std::shared_ptr<detail::TaskState<T>>& state() { return m_state; }
+
+private:
+    std::shared_ptr<detail::TaskState<T>> m_state;
+};
+
+// async_task. Run f(args...) as a task on a pool, and return its Task
+template <typename F, typename... Args>
+auto async_task(ThreadPool& pool, F f, Args... args)
+{
+    using R = std::invoke_result_t<F&, Args&...>;
+    auto state = std::make_shared<detail::TaskState<R>>(pool);
+    pool.submit([state, f, args...]() mutable { detail::complete_task(*state, f, args...); });
+    return Task<R>(state);
+}
+
+// async_task on the shared pool
+template <typename F, typename... Args,
+          typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, ThreadPool>>>
+auto async_task(F f, Args... args)
+{
+    return async_task(ThreadPool::shared(), std::move(f), std::move(args)...);
+}
+
+// make_task. A task which already holds its value, to start a chain from
+template <typename T>
+Task<T> make_task(T value, ThreadPool& pool = ThreadPool::shared())
+{
+    auto state = std::make_shared<detail::TaskState<T>>(pool);
+    state->set_value(std::move(value));
+    return Task<T>(state);
+}
+
+// Bind for a Maybe task. Once the task finishes with a value, f is called on
+// it as a new task on the same executor. A task which finishes with nullopt
+// (or an exception) passes that on at once, and f is never scheduled, so a
+// failed chain costs no more tasks. f returns a std::optional, like the
+// synchronous Maybe functions, or a Task of one, for stages which are
+// themselves asynchronous
+template <typename T, typename F>
+auto bind_maybe(Task<std::optional<T>> task, F f)
+{
+    using stage_result = std::invoke_result_t<F&, T&&>;
+    using result_type = typename std::conditional_t<detail::is_task<stage_result>::value,
+                                                    stage_result, Task<stage_result>>::value_type;
+    auto previous = task.state();
+    auto next = std::make_shared<detail::TaskState<result_type>>(*previous->pool);
+    previous->on_ready([previous, next, f](bool from_stage) mutable
+    {
+        if (previous->error)
+            return next->set_error(previous->error);
+        if (!*previous->value)
+        {
+            FP_TRACE_SHORT_CIRCUIT("bind_maybe (task)", 1);
+            return next->set_value(result_type{});
+        }
+        auto run_stage = [previous, next, f]() mutable
+        {
+            if constexpr (detail::is_task<stage_result>::value)
+            {
+                try
+                {
+                    auto inner = std::invoke(f, std::move(**previous->value)).state();
+                    inner->on_ready([inner, next](bool)
+                    {
+                        if (inner->error)
+                            next->set_error(inner->error);
+                        else
+                            next->set_value(std::move(*inner->value));
+                    });
+                }
+                catch (...)
+                {
+                    next->set_error(std::current_exception());
+                }
+            }
+            else
+                detail::complete_task(*next, f, std::move(**previous->value));
+        };
+        // The worker which finished a stage runs the next one itself, instead
+        // of handing it to another thread. A chain built on a finished task is
+        // queued, so | never runs a stage on the thread building the chain
+        std::size_t& depth = detail::inline_stage_depth();
+        if (from_stage && next->pool->is_worker() && depth < detail::max_inline_stages)
+        {
+            depth++;
+            run_stage();
+            depth--;
+        }
+        else
+            next->pool->submit(std::move(run_stage));
+    });
+    return Task<result_type>(next);
+}
+
+// The | operator binds a Maybe task, with the same syntax as std::optional
+template <typename T, typename F>
+auto operator|(Task<std::optional<T>> task, F f)
+{
+    return bind_maybe(std::move(task), std::move(f));
+}
+} // namespace fp
+
+//////////////////////////////////////////////////////////////////////////////
+// Batch Maybe Monad. A monadic chain over whole arrays with a validity bitmask
+//////////////////////////////////////////////////////////////////////////////
+
+namespace fp
 {
-    // When the head and end iterators equal, we have finished our recursion (base case)
-    // Otherwise add the head to the recursive result of the remainder of the list to compute sum
-    return (list_head == list_end)  ? 0
-                                    : *list_head + sumlist<T, input_iterator>(list_head+1, list_end); 
+// MaybeBatch. An array of Maybe values stored as one array of values and one
+// validity bit per element (64 elements per mask word), in place of one
+// std::optional per element. A lane without a value keeps whatever is in its
+// value slot, which is never read
+template <typename T>
+class MaybeBatch
+{
+public:
+    static constexpr std::size_t lanes_per_word = 64;
+
+    MaybeBatch() = default;
+
+    // Every element has a value
+    explicit MaybeBatch(std::vector<T> values)
+        : m_values(std::move(values)), m_mask((m_values.size() + lanes_per_word - 1) / lanes_per_word, ~uint64_t(0))
+    {
+        clear_unused_lanes();
+    }
+
+    MaybeBatch(std::vector<T> values, std::vector<uint64_t> mask)
+        : m_values(std::move(values)), m_mask(std::move(mask))
+    {
+        m_mask.resize((m_values.size() + lanes_per_word - 1) / lanes_per_word, 0);
+        clear_unused_lanes();
+    }
+
+    std::size_t size() const { return m_values.size(); }
+
+    bool has_value(std::size_t index) const
+    {
+        return (m_mask[index / lanes_per_word] >> (index % lanes_per_word)) & 1;
+    }
+
+    // Only meaningful when has_value(index) is true
+    const T& value(std::size_t index) const { return m_values[index]; }
+
+    std::optional<T> operator[](std::size_t index) const
+    {
+        if (!has_value(index))
+            return std::nullopt;
+        return m_values[index];
+    }
+
+    std::size_t count_valid() const
+    {
+        std::size_t count = 0;
+        for (uint64_t word : m_mask)
+            count += static_cast<std::size_t>(__builtin_popcountll(word));
+        return count;
+    }
+
+    std::vector<std::optional<T>> to_optionals() const
+    {
+        std::vector<std::optional<T>> optionals;
+        optionals.reserve(size());
+        for (std::size_t i = 0; i < size(); i++)
+            optionals.push_back((*this)[i]);
+        return optionals;
+    }
+
+    const std::vector<T>& values() const { return m_values; }
+    const std::vector<uint64_t>& mask() const { return m_mask; }
+    std::vector<T>& values() { return m_values; }
+    std::vector<uint64_t>& mask() { return m_mask; }
+
+private:
+    // Lanes past the end of the values never have a value
+    void clear_unused_lanes()
+    {
+        std::size_t used = m_values.size() % lanes_per_word;
+        if (used != 0)
+            m_mask.back() &= (uint64_t(1) << used) - 1;
+    }
+
+    std::vector<T> m_values;
+    std::vector<uint64_t> m_mask;
+};
+
+// MaybeKernel. A Maybe function split into a guard, which says whether an
+// input gives a value, and a transform, which computes the value for any input.
+// Neither has a branch on the data, so a batch can run both over a whole mask
+// word of lanes at once instead of calling a function per element
+template <typename guard_type, typename transform_type>
+struct MaybeKernel
+{
+    guard_type guard;
+    transform_type transform;
+};
+
+template <typename guard_type, typename transform_type>
+MaybeKernel<guard_type, transform_type> maybe_kernel(guard_type guard, transform_type transform)
+{
+    return {std::move(guard), std::move(transform)};
+}
+
+namespace detail
+{
+// Pack 64 bytes, each 0 or 1, into one mask word (byte i becomes bit i).
+// A multiply gathers eight bytes into eight bits at a time
+__attribute__((always_inline)) inline uint64_t pack_lane_bytes(const uint8_t* bytes)
+{
+    uint64_t word = 0;
+    for (std::size_t group = 0; group < 8; group++)
+    {
+        uint64_t eight_bytes;
+        std::memcpy(&eight_bytes, bytes + group * 8, sizeof(eight_bytes));
+        word |= ((eight_bytes * 0x0102040810204080ull) >> 56) << (group * 8);
+    }
+    return word;
+}
+
+// Run a kernel over the lanes of one mask word. Called with a constant count
+// of 64 for full words, so the loops have a fixed trip count the compiler can
+// vectorize. The lanes are copied in first, so in and out may be the same array
+template <typename T, typename U, typename guard_type, typename transform_type>
+__attribute__((always_inline)) inline uint64_t run_kernel_lanes(const T* in, U* out, std::size_t count,
+                                                                const guard_type& guard,
+                                                                const transform_type& transform)
+{
+    T lanes[64];
+    uint8_t valid[64] = {};
+    std::copy(in, in + count, lanes);
+    for (std::size_t lane = 0; lane < count; lane++)
+        valid[lane] = guard(lanes[lane]) ? 1 : 0;
+    for (std::size_t lane = 0; lane < count; lane++)
+        out[lane] = transform(lanes[lane]);
+    return pack_lane_bytes(valid);
+}
+} // namespace detail
+
+// Bind a batch to a kernel, one pass over the values and the mask. Mask words
+// with no value left are skipped, which is the batch form of the Maybe short
+// circuit. The batch is taken by value: a moved in batch whose value type does
+// not change is updated in place, without allocating
+template <typename T, typename guard_type, typename transform_type>
+auto bind_maybe(MaybeBatch<T> batch, const MaybeKernel<guard_type, transform_type>& kernel)
+{
+    using U = std::decay_t<std::invoke_result_t<const transform_type&, const T&>>;
+    constexpr std::size_t lanes_per_word = MaybeBatch<T>::lanes_per_word;
+    std::vector<uint64_t>& mask = batch.mask();
+    if constexpr (trace::enabled)
+        FP_TRACE_SHORT_CIRCUIT("bind_maybe (batch lanes)", batch.size() - batch.count_valid());
+    const T* in = batch.values().data();
+    std::vector<U> new_values;
+    U* out;
+    if constexpr (std::is_same_v<U, T>)
+        out = batch.values().data();
+    else
+    {
+        new_values.resize(batch.size());
+        out = new_values.data();
+    }
+
+    for (std::size_t word = 0; word < mask.size(); word++)
+    {
+        if (mask[word] == 0)
+            continue;
+        std::size_t first = word * lanes_per_word;
+        std::size_t count = batch.size() - first;
+        uint64_t valid = (count >= lanes_per_word)
+            ? detail::run_kernel_lanes(in + first, out + first, lanes_per_word, kernel.guard, kernel.transform)
+            : detail::run_kernel_lanes(in + first, out + first, count, kernel.guard, kernel.transform);
+        mask[word] &= valid;
+    }
+
+    if constexpr (std::is_same_v<U, T>)
+        return batch;
+    else
+        return MaybeBatch<U>(std::move(new_values), std::move(mask));
+}
+
+// Bind a batch to an ordinary Maybe function (one returning std::optional).
+// The function is only called for lanes which still have a value, and each
+// value is moved into it
+template <typename T, typename F,
+          typename = std::enable_if_t<detail::is_optional_v<std::decay_t<std::invoke_result_t<F&, T&&>>>>>
+auto bind_maybe(MaybeBatch<T> batch, F&& f)
+{
+    using U = typename std::decay_t<std::invoke_result_t<F&, T&&>>::value_type;
+    std::vector<U> new_values(batch.size());
+    std::vector<uint64_t>& mask = batch.mask();
+    if constexpr (trace::enabled)
+        FP_TRACE_SHORT_CIRCUIT("bind_maybe (batch lanes)", batch.size() - batch.count_valid());
+    for (std::size_t i = 0; i < batch.size(); i++)
+    {
+        if (!batch.has_value(i))
+            continue;
+        auto result = std::invoke(f, std::move(batch.values()[i]));
+        if (result)
+            new_values[i] = std::move(*result);
+        else
+            mask[i / MaybeBatch<T>::lanes_per_word] &= ~(uint64_t(1) << (i % MaybeBatch<T>::lanes_per_word));
+    }
+    return MaybeBatch<U>(std::move(new_values), std::move(mask));
+}
+
+// The | operator binds a batch with the same syntax as a single optional
+template <typename T, typename F>
+auto operator|(MaybeBatch<T> batch, F&& f)
+{
+    return bind_maybe(std::move(batch), std::forward<F>(f));
+}
+} // namespace fp
+
+// Batch versions of the Maybe example functions. divide_batch starts a chain
+// from two arrays, and the kernels are square_root and double_opt split into
+// guard and transform, so the chain divide | square_root | double_opt over a
+// million values becomes three passes over arrays
+fp::MaybeBatch<double> divide_batch(const std::vector<double>& nums, const std::vector<double>& denoms)
+{
+    std::size_t count = std::min(nums.size(), denoms.size());
+    constexpr std::size_t lanes_per_word = fp::MaybeBatch<double>::lanes_per_word;
+    std::vector<double> values(count);
+    std::vector<uint64_t> mask((count + lanes_per_word - 1) / lanes_per_word, 0);
+    // Full words run with a constant lane count, so the loop can be vectorized
+    auto divide_lanes = [&](std::size_t first, std::size_t lanes) __attribute__((always_inline))
+    {
+        uint8_t valid[lanes_per_word] = {};
+        for (std::size_t lane = 0; lane < lanes; lane++)
+        {
+            valid[lane] = (denoms[first + lane] != 0.0) ? 1 : 0;
+            values[first + lane] = nums[first + lane] / denoms[first + lane];
+        }
+        mask[first / lanes_per_word] = fp::detail::pack_lane_bytes(valid);
+    };
+    for (std::size_t first = 0; first < count; first += lanes_per_word)
+    {
+        if (count - first >= lanes_per_word)
+            divide_lanes(first, lanes_per_word);
+        else
+            divide_lanes(first, count - first);
+    }
+    return fp::MaybeBatch<double>(std::move(values), std::move(mask));
 }
 
+auto square_root_kernel = fp::maybe_kernel([](double num){ return !(num < 0); },
+                                           [](double num){ return sqrt(num); });
+
+auto double_kernel = fp::maybe_kernel([](double){ return true; },
+                                      [](double num){ return num * 2; });
+
 //////////////////////////////////////////////////////////////////////////////
-// List Tail Recursion
+// Either Monad. Error handling which says why, with small error codes
 //////////////////////////////////////////////////////////////////////////////
 
-// sumlist. Compute the sum of all of the elements of a list
-// Uses tail recursion on the list
-// Use iterators to track the head of the list
-template<typename T, typename input_iterator>
-T sumlist_tail(input_iterator list_head, input_iterator list_end, T accumulator = 0)
+namespace fp
 {
-    // When the head and end iterators equal, we have finished our recursion (base case)
-    // Otherwise add the head to the current result in an accumulator, while recursively working through the list 
-    return (list_head == list_end)  ? accumulator
-                                    : sumlist_tail<T, input_iterator>(list_head+1, list_end, *list_head + accumulator); 
+// The error side of an Either. A function which returns an Either gives an
+// error with: return fp::unexpected(code);
+template <typename E>
+struct Unexpected
+{
+    E error;
+};
+
+template <typename E>
+constexpr Unexpected<std::decay_t<E>> unexpected(E&& error)
+{
+    return {std::forward<E>(error)};
+}
+
+// Either. A value of type T, or an error of type E which says why there is no
+// value. Errors are small codes (an enum, an int, a const char* message): E
+// must be trivially copyable, so handing an error down a chain is a register
+// copy, and an Either of a trivially copyable T is trivially copyable too.
+// Default construction holds a value initialized T, as for std::expected
+template <typename E, typename T>
+class Either
+{
+    static_assert(std::is_trivially_copyable_v<E>, "Either error types must be trivially copyable codes");
+
+public:
+    using error_type = E;
+    using value_type = T;
+
+    constexpr Either() : m_value(std::in_place) {}
+    constexpr Either(const T& value) : m_value(value) {}
+    constexpr Either(T&& value) : m_value(std::move(value)) {}
+    template <typename G, typename = std::enable_if_t<std::is_convertible_v<G, E>>>
+    constexpr Either(Unexpected<G> failure) : m_error(E(failure.error)) {}
+
+    constexpr bool has_value() const { return m_value.has_value(); }
+    constexpr explicit operator bool() const { return has_value(); }
+
+    // Checked access. Throws std::bad_optional_access when there is an error
+    constexpr T& value() & { return m_value.value(); }
+    constexpr const T& value() const & { return m_value.value(); }
+    constexpr T&& value() && { return std::move(m_value).value(); }
+
+    // Unchecked access. Only meaningful when has_value() is true
+    constexpr T& operator*() & { return *m_value; }
+    constexpr const T& operator*() const & { return *m_value; }
+    constexpr T&& operator*() && { return std::move(*m_value); }
+
+    // Only meaningful when has_value() is false
+    constexpr E error() const { return m_error; }
+
+    template <typename U>
+    constexpr T value_or(U&& fallback) const & { return m_value.value_or(std::forward<U>(fallback)); }
+    template <typename U>
+    constexpr T value_or(U&& fallback) && { return std::move(m_value).value_or(std::forward<U>(fallback)); }
+
+    // Drop the error, for code which only needs to know whether there is a value
+    const std::optional<T>& to_optional() const & { return m_value; }
+    std::optional<T> to_optional() && { return std::move(m_value); }
+
+    friend constexpr bool operator==(const Either& a, const Either& b)
+    {
+        return a.m_value == b.m_value && (a.has_value() || a.m_error == b.m_error);
+    }
+    friend constexpr bool operator!=(const Either& a, const Either& b) { return !(a == b); }
+
+private:
+    // The error sits beside the value, not in a union with it, so setting one
+    // never overwrites part of the other: a chain of trivially copyable
+    // Eithers stays in registers instead of going through memory
+    std::optional<T> m_value;
+    E m_error{};
+};
+
+namespace detail
+{
+template <typename T> struct is_either : std::false_type {};
+template <typename E, typename T> struct is_either<Either<E, T>> : std::true_type {};
+template <typename T> constexpr bool is_either_v = is_either<T>::value;
+
+template <typename T> struct is_error_mapper : std::false_type {};
+} // namespace detail
+
+// Bind operation for the Either monad. f is called with the value, and must
+// return an Either with the same error type. An error skips f and is passed
+// on unchanged, so a chain reports the first error it met. As for bind_maybe,
+// an rvalue Either moves its value into f, and a skipped stage is traced as a
+// short circuit
+template <typename either_type, typename F,
+          typename = std::enable_if_t<detail::is_either_v<std::decay_t<either_type>>>>
+auto bind_either(either_type&& m, F&& f)
+        -> decltype(std::invoke(std::forward<F>(f), *std::forward<either_type>(m)))
+{
+    using R = std::decay_t<decltype(std::invoke(std::forward<F>(f), *std::forward<either_type>(m)))>;
+    static_assert(detail::is_either_v<R>, "An Either stage must return an Either");
+    static_assert(std::is_same_v<typename R::error_type, typename std::decay_t<either_type>::error_type>,
+                  "An Either stage must keep the error type of the chain; use map_error to change it");
+    if (m)
+        return std::invoke(std::forward<F>(f), *std::forward<either_type>(m));
+    FP_TRACE_SHORT_CIRCUIT("bind_either", 1);
+    return unexpected(m.error());
+}
+
+// map_error. Change the error of an Either with g, and keep a value as it is.
+// Used to turn one stage's error codes into the codes of a wider chain, or
+// into messages at the edge of the program
+template <typename either_type, typename G,
+          typename = std::enable_if_t<detail::is_either_v<std::decay_t<either_type>>>>
+auto map_error(either_type&& m, G&& g)
+{
+    using E = typename std::decay_t<either_type>::error_type;
+    using T = typename std::decay_t<either_type>::value_type;
+    using mapped_error = std::decay_t<std::invoke_result_t<G&, E>>;
+    if (m)
+        return Either<mapped_error, T>(*std::forward<either_type>(m));
+    return Either<mapped_error, T>(unexpected(std::invoke(g, m.error())));
+}
+
+// map_error(g) on its own is a stage for the | operator:
+//     divide_either(x, y) | square_root_either | fp::map_error(describe)
+template <typename G>
+struct ErrorMapper
+{
+    G g;
+};
+
+template <typename G>
+ErrorMapper<std::decay_t<G>> map_error(G&& g)
+{
+    return {std::forward<G>(g)};
+}
+
+namespace detail
+{
+template <typename G> struct is_error_mapper<ErrorMapper<G>> : std::true_type {};
+} // namespace detail
+
+// The | operator binds an Either, with the same syntax as std::optional
+template <typename either_type, typename F,
+          typename = std::enable_if_t<detail::is_either_v<std::decay_t<either_type>>>>
+auto operator|(either_type&& m, F&& f)
+{
+    if constexpr (detail::is_error_mapper<std::decay_t<F>>::value)
+        return map_error(std::forward<either_type>(m), std::forward<F>(f).g);
+    else
+        return bind_either(std::forward<either_type>(m), std::forward<F>(f));
+}
+
+// EitherBatch. An array of Either values stored as one array of values and a
+// side array of error codes, one per element. The zero code E{} means the
+// element has a value, so an error enum used in a batch keeps 0 for "no
+// error". An element with an error keeps whatever is in its value slot, which
+// is never read
+template <typename E, typename T>
+class EitherBatch
+{
+    static_assert(std::is_trivially_copyable_v<E>, "Either error types must be trivially copyable codes");
+
+public:
+    EitherBatch() = default;
+
+    // Every element has a value
+    explicit EitherBatch(std::vector<T> values)
+        : m_values(std::move(values)), m_errors(m_values.size(), E{})
+    {
+    }
+
+    EitherBatch(std::vector<T> values, std::vector<E> errors)
+        : m_values(std::move(values)), m_errors(std::move(errors))
+    {
+        m_errors.resize(m_values.size(), E{});
+    }
+
+    std::size_t size() const { return m_values.size(); }
+
+    bool has_value(std::size_t index) const { return m_errors[index] == E{}; }
+
+    // Only meaningful when has_value(index) is true
+    const T& value(std::size_t index) const { return m_values[index]; }
+
+    E error(std::size_t index) const { return m_errors[index]; }
+
+    Either<E, T> operator[](std::size_t index) const
+    {
+        if (!has_value(index))
+            return unexpected(m_errors[index]);
+        return m_values[index];
+    }
+
+    std::size_t count_valid() const
+    {
+        return static_cast<std::size_t>(std::count(m_errors.begin(), m_errors.end(), E{}));
+    }
+
+    std::vector<Either<E, T>> to_eithers() const
+    {
+        std::vector<Either<E, T>> eithers;
+        eithers.reserve(size());
+        for (std::size_t i = 0; i < size(); i++)
+            eithers.push_back((*this)[i]);
+        return eithers;
+    }
+
+    const std::vector<T>& values() const { return m_values; }
+    const std::vector<E>& errors() const { return m_errors; }
+    std::vector<T>& values() { return m_values; }
+    std::vector<E>& errors() { return m_errors; }
+
+private:
+    std::vector<T> m_values;
+    std::vector<E> m_errors;
+};
+
+// EitherKernel. An Either function split into a check, which returns the error
+// code an input gives (E{} for none), and a transform, which computes the value
+// for any input. Neither branches on the data, so a batch runs both over every
+// element in a loop the compiler can vectorize
+template <typename check_type, typename transform_type>
+struct EitherKernel
+{
+    check_type check;
+    transform_type transform;
+};
+
+template <typename check_type, typename transform_type>
+EitherKernel<check_type, transform_type> either_kernel(check_type check, transform_type transform)
+{
+    return {std::move(check), std::move(transform)};
+}
+
+namespace detail
+{
+// Run an Either kernel over a block of up to 64 elements. Called with a
+// constant count for full blocks, so the loops have a fixed trip count the
+// compiler can vectorize. The values are copied in first, so in and out may
+// be the same array
+template <typename T, typename U, typename E, typename check_type, typename transform_type>
+__attribute__((always_inline)) inline void run_either_kernel_lanes(const T* in, U* out, E* errors, std::size_t count,
+                                                                   const check_type& check,
+                                                                   const transform_type& transform)
+{
+    T lanes[64];
+    E found[64];
+    std::copy(in, in + count, lanes);
+    for (std::size_t lane = 0; lane < count; lane++)
+        found[lane] = check(lanes[lane]);
+    for (std::size_t lane = 0; lane < count; lane++)
+        out[lane] = transform(lanes[lane]);
+    for (std::size_t lane = 0; lane < count; lane++)
+        errors[lane] = (errors[lane] == E{}) ? found[lane] : errors[lane];
+}
+} // namespace detail
+
+// Bind a batch to a kernel, one pass over the values and the error codes. An
+// element which already has an error keeps it, which is the batch form of the
+// Either short circuit: each element reports the first error its chain met.
+// The batch is taken by value: a moved in batch whose value type does not
+// change is updated in place, without allocating
+template <typename E, typename T, typename check_type, typename transform_type>
+auto bind_either(EitherBatch<E, T> batch, const EitherKernel<check_type, transform_type>& kernel)
+{
+    using U = std::decay_t<std::invoke_result_t<const transform_type&, const T&>>;
+    static_assert(std::is_convertible_v<std::invoke_result_t<const check_type&, const T&>, E>,
+                  "An Either kernel check must return the error type of the batch");
+    if constexpr (trace::enabled)
+        FP_TRACE_SHORT_CIRCUIT("bind_either (batch elements)", batch.size() - batch.count_valid());
+    const T* in = batch.values().data();
+    E* errors = batch.errors().data();
+    std::vector<U> new_values;
+    U* out;
+    if constexpr (std::is_same_v<U, T>)
+        out = batch.values().data();
+    else
+    {
+        new_values.resize(batch.size());
+        out = new_values.data();
+    }
+
+    constexpr std::size_t lanes_per_block = 64;
+    for (std::size_t first = 0; first < batch.size(); first += lanes_per_block)
+    {
+        std::size_t count = batch.size() - first;
+        if (count >= lanes_per_block)
+            detail::run_either_kernel_lanes(in + first, out + first, errors + first, lanes_per_block,
+                                            kernel.check, kernel.transform);
+        else
+            detail::run_either_kernel_lanes(in + first, out + first, errors + first, count,
+                                            kernel.check, kernel.transform);
+    }
+
+    if constexpr (std::is_same_v<U, T>)
+        return batch;
+    else
+        return EitherBatch<E, U>(std::move(new_values), std::move(batch.errors()));
+}
+
+// Bind a batch to an ordinary Either function. The function is only called
+// for elements which still have a value, and each value is moved into it
+template <typename E, typename T, typename F,
+          typename = std::enable_if_t<detail::is_either_v<std::decay_t<std::invoke_result_t<F&, T&&>>>>>
+auto bind_either(EitherBatch<E, T> batch, F&& f)
+{
+    using R = std::decay_t<std::invoke_result_t<F&, T&&>>;
+    static_assert(std::is_same_v<typename R::error_type, E>,
+                  "An Either stage must keep the error type of the chain; use map_error to change it");
+    using U = typename R::value_type;
+    std::vector<U> new_values(batch.size());
+    std::vector<E>& errors = batch.errors();
+    if constexpr (trace::enabled)
+        FP_TRACE_SHORT_CIRCUIT("bind_either (batch elements)", batch.size() - batch.count_valid());
+    for (std::size_t i = 0; i < batch.size(); i++)
+    {
+        if (errors[i] != E{})
+            continue;
+        R result = std::invoke(f, std::move(batch.values()[i]));
+        if (result)
+            new_values[i] = std::move(*result);
+        else
+            errors[i] = result.error();
+    }
+    return EitherBatch<E, U>(std::move(new_values), std::move(errors));
+}
+
+// Change the error codes of a batch with g. Only the elements with an error
+// are mapped, and g must not map an error to the zero code
+template <typename E, typename T, typename G>
+auto map_error(EitherBatch<E, T> batch, G&& g)
+{
+    using mapped_error = std::decay_t<std::invoke_result_t<G&, E>>;
+    std::vector<mapped_error> mapped(batch.size(), mapped_error{});
+    const std::vector<E>& errors = batch.errors();
+    for (std::size_t i = 0; i < batch.size(); i++)
+        if (errors[i] != E{})
+            mapped[i] = std::invoke(g, errors[i]);
+    return EitherBatch<mapped_error, T>(std::move(batch.values()), std::move(mapped));
+}
+
+// The | operator binds a batch with the same syntax as a single Either
+template <typename E, typename T, typename F>
+auto operator|(EitherBatch<E, T> batch, F&& f)
+{
+    if constexpr (detail::is_error_mapper<std::decay_t<F>>::value)
+        return map_error(std::move(batch), std::forward<F>(f).g);
+    else
+        return bind_either(std::move(batch), std::forward<F>(f));
+}
+} // namespace fp
+
+// Error codes of the Either versions of the Maybe example functions. 0 is kept
+// for "no error", so the codes can fill the side array of an EitherBatch
+enum class math_error : uint8_t
+{
+    none = 0,
+    divide_by_zero,
+    negative_square_root
+};
+
+// Divide Either monad function which fails when the denominator is 0
+fp::Either<math_error, double> divide_either(double num, double denom)
+{
+    FP_TRACE_SCOPE("divide_either");
+    if (denom == 0.0)
+        return fp::unexpected(math_error::divide_by_zero);
+    else
+        return num / denom;
+}
+
+// Square root Either monad function which fails when the value to root is negative
+fp::Either<math_error, double> square_root_either(double num)
+{
+    FP_TRACE_SCOPE("square_root_either");
+    if (num < 0)
+        return fp::unexpected(math_error::negative_square_root);
+    else
+        return sqrt(num);
+}
+
+// Double Either monad. No failure. Just performs the double operation
+fp::Either<math_error, double> double_either(double num)
+{
+    FP_TRACE_SCOPE("double_either");
+    return num * 2;
+}
+
+// Batch versions of the Either example functions. divide_either_batch starts
+// a chain from two arrays, with the error codes in the side array, and the
+// kernels are square_root_either and double_either split into check and
+// transform
+fp::EitherBatch<math_error, double> divide_either_batch(const std::vector<double>& nums,
+                                                        const std::vector<double>& denoms)
+{
+    std::size_t count = std::min(nums.size(), denoms.size());
+    std::vector<double> values(count);
+    std::vector<math_error> errors(count);
+    for (std::size_t i = 0; i < count; i++)
+    {
+        errors[i] = (denoms[i] == 0.0) ? math_error::divide_by_zero : math_error::none;
+        values[i] = nums[i] / denoms[i];
+    }
+    return fp::EitherBatch<math_error, double>(std::move(values), std::move(errors));
 }
 
+auto square_root_either_kernel = fp::either_kernel(
+    [](double num){ return (num < 0) ? math_error::negative_square_root : math_error::none; },
+    [](double num){ return sqrt(num); });
+
+auto double_either_kernel = fp::either_kernel([](double){ return math_error::none; },
+                                              [](double num){ return num * 2; });
+
 //////////////////////////////////////////////////////////////////////////////
-// High Order FUnctions (HOF). Haskell map and foldr equivalent
+// Property checks. Seeded random differential tests of fast kernels against references
 //////////////////////////////////////////////////////////////////////////////
 
-// inclist_HOF. increment each element of a list by 1
-// Uses a High Order Function (HOF) to complete task. for_each is equivalent to Haskell map
-template<typename T>
-void inclist_HOF(std::vector<T>& in_list)
+namespace fp::check
 {
-    // apply the lambda function (which increments the element) over the entire list
-    // Applying a function in for_each is equivalent to applying a function via Haskell map.
-    // The function will be applied to each element of the list
-    std::for_each(in_list.begin(), in_list.end(), [](T& x){x = x + 1;});
-}
+// Random. A SplitMix64 generator: small, fast, and fully determined by its seed
+class Random
+{
+public:
+    explicit Random(uint64_t seed) : m_state(seed) {}
 
-// sumlist_HOF. Compute the sum of all of the elements of a list
-// Uses a High Order Function (HOF) to complete task. accumulate is equivelent to Haskell foldr
-template<typename T>
-T sumlist_HOF(std::vector<T>& in_list)
+    uint64_t next()
+    {
+        uint64_t z = (m_state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform in [0, bound). 0 for a bound of 0
+    uint64_t below(uint64_t bound) { return (bound == 0) ? 0 : next() % bound; }
+
+    // Uniform in [0, 1)
+    double uniform() { return double(next() >> 11) * 0x1.0p-53; }
+
+    bool one_in(uint64_t n) { return below(n) == 0; }
+
+private:
+    uint64_t m_state;
+};
+
+// Seed of one case of a run. Each case has a generator of its own, so any case
+// can be regenerated alone, and the inputs do not depend on the thread count
+inline uint64_t case_seed(uint64_t seed, std::size_t index)
 {
-    // apply the lambda function (which adds elements to a sum) over the entire list
-    // Applying a function in accumulate is equivalent to applying a function via Haskell foldr
-    // The function will be applied (folding) starting with a base value to each element in the list
-    return std::accumulate(in_list.begin(), in_list.end(), 0.0, [](T a, T b){return a + b;});
+    return Random(seed ^ (uint64_t(index) * 0xD1B54A32D192ED03ull)).next();
 }
 
-// Algebraic Data Types (ADTs)
-// ADT for shape
-class Shape
+// Generators. A generator is a type with
+//     value_type                          the type of the inputs it makes
+//     value_type operator()(Random&)      a random input
+//     std::vector<value_type> shrink(x)   simpler inputs to try when x fails
+// and optionally describe(std::ostream&, x), to print an input for a report
+
+// Random doubles in [low, high]. One in eight is an edge value of the range
+// (the ends, 0, -0, +-1, the smallest normal and subnormal numbers, epsilon).
+// With special_values, one in sixteen is NaN, an infinity or a subnormal,
+// whatever the range
+struct real_generator
 {
-public:
-    struct circle
-    {
-        double radius;
-    };
-    struct square
-    {
-        double side;
-    };
-    struct rectangle
-    {
-        double length;
-        double width;
-    };
-    struct ellipse
+    using value_type = double;
+    double low;
+    double high;
+    bool special_values = false;
+
+    double operator()(Random& random) const
     {
-        // Axis relative to the center
-        double axis_1;
-        double axis_2;
-    };
-    struct cylinder
+        using limits = std::numeric_limits<double>;
+        if (special_values && random.one_in(16))
+        {
+            const double specials[] = {limits::quiet_NaN(), limits::infinity(), -limits::infinity(),
+                                       limits::denorm_min(), -limits::denorm_min()};
+            return specials[random.below(std::size(specials))];
+        }
+        if (random.one_in(8))
+        {
+            const double edges[] = {low, high, 0.0, -0.0, 1.0, -1.0, limits::min(), -limits::min(),
+                                    limits::denorm_min(), limits::epsilon()};
+            double edge = edges[random.below(std::size(edges))];
+            if (edge >= low && edge <= high)
+                return edge;
+        }
+        return low + (high - low) * random.uniform();
+    }
+
+    // Toward the value in range nearest 0: that value, the whole part, and
+    // half way there. Each candidate is smaller or whole, so shrinking ends
+    std::vector<double> shrink(double x) const
     {
-        double radius;
-        double height;
-    };
+        double target = std::min(std::max(0.0, low), high);
+        std::vector<double> candidates;
+        auto add = [&](double candidate) {
+            if (candidate >= low && candidate <= high && candidate != x)
+                candidates.push_back(candidate);
+        };
+        if (!std::isfinite(x))
+            return {target};
+        add(target);
+        add(std::trunc(x));
+        if (std::fabs(x - target) >= 2.0)
+            add(std::trunc(target + (x - target) / 2));
+        return candidates;
+    }
 };
 
-//////////////////////////////////////////////////////////////////////////////
-// Algebraic Data Types (ADTs) using sum types
-//////////////////////////////////////////////////////////////////////////////
+inline real_generator doubles(double low, double high, bool special_values = false)
+{
+    return {low, high, special_values};
+}
 
-// std::variant used to create an ADT sum type
-// The adt_shape sum type can be any of the shapes referenced below
-using adt_shape = std::variant<Shape::circle, Shape::square, Shape::rectangle, Shape::ellipse, Shape::cylinder>;
+// Random integers in [low, high]. One in eight is an edge value (the ends, 0, +-1)
+template <typename T>
+struct integer_generator
+{
+    static_assert(std::is_integral_v<T>, "integer_generator makes integers");
+    using value_type = T;
+    T low;
+    T high;
 
-// Overloaded function which separates implementations for different sum types
-// Necessary for pattern matching with std::variant
-template <typename... Ts>
-struct overloaded : Ts... { using Ts::operator()...; };
-template <typename... Ts> overloaded(Ts...) -> overloaded<Ts...>;
+    T operator()(Random& random) const
+    {
+        if (random.one_in(8))
+        {
+            const T edges[] = {low, high, T(0), T(1), T(-1)};
+            T edge = edges[random.below(std::size(edges))];
+            if (edge >= low && edge <= high)
+                return edge;
+        }
+        using wide = std::make_unsigned_t<T>;
+        wide span = wide(wide(high) - wide(low));
+        wide offset = (span == std::numeric_limits<wide>::max()) ? wide(random.next())
+                                                                 : wide(random.below(uint64_t(span) + 1));
+        return T(wide(low) + offset);
+    }
 
-//////////////////////////////////////////////////////////////////////////////
-// Pattern Matching using ADT
-//////////////////////////////////////////////////////////////////////////////
+    // Toward the value in range nearest 0: that value, half way there, and one step
+    std::vector<T> shrink(T x) const
+    {
+        T target = std::min(std::max(T(0), low), high);
+        if (x == target)
+            return {};
+        std::vector<T> candidates{target};
+        T half = T(x - (x - target) / 2);
+        if (half != x && half != target)
+            candidates.push_back(half);
+        T step = (x > target) ? T(x - 1) : T(x + 1);
+        if (step != target && step != half)
+            candidates.push_back(step);
+        return candidates;
+    }
+};
 
-// Compute the area of any of the allowable shapes
-// Pattern matching is used to determine which area computation to use, 
-// depending on the shape
-double compute_area(const adt_shape& shape)
+template <typename T>
+integer_generator<T> integers(T low, T high)
 {
-    double area;
-    std::visit(overloaded
-    {
-        [&area](const Shape::circle& circle) { 
-            area = M_PI * pow(circle.radius, 2.0); },
-        [&area](const Shape::square& square) { 
-            area = pow(square.side, 2.0); },
-        [&area](const Shape::rectangle& rectangle) { 
-            area = rectangle.length * rectangle.width; },
-        [&area](const Shape::ellipse& ellipse) { 
-            area = M_PI * ellipse.axis_1 * ellipse.axis_2; },
-        [&area](const Shape::cylinder& cylinder) { 
-            area = 2 * M_PI * cylinder.radius * 
-                (cylinder.radius + cylinder.height); }
-    }, shape);
-    return area;
+    return {low, high};
 }
 
-//////////////////////////////////////////////////////////////////////////////
-// Function Currying. Create functions that return functions that can be curried
-//////////////////////////////////////////////////////////////////////////////
-
-// Curry Function. Create an output lambda function that adds the number
-// passed in from the original with whatever else is used as the output function argument
-template<typename T>
-auto add(T first_in)
+namespace detail
 {
-    return [first_in](T second_in) {return first_in + second_in;};
-}
+template <typename T, typename = void> struct is_streamable : std::false_type {};
+template <typename T>
+struct is_streamable<T, std::void_t<decltype(std::declval<std::ostream&>() << std::declval<const T&>())>>
+    : std::true_type {};
 
-// Use currying to eaily create new functions
-auto inc = add(1.0);
-auto add2 = add(2.0);
-auto add3 = add(3.0);
+template <typename T> struct is_vector : std::false_type {};
+template <typename T, typename allocator_type> struct is_vector<std::vector<T, allocator_type>> : std::true_type {};
 
-// Curry Function. Create an output lambda function that multiplies the number
-// passed in from the original with whatever else is used as the output function argument
-template<typename T>
-auto mult(T first_in)
+template <typename T> struct is_pair : std::false_type {};
+template <typename A, typename B> struct is_pair<std::pair<A, B>> : std::true_type {};
+
+// Longest list written out in full in a report
+constexpr std::size_t described_elements = 32;
+
+// Print a value for a report: floating point numbers to the last bit, enums
+// as their number, and lists, pairs, optionals and Eithers element by element
+template <typename T>
+void describe_value(std::ostream& out, const T& value)
 {
-    return [first_in](T second_in) {return first_in * second_in;};
+    if constexpr (std::is_floating_point_v<T>)
+    {
+        auto precision = out.precision(std::numeric_limits<T>::max_digits10);
+        out << value;
+        out.precision(precision);
+    }
+    else if constexpr (std::is_enum_v<T>)
+        out << +static_cast<std::underlying_type_t<T>>(value);
+    else if constexpr (std::is_integral_v<T>)
+        out << +value;
+    else if constexpr (is_vector<T>::value)
+    {
+        out << "[";
+        for (std::size_t i = 0; i < value.size() && i < described_elements; i++)
+        {
+            out << (i ? ", " : "");
+            describe_value(out, value[i]);
+        }
+        if (value.size() > described_elements)
+            out << ", ... (" << value.size() << " elements)";
+        out << "]";
+    }
+    else if constexpr (is_pair<T>::value)
+    {
+        out << "(";
+        describe_value(out, value.first);
+        out << ", ";
+        describe_value(out, value.second);
+        out << ")";
+    }
+    else if constexpr (fp::detail::is_optional_v<T>)
+    {
+        if (value)
+            describe_value(out, *value);
+        else
+            out << "nothing";
+    }
+    else if constexpr (fp::detail::is_either_v<T>)
+    {
+        if (value)
+            describe_value(out, *value);
+        else
+        {
+            out << "error ";
+            describe_value(out, value.error());
+        }
+    }
+    else if constexpr (is_streamable<T>::value)
+        out << value;
+    else
+        out << "<" << sizeof(T) << " byte value>";
 }
 
-// Use currying to eaily create new functions
-auto times2 = mult(2.0);
-auto triple = mult(3.0);
-auto quadruple = mult(4.0);
+template <typename generator_type, typename T, typename = void>
+struct has_describe : std::false_type {};
+template <typename generator_type, typename T>
+struct has_describe<generator_type, T, std::void_t<decltype(std::declval<const generator_type&>().describe(
+    std::declval<std::ostream&>(), std::declval<const T&>()))>> : std::true_type {};
 
-// Curry Function. Create an output lambda function that computes a tip based the number (percentage)
-// passed in from the original with whatever else is used as the output function argument (total)
-auto compute_tip(double tip_percent)
+// Print an input the way its generator describes it, if it does
+template <typename generator_type, typename T>
+void describe_input(std::ostream& out, const generator_type& generator, const T& value)
 {
-    return [tip_percent](double subtotal) {return (tip_percent / 100.0) * subtotal;};
+    if constexpr (has_describe<generator_type, T>::value)
+        generator.describe(out, value);
+    else
+        describe_value(out, value);
 }
+} // namespace detail
 
-// Use currying to eaily create new functions
-auto compute_low_tip = compute_tip(10.0);
-auto compute_avg_tip = compute_tip(15.0);
-auto compute_high_tip = compute_tip(20.0);
+// Random lists of up to max_size elements. Empty lists, single elements and
+// full size lists each come up one time in sixteen
+template <typename element_generator>
+struct vector_generator
+{
+    using value_type = std::vector<typename element_generator::value_type>;
+    element_generator element;
+    std::size_t max_size;
 
-//////////////////////////////////////////////////////////////////////////////
-// Lazy evaluation. Only compute fibonacci sequence when needed and not done before
-//////////////////////////////////////////////////////////////////////////////
+    value_type operator()(Random& random) const
+    {
+        std::size_t size;
+        switch (random.below(16))
+        {
+        case 0: size = 0; break;
+        case 1: size = std::min<std::size_t>(1, max_size); break;
+        case 2: size = max_size; break;
+        default: size = random.below(max_size + 1); break;
+        }
+        value_type list;
+        list.reserve(size);
+        for (std::size_t i = 0; i < size; i++)
+            list.push_back(element(random));
+        return list;
+    }
 
-// Lazy evaluation must be done explicitly in C++,
-// since it is not part of the language
-// A fibonacci class performs a lazy evaluation of the fibonacci sequence
-class Fibonacci
-{
-public: 
-    // when a fibonacci number is requested, it will either be returned (if previously computed)
-    // or the function will add fibonacci numbers to the stored sequence until it computes the number
-    // This prevents any computation until necessary, and recpomputation
-    uint64_t get_fib_num(uint16_t fib_index)
+    // Shorter lists first (empty, each half, each element removed), then short
+    // lists with one element shrunk
+    std::vector<value_type> shrink(const value_type& list) const
     {
-        if ((m_fibonacci.size() -1) >=  fib_index)
+        constexpr std::size_t short_list = 64;
+        std::vector<value_type> candidates;
+        if (list.empty())
+            return candidates;
+        candidates.emplace_back();
+        if (list.size() > 1)
         {
-            return m_fibonacci[fib_index];
+            candidates.emplace_back(list.begin(), list.begin() + list.size() / 2);
+            candidates.emplace_back(list.begin() + list.size() / 2, list.end());
         }
-        else
+        if (list.size() <= short_list)
         {
-            m_fibonacci.push_back(m_fibonacci[m_fibonacci.size()-1] + m_fibonacci[m_fibonacci.size()-2]);
-            // Note: print added for understanding when running tests. It can be removed if desired
-            std::cout << "Add Fibonacci Number " << m_fibonacci.size()-1 << ": " << m_fibonacci[m_fibonacci.size()-1] << std::endl;
-            return get_fib_num(fib_index);
+            for (std::size_t i = 0; i < list.size() && list.size() > 1; i++)
+            {
+                candidates.push_back(list);
+                candidates.back().erase(candidates.back().begin() + i);
+            }
+            for (std::size_t i = 0; i < list.size(); i++)
+                for (auto& smaller : element.shrink(list[i]))
+                {
+                    candidates.push_back(list);
+                    candidates.back()[i] = std::move(smaller);
+                }
         }
+        return candidates;
+    }
+
+    void describe(std::ostream& out, const value_type& list) const
+    {
+        out << "[";
+        for (std::size_t i = 0; i < list.size() && i < detail::described_elements; i++)
+        {
+            out << (i ? ", " : "");
+            detail::describe_input(out, element, list[i]);
+        }
+        if (list.size() > detail::described_elements)
+            out << ", ... (" << list.size() << " elements)";
+        out << "]";
     }
-private:
-    // A stored sequence is used to prevent re-computation
-    std::vector<uint64_t> m_fibonacci = {0,1};
 };
 
-//////////////////////////////////////////////////////////////////////////////
-// Maybe Monad. Error handling using std::optional
-//////////////////////////////////////////////////////////////////////////////
+template <typename element_generator>
+vector_generator<element_generator> vectors(element_generator element, std::size_t max_size)
+{
+    return {std::move(element), max_size};
+}
 
-// Bind operation for the maybe monad, using std::optional
-// The boilerplate process of checking the optional value, and passing
-// along the value is abstracted in this bind operation
-// Credit: Maybe and Either Monads in Plain C++ 17 (Timothy A.V Teatro et. al.)
-template <typename T, typename F>
-auto bind_maybe(std::optional<T> m, F f)
-        -> decltype(std::invoke(f, *m)) {
-    if (m)
-        return std::invoke(f, *m);
-    else
-        return {};
+// Random pairs, for kernels with two inputs
+template <typename first_generator, typename second_generator>
+struct pair_generator
+{
+    using value_type = std::pair<typename first_generator::value_type, typename second_generator::value_type>;
+    first_generator first;
+    second_generator second;
+
+    value_type operator()(Random& random) const
+    {
+        auto a = first(random);
+        return {std::move(a), second(random)};
+    }
+
+    std::vector<value_type> shrink(const value_type& pair) const
+    {
+        std::vector<value_type> candidates;
+        for (auto& smaller : first.shrink(pair.first))
+            candidates.emplace_back(std::move(smaller), pair.second);
+        for (auto& smaller : second.shrink(pair.second))
+            candidates.emplace_back(pair.first, std::move(smaller));
+        return candidates;
+    }
+
+    void describe(std::ostream& out, const value_type& pair) const
+    {
+        out << "(";
+        detail::describe_input(out, first, pair.first);
+        out << ", ";
+        detail::describe_input(out, second, pair.second);
+        out << ")";
+    }
+};
+
+template <typename first_generator, typename second_generator>
+pair_generator<first_generator, second_generator> pairs(first_generator first, second_generator second)
+{
+    return {std::move(first), std::move(second)};
 }
 
-// The | operator is used to perform the bind for better syntax
-// Credit: Maybe and Either Monads in Plain C++ 17 (Timothy A.V Teatro et. al.)
-template <typename optional_maybe, typename F>
-auto operator|(optional_maybe &&m, F &&f) {
-    return bind_maybe(std::forward<optional_maybe>(m),
-                    std::forward<F>(f));};
+// Distance between two floating point numbers in units in the last place: the
+// count of representable numbers between them. -0 and 0 are the same number,
+// NaN is 0 away from NaN and as far as possible from anything else
+template <typename T>
+uint64_t ulp_distance(T a, T b)
+{
+    static_assert(std::is_floating_point_v<T> && (sizeof(T) == 4 || sizeof(T) == 8),
+                  "ulp_distance is for float and double");
+    if (std::isnan(a) || std::isnan(b))
+        return (std::isnan(a) && std::isnan(b)) ? 0 : std::numeric_limits<uint64_t>::max();
+    using bits_type = std::conditional_t<sizeof(T) == 4, int32_t, int64_t>;
+    // Map the sign and magnitude bits onto a number line, so neighbours differ by one
+    auto ordered = [](T x) {
+        bits_type bits;
+        std::memcpy(&bits, &x, sizeof(bits));
+        return int64_t((bits < 0) ? bits_type(std::numeric_limits<bits_type>::min() - bits) : bits);
+    };
+    int64_t oa = ordered(a);
+    int64_t ob = ordered(b);
+    return (oa >= ob) ? uint64_t(oa) - uint64_t(ob) : uint64_t(ob) - uint64_t(oa);
+}
 
-// Divide optional monad function which fails when the demoninator is 0
-std::optional<double> divide(double num, double denom)
+namespace detail
 {
-    // Note: print added for understanding when running tests. It can be removed if desired
-    std::cout << "Running divide function..." << std::endl;
-    if (denom == 0.0)
-        return std::nullopt;
+// Results agree when they have the same shape, and their floating point
+// numbers are at most ulps apart. Everything else must compare equal
+template <typename T>
+bool agree(const T& fast, const T& reference, uint64_t ulps)
+{
+    if constexpr (std::is_floating_point_v<T>)
+        return ulp_distance(fast, reference) <= ulps;
+    else if constexpr (is_vector<T>::value)
+    {
+        if (fast.size() != reference.size())
+            return false;
+        for (std::size_t i = 0; i < fast.size(); i++)
+            if (!agree(fast[i], reference[i], ulps))
+                return false;
+        return true;
+    }
+    else if constexpr (is_pair<T>::value)
+        return agree(fast.first, reference.first, ulps) && agree(fast.second, reference.second, ulps);
+    else if constexpr (fp::detail::is_optional_v<T>)
+        return fast.has_value() == reference.has_value() && (!fast || agree(*fast, *reference, ulps));
+    else if constexpr (fp::detail::is_either_v<T>)
+    {
+        if (fast.has_value() != reference.has_value())
+            return false;
+        return fast ? agree(*fast, *reference, ulps) : fast.error() == reference.error();
+    }
     else
-        return num / denom;
+        return fast == reference;
 }
+} // namespace detail
 
-// Square root optional monad function which fails when the value to root is negative
-std::optional<double> square_root(double num)
+// Comparison of a fast result with the reference result, for results made of
+// numbers, lists, pairs, optionals and Eithers. within_ulps(0) asks for the
+// same numbers, where NaN matches NaN
+struct within_ulps
 {
-    // Note: print added for understanding when running tests. It can be removed if desired
-    std::cout << "Running square root function..." << std::endl;
-    if (num < 0)
-        return std::nullopt;
-    else
-        return sqrt(num);
+    uint64_t ulps = 0;
+
+    template <typename T>
+    bool operator()(const T& fast, const T& reference) const
+    {
+        return detail::agree(fast, reference, ulps);
+    }
+};
+
+// Tuning for a run. Every case has its own seed, derived from the run's, so
+// a run gives the same inputs and the same report for any thread count
+struct options
+{
+    uint64_t seed = 0x5EED;
+    std::size_t cases = 10000;
+    // Largest number of shrink candidates tried on a failing input
+    std::size_t max_shrink_steps = 2000;
+    // grain_size is the number of cases in one timed batch (default 64)
+    parallel_options parallel;
+};
+
+// The outcome of one differential check. A failure reports the first failing
+// case, shrunk to a smaller input which still fails
+struct report
+{
+    std::string name;
+    uint64_t seed = 0;
+    std::size_t cases = 0;
+    std::size_t failures = 0;
+    std::size_t failing_case = 0;
+    std::size_t shrinks = 0;
+    std::string input;
+    std::string fast_result;
+    std::string reference_result;
+    // Total time spent in each implementation over all of the cases
+    double fast_ns = 0;
+    double reference_ns = 0;
+
+    bool passed() const { return failures == 0; }
+};
+
+// differential. Run fast and reference on options.cases random inputs from
+// generator, in parallel, and check that agree(fast_result, reference_result)
+// holds for each (agree may also take the input as a third argument, for
+// tolerances which depend on it). Both are timed over the same inputs, in
+// batches, so the report says how much faster the fast version is. A failing
+// input is shrunk with the generator's shrink: the first simpler candidate
+// which still fails replaces it, until none does
+template <typename generator_type, typename fast_type, typename reference_type, typename agree_type>
+report differential(std::string name, const generator_type& generator, fast_type fast, reference_type reference,
+                    agree_type agree, const options& run = {})
+{
+    using input_type = typename generator_type::value_type;
+    auto agrees = [&](const auto& fast_result, const auto& reference_result, const input_type& input) {
+        if constexpr (std::is_invocable_v<const agree_type&, decltype(fast_result), decltype(reference_result),
+                                          const input_type&>)
+            return bool(agree(fast_result, reference_result, input));
+        else
+            return bool(agree(fast_result, reference_result));
+    };
+
+    struct chunk_result
+    {
+        std::size_t failures = 0;
+        std::size_t first_failure = std::numeric_limits<std::size_t>::max();
+        std::chrono::nanoseconds fast_time{0};
+        std::chrono::nanoseconds reference_time{0};
+    };
+    ThreadPool& pool = run.parallel.pool ? *run.parallel.pool : ThreadPool::shared();
+    std::size_t batch_size = run.parallel.grain_size ? run.parallel.grain_size : 64;
+    std::size_t batches = (run.cases + batch_size - 1) / batch_size;
+    std::size_t threads = run.parallel.thread_count ? run.parallel.thread_count : pool.size() * 4;
+    std::size_t chunks = std::min(batches, threads);
+    std::vector<chunk_result> results(chunks);
+    pool.parallel_for(chunks, [&](std::size_t chunk)
+    {
+        chunk_result& result = results[chunk];
+        std::vector<input_type> inputs;
+        for (std::size_t batch = chunk * batches / chunks; batch < (chunk + 1) * batches / chunks; batch++)
+        {
+            std::size_t first = batch * batch_size;
+            std::size_t count = std::min(batch_size, run.cases - first);
+            inputs.clear();
+            for (std::size_t i = 0; i < count; i++)
+            {
+                Random random(case_seed(run.seed, first + i));
+                inputs.push_back(generator(random));
+            }
+            using fast_result_type = std::decay_t<std::invoke_result_t<fast_type&, const input_type&>>;
+            using reference_result_type = std::decay_t<std::invoke_result_t<reference_type&, const input_type&>>;
+            std::vector<fast_result_type> fast_results;
+            std::vector<reference_result_type> reference_results;
+            fast_results.reserve(count);
+            reference_results.reserve(count);
+            auto start = std::chrono::steady_clock::now();
+            for (const auto& input : inputs)
+                fast_results.push_back(std::invoke(fast, input));
+            auto middle = std::chrono::steady_clock::now();
+            for (const auto& input : inputs)
+                reference_results.push_back(std::invoke(reference, input));
+            auto end = std::chrono::steady_clock::now();
+            result.fast_time += middle - start;
+            result.reference_time += end - middle;
+            for (std::size_t i = 0; i < count; i++)
+            {
+                if (agrees(fast_results[i], reference_results[i], inputs[i]))
+                    continue;
+                result.failures++;
+                result.first_failure = std::min(result.first_failure, first + i);
+            }
+        }
+    });
+
+    report outcome;
+    outcome.name = std::move(name);
+    outcome.seed = run.seed;
+    outcome.cases = run.cases;
+    outcome.failing_case = std::numeric_limits<std::size_t>::max();
+    for (const chunk_result& result : results)
+    {
+        outcome.failures += result.failures;
+        outcome.failing_case = std::min(outcome.failing_case, result.first_failure);
+        outcome.fast_ns += double(result.fast_time.count());
+        outcome.reference_ns += double(result.reference_time.count());
+    }
+    if (outcome.passed())
+    {
+        outcome.failing_case = 0;
+        return outcome;
+    }
+
+    Random random(case_seed(run.seed, outcome.failing_case));
+    input_type smallest = generator(random);
+    auto fails = [&](const input_type& input) {
+        return !agrees(std::invoke(fast, input), std::invoke(reference, input), input);
+    };
+    std::size_t steps = 0;
+    bool shrunk = true;
+    while (shrunk && steps < run.max_shrink_steps)
+    {
+        shrunk = false;
+        for (auto& candidate : generator.shrink(smallest))
+        {
+            if (steps++ == run.max_shrink_steps)
+                break;
+            if (fails(candidate))
+            {
+                smallest = std::move(candidate);
+                outcome.shrinks++;
+                shrunk = true;
+                break;
+            }
+        }
+    }
+    std::ostringstream text;
+    detail::describe_input(text, generator, smallest);
+    outcome.input = text.str();
+    text.str("");
+    detail::describe_value(text, std::invoke(fast, smallest));
+    outcome.fast_result = text.str();
+    text.str("");
+    detail::describe_value(text, std::invoke(reference, smallest));
+    outcome.reference_result = text.str();
+    return outcome;
 }
 
-// Double optional monad. No failure. Just performs the double operation
-std::optional<double> double_opt(double num)
+// Write a report. A passing check writes nothing, unless timings is set, for
+// one line with the time per case of each implementation. A failing check
+// writes the seed, the case, the shrunk input and both results
+inline void write_report(std::ostream& out, const report& result, bool timings = false)
 {
-    // Note: print added for understanding when running tests. It can be removed if desired
-    std::cout << "Running double function..." << std::endl;
-    return num * 2;
+    double cases = double(std::max<std::size_t>(result.cases, 1));
+    if (!result.passed())
+    {
+        out << "PROPERTY FAILED: " << result.name << "\n"
+            << "    " << result.failures << " of " << result.cases << " cases failed (seed "
+            << result.seed << "), first at case " << result.failing_case << "\n"
+            << "    input (after " << result.shrinks << " shrinks): " << result.input << "\n"
+            << "    fast:      " << result.fast_result << "\n"
+            << "    reference: " << result.reference_result << "\n";
+    }
+    else if (timings)
+    {
+        out << result.name << ": " << result.cases << " cases, fast " << result.fast_ns / cases
+            << " ns/case, reference " << result.reference_ns / cases << " ns/case ("
+            << result.reference_ns / std::max(result.fast_ns, 1.0) << "x)\n";
+    }
 }
+} // namespace fp::check
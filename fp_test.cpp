@@ -3,6 +3,9 @@
 #include <vector>
 #include <math.h>
 #include <optional>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
 
 // Determine test results for integer results
 int check_test_int(std::string test_name, int result, int expected)
@@ -162,6 +165,149 @@ int sumlist_tests()
     return failed_tests;
 }
 
+// Run the reduction engine tests. Large lists would overflow the stack with
+// list recursion, and odd sizes exercise the leftover (non vector) elements
+int reduce_tests()
+{
+    int failed_tests = 0;
+
+    // Reference recursive versions agree with the engine backed versions
+    std::vector<int> reduce_1{4,-2,9,11,3};
+    failed_tests += check_test_int("Reduce Test 1: List Recursion Reference",
+        sumlist_recursive<int, std::vector<int>::iterator>(reduce_1.begin(), reduce_1.end()),
+        sumlist<int, std::vector<int>::iterator>(reduce_1.begin(), reduce_1.end()));
+    failed_tests += check_test_int("Reduce Test 2: Tail Recursion Reference",
+        sumlist_tail_recursive<int, std::vector<int>::iterator>(reduce_1.begin(), reduce_1.end()),
+        sumlist_tail<int, std::vector<int>::iterator>(reduce_1.begin(), reduce_1.end()));
+
+    // A list far deeper than the stack allows for recursion
+    std::vector<int> reduce_3(5000003, 1);
+    failed_tests += check_test_int("Reduce Test 3: Sumlist 5 Million Elements",
+        sumlist<int, std::vector<int>::iterator>(reduce_3.begin(), reduce_3.end()), 5000003);
+    failed_tests += check_test_int("Reduce Test 4: Tail Sumlist 5 Million Elements",
+        sumlist_tail<int, std::vector<int>::iterator>(reduce_3.begin(), reduce_3.end(), 7), 5000010);
+
+    // Vector path for doubles, with a leftover tail
+    std::vector<double> reduce_5(1003);
+    std::iota(reduce_5.begin(), reduce_5.end(), 0.5);
+    failed_tests += check_test_double("Reduce Test 5: Double Sum",
+        fp::reduce(reduce_5.begin(), reduce_5.end(), 0.0), 1003 * 1002 / 2 + 0.5 * 1003);
+
+    // Other associative operators
+    std::vector<int> reduce_6{7,3,-9,12,5,8,1,0,4,6,2,-4,11,10,9,13,-1,3};
+    failed_tests += check_test_int("Reduce Test 6: Minimum",
+        fp::reduce(reduce_6.begin(), reduce_6.end(), reduce_6[0], fp::minimum{}), -9);
+    failed_tests += check_test_int("Reduce Test 7: Maximum",
+        fp::reduce(reduce_6.begin(), reduce_6.end(), reduce_6[0], fp::maximum{}), 13);
+    std::vector<long long> reduce_8(40, 2);
+    failed_tests += check_test_int("Reduce Test 8: Product (2^40 >> 30)",
+        fp::reduce(reduce_8.begin(), reduce_8.end(), 1LL, std::multiplies<>{}) >> 30, 1024);
+    std::vector<unsigned> reduce_9{0xF0F0, 0x0FF0, 0xFFF0, 0x1F30, 0xF0F0, 0x0FF0, 0xFFF0, 0x1F30, 0x3};
+    failed_tests += check_test_int("Reduce Test 9: Bitwise Or",
+        fp::reduce(reduce_9.begin(), reduce_9.end(), 0u, std::bit_or<>{}), 0xFFF3);
+
+    // Non vector operator (associative but not commutative) keeps the list order
+    std::vector<std::string> reduce_10{"fo", "ld", "l", "eft"};
+    failed_tests += check_test_list("Reduce Test 10: String Concatenation",
+        fp::reduce(reduce_10.begin(), reduce_10.end(), std::string{}), std::string{"foldleft"});
+
+    return failed_tests;
+}
+
+// Mutually recursive functions for the trampoline tests. Each tail call is to
+// the other function, so the trampoline switches thunk types every step
+fp::trampoline<bool> is_odd_trampoline(unsigned n);
+fp::trampoline<bool> is_even_trampoline(unsigned n)
+{
+    return (n == 0) ? fp::trampoline<bool>(true) : fp::tail_call(is_odd_trampoline, n - 1);
+}
+fp::trampoline<bool> is_odd_trampoline(unsigned n)
+{
+    return (n == 0) ? fp::trampoline<bool>(false) : fp::tail_call(is_even_trampoline, n - 1);
+}
+
+// Run the trampoline tests. These are built without optimization, where the
+// recursive versions would overflow the stack on the long lists
+int trampoline_tests()
+{
+    int failed_tests = 0;
+
+    // Same result as the recursive version
+    std::vector<int> trampoline_1{4,-2,9,11,3};
+    failed_tests += check_test_int("Trampoline Test 1: Tail Recursion Reference",
+        sumlist_trampoline<int>(trampoline_1.begin(), trampoline_1.end()).run(),
+        sumlist_tail_recursive<int, std::vector<int>::iterator>(trampoline_1.begin(), trampoline_1.end()));
+
+    // A list far deeper than the stack allows for recursion
+    std::vector<int> trampoline_2(5000003, 1);
+    failed_tests += check_test_int("Trampoline Test 2: Sumlist 5 Million Elements",
+        sumlist_trampoline<int>(trampoline_2.begin(), trampoline_2.end(), 7).run(), 5000010);
+
+    // Mutual recursion, a million calls deep
+    failed_tests += check_test_int("Trampoline Test 3: Mutual Recursion",
+        is_even_trampoline(1000000).run() && is_odd_trampoline(999999).run(), true);
+
+    // Arguments which are not trivially copyable are moved from step to step
+    std::vector<std::string> trampoline_4{"e", "n", "i", "l", "o", "p", "m", "a", "r", "t"};
+    failed_tests += check_test_list("Trampoline Test 4: String Accumulator",
+        sumlist_trampoline<std::string>(trampoline_4.begin(), trampoline_4.end(), std::string{}).run(),
+        std::string{"trampoline"});
+
+    // A finished trampoline runs no steps
+    fp::trampoline<int> trampoline_5(42);
+    failed_tests += check_test_int("Trampoline Test 5: Finished Result", trampoline_5.done() && trampoline_5.run() == 42, true);
+
+    return failed_tests;
+}
+
+// User defined monoid for the monoid tests (string concatenation)
+struct concat_monoid
+{
+    template <typename T> static T identity() { return T{}; }
+    static std::string combine(const std::string& a, const std::string& b) { return a + b; }
+};
+
+// Run the monoid fold tests. Every fold stays in the element type
+int monoid_tests()
+{
+    int failed_tests = 0;
+
+    // The traits are usable at compile time
+    constexpr int monoid_1 = fp::monoid::max::combine(fp::monoid::max::identity<int>(), 42);
+    failed_tests += check_test_int("Monoid Test 1: Constexpr Identity and Combine", monoid_1, 42);
+
+    // 64 bit sums keep full precision (a double seed would drop the low bits)
+    std::vector<int64_t> monoid_2{(int64_t(1) << 60) + 1, 1, -3, 3};
+    failed_tests += check_test_int("Monoid Test 2: Sum of 64 Bit Integers (Low Bits)",
+                                   int(sumlist_HOF<int64_t>(monoid_2) - (int64_t(1) << 60)), 2);
+
+    std::vector<int> monoid_3(101);
+    std::iota(monoid_3.begin(), monoid_3.end(), -50);
+    failed_tests += check_test_int("Monoid Test 3: Min", fp::mconcat<fp::monoid::min>(monoid_3), -50);
+    failed_tests += check_test_int("Monoid Test 4: Max", fp::mconcat<fp::monoid::max>(monoid_3), 50);
+    failed_tests += check_test_int("Monoid Test 5: Bitwise Xor", fp::mconcat<fp::monoid::bit_xor>(monoid_3),
+                                   std::accumulate(monoid_3.begin(), monoid_3.end(), 0, std::bit_xor<>{}));
+
+    std::vector<uint8_t> monoid_6(77, 0xFF);
+    monoid_6[40] = 0x3C;
+    failed_tests += check_test_int("Monoid Test 6: Bitwise And (8 Bit)", fp::mconcat<fp::monoid::bit_and>(monoid_6), 0x3C);
+    failed_tests += check_test_int("Monoid Test 7: Bitwise Or (8 Bit)", fp::mconcat<fp::monoid::bit_or>(monoid_6), 0xFF);
+
+    std::vector<double> monoid_8(30, 1.5);
+    failed_tests += check_test_double("Monoid Test 8: Product (Double)",
+                                      fp::mconcat<fp::monoid::product>(monoid_8), pow(1.5, 30));
+    std::vector<double> monoid_9{};
+    failed_tests += check_test_int("Monoid Test 9: Min of Empty List is Identity",
+                                   std::isinf(fp::mconcat<fp::monoid::min>(monoid_9)), true);
+
+    // User defined monoid without an operator_type
+    std::vector<std::string> monoid_10{"mon", "o", "id"};
+    failed_tests += check_test_list("Monoid Test 10: User Defined Monoid",
+                                    fp::mconcat<concat_monoid>(monoid_10), std::string{"monoid"});
+
+    return failed_tests;
+}
+
 // Run the inclist tests (HOF)
 int inclist_tests()
 {
@@ -190,6 +336,318 @@ int inclist_tests()
     return failed_tests;
 }
 
+#if __has_include(<memory_resource>)
+int memory_resource_tests()
+{
+    int failed_tests = 0;
+
+    // The list HOFs take lists from an arena
+    fp::Arena arena(4096);
+    std::pmr::vector<int> list_1({1, 2, 3, 4, 5}, &arena);
+    inclist_HOF<int>(list_1);
+    failed_tests += check_test_int("Memory Resource Test 1: inclist_HOF, sumlist_HOF On An Arena",
+                                   sumlist_HOF<int>(list_1), 20);
+    auto list_2 = fp::apply_all(list_1, [](int x){ return x * 0.5; });
+    failed_tests += check_test_int("Memory Resource Test 2: apply_all Results In The Same Arena",
+                                   list_2.get_allocator().resource() == &arena && list_2[4] == 3.0, true);
+
+    // A request growing past the first block, then reset: one block of the
+    // whole size, which the same request fits in the next time
+    list_1 = std::pmr::vector<int>(&arena);
+    list_2 = std::pmr::vector<double>(&arena);
+    auto request = [&arena]
+    {
+        std::pmr::vector<int> list(&arena);
+        for (int i = 0; i < 10000; i++)
+            list.push_back(i);
+        return sumlist_HOF<int>(list);
+    };
+    request();
+    failed_tests += check_test_int("Memory Resource Test 3: Arena Grows", arena.block_count() > 1, true);
+    arena.reset();
+    failed_tests += check_test_int("Memory Resource Test 4: Reset To One Block", arena.block_count(), 1);
+    failed_tests += check_test_int("Memory Resource Test 5: Nothing Allocated After Reset", arena.bytes_allocated(), 0);
+    request();
+    failed_tests += check_test_int("Memory Resource Test 6: Same Request Fits", arena.block_count(), 1);
+    void* aligned = arena.allocate(100, 64);
+    failed_tests += check_test_int("Memory Resource Test 7: Aligned Allocation",
+                                   reinterpret_cast<uintptr_t>(aligned) % 64, 0);
+
+    // The pool reuses a freed block of the same size class
+    fp::SizeClassPool pool;
+    void* block_1 = pool.allocate(40);
+    pool.deallocate(block_1, 40);
+    void* block_2 = pool.allocate(60);
+    failed_tests += check_test_int("Memory Resource Test 8: Pool Reuses Freed Block", block_1 == block_2, true);
+    pool.deallocate(block_2, 60);
+    std::pmr::vector<double> list_9(&pool);
+    for (int i = 0; i < 1000; i++)
+        list_9.push_back(i);
+    failed_tests += check_test_double("Memory Resource Test 9: sumlist_HOF On A Pool", sumlist_HOF<double>(list_9), 499500.0);
+    list_9 = std::pmr::vector<double>(&pool);
+    pool.reset();
+    failed_tests += check_test_int("Memory Resource Test 10: Pool Reset", pool.arena().bytes_allocated(), 0);
+
+    // Shapes, columns and the Fibonacci sequence from an arena
+    std::pmr::vector<adt_shape> shapes(&arena);
+    for (int i = 0; i < 20; i++)
+        shapes.push_back(Shape::rectangle{double(i), 2.0});
+    ShapeColumns columns(shapes, &arena);
+    auto rebuilt = columns.to_shapes(std::pmr::polymorphic_allocator<adt_shape>(&arena));
+    failed_tests += check_test_int("Memory Resource Test 11: Shape Columns On An Arena",
+                                   columns.rectangles().width.get_allocator().resource() == &arena
+                                   && rebuilt.get_allocator().resource() == &arena, true);
+    failed_tests += check_test_double("Memory Resource Test 12: Areas", compute_areas(columns)[19], 38.0);
+    columns.clear();
+    columns.push_back(Shape::square{3.0});
+    failed_tests += check_test_int("Memory Resource Test 13: Clear Keeps The Arena",
+                                   columns.squares().side.get_allocator().resource() == &arena, true);
+    std::size_t before = arena.bytes_allocated();
+    Fibonacci fibonacci(&arena);
+    Fibonacci fibonacci_heap;
+    failed_tests += check_test_int("Memory Resource Test 14: Fibonacci On An Arena",
+                                   fibonacci.get_fib_num(100) == fibonacci_heap.get_fib_num(100)
+                                   && arena.bytes_allocated() > before, true);
+
+    return failed_tests;
+}
+#endif
+
+// Run the parallel HOF tests. The sequential HOFs are the reference results
+int parallel_HOF_tests()
+{
+    int failed_tests = 0;
+    // A small pool and grain size split even short lists over several tasks
+    fp::ThreadPool pool(4);
+    fp::parallel_options options{16, 0, &pool};
+
+    // Parallel map against inclist_HOF
+    std::vector<int> parallel_1(1000);
+    std::iota(parallel_1.begin(), parallel_1.end(), -500);
+    std::vector<int> parallel_1_exp = parallel_1;
+    inclist_HOF<int>(parallel_1_exp);
+    fp::map(parallel_1, [](int& x){x = x + 1;}, options);
+    failed_tests += check_test_list("Parallel HOF Test 1: Map (Increment)", parallel_1, parallel_1_exp);
+
+    // Parallel fold against sumlist_HOF
+    failed_tests += check_test_int("Parallel HOF Test 2: Fold (Sum)",
+                                   fp::fold(parallel_1, 0, std::plus<>{}, options), sumlist_HOF<int>(parallel_1));
+    std::vector<double> parallel_3(100001, 0.25);
+    failed_tests += check_test_double("Parallel HOF Test 3: Fold (Sum, Shared Pool)",
+                                      fp::fold(parallel_3, 0.0), sumlist_HOF<double>(parallel_3));
+
+    // Thread count override limits the split, init is only applied once
+    failed_tests += check_test_int("Parallel HOF Test 4: Fold (Max, 2 Threads)",
+                                   fp::fold(parallel_1, -1000, fp::maximum{}, fp::parallel_options{1, 2, &pool}), 500);
+    std::vector<int> parallel_5{};
+    failed_tests += check_test_int("Parallel HOF Test 5: Fold (Empty List)",
+                                   fp::fold(parallel_5, 7, std::plus<>{}, options), 7);
+
+    // Non commutative operator keeps the list order across chunks
+    std::vector<std::string> parallel_6{"p", "a", "r", "a", "l", "l", "e", "l"};
+    failed_tests += check_test_list("Parallel HOF Test 6: Fold (String Concatenation)",
+                                    fp::fold(parallel_6, std::string{}, std::plus<>{}, fp::parallel_options{1, 0, &pool}),
+                                    std::string{"parallel"});
+
+    return failed_tests;
+}
+
+// Reproducible summation tests. Same bits for every split, and compensated precision
+int reproducible_sum_tests()
+{
+    int failed_tests = 0;
+    fp::ThreadPool pool(4);
+
+    // Magnitudes from 1e-10 to 1e9, with both signs, so the rounding of a plain
+    // sum depends on the order of the additions
+    std::vector<double> mixed(1000003);
+    for (std::size_t i = 0; i < mixed.size(); i++)
+        mixed[i] = sin(double(i)) * pow(10.0, double(i % 20) - 10.0);
+    double reference = fp::reproducible_sum(mixed, fp::parallel_options{0, 1, &pool});
+    bool identical = true;
+    for (std::size_t threads : {2, 3, 4})
+        for (std::size_t grain : {0, 1000, 50000})
+            identical = identical && fp::reproducible_sum(mixed, fp::parallel_options{grain, threads, &pool}) == reference;
+    identical = identical && fp::reproducible_sum(mixed) == reference;
+    failed_tests += check_test_int("Reproducible Sum Test 1: Bit Identical For Any Thread Count", identical, true);
+
+    // Additions a plain sum loses entirely
+    std::vector<double> cancel{1e100, 1.0, -1e100};
+    failed_tests += check_test_int("Reproducible Sum Test 2: Cancellation",
+                                   fp::reproducible_sum(cancel) == 1.0 && sumlist_HOF<double>(cancel) == 0.0, true);
+
+    // The exact sum of a million 0.1s (0.1 is not exact in binary) rounds to 100000
+    std::vector<double> tenths(1000000, 0.1);
+    failed_tests += check_test_int("Reproducible Sum Test 3: Correctly Rounded",
+                                   sumlist_HOF(tenths, fp::summation::reproducible) == 100000.0, true);
+    failed_tests += check_test_double("Reproducible Sum Test 4: Fast Mode",
+                                      sumlist_HOF(tenths, fp::summation::fast), 100000.0);
+
+    // Lists shorter than a block, with a partial last block, and empty
+    std::vector<float> short_list(4099);
+    std::iota(short_list.begin(), short_list.end(), 0.0f);
+    failed_tests += check_test_double("Reproducible Sum Test 5: Float, Partial Block",
+                                      fp::reproducible_sum(short_list, fp::parallel_options{1, 0, &pool}), 8398851.0);
+    std::vector<double> empty_list{};
+    failed_tests += check_test_double("Reproducible Sum Test 6: Empty List", fp::reproducible_sum(empty_list), 0.0);
+
+    // Infinite inputs sum to infinity, not to the NaN left in the error term
+    std::vector<double> infinite(5000, 1.0);
+    infinite[1234] = std::numeric_limits<double>::infinity();
+    failed_tests += check_test_int("Reproducible Sum Test 7: Infinity",
+                                   fp::reproducible_sum(infinite) == std::numeric_limits<double>::infinity(), true);
+    infinite[1234] = -std::numeric_limits<double>::infinity();
+    failed_tests += check_test_int("Reproducible Sum Test 8: Negative Infinity",
+        fp::reproducible_sum(infinite, fp::parallel_options{100, 4, &pool}) == -std::numeric_limits<double>::infinity(), true);
+    std::vector<float> infinite_float{1.0f, std::numeric_limits<float>::infinity(), 2.0f};
+    failed_tests += check_test_int("Reproducible Sum Test 9: Float Infinity",
+                                   std::isinf(fp::reproducible_sum(infinite_float)), true);
+
+    return failed_tests;
+}
+
+// Persistent vector tests. Non-destructive updates, transients and the HOF adapters
+int persistent_vector_tests()
+{
+    int failed_tests = 0;
+
+    // Sizes past one leaf (32), one internal level (1024) and two levels (32768)
+    std::vector<int> expected(40000);
+    std::iota(expected.begin(), expected.end(), 0);
+    fp::PersistentVector<int> list;
+    std::vector<fp::PersistentVector<int>> versions;
+    for (int i = 0; i < 40000; i++)
+    {
+        list = list.push_back(i);
+        if (i % 1000 == 0)
+            versions.push_back(list);
+    }
+    failed_tests += check_test_list("Persistent Vector Test 1: push_back", list.to_vector(), expected);
+
+    // Every older version still holds exactly what it held when it was taken
+    bool versions_unchanged = true;
+    for (std::size_t k = 0; k < versions.size(); k++)
+        versions_unchanged = versions_unchanged
+            && versions[k].to_vector() == std::vector<int>(expected.begin(), expected.begin() + k * 1000 + 1);
+    failed_tests += check_test_int("Persistent Vector Test 2: Old Versions Unchanged", versions_unchanged, true);
+
+    // set returns a new version, in the tree and in the tail
+    fp::PersistentVector<int> updated = list.set(12345, -1).set(39999, -2);
+    failed_tests += check_test_int("Persistent Vector Test 3: set", updated[12345] + updated[39999], -3);
+    failed_tests += check_test_int("Persistent Vector Test 4: set Leaves Original", list[12345] + list[39999], 52344);
+
+    // A transient applies a batch of edits, then seals into a new version
+    auto edit = list.transient();
+    for (int i = 0; i < 40000; i += 2)
+        edit.set(i, 0);
+    edit.push_back(40000);
+    fp::PersistentVector<int> batch = std::move(edit).persistent();
+    failed_tests += check_test_int("Persistent Vector Test 5: Transient Edits", batch[10] + batch[11] + batch[40000], 40011);
+    failed_tests += check_test_int("Persistent Vector Test 6: Transient Leaves Original",
+                                   list.size() == 40000 && list[10] == 10, true);
+    failed_tests += check_test_int("Persistent Vector Test 7: Transient is Move Only",
+                                   !std::is_copy_constructible_v<fp::PersistentVector<int>::Transient> &&
+                                   std::is_move_constructible_v<fp::PersistentVector<int>::Transient>, true);
+
+    // A moved from vector is a valid empty vector
+    fp::PersistentVector<int> source = {1, 2, 3};
+    fp::PersistentVector<int> destination = std::move(source);
+    failed_tests += check_test_int("Persistent Vector Test 8: Moved From is Empty",
+        source.size() == 0 && source.to_vector().empty() && source.push_back(4)[0] == 4
+        && destination.to_vector() == std::vector<int>{1, 2, 3}, true);
+
+    // The folds, map and HOFs accept a persistent vector
+    failed_tests += check_test_int("Persistent Vector Test 9: fp::fold", fp::fold(list, 0), 799980000);
+    failed_tests += check_test_int("Persistent Vector Test 10: fp::reduce Over Iterators",
+                                   fp::reduce(list.begin(), list.end(), 0, fp::maximum{}), 39999);
+    fp::PersistentVector<int> incremented = inclist_HOF(list);
+    failed_tests += check_test_int("Persistent Vector Test 11: inclist_HOF", sumlist_HOF(incremented), 800020000);
+    failed_tests += check_test_int("Persistent Vector Test 12: inclist_HOF Leaves Original", sumlist_HOF(list), 799980000);
+    fp::PersistentVector<std::string> words = {"persistent", "vector"};
+    auto upper = fp::map(words, [](std::string& word){ word[0] = char(std::toupper(word[0])); });
+    failed_tests += check_test_int("Persistent Vector Test 13: fp::map Other Types",
+        upper.to_vector() == std::vector<std::string>{"Persistent", "Vector"} && words[0] == "persistent", true);
+
+    return failed_tests;
+}
+
+// Write a list to a raw binary file, for the memory mapped array tests
+template <typename T>
+void write_binary_file(const std::string& path, const std::vector<T>& list)
+{
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(list.data()), std::streamsize(list.size() * sizeof(T)));
+}
+
+// Memory mapped and streamed files, folded and mapped without loading them into a vector
+int mapped_array_tests()
+{
+    int failed_tests = 0;
+
+    // Not a whole number of pages, chunks or parallel chunks
+    std::vector<double> doubles(100003);
+    std::vector<int64_t> int64s(100003);
+    for (std::size_t i = 0; i < doubles.size(); i++)
+    {
+        doubles[i] = double(i % 1000) * 0.5;
+        int64s[i] = int64_t(i) * 1000003 - 7;
+    }
+    write_binary_file("fp_test_doubles.bin", doubles);
+    write_binary_file("fp_test_int64s.bin", int64s);
+
+    fp::MappedArray<double> mapped_doubles("fp_test_doubles.bin");
+    fp::MappedArray<int64_t> mapped_int64s("fp_test_int64s.bin", fp::access_hint::random);
+    failed_tests += check_test_int("Mapped Array Test 1: Size", mapped_doubles.size(), doubles.size());
+    failed_tests += check_test_int("Mapped Array Test 2: sumlist_HOF<double>",
+                                   sumlist_HOF(mapped_doubles) == sumlist_HOF(doubles), true);
+    failed_tests += check_test_int("Mapped Array Test 3: fp::reduce max<int64_t>",
+        fp::reduce(mapped_int64s.begin(), mapped_int64s.end(), int64_t(0), fp::maximum{}), int64s.back());
+    fp::ThreadPool pool(4);
+    failed_tests += check_test_int("Mapped Array Test 4: Parallel fold<int64_t>",
+        fp::fold(mapped_int64s, int64_t(0), std::plus<>{}, fp::parallel_options{1000, 0, &pool}),
+        std::accumulate(int64s.begin(), int64s.end(), int64_t(0)));
+    failed_tests += check_test_double("Mapped Array Test 5: Parallel sumlist_HOF<double>",
+        sumlist_HOF(mapped_doubles, fp::parallel_options{1000, 0, &pool}), sumlist_HOF(doubles));
+    std::vector<double> doubled(mapped_doubles.size());
+    fp::apply_all(mapped_doubles.begin(), mapped_doubles.end(), doubled.begin(), times2);
+    failed_tests += check_test_double("Mapped Array Test 6: apply_all", doubled[1999], 999.0);
+
+    // Streamed in small chunks, with a partial chunk at the end
+    fp::ChunkedFileReader<double> reader("fp_test_doubles.bin", 4096);
+    std::size_t chunks = 0;
+    double chunk_sum = 0;
+    reader.for_each_chunk([&](const double* data, std::size_t count) {
+        chunks++; chunk_sum = std::accumulate(data, data + count, chunk_sum); });
+    failed_tests += check_test_int("Mapped Array Test 7: Chunk Count", chunks, (doubles.size() + 511) / 512);
+    failed_tests += check_test_double("Mapped Array Test 8: Chunked Sum", chunk_sum, sumlist_HOF(doubles));
+    fp::ChunkedFileReader<int64_t> int64_reader("fp_test_int64s.bin", 4096);
+    failed_tests += check_test_int("Mapped Array Test 9: Chunked fold<int64_t>",
+        fp::fold(int64_reader, int64_t(0)), std::accumulate(int64s.begin(), int64s.end(), int64_t(0)));
+    fp::ChunkedFileReader<int64_t> iterated("fp_test_int64s.bin", 4096);
+    failed_tests += check_test_int("Mapped Array Test 10: Chunked Iterator Range",
+        std::vector<int64_t>(iterated.begin(), iterated.end()) == int64s, true);
+
+    // An empty file, a missing file and a file which is not a whole number of elements
+    write_binary_file("fp_test_empty.bin", std::vector<double>{});
+    fp::MappedArray<double> empty("fp_test_empty.bin");
+    failed_tests += check_test_double("Mapped Array Test 11: Empty File",
+                                      fp::reduce(empty.begin(), empty.end(), 0.0), 0.0);
+    bool missing_throws = false;
+    try { fp::MappedArray<double> missing("fp_test_missing.bin"); }
+    catch (const std::system_error&) { missing_throws = true; }
+    failed_tests += check_test_int("Mapped Array Test 12: Missing File Throws", missing_throws, true);
+    write_binary_file("fp_test_empty.bin", std::vector<char>{1, 2, 3});
+    bool partial_throws = false;
+    try { fp::MappedArray<double> partial("fp_test_empty.bin"); }
+    catch (const std::runtime_error&) { partial_throws = true; }
+    failed_tests += check_test_int("Mapped Array Test 13: Partial Element Throws", partial_throws, true);
+
+    std::remove("fp_test_doubles.bin");
+    std::remove("fp_test_int64s.bin");
+    std::remove("fp_test_empty.bin");
+    return failed_tests;
+}
+
 // Run the compute_area tests
 // ADT and pattern matching
 int compute_area_tests()
@@ -235,6 +693,309 @@ int compute_area_tests()
     return failed_tests;
 }
 
+// A sum type larger than the index test chain handles, for the match tests
+template <int index>
+struct numbered_alternative
+{
+    static constexpr int number = index;
+    int value;
+};
+template <int... index>
+std::variant<numbered_alternative<index>...> numbered_variant(std::integer_sequence<int, index...>);
+using large_variant = decltype(numbered_variant(std::make_integer_sequence<int, 20>{}));
+
+// One value of each alternative of large_variant
+template <int... index>
+std::vector<large_variant> every_alternative(std::integer_sequence<int, index...>)
+{
+    return {numbered_alternative<index>{index * 10}...};
+}
+
+// Constant expression matches are checked when this file compiles
+constexpr std::variant<int, double, char> constexpr_value{2.5};
+constexpr std::variant<int, char> constexpr_int{3};
+constexpr std::variant<int, char> constexpr_char{'a'};
+static_assert(fp::visit([](auto x){ return double(x) * 2; }, constexpr_value) == 5.0);
+static_assert(fp::match(constexpr_int, constexpr_char)(
+                  [](int x, char y){ return x + y; }, [](auto, auto){ return 0; }) == 3 + 'a');
+
+// Pattern matching engine tests. Small, large and multi variant dispatch
+int match_tests()
+{
+    int failed_tests = 0;
+
+    // Cases return their result directly, of a common type
+    adt_shape shape = Shape::rectangle{2.0, 3.0};
+    failed_tests += check_test_double("Match Test 1: Returns the Matching Case",
+        fp::match(shape)([](const Shape::rectangle& r){ return r.length * r.width; },
+                         [](const auto&){ return 0; }), 6.0);
+
+    // A large variant goes through the dispatch table
+    bool all_match = true;
+    for (const large_variant& value : every_alternative(std::make_integer_sequence<int, 20>{}))
+        all_match = all_match && fp::visit([](auto alternative){ return alternative.number * 10 == alternative.value; }, value);
+    large_variant last = numbered_alternative<19>{7};
+    failed_tests += check_test_int("Match Test 2: Large Variant", all_match, true);
+    failed_tests += check_test_int("Match Test 3: Large Variant Last Alternative",
+        fp::match(last)([](const numbered_alternative<19>& n){ return n.value; },
+                        [](const auto&){ return -1; }), 7);
+
+    // Double dispatch over two shapes
+    auto same_kind = [](const adt_shape& a, const adt_shape& b)
+    {
+        return fp::match(a, b)(
+            [](const auto& x, const auto& y){ return std::is_same_v<decltype(x), decltype(y)>; });
+    };
+    failed_tests += check_test_int("Match Test 4: Double Dispatch Same",
+                                   same_kind(Shape::circle{1.0}, Shape::circle{2.0}), true);
+    failed_tests += check_test_int("Match Test 5: Double Dispatch Different",
+                                   same_kind(Shape::circle{1.0}, Shape::cylinder{1.0, 2.0}), false);
+
+    // An rvalue variant hands its alternative on by move
+    std::variant<int, std::string> text = std::string(1000, 'x');
+    std::string taken = fp::visit([](auto&& alternative) -> std::string
+    {
+        if constexpr (std::is_same_v<std::decay_t<decltype(alternative)>, std::string>)
+            return std::move(alternative);
+        else
+            return {};
+    }, std::move(text));
+    failed_tests += check_test_int("Match Test 6: Moves From an Rvalue Variant",
+                                   taken.size() == 1000 && std::get<std::string>(text).empty(), true);
+
+    // Same results as std::visit on every shape
+    std::vector<adt_shape> shapes = {Shape::circle{2.0}, Shape::square{3.0}, Shape::rectangle{1.0, 2.0},
+                                     Shape::ellipse{2.0, 3.0}, Shape::cylinder{1.0, 4.0}};
+    auto perimeter_like = [](const auto& s){ return sizeof(s) * 10.0; };
+    bool agrees = true;
+    for (const auto& s : shapes)
+        agrees = agrees && fp::visit(perimeter_like, s) == std::visit(perimeter_like, s);
+    failed_tests += check_test_int("Match Test 7: Agrees with std::visit", agrees, true);
+
+    // A matcher over a temporary variant holds its own copy, so it can be called later
+    auto square_matcher = fp::match(adt_shape{Shape::square{3.0}});
+    failed_tests += check_test_double("Match Test 8: Stored Matcher Over an Rvalue",
+        square_matcher([](const Shape::square& s){ return s.side * s.side; },
+                       [](const auto&){ return 0.0; }), 9.0);
+
+    // A stored matcher does not move from its variants, so it can be called again
+    std::variant<int, std::string> word = std::string("kept");
+    auto word_matcher = fp::match(std::move(word));
+    auto take = [](auto&& alternative) -> std::string
+    {
+        if constexpr (std::is_same_v<std::decay_t<decltype(alternative)>, std::string>)
+            return std::forward<decltype(alternative)>(alternative);
+        else
+            return {};
+    };
+    std::string first = word_matcher(take);
+    failed_tests += check_test_int("Match Test 9: Stored Matcher Called Twice",
+                                   first == "kept" && word_matcher(take) == "kept", true);
+
+    return failed_tests;
+}
+
+// Run the columnar shape store tests. compute_area is the reference result
+int shape_columns_tests()
+{
+    int failed_tests = 0;
+
+    // A mix of every alternative, with counts which do not fill whole vector registers
+    std::vector<adt_shape> shapes;
+    for (int i = 0; i < 43; i++)
+    {
+        double x = 0.37 * i;
+        switch (i % 5)
+        {
+        case 0: shapes.push_back(Shape::circle{x}); break;
+        case 1: shapes.push_back(Shape::cylinder{x, 2.0 * x}); break;
+        case 2: shapes.push_back(Shape::square{x}); break;
+        case 3: shapes.push_back(Shape::ellipse{x, 1.5}); break;
+        default: shapes.push_back(Shape::rectangle{x, x + 1.0}); break;
+        }
+    }
+    shapes.push_back(Shape::circle{2.0});
+    ShapeColumns columns(shapes);
+
+    std::vector<double> expected_areas;
+    for (const auto& shape : shapes)
+        expected_areas.push_back(compute_area(shape));
+    failed_tests += check_test_list("Shape Columns Test 1: Batch Areas Match compute_area",
+                                    compute_areas(columns), expected_areas);
+    failed_tests += check_test_int("Shape Columns Test 2: Size", columns.size(), shapes.size());
+    failed_tests += check_test_int("Shape Columns Test 3: Circle Column Size", columns.circles().radius.size(), 10);
+    std::vector<double> round_trip_areas;
+    for (const auto& shape : columns.to_shapes())
+        round_trip_areas.push_back(compute_area(shape));
+    failed_tests += check_test_list("Shape Columns Test 4: Shapes Round Trip", round_trip_areas, expected_areas);
+
+    ShapeColumns empty_columns;
+    failed_tests += check_test_int("Shape Columns Test 5: Empty Batch", compute_areas(empty_columns).size(), 0);
+
+    return failed_tests;
+}
+
+int shape_analytics_tests()
+{
+    int failed_tests = 0;
+
+    // One shape of each alternative
+    std::vector<adt_shape> shapes_1{Shape::circle{1.0}, Shape::square{2.0}, Shape::rectangle{2.0, 3.0},
+                                    Shape::ellipse{3.0, 3.0}, Shape::cylinder{1.0, 2.0}};
+    fp::ShapeReport report_1 = fp::analyze_shapes(shapes_1);
+    failed_tests += check_test_list("Shape Analytics Test 1: Areas", report_1.area,
+        std::vector<double>{compute_area(shapes_1[0]), compute_area(shapes_1[1]), compute_area(shapes_1[2]),
+                            compute_area(shapes_1[3]), compute_area(shapes_1[4])});
+    failed_tests += check_test_double("Shape Analytics Test 2: Circle Circumference", report_1.perimeter[0], 2 * M_PI);
+    failed_tests += check_test_double("Shape Analytics Test 3: Rectangle Perimeter", report_1.perimeter[2], 10.0);
+    failed_tests += check_test_double("Shape Analytics Test 4: Circular Ellipse Perimeter", report_1.perimeter[3], 6 * M_PI);
+    failed_tests += check_test_double("Shape Analytics Test 5: Cylinder Volume", report_1.volume[4], 2 * M_PI);
+    failed_tests += check_test_double("Shape Analytics Test 6: Square Volume", compute_volume(shapes_1[1]), 0.0);
+    failed_tests += check_test_double("Shape Analytics Test 7: compute_perimeter",
+                                      compute_perimeter(Shape::ellipse{2.0, 1.0}), 9.688);
+
+    // Totals and histograms per alternative, in parallel chunks
+    std::vector<adt_shape> shapes_8;
+    for (int i = 0; i < 5000; i++)
+    {
+        if (i % 4 == 0)
+            shapes_8.push_back(Shape::circle{double(i % 10)});
+        else
+            shapes_8.push_back(Shape::square{1.5});
+    }
+    fp::ThreadPool pool(4);
+    fp::shape_report_options options;
+    options.metrics = fp::shape_metric::area | fp::shape_metric::perimeter;
+    options.parallel.pool = &pool;
+    options.parallel.grain_size = 100;
+    fp::ShapeReport report_8 = fp::analyze_shapes(shapes_8, options);
+    double circle_area = 0;
+    for (const auto& shape : shapes_8)
+        circle_area += std::holds_alternative<Shape::circle>(shape) ? compute_area(shape) : 0.0;
+    failed_tests += check_test_int("Shape Analytics Test 8: Circle Count", report_8.groups[0].count, 1250);
+    failed_tests += check_test_double("Shape Analytics Test 9: Circle Area Total", report_8.groups[0].area, circle_area);
+    failed_tests += check_test_double("Shape Analytics Test 10: Square Perimeter Total", report_8.groups[1].perimeter, 3750 * 6.0);
+    failed_tests += check_test_int("Shape Analytics Test 11: No Volume Column",
+                                   report_8.volume.empty() && report_8.perimeter.size() == shapes_8.size(), true);
+    // Squares of side 1.5 have an area of 2.25, in bucket 1 + 32. Circles of radius 0 go in bucket 0
+    failed_tests += check_test_int("Shape Analytics Test 12: Square Histogram", report_8.groups[1].histogram[33], 3750);
+    failed_tests += check_test_int("Shape Analytics Test 13: Zero Area Circles", report_8.groups[0].histogram[0], 250);
+
+    // Histogram of a metric which was not requested, and totals only
+    options.metrics = fp::shape_metric::none;
+    options.histogram_metric = fp::shape_metric::volume;
+    options.per_shape = false;
+    fp::ShapeReport report_14 = fp::analyze_shapes(shapes_8, options);
+    failed_tests += check_test_int("Shape Analytics Test 14: Totals Only",
+                                   report_14.area.empty() && report_14.volume.empty(), true);
+    failed_tests += check_test_int("Shape Analytics Test 15: Volume Histogram (All Flat)",
+                                   report_14.groups[0].histogram[0] + report_14.groups[1].histogram[0], 5000);
+    failed_tests += check_test_int("Shape Analytics Test 16: Empty List",
+                                   fp::analyze_shapes(std::vector<adt_shape>{}).groups[4].count, 0);
+
+    return failed_tests;
+}
+
+// Shape file tests. Streaming writes, appends, and reads from the mapped file
+int shape_file_tests()
+{
+    int failed_tests = 0;
+    std::string path = "fp_test_shapes.bin";
+
+    std::vector<adt_shape> shapes;
+    for (int i = 0; i < 50; i++)
+    {
+        double x = 0.5 * i;
+        switch (i % 5)
+        {
+        case 0: shapes.push_back(Shape::circle{x}); break;
+        case 1: shapes.push_back(Shape::rectangle{x, 3.0}); break;
+        case 2: shapes.push_back(Shape::cylinder{x, x + 1.0}); break;
+        case 3: shapes.push_back(Shape::square{x}); break;
+        default: shapes.push_back(Shape::ellipse{x, 0.25}); break;
+        }
+    }
+    std::vector<double> expected_areas;
+    for (const auto& shape : shapes)
+        expected_areas.push_back(compute_area(shape));
+
+    // Streamed in segments of 16 shapes (the last one partly full)
+    {
+        fp::ShapeFileWriter writer(path, false, 16);
+        for (const auto& shape : shapes)
+            writer.push_back(shape);
+    }
+    fp::ShapeFileView file(path);
+    failed_tests += check_test_int("Shape File Test 1: Streamed Segments", file.segment_count(), 4);
+    failed_tests += check_test_list("Shape File Test 2: Areas From the Mapped File", compute_areas(file), expected_areas);
+
+    // Appending keeps the shapes already in the file
+    {
+        fp::ShapeFileWriter writer(path, true);
+        writer.write(ShapeColumns(shapes));
+    }
+    fp::ShapeFileView appended(path);
+    std::vector<double> round_trip_areas;
+    for (const auto& shape : appended.to_shapes())
+        round_trip_areas.push_back(compute_area(shape));
+    expected_areas.insert(expected_areas.end(), expected_areas.begin(), expected_areas.end());
+    failed_tests += check_test_list("Shape File Test 3: Append and Round Trip", round_trip_areas, expected_areas);
+
+    // Columns are read in place, aligned for the vector kernels
+    bool aligned = true;
+    appended.for_each_segment([&aligned](const fp::ShapeSegmentView& segment) {
+        aligned = aligned && reinterpret_cast<uintptr_t>(segment.cylinders().height.data()) % 64 == 0; });
+    failed_tests += check_test_int("Shape File Test 4: Aligned Columns", aligned, true);
+
+    // A file which is not a shape file, or has been cut short, is refused
+    auto refused = [](const std::string& bad_path)
+    {
+        try
+        {
+            fp::ShapeFileView bad(bad_path);
+        }
+        catch (const std::runtime_error&)
+        {
+            return true;
+        }
+        return false;
+    };
+    write_binary_file(path + ".txt", std::vector<char>{'n', 'o', 't', ' ', 'a', ' ', 's', 'h', 'a', 'p', 'e'});
+    failed_tests += check_test_int("Shape File Test 5: Not a Shape File", refused(path + ".txt"), true);
+    std::vector<char> bytes(appended.size() * 4);
+    {
+        std::ifstream in(path, std::ios::binary);
+        in.read(bytes.data(), std::streamsize(bytes.size()));
+    }
+    write_binary_file(path + ".cut", bytes);
+    failed_tests += check_test_int("Shape File Test 6: Damaged File", refused(path + ".cut"), true);
+
+    // Segment headers which claim too little room, columns which overlap the
+    // segment header, and more segments than the file could hold are refused
+    std::vector<char> whole(std::size_t(std::ifstream(path, std::ios::binary | std::ios::ate).tellg()));
+    {
+        std::ifstream in(path, std::ios::binary);
+        in.read(whole.data(), std::streamsize(whole.size()));
+    }
+    auto refused_patch = [&](std::size_t at, uint64_t value)
+    {
+        std::vector<char> patched = whole;
+        std::memcpy(patched.data() + at, &value, sizeof(value));
+        write_binary_file(path + ".cut", patched);
+        return refused(path + ".cut");
+    };
+    const std::size_t segment = fp::detail::first_segment_offset;
+    bool all_refused = refused_patch(segment + offsetof(fp::detail::shape_segment_header, bytes), 0)
+        && refused_patch(segment + offsetof(fp::detail::shape_segment_header, columns[1].offset), 0)
+        && refused_patch(offsetof(fp::detail::shape_file_header, segment_count), uint64_t(1) << 60);
+    failed_tests += check_test_int("Shape File Test 7: Damaged Segment Headers", all_refused, true);
+
+    std::remove(path.c_str());
+    std::remove((path + ".txt").c_str());
+    std::remove((path + ".cut").c_str());
+    return failed_tests;
+}
+
 // Currying tests. Test curryed function calls
 int currying_tests()
 {
@@ -275,6 +1036,116 @@ int currying_tests()
     return failed_tests;
 }
 
+int money_tests()
+{
+    int failed_tests = 0;
+
+    // Exact decimal amounts
+    fp::Money price = fp::Money::from_double(0.10) + fp::Money::from_double(0.20);
+    failed_tests += check_test_int("Money Test 1: 0.10 + 0.20 == 0.30", price == fp::Money::from_units(30), true);
+    failed_tests += check_test_int("Money Test 2: To String",
+                                   fp::Money::from_units(-1205).to_string() == "-12.05"
+                                   && fp::Money::from_units(7).to_string() == "0.07", true);
+
+    // compute_tip with the tip rounded to the cent: 15.67% of 122.75 is 19.234925
+    failed_tests += check_test_int("Money Test 3: Curried Tip", compute_money_tip(15.67)(fp::Money::from_units(12275)).units(), 1923);
+    failed_tests += check_test_int("Money Test 4: Curried Total",
+                                   compute_money_total(fp::percent(15.0))(fp::percent(8.875))(fp::Money::from_units(10000)).units(), 12388);
+
+    // Rounding modes on a tie (50% of 5 cents) and on a refund (negative amount)
+    fp::Money five_cents = fp::Money::from_units(5);
+    fp::Rate half = fp::percent(50.0);
+    failed_tests += check_test_int("Money Test 5: Half Even", fp::money::tip(half)(five_cents).units(), 2);
+    failed_tests += check_test_int("Money Test 6: Half Up", fp::money::tip(half, fp::rounding::half_up)(five_cents).units(), 3);
+    failed_tests += check_test_int("Money Test 7: Toward Zero", fp::money::tip(half, fp::rounding::toward_zero)(five_cents).units(), 2);
+    failed_tests += check_test_int("Money Test 8: Away From Zero",
+                                   fp::money::tip(fp::percent(1.0), fp::rounding::away_from_zero)(five_cents).units(), 1);
+    failed_tests += check_test_int("Money Test 9: Refund, Half Up", fp::money::tip(half, fp::rounding::half_up)(-five_cents).units(), -3);
+
+    // Discount, then tax, as one pipeline
+    auto checkout = fp::pipe(fp::money::less_discount(fp::percent(10.0)), fp::money::plus_tax(fp::percent(8.875)));
+    failed_tests += check_test_int("Money Test 10: Discount Then Tax", checkout(fp::Money::from_units(2000)).units(), 1960);
+
+    // The batch loop gives the same amounts as one call at a time, for every
+    // rounding mode, including the amounts left over after the last register
+    std::vector<fp::Money> amounts;
+    for (int64_t i = 0; i < 1003; i++)
+        amounts.push_back(fp::Money::from_units((i * 7919) % 100000 - 50000));
+    bool batch_matches = true;
+    for (auto mode : {fp::rounding::half_even, fp::rounding::half_up, fp::rounding::toward_zero, fp::rounding::away_from_zero})
+    {
+        auto tax = fp::money::plus_tax(fp::percent(8.875), mode);
+        std::vector<fp::Money> taxed = fp::apply_all(amounts, tax);
+        for (std::size_t i = 0; i < amounts.size(); i++)
+            batch_matches = batch_matches && taxed[i] == tax(amounts[i]);
+    }
+    failed_tests += check_test_int("Money Test 11: Batch Matches Scalar", batch_matches, true);
+
+    // A million tips of 15% on 19.99 are a million times 3.00, exactly
+    fp::Money money_total;
+    auto tip = compute_money_tip(15.0);
+    for (int i = 0; i < 1000000; i++)
+        money_total += tip(fp::Money::from_units(1999));
+    failed_tests += check_test_int("Money Test 12: A Million Tips", money_total == fp::Money::from_units(300000000), true);
+
+    return failed_tests;
+}
+
+// Generic currying, and composition of the curried functions into fused pipelines
+int composition_tests()
+{
+    int failed_tests = 0;
+
+    // curry binds any number of arguments at a time
+    failed_tests += check_test_double("Composition Test 1: Curry One at a Time", compute_total(15.0)(8.0)(100.0), 123.0);
+    failed_tests += check_test_double("Composition Test 2: Curry Two then One", compute_total(15.0, 8.0)(100.0), 123.0);
+    failed_tests += check_test_double("Composition Test 3: Curry All at Once", compute_total(15.0, 8.0, 100.0), 123.0);
+    auto curried_plus = fp::curry(std::plus<>{});
+    failed_tests += check_test_int("Composition Test 4: Curry Generic Function", curried_plus(3)(4), 7);
+
+    // pipe applies left to right, compose right to left
+    failed_tests += check_test_double("Composition Test 5: Pipe", fp::pipe(inc, times2)(3.0), 8.0);
+    failed_tests += check_test_double("Composition Test 6: Compose", fp::compose(inc, times2)(3.0), 7.0);
+    failed_tests += check_test_double("Composition Test 7: Pipeline Operator",
+                                      (fp::pipe(inc) | times2 | compute_avg_tip)(99.0), 30.0);
+    failed_tests += check_test_double("Composition Test 8: Bill Pipeline", avg_tip_pipeline(99.0), 30.0);
+    failed_tests += check_test_int("Composition Test 9: Pipelines Flatten",
+        std::is_same_v<decltype(fp::pipe(fp::pipe(inc, times2), add3)), decltype(fp::pipe(inc, times2, add3))>, true);
+    failed_tests += check_test_int("Composition Test 10: Pipeline Holds Only Its Functions",
+                                   sizeof(avg_tip_pipeline), sizeof(double) * 3);
+    failed_tests += check_test_double("Composition Test 11: Curried Function in a Pipeline",
+                                      fp::pipe(inc, compute_total(15.0, 8.0))(99.0), 123.0);
+
+    // apply_all runs a pipeline over a list, against the step by step result.
+    // 1001 elements exercises the blocked loop and its remainder
+    std::vector<double> bills(1001);
+    std::iota(bills.begin(), bills.end(), 0.0);
+    std::vector<double> expected;
+    for (double bill : bills)
+        expected.push_back(compute_avg_tip(times2(inc(bill))));
+    failed_tests += check_test_list("Composition Test 12: apply_all", fp::apply_all(bills, avg_tip_pipeline), expected);
+    fp::apply_all(bills.begin(), bills.end(), bills.begin(), avg_tip_pipeline);
+    failed_tests += check_test_list("Composition Test 13: apply_all in Place", bills, expected);
+    std::list<int> numbers = {1, 2, 3};
+    std::vector<std::string> labels(3);
+    fp::apply_all(numbers.begin(), numbers.end(), labels.begin(),
+                  fp::pipe(add(1), [](int x){ return std::to_string(x); }));
+    failed_tests += check_test_int("Composition Test 14: apply_all Other Types",
+                                   labels == std::vector<std::string>{"2", "3", "4"}, true);
+    std::vector<int> appended;
+    fp::apply_all(numbers.begin(), numbers.end(), std::back_inserter(appended), times2);
+    failed_tests += check_test_list("Composition Test 15: apply_all to a back_inserter",
+                                    appended, std::vector<int>{2, 4, 6});
+
+    // An empty pipeline is the identity, and a start for the | operator
+    failed_tests += check_test_double("Composition Test 16: Empty Pipe is Identity", fp::pipe()(3.0), 3.0);
+    failed_tests += check_test_double("Composition Test 17: Empty Pipe Extended", (fp::pipe() | inc)(3.0), 4.0);
+    failed_tests += check_test_int("Composition Test 18: Curried Arity",
+                                   fp::detail::function_arity<decltype(compute_tip(15.0))>::value, 1);
+
+    return failed_tests;
+}
+
 // Lazy computation of the Fibonacci sequence
 int lazy_fibonacci_tests()
 {
@@ -282,13 +1153,14 @@ int lazy_fibonacci_tests()
 
     // Create the Fibonacci object
     Fibonacci fib;
+    fp::trace::Collector::instance().reset();
     std::cout << std::endl;
     std::cout << "***** Lazy Fibonacci Tests " << std::endl;
     std::cout << "Note: The computation of the fibonacci sequence is only done when needed." << std::endl;
-    std::cout << "      New numbers should be printed to the console to show the computation." << std::endl;
-    std::cout << "      0 and 1 are already initialized. When a number is requested that has" << std::endl;
-    std::cout << "      been computed, it'll be returned with no computation. Otherwise, " << std::endl;
-    std::cout << "      computations will only take place as needed and when not done before" << std::endl;
+    std::cout << "      The trace report after the tests counts the numbers which were computed." << std::endl;
+    std::cout << "      Numbers 0 to 93 come from a table built at compile time. When a number is" << std::endl;
+    std::cout << "      requested that has been computed, it'll be returned with no computation." << std::endl;
+    std::cout << "      Otherwise, computations will only take place as needed and when not done before" << std::endl;
     std::cout << std::endl;
 
     // Lazy Fibonacci tests
@@ -307,6 +1179,323 @@ int lazy_fibonacci_tests()
     failed_tests += check_test_int("Lazy Fibonacci Test 6: Fibonacci number 1", 
                                     fib.get_fib_num(1), 1);
 
+    // Numbers past the table wrap around like the uint64_t sums which make them
+    uint64_t fib_100 = 0;
+    for (uint64_t previous = 1, i = 0; i < 100; i++)
+        fib_100 = std::exchange(previous, previous + fib_100);
+    failed_tests += check_test_int("Lazy Fibonacci Test 7: Fibonacci number 100 (Past the Table)",
+                                    fib.get_fib_num(100) == fib_100, true);
+    failed_tests += check_test_int("Lazy Fibonacci Test 8: Fibonacci number 96 (Past the Table)",
+                                    fib.get_fib_num(96) == fib.get_fib_num(95) + fib.get_fib_num(94), true);
+
+    // Only 7 numbers (94 to 100) should have been added, however many lookups there were
+    fp::trace::snapshot trace = fp::trace::Collector::instance().take_snapshot();
+    if (fp::trace::enabled)
+    {
+        failed_tests += check_test_int("Lazy Fibonacci Test 9: Numbers Computed Once",
+                                        trace.find("Fibonacci::add_number")->calls, 7);
+        std::cout << "Trace report (Lazy Fibonacci Tests):" << std::endl;
+        fp::trace::text_sink(std::cout)(trace);
+    }
+
+    return failed_tests;
+}
+
+// Sequence tables are built by the compiler
+static_assert(fp::sequence::fibonacci[93] == 12200160415121876738ull);
+static_assert(fp::sequence::factorial[20] == 2432902008176640000ull);
+static_assert(fp::sequence::powers<2>.size() == 64 && fp::sequence::powers<10>.size() == 20);
+static_assert(fp::sequence::binomial(67, 33) == 14226520737620288370ull);
+
+// Compile time sequence tables, and the runtime fallback past them
+int sequence_table_tests()
+{
+    int failed_tests = 0;
+
+    failed_tests += check_test_int("Sequence Table Test 1: Fibonacci Number 50",
+                                   fp::sequence::fibonacci[50] == 12586269025ull, true);
+    failed_tests += check_test_int("Sequence Table Test 2: 3 to the 40",
+                                   fp::sequence::powers<3>[40] == 12157665459056928801ull
+                                   && fp::sequence::powers<3>.size() == 41, true);
+    failed_tests += check_test_int("Sequence Table Test 3: 10 Choose 3", fp::sequence::binomial(10, 3), 120);
+    failed_tests += check_test_int("Sequence Table Test 4: Binomial Row Sum",
+        std::accumulate(&fp::sequence::binomials[20 * 21 / 2], &fp::sequence::binomials[21 * 22 / 2], uint64_t{0})
+            == uint64_t{1} << 20, true);
+    bool out_of_range = false;
+    try
+    {
+        (void)fp::sequence::binomial(68, 34);
+    }
+    catch (const std::out_of_range&)
+    {
+        out_of_range = true;
+    }
+    failed_tests += check_test_int("Sequence Table Test 5: Binomial Past the Table Throws", out_of_range, true);
+
+    // A short table, extended at runtime by the same recurrence
+    fp::LazySequence<uint64_t, 10, fp::sequence::fibonacci_term> short_fibonacci;
+    failed_tests += check_test_int("Sequence Table Test 6: LazySequence Inside the Table", short_fibonacci.get(9), 34);
+    failed_tests += check_test_int("Sequence Table Test 7: LazySequence Past the Table",
+                                   short_fibonacci.get(80) == fp::sequence::fibonacci[80], true);
+
+    return failed_tests;
+}
+
+// Fibonacci engine tests. Fast doubling, big integer results and the shared memo
+int fibonacci_engine_tests()
+{
+    int failed_tests = 0;
+    fp::FibonacciEngine engine(8);
+
+    // Agrees with the lazy Fibonacci class
+    std::vector<uint64_t> lazy_values;
+    std::vector<uint64_t> engine_values;
+    Fibonacci fib;
+    for (uint16_t i = 0; i <= 93; i++)
+    {
+        lazy_values.push_back(fib.get_fib_num(i));
+        engine_values.push_back(*engine.get_fib_uint64(i));
+    }
+    failed_tests += check_test_list("Fibonacci Engine Test 1: Matches Lazy Fibonacci (0 to 93)",
+                                    engine_values, lazy_values);
+
+    // uint64_t up to index 93, big integers after
+    failed_tests += check_test_int("Fibonacci Engine Test 2: Index 93 is uint64_t",
+                                   std::holds_alternative<uint64_t>(engine.get_fib_num(93)), true);
+    failed_tests += check_test_int("Fibonacci Engine Test 3: Index 94 does not fit uint64_t",
+                                   engine.get_fib_uint64(94).has_value(), false);
+    failed_tests += check_test_list("Fibonacci Engine Test 4: Fibonacci number 94",
+                                    std::get<fp::BigUnsigned>(engine.get_fib_num(94)).to_string(),
+                                    std::string{"19740274219868223167"});
+    failed_tests += check_test_list("Fibonacci Engine Test 5: Fibonacci number 300",
+                                    engine.get_fib_big(300).to_string(),
+                                    std::string{"222232244629420445529739893461909967206666939096499764990979600"});
+
+    // Big results are remembered, and the memo stays within its bound
+    failed_tests += check_test_int("Fibonacci Engine Test 6: Memo Hit",
+                                   engine.get_fib_big(300) == engine.get_fib_big(299) + engine.get_fib_big(298), true);
+    for (uint64_t i = 100; i < 200; i++)
+        engine.get_fib_big(i);
+    failed_tests += check_test_int("Fibonacci Engine Test 7: Memo Bounded", engine.memo_size(), 8);
+    fp::FibonacciEngine single_entry(1);
+    for (uint64_t i = 100; i < 200; i++)
+        single_entry.get_fib_big(i);
+    failed_tests += check_test_int("Fibonacci Engine Test 8: Memo of One Result", single_entry.memo_size(), 1);
+
+    // Many threads reading and filling the memo at once
+    std::vector<std::string> thread_results(4);
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < thread_results.size(); t++)
+        threads.emplace_back([&engine, &thread_results, t]{
+            for (uint64_t i = 94; i < 400; i++)
+                engine.get_fib_big(i);
+            thread_results[t] = engine.get_fib_big(300).to_string();
+        });
+    for (auto& thread : threads)
+        thread.join();
+    failed_tests += check_test_list("Fibonacci Engine Test 9: Concurrent Lookups", thread_results,
+                                    std::vector<std::string>(4, engine.get_fib_big(300).to_string()));
+
+    return failed_tests;
+}
+
+// Memoize tests. Each policy must call the wrapped function only once per argument set
+int memoize_tests()
+{
+    int failed_tests = 0;
+
+    // Unbounded. Repeated calls are served from the cache
+    int calls = 0;
+    auto slow_add = fp::memoize([&calls](int a, int b){ calls++; return a + b; });
+    slow_add(2, 3);
+    slow_add(2, 3);
+    failed_tests += check_test_int("Memoize Test 1: Unbounded Result", slow_add(2, 3), 5);
+    failed_tests += check_test_int("Memoize Test 2: Unbounded Function Called Once", calls, 1);
+    failed_tests += check_test_int("Memoize Test 3: Unbounded Hits", slow_add.stats().hits, 2);
+    slow_add(3, 2);
+    failed_tests += check_test_int("Memoize Test 4: Different Arguments Miss", calls, 2);
+
+    // LRU with a capacity. The least recently used result is evicted
+    calls = 0;
+    auto square = fp::memoize([&calls](double x){ calls++; return x * x; }, fp::memo_policy::lru{2});
+    square(1.0);
+    square(2.0);
+    square(1.0);
+    square(3.0);
+    failed_tests += check_test_int("Memoize Test 5: LRU Evictions", square.stats().evictions, 1);
+    square(1.0);
+    failed_tests += check_test_int("Memoize Test 6: LRU Keeps Recently Used", calls, 3);
+    square(2.0);
+    failed_tests += check_test_int("Memoize Test 7: LRU Recomputes Evicted", calls, 4);
+
+    // LRU with a memory budget
+    auto repeat = fp::memoize([](const std::string& text, int times)
+    {
+        std::string result;
+        for (int i = 0; i < times; i++)
+            result += text;
+        return result;
+    }, fp::memo_policy::lru{0, 4096});
+    for (int i = 1; i <= 50; i++)
+        repeat("memo", i);
+    failed_tests += check_test_list("Memoize Test 8: LRU Budget Result", repeat("ab", 3), std::string{"ababab"});
+    failed_tests += check_test_int("Memoize Test 9: LRU Within Memory Budget", repeat.stats().bytes <= 4096, true);
+    failed_tests += check_test_int("Memoize Test 10: LRU Budget Evicts", repeat.stats().evictions > 0, true);
+
+    // Sharded, shared between threads
+    std::atomic<int> sharded_calls{0};
+    auto cube = fp::memoize([&sharded_calls](int64_t x){ sharded_calls++; return x * x * x; },
+                            fp::memo_policy::sharded{8});
+    std::vector<std::thread> threads;
+    std::vector<int64_t> thread_sums(4, 0);
+    for (std::size_t t = 0; t < thread_sums.size(); t++)
+        threads.emplace_back([&cube, &thread_sums, t]{
+            for (int64_t x = 0; x < 1000; x++)
+                thread_sums[t] += cube(x);
+        });
+    for (auto& thread : threads)
+        thread.join();
+    failed_tests += check_test_list("Memoize Test 11: Sharded Results", thread_sums,
+                                    std::vector<int64_t>(4, 249500250000LL));
+    fp::memo_stats cube_stats = cube.stats();
+    failed_tests += check_test_int("Memoize Test 12: Sharded Counters", cube_stats.hits + cube_stats.misses, 4000);
+    failed_tests += check_test_int("Memoize Test 13: Sharded Entries", cube_stats.entries, 1000);
+
+    // The sharded capacity is for the whole cache, even with more shards than entries
+    auto small_square = fp::memoize([](int64_t x){ return x * x; }, fp::memo_policy::sharded{16, 10});
+    for (int64_t x = 0; x < 1000; x++)
+        small_square(x);
+    failed_tests += check_test_int("Memoize Test 14: Sharded Within Capacity", small_square.stats().entries <= 10, true);
+
+    return failed_tests;
+}
+
+// Lazy stream tests. Pipelines are checked against the staged HOF versions
+int lazy_stream_tests()
+{
+    int failed_tests = 0;
+
+    // increment, keep the even numbers, sum (staged with the list HOFs as the reference)
+    std::vector<int> stream_1{3, 8, -1, 4, 7, 10, 5, 0, 2, 9};
+    std::vector<int> stream_1_staged = stream_1;
+    inclist_HOF<int>(stream_1_staged);
+    std::vector<int> stream_1_even;
+    std::copy_if(stream_1_staged.begin(), stream_1_staged.end(), std::back_inserter(stream_1_even),
+                 [](int x){ return x % 2 == 0; });
+    int stream_1_exp = sumlist_HOF<int>(stream_1_even);
+    failed_tests += check_test_int("Lazy Stream Test 1: Map, Filter, Fold",
+        fp::stream::from(stream_1).map(add(1)).filter([](int x){ return x % 2 == 0; }).fold(0, std::plus<>{}),
+        stream_1_exp);
+    failed_tests += check_test_list("Lazy Stream Test 2: Map, Filter, Take",
+        fp::stream::from(stream_1).map(add(1)).filter([](int x){ return x % 2 == 0; }).take(3).to_vector(),
+        std::vector<int>{4, 0, 8});
+
+    // Infinite Fibonacci source
+    failed_tests += check_test_list("Lazy Stream Test 3: Infinite Fibonacci, Take 10",
+        fp::stream::fibonacci().take(10).to_vector(),
+        std::vector<uint64_t>{0, 1, 1, 2, 3, 5, 8, 13, 21, 34});
+    failed_tests += check_test_int("Lazy Stream Test 4: Fibonacci Numbers Below 1000",
+        fp::stream::fibonacci().take_while([](uint64_t x){ return x < 1000; }).count(), 17);
+    fp::FibonacciEngine engine;
+    failed_tests += check_test_int("Lazy Stream Test 5: Fibonacci Number 93",
+        fp::stream::fibonacci().take(94).fold(uint64_t{0}, [](uint64_t, uint64_t x){ return x; })
+            == *engine.get_fib_uint64(93), true);
+
+    // Zip ends with the shorter stream
+    std::vector<double> prices{10.0, 20.0, 30.0};
+    failed_tests += check_test_double("Lazy Stream Test 6: Zip (Dot Product)",
+        fp::stream::from(prices).zip(fp::stream::iota(1))
+            .map([](const std::pair<double, int>& p){ return p.first * p.second; })
+            .mconcat<fp::monoid::sum>(), 140.0);
+
+    // Range based for loop and empty lists
+    std::vector<int> stream_7;
+    for (int x : fp::stream::iota(1).map(mult(2)).take(4))
+        stream_7.push_back(x);
+    failed_tests += check_test_list("Lazy Stream Test 7: Range For", stream_7, std::vector<int>{2, 4, 6, 8});
+    std::vector<int> stream_8{};
+    failed_tests += check_test_int("Lazy Stream Test 8: Empty List",
+        fp::stream::from(stream_8).map(inc).count(), 0);
+
+    return failed_tests;
+}
+
+int transducer_tests()
+{
+    int failed_tests = 0;
+
+    // increment, keep the even numbers, sum (staged with the list HOFs as the reference)
+    std::vector<int> list_1{3, 8, -1, 4, 7, 10, 5, 0, 2, 9};
+    std::vector<int> list_1_staged = list_1;
+    inclist_HOF<int>(list_1_staged);
+    std::vector<int> list_1_even;
+    std::copy_if(list_1_staged.begin(), list_1_staged.end(), std::back_inserter(list_1_even),
+                 [](int x){ return x % 2 == 0; });
+    auto inc_even = fp::mapping(add(1)) | fp::filtering([](int x){ return x % 2 == 0; });
+    failed_tests += check_test_int("Transducer Test 1: Map, Filter, Fold",
+        fp::transduce(inc_even, std::plus<>{}, 0, list_1), sumlist_HOF<int>(list_1_even));
+    failed_tests += check_test_int("Transducer Test 2: sumlist_HOF",
+        sumlist_HOF(list_1, inc_even), sumlist_HOF<int>(list_1_even));
+    failed_tests += check_test_list("Transducer Test 3: Into Vector", fp::into_vector(inc_even, list_1), list_1_even);
+
+    // The order of the stages matters: filter then map is not map then filter
+    failed_tests += check_test_list("Transducer Test 4: Filter, Map",
+        fp::into_vector(fp::filtering([](int x){ return x % 2 == 0; }) | fp::mapping(add(1)), list_1),
+        std::vector<int>{9, 5, 11, 1, 3});
+    failed_tests += check_test_list("Transducer Test 5: Map To Another Type",
+        fp::into_vector(fp::mapping([](int x){ return x * 0.5; }) | fp::taking(3), list_1),
+        std::vector<double>{1.5, 4.0, -0.5});
+
+    // Stateful stages start over on every run
+    std::vector<int> list_6{1, 1, 2, 2, 2, 3, 1, 1, 4};
+    auto dedupe_take = fp::deduplicating() | fp::taking(4);
+    failed_tests += check_test_list("Transducer Test 6: Deduplicate, Take",
+        fp::into_vector(dedupe_take, list_6), std::vector<int>{1, 2, 3, 1});
+    failed_tests += check_test_list("Transducer Test 7: Run Twice",
+        fp::into_vector(dedupe_take, list_6), std::vector<int>{1, 2, 3, 1});
+    failed_tests += check_test_list("Transducer Test 8: Take 0",
+        fp::into_vector(fp::taking(0), list_6), std::vector<int>{});
+
+    // taking stops reading the source, so infinite streams end, and a stream
+    // is not read past the last element taken
+    failed_tests += check_test_list("Transducer Test 9: Infinite Fibonacci Stream",
+        fp::into_vector(fp::filtering([](uint64_t x){ return x % 2 == 0; }) | fp::taking(5), fp::stream::fibonacci()),
+        std::vector<uint64_t>{0, 2, 8, 34, 144});
+    int pulled = 0;
+    fp::transduce(fp::taking(3), std::plus<>{}, 0,
+                  fp::stream::iota(1).map([&pulled](int x){ pulled++; return x; }));
+    failed_tests += check_test_int("Transducer Test 10: Elements Pulled", pulled, 3);
+
+    // Parallel: the same result as sequential, for any number of chunks
+    std::vector<double> list_11(100000);
+    for (std::size_t i = 0; i < list_11.size(); i++)
+        list_11[i] = double(i % 1000) - 500.0;
+    auto positive_squares = fp::filtering([](double x){ return x > 0; }) | fp::mapping([](double x){ return x * x; });
+    double list_11_exp = fp::transduce(positive_squares, std::plus<>{}, 1.0, list_11);
+    fp::ThreadPool pool(4);
+    fp::parallel_options options;
+    options.pool = &pool;
+    options.grain_size = 1000;
+    failed_tests += check_test_double("Transducer Test 11: Parallel Sum Of Squares",
+        fp::transduce(positive_squares, std::plus<>{}, 1.0, list_11, options), list_11_exp);
+    failed_tests += check_test_double("Transducer Test 12: Parallel Max",
+        fp::transduce(positive_squares, fp::maximum{}, 0.0, list_11, options), 499.0 * 499.0);
+
+    // Mapped and streamed files
+    write_binary_file("fp_test_transduce.bin", list_11);
+    fp::MappedArray<double> mapped("fp_test_transduce.bin");
+    failed_tests += check_test_double("Transducer Test 13: Mapped File",
+        fp::transduce(positive_squares, std::plus<>{}, 1.0, mapped), list_11_exp);
+    failed_tests += check_test_double("Transducer Test 14: Mapped File In Parallel",
+        fp::transduce(positive_squares, std::plus<>{}, 1.0, mapped, options), list_11_exp);
+    fp::ChunkedFileReader<double> reader("fp_test_transduce.bin", 4096);
+    failed_tests += check_test_double("Transducer Test 15: Streamed File",
+        fp::transduce(positive_squares, std::plus<>{}, 1.0, reader), list_11_exp);
+    fp::ChunkedFileReader<double> reader_take("fp_test_transduce.bin", 4096);
+    failed_tests += check_test_int("Transducer Test 16: Streamed File, Take",
+        fp::into_vector(fp::filtering([](double x){ return x > 498.0; }) | fp::taking(2), reader_take).size(), 2);
+    std::remove("fp_test_transduce.bin");
+
     return failed_tests;
 }
 
@@ -323,8 +1512,9 @@ int maybe_optional_monad_tests()
     std::cout << "      std::optional is used as the Maybe monad, to allow computation error." << std::endl;
     std::cout << "      Divide will fail if the denominator is 0, and square root will fail on negative numbers." << std::endl;
     std::cout << "      Once a failure is reached, the computation will kick out and not go any furthe.r" << std::endl;
-    std::cout << "      View the print statements to ensure the computation is stopped after a failure." << std::endl;
+    std::cout << "      View the trace report to ensure the computation is stopped after a failure." << std::endl;
     std::cout << std::endl;
+    fp::trace::Collector::instance().reset();
     result = divide(10.0, 5.0) | square_root | double_opt;
     failed_tests += check_test_optional_double("Maybe/Optional Monad Test 1: Valid computation",
                                                result, 2.828, true); 
@@ -338,6 +1528,508 @@ int maybe_optional_monad_tests()
     failed_tests += check_test_optional_double("Maybe/Optional Monad Test 4: Square Root Failure (Negative)",
                                                result, 0.0, false); 
 
+    // 4 divides, 3 square roots (one divide failed) and 2 doubles (one square root failed)
+    fp::trace::snapshot trace = fp::trace::Collector::instance().take_snapshot();
+    if (fp::trace::enabled)
+    {
+        failed_tests += check_test_int("Maybe/Optional Monad Test 5: Divide Calls", trace.find("divide")->calls, 4);
+        failed_tests += check_test_int("Maybe/Optional Monad Test 6: Square Root Calls", trace.find("square_root")->calls, 3);
+        failed_tests += check_test_int("Maybe/Optional Monad Test 7: Double Calls", trace.find("double_opt")->calls, 2);
+        failed_tests += check_test_int("Maybe/Optional Monad Test 8: Stages Skipped",
+                                       trace.find("bind_maybe")->short_circuits, 3);
+        std::cout << "Trace report (Maybe/Optional Monad Tests):" << std::endl;
+        fp::trace::text_sink(std::cout)(trace);
+    }
+
+    return failed_tests;
+}
+
+// The Maybe chain again, with every stage run as a task on a thread pool
+int async_maybe_tests()
+{
+    int failed_tests = 0;
+    fp::ThreadPool pool(4);
+
+    // Same chains, and results, as the Maybe/Optional Monad Tests
+    failed_tests += check_test_optional_double("Async Maybe Test 1: Valid computation",
+        (fp::async_task(pool, divide, 10.0, 5.0) | square_root | double_opt).get(), 2.828, true);
+    failed_tests += check_test_optional_double("Async Maybe Test 2: Divide Failure (x/0)",
+        (fp::async_task(pool, divide, 10.0, 0.0) | square_root | double_opt).get(), 0.0, false);
+    failed_tests += check_test_optional_double("Async Maybe Test 3: Square Root Failure (Negative)",
+        (fp::async_task(pool, divide, -10.0, 5.0) | square_root | double_opt).get(), 0.0, false);
+
+    // Stages after a failure are never scheduled
+    std::atomic<int> stages_run{0};
+    auto counted = [&stages_run](double x) -> std::optional<double> { stages_run++; return x; };
+    (void)(fp::make_task(std::optional<double>{}, pool) | counted | counted).get();
+    (void)(fp::make_task(std::optional<double>{1.0}, pool) | counted | counted).get();
+    failed_tests += check_test_int("Async Maybe Test 4: Failed Chain Schedules No Stages", stages_run.load(), 2);
+
+    // Thousands of chains in flight at once agree with the synchronous chain
+    std::vector<fp::Task<std::optional<double>>> chains;
+    for (int i = 0; i < 5000; i++)
+        chains.push_back(fp::async_task(pool, divide, double(i % 50 - 10), double(i % 7)) | square_root | double_opt);
+    bool chains_match = true;
+    for (int i = 0; i < 5000; i++)
+        chains_match = chains_match && chains[i].get() == (divide(double(i % 50 - 10), double(i % 7)) | square_root | double_opt);
+    failed_tests += check_test_int("Async Maybe Test 5: 5000 Concurrent Chains", chains_match, true);
+
+    // A stage may itself be asynchronous, and return a task
+    auto square_root_async = [&pool](double x) { return fp::async_task(pool, square_root, x); };
+    failed_tests += check_test_optional_double("Async Maybe Test 6: Asynchronous Stage",
+        (fp::make_task(std::optional<double>{16.0}, pool) | square_root_async | double_opt).get(), 8.0, true);
+
+    // An exception skips the rest of the chain and is rethrown by get()
+    auto throwing = [](double) -> std::optional<double> { throw std::runtime_error("stage failed"); };
+    auto failed_chain = fp::make_task(std::optional<double>{1.0}, pool) | throwing | counted;
+    bool rethrown = false;
+    try
+    {
+        failed_chain.get();
+    }
+    catch (const std::runtime_error&)
+    {
+        rethrown = true;
+    }
+    failed_tests += check_test_int("Async Maybe Test 7: Exception Rethrown", rethrown && stages_run.load() == 2, true);
+
+    // A task is move only, and its state takes a single continuation
+    auto once = fp::make_task(std::optional<double>{1.0}, pool);
+    once.state()->on_ready([](bool){});
+    bool second_rejected = false;
+    try
+    {
+        once.state()->on_ready([](bool){});
+    }
+    catch (const std::logic_error&)
+    {
+        second_rejected = true;
+    }
+    failed_tests += check_test_int("Async Maybe Test 8: Continued Only Once",
+        second_rejected && !std::is_copy_constructible_v<fp::Task<std::optional<double>>>, true);
+
+    return failed_tests;
+}
+
+// Payload which counts its copies, for the move aware bind tests
+struct CopyCounter
+{
+    static int copies;
+    std::vector<double> payload;
+    CopyCounter(std::vector<double> values) : payload(std::move(values)) {}
+    CopyCounter(const CopyCounter& other) : payload(other.payload) { copies++; }
+    CopyCounter(CopyCounter&&) = default;
+    CopyCounter& operator=(const CopyCounter& other) { payload = other.payload; copies++; return *this; }
+    CopyCounter& operator=(CopyCounter&&) = default;
+};
+int CopyCounter::copies = 0;
+
+// Move aware bind and the batch (validity bitmask) Maybe chain
+int maybe_batch_tests()
+{
+    int failed_tests = 0;
+
+    // A chain of binds moves the payload from stage to stage
+    auto drop_first = [](CopyCounter c) -> std::optional<CopyCounter> {
+        c.payload.erase(c.payload.begin()); return c; };
+    auto must_be_long = [](CopyCounter c) -> std::optional<CopyCounter> {
+        return (c.payload.size() < 2) ? std::nullopt : std::optional<CopyCounter>(std::move(c)); };
+    CopyCounter::copies = 0;
+    std::optional<CopyCounter> chain = std::optional<CopyCounter>(std::vector<double>(1000, 1.0))
+                                       | drop_first | must_be_long | drop_first;
+    failed_tests += check_test_int("Maybe Batch Test 1: Bind Chain Makes No Copies", CopyCounter::copies, 0);
+    failed_tests += check_test_int("Maybe Batch Test 2: Bind Chain Result", chain->payload.size(), 998);
+
+    // Batch chain against the scalar chain, over a size which is not a whole mask word
+    std::vector<double> nums;
+    std::vector<double> denoms;
+    for (int i = 0; i < 150; i++)
+    {
+        nums.push_back((i % 7) - 2.0);
+        denoms.push_back(i % 11 == 0 ? 0.0 : 0.5 * (i % 5 + 1));
+    }
+    std::vector<std::optional<double>> scalar_results;
+    for (std::size_t i = 0; i < nums.size(); i++)
+        scalar_results.push_back(divide(nums[i], denoms[i]) | square_root | double_opt);
+
+    fp::MaybeBatch<double> batch = divide_batch(nums, denoms) | square_root_kernel | double_kernel;
+    failed_tests += check_test_int("Maybe Batch Test 3: Batch Chain Matches Scalar Chain",
+                                   batch.to_optionals() == scalar_results, true);
+    failed_tests += check_test_int("Maybe Batch Test 4: Valid Lane Count", batch.count_valid(),
+        std::count_if(scalar_results.begin(), scalar_results.end(), [](const auto& r){ return r.has_value(); }));
+
+    // Ordinary Maybe functions can be bound to a batch as well
+    fp::MaybeBatch<double> mixed = divide_batch(nums, denoms) | square_root | double_kernel;
+    failed_tests += check_test_int("Maybe Batch Test 5: Batch Bind to Maybe Function",
+                                   mixed.to_optionals() == scalar_results, true);
+
+    // A kernel which changes the value type
+    fp::MaybeBatch<double> small_batch(std::vector<double>{4.0, -1.0, 9.0});
+    auto rounded = small_batch | square_root_kernel
+                               | fp::maybe_kernel([](double){ return true; }, [](double x){ return int(x); });
+    failed_tests += check_test_int("Maybe Batch Test 6: Kernel Changes Type",
+        rounded.to_optionals() == std::vector<std::optional<int>>{2, std::nullopt, 3}, true);
+
+    return failed_tests;
+}
+
+// Math computation with error handling, using the Either monad, which keeps the error code
+int either_monad_tests()
+{
+    int failed_tests = 0;
+
+    std::cout << std::endl;
+    std::cout << "***** Either Monad Tests " << std::endl;
+    std::cout << "Note: The Maybe computation 2 * square_root(x / y) again, where a failure" << std::endl;
+    std::cout << "      carries an error code which says which stage failed." << std::endl;
+    std::cout << std::endl;
+    fp::trace::Collector::instance().reset();
+    fp::Either<math_error, double> result = divide_either(10.0, 5.0) | square_root_either | double_either;
+    failed_tests += check_test_optional_double("Either Monad Test 1: Valid computation",
+                                               result.to_optional(), 2.828, true);
+    result = divide_either(10.0, 0.0) | square_root_either | double_either;
+    failed_tests += check_test_int("Either Monad Test 2: Divide Failure (x/0)",
+                                   int(result.value_or(0.0) == 0.0 && result.error() == math_error::divide_by_zero), 1);
+    result = divide_either(-10.0, 5.0) | square_root_either | double_either;
+    failed_tests += check_test_int("Either Monad Test 3: Square Root Failure (Negative)",
+                                   int(result.error()), int(math_error::negative_square_root));
+
+    // The first error is kept, even when a later stage would fail as well
+    result = divide_either(-10.0, 0.0) | square_root_either | square_root_either;
+    failed_tests += check_test_int("Either Monad Test 4: First Error Kept",
+                                   int(result.error()), int(math_error::divide_by_zero));
+
+    // Errors are turned into other codes, or messages, without touching values
+    auto describe = [](math_error error) {
+        return (error == math_error::divide_by_zero) ? "divide by zero" : "negative square root"; };
+    fp::Either<const char*, double> described = divide_either(-4.0, 1.0) | square_root_either | fp::map_error(describe);
+    failed_tests += check_test_int("Either Monad Test 5: Map Error",
+                                   std::string(described.error()) == "negative square root", true);
+    described = fp::map_error(divide_either(16.0, 1.0) | square_root_either, describe);
+    failed_tests += check_test_optional_double("Either Monad Test 6: Map Error Keeps Value",
+                                               described.to_optional(), 4.0, true);
+    failed_tests += check_test_int("Either Monad Test 7: Trivially Copyable",
+        std::is_trivially_copyable_v<fp::Either<math_error, double>>, true);
+
+    bool threw = false;
+    try
+    {
+        (void)(divide_either(1.0, 0.0)).value();
+    }
+    catch (const std::bad_optional_access&)
+    {
+        threw = true;
+    }
+    failed_tests += check_test_int("Either Monad Test 8: Checked Access of an Error Throws", threw, true);
+
+    // Two stages skipped after each failed divide, one after each failed square root
+    fp::trace::snapshot trace = fp::trace::Collector::instance().take_snapshot();
+    if (fp::trace::enabled)
+    {
+        failed_tests += check_test_int("Either Monad Test 9: Stages Skipped",
+            trace.find("bind_either")->short_circuits, 5);
+    }
+
+    // Batch chain against the scalar chain, with the error codes in a side array
+    std::vector<double> nums;
+    std::vector<double> denoms;
+    for (int i = 0; i < 150; i++)
+    {
+        nums.push_back((i % 7) - 2.0);
+        denoms.push_back(i % 11 == 0 ? 0.0 : 0.5 * (i % 5 + 1));
+    }
+    std::vector<fp::Either<math_error, double>> scalar_results;
+    for (std::size_t i = 0; i < nums.size(); i++)
+        scalar_results.push_back(divide_either(nums[i], denoms[i]) | square_root_either | double_either);
+    fp::EitherBatch<math_error, double> batch = divide_either_batch(nums, denoms)
+                                                | square_root_either_kernel | double_either_kernel;
+    failed_tests += check_test_int("Either Monad Test 10: Batch Matches Scalar Chain",
+                                   batch.to_eithers() == scalar_results, true);
+    fp::EitherBatch<math_error, double> mixed = divide_either_batch(nums, denoms)
+                                                | square_root_either | double_either_kernel;
+    failed_tests += check_test_int("Either Monad Test 11: Batch Bind to Either Function",
+                                   mixed.to_eithers() == scalar_results, true);
+    failed_tests += check_test_int("Either Monad Test 12: Batch Error Codes",
+        std::count(batch.errors().begin(), batch.errors().end(), math_error::divide_by_zero), 14);
+    auto codes = batch | fp::map_error([](math_error error) { return int(error) + 400; });
+    failed_tests += check_test_int("Either Monad Test 13: Batch Map Error",
+        codes.error(0) == 401 && codes.error(1) == 402 && codes.has_value(2), true);
+
+    return failed_tests;
+}
+
+// Instrumentation tests. Statistics, sinks, and events from several threads
+int trace_tests()
+{
+    int failed_tests = 0;
+    if (!fp::trace::enabled)
+        return failed_tests;
+    fp::trace::Collector& collector = fp::trace::Collector::instance();
+    collector.reset();
+
+    // Calls, latencies and short circuits are counted per trace point
+    auto traced = [](int x) -> std::optional<int>
+    {
+        FP_TRACE_SCOPE("trace_tests::traced");
+        return (x < 0) ? std::nullopt : std::optional<int>(x);
+    };
+    for (int x = -5; x < 5; x++)
+        (void)(traced(x) | traced | traced);
+    fp::trace::snapshot trace = collector.take_snapshot();
+    const fp::trace::point_stats* point = trace.find("trace_tests::traced");
+    failed_tests += check_test_int("Trace Test 1: Call Count", point->calls, 20);
+    failed_tests += check_test_int("Trace Test 2: Histogram Holds Every Call",
+        std::accumulate(point->latency_histogram.begin(), point->latency_histogram.end(), uint64_t(0)), 20);
+    failed_tests += check_test_int("Trace Test 3: Short Circuits", trace.find("bind_maybe")->short_circuits, 10);
+    failed_tests += check_test_int("Trace Test 4: Percentiles Ordered",
+                                   point->percentile_ns(0.5) <= point->percentile_ns(0.99), true);
+
+    // Events recorded on other threads, including ones which have exited, are drained
+    collector.reset();
+    fp::ThreadPool pool(4);
+    pool.parallel_for(4, [&](std::size_t){ for (int x = 0; x < 1000; x++) traced(x); });
+    std::thread([&]{ for (int x = 0; x < 1000; x++) traced(x); }).join();
+    failed_tests += check_test_int("Trace Test 5: Events From Several Threads",
+                                   collector.take_snapshot().find("trace_tests::traced")->calls, 5000);
+
+    // A full buffer drops events rather than block, and counts them
+    collector.reset();
+    std::size_t overflow = fp::trace::detail::EventBuffer::capacity + 100;
+    for (std::size_t i = 0; i < overflow; i++)
+        traced(1);
+    trace = collector.take_snapshot();
+    failed_tests += check_test_int("Trace Test 6: Dropped Events Counted",
+                                   trace.find("trace_tests::traced")->calls + trace.dropped_events, overflow);
+
+    // The background collector drains to a sink, and writes a final snapshot on stop
+    collector.reset();
+    std::ostringstream json;
+    collector.start(fp::trace::json_sink(json), std::chrono::milliseconds(1));
+    traced(1);
+    collector.stop();
+    failed_tests += check_test_int("Trace Test 7: JSON Sink",
+        json.str().rfind("{\"dropped_events\":0,\"points\":[{\"name\":\"trace_tests::traced\",\"calls\":1,", 0) == 0, true);
+    std::ostringstream text;
+    fp::trace::text_sink(text)(collector.take_snapshot());
+    failed_tests += check_test_int("Trace Test 8: Text Sink",
+        text.str().rfind("trace_tests::traced: calls=1 short_circuits=0 mean_ns=", 0) == 0, true);
+    collector.reset();
+
+    return failed_tests;
+}
+
+// Random shapes for the property tests. Shrinking keeps the alternative and
+// shrinks one dimension at a time
+struct shape_generator
+{
+    using value_type = adt_shape;
+    fp::check::real_generator dimension;
+
+    adt_shape operator()(fp::check::Random& random) const
+    {
+        double a = dimension(random);
+        double b = dimension(random);
+        switch (random.below(std::variant_size_v<adt_shape>))
+        {
+        case 0: return Shape::circle{a};
+        case 1: return Shape::square{a};
+        case 2: return Shape::rectangle{a, b};
+        case 3: return Shape::ellipse{a, b};
+        default: return Shape::cylinder{a, b};
+        }
+    }
+
+    std::vector<adt_shape> shrink(const adt_shape& shape) const
+    {
+        std::vector<adt_shape> candidates;
+        auto shrink_two = [&](double a, double b, auto make) {
+            for (double smaller : dimension.shrink(a))
+                candidates.push_back(make(smaller, b));
+            for (double smaller : dimension.shrink(b))
+                candidates.push_back(make(a, smaller));
+        };
+        fp::match(shape)(
+            [&](const Shape::circle& circle) {
+                for (double smaller : dimension.shrink(circle.radius))
+                    candidates.push_back(Shape::circle{smaller}); },
+            [&](const Shape::square& square) {
+                for (double smaller : dimension.shrink(square.side))
+                    candidates.push_back(Shape::square{smaller}); },
+            [&](const Shape::rectangle& rectangle) {
+                shrink_two(rectangle.length, rectangle.width, [](double a, double b){ return Shape::rectangle{a, b}; }); },
+            [&](const Shape::ellipse& ellipse) {
+                shrink_two(ellipse.axis_1, ellipse.axis_2, [](double a, double b){ return Shape::ellipse{a, b}; }); },
+            [&](const Shape::cylinder& cylinder) {
+                shrink_two(cylinder.radius, cylinder.height, [](double a, double b){ return Shape::cylinder{a, b}; }); });
+        return candidates;
+    }
+
+    void describe(std::ostream& out, const adt_shape& shape) const
+    {
+        auto fields = [&out](const char* name, double a, const double* b) {
+            out << name << "{";
+            fp::check::detail::describe_value(out, a);
+            if (b)
+            {
+                out << ", ";
+                fp::check::detail::describe_value(out, *b);
+            }
+            out << "}";
+        };
+        fp::match(shape)(
+            [&](const Shape::circle& circle) { fields("circle", circle.radius, nullptr); },
+            [&](const Shape::square& square) { fields("square", square.side, nullptr); },
+            [&](const Shape::rectangle& rectangle) { fields("rectangle", rectangle.length, &rectangle.width); },
+            [&](const Shape::ellipse& ellipse) { fields("ellipse", ellipse.axis_1, &ellipse.axis_2); },
+            [&](const Shape::cylinder& cylinder) { fields("cylinder", cylinder.radius, &cylinder.height); });
+    }
+};
+
+// Reference for the Money rates: amount * rate / 10^6 in 128 bit arithmetic,
+// rounded by mode the long way round
+int64_t reference_rate_part(int64_t amount, int64_t rate, fp::rounding mode)
+{
+    const __int128 denominator = fp::Rate::unit;
+    __int128 product = __int128(amount) * rate;
+    __int128 quotient = product / denominator;
+    __int128 remainder = product % denominator;
+    if (remainder == 0 || mode == fp::rounding::toward_zero)
+        return int64_t(quotient);
+    __int128 twice = 2 * ((remainder < 0) ? -remainder : remainder);
+    bool away = (mode == fp::rounding::away_from_zero)
+             || (mode == fp::rounding::half_up && twice >= denominator)
+             || (mode == fp::rounding::half_even && (twice > denominator || (twice == denominator && (quotient & 1))));
+    return int64_t(quotient + (away ? ((product < 0) ? -1 : 1) : 0));
+}
+
+// Property tests. Each fast kernel (vectorized, parallel, batch or fixed point)
+// against its reference version, on random inputs with edge values, NaNs and
+// empty lists. Nothing is printed for a property which holds, unless timings
+// are asked for, and the output is written in one go at the end
+int property_tests(const fp::check::options& options, bool timings)
+{
+    using list = std::vector<double>;
+    std::vector<fp::check::report> reports;
+    auto any_doubles = fp::check::doubles(-1e6, 1e6, true);
+    auto int_lists = fp::check::vectors(fp::check::integers(-1000000, 1000000), 2048);
+    auto double_lists = fp::check::vectors(any_doubles, 2048);
+
+    auto sum_reference = [](const auto& in_list) {
+        using T = typename std::decay_t<decltype(in_list)>::value_type;
+        return sumlist_recursive<T>(in_list.begin(), in_list.end()); };
+    // Another order of additions rounds differently: by at most one rounding
+    // of a partial sum per element, each under epsilon times the sum of the
+    // magnitudes. A NaN or infinite sum does not depend on the order
+    auto sum_tolerance = [](double fast, double reference, const list& in_list) {
+        if (!std::isfinite(reference))
+            return fp::check::ulp_distance(fast, reference) == 0;
+        double magnitude = 0.0;
+        for (double x : in_list)
+            magnitude += std::fabs(x);
+        return std::fabs(fast - reference) <= double(in_list.size()) * std::numeric_limits<double>::epsilon() * magnitude;
+    };
+
+    reports.push_back(fp::check::differential("sumlist<int> (vectorized) vs sumlist_recursive", int_lists,
+        [](const std::vector<int>& in_list){ return sumlist<int>(in_list.begin(), in_list.end()); },
+        sum_reference, std::equal_to<>{}, options));
+    reports.push_back(fp::check::differential("fp::fold<int> (parallel) vs sumlist_recursive", int_lists,
+        [](const std::vector<int>& in_list){ return fp::fold(in_list, 0, std::plus<>{}, fp::parallel_options{512}); },
+        sum_reference, std::equal_to<>{}, options));
+    reports.push_back(fp::check::differential("sumlist<double> (vectorized) vs sumlist_recursive", double_lists,
+        [](const list& in_list){ return sumlist<double>(in_list.begin(), in_list.end()); },
+        sum_reference, sum_tolerance, options));
+    reports.push_back(fp::check::differential("reproducible_sum vs sumlist_recursive", double_lists,
+        [](const list& in_list){ return fp::reproducible_sum(in_list); },
+        sum_reference, sum_tolerance, options));
+
+    // Lists of several reproducible blocks, summed on 1 and on 8 threads
+    fp::check::options long_lists = options;
+    long_lists.cases = std::max<std::size_t>(options.cases / 20, 1);
+    reports.push_back(fp::check::differential("reproducible_sum (8 threads) vs reproducible_sum (1 thread)",
+        fp::check::vectors(any_doubles, 40000),
+        [](const list& in_list){ return fp::reproducible_sum(in_list, fp::parallel_options{4096, 8}); },
+        [](const list& in_list){ return fp::reproducible_sum(in_list, fp::parallel_options{0, 1}); },
+        fp::check::within_ulps{0}, long_lists));
+
+    // compute_areas uses the same formulas as compute_area, on vector registers.
+    // Unoptimized, compute_area calls pow(radius, 2.0) from libm, which may be
+    // a unit in the last place away from radius * radius
+    reports.push_back(fp::check::differential("compute_areas (ShapeColumns) vs compute_area",
+        fp::check::vectors(shape_generator{fp::check::doubles(0.0, 1e4, true)}, 256),
+        [](const std::vector<adt_shape>& shapes){ return compute_areas(ShapeColumns(shapes)); },
+        [](const std::vector<adt_shape>& shapes){
+            std::vector<double> areas;
+            for (const auto& shape : shapes)
+                areas.push_back(compute_area(shape));
+            return areas; },
+        fp::check::within_ulps{2}, options));
+
+    // The batch Maybe and Either chains give exactly the scalar chains' results
+    auto divisions = fp::check::vectors(fp::check::pairs(any_doubles, fp::check::doubles(-4.0, 4.0, true)), 300);
+    using division_list = std::vector<std::pair<double, double>>;
+    auto split = [](const division_list& in_list) {
+        std::pair<list, list> columns;
+        for (const auto& [num, denom] : in_list)
+        {
+            columns.first.push_back(num);
+            columns.second.push_back(denom);
+        }
+        return columns; };
+    reports.push_back(fp::check::differential("Maybe chain (MaybeBatch) vs Maybe chain (std::optional)", divisions,
+        [&](const division_list& in_list){
+            auto [nums, denoms] = split(in_list);
+            return (divide_batch(nums, denoms) | square_root_kernel | double_kernel).to_optionals(); },
+        [](const division_list& in_list){
+            std::vector<std::optional<double>> results;
+            for (const auto& [num, denom] : in_list)
+                results.push_back(divide(num, denom) | square_root | double_opt);
+            return results; },
+        fp::check::within_ulps{0}, options));
+    reports.push_back(fp::check::differential("Either chain (EitherBatch) vs Either chain (fp::Either)", divisions,
+        [&](const division_list& in_list){
+            auto [nums, denoms] = split(in_list);
+            return (divide_either_batch(nums, denoms) | square_root_either_kernel | double_either_kernel).to_eithers(); },
+        [](const division_list& in_list){
+            std::vector<fp::Either<math_error, double>> results;
+            for (const auto& [num, denom] : in_list)
+                results.push_back(divide_either(num, denom) | square_root_either | double_either);
+            return results; },
+        fp::check::within_ulps{0}, options));
+
+    // Money plus tax on the integer vector loop, against 128 bit arithmetic.
+    // Amounts up to $100 million, rates from 0 to 100%, every rounding mode
+    using money_input = std::pair<std::vector<int64_t>, std::pair<int64_t, int>>;
+    reports.push_back(fp::check::differential("Money plus_tax (batch) vs 128 bit reference",
+        fp::check::pairs(fp::check::vectors(fp::check::integers<int64_t>(-10000000000, 10000000000), 300),
+                         fp::check::pairs(fp::check::integers<int64_t>(0, fp::Rate::unit), fp::check::integers(0, 3))),
+        [](const money_input& in){
+            std::vector<fp::Money> amounts;
+            for (int64_t units : in.first)
+                amounts.push_back(fp::Money::from_units(units));
+            auto plus_tax = fp::money::plus_tax(fp::Rate::from_units(in.second.first), fp::rounding(in.second.second));
+            std::vector<int64_t> totals;
+            for (fp::Money total : fp::apply_all(amounts, plus_tax))
+                totals.push_back(total.units());
+            return totals; },
+        [](const money_input& in){
+            std::vector<int64_t> totals;
+            for (int64_t units : in.first)
+                totals.push_back(units + reference_rate_part(units, in.second.first, fp::rounding(in.second.second)));
+            return totals; },
+        std::equal_to<>{}, options));
+
+    std::ostringstream out;
+    int failed_tests = 0;
+    std::size_t cases = 0;
+    for (const auto& report : reports)
+    {
+        fp::check::write_report(out, report, timings);
+        failed_tests += report.passed() ? 0 : 1;
+        cases += report.cases;
+    }
+    out << reports.size() << " properties, " << cases << " random cases (seed " << options.seed << "), "
+        << failed_tests << " failed\n";
+    std::cout << "\n***** Property Tests\n" << out.str() << std::flush;
     return failed_tests;
 }
 
@@ -352,23 +2044,97 @@ void test_summary(int failed_tests)
     std::cout << "========================================" << std::endl;
 }
 
-int main ()
+int main (int argc, char** argv)
 {
+    // Property tests: --seed and --cases pick the random inputs, and --timings
+    // reports the time per case of each fast kernel and its reference
+    fp::check::options property_options;
+    bool timings = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--timings")
+            timings = true;
+        else if ((arg == "--seed" || arg == "--cases") && i + 1 < argc)
+        {
+            uint64_t value = std::strtoull(argv[++i], nullptr, 0);
+            if (arg == "--seed")
+                property_options.seed = value;
+            else
+                property_options.cases = value;
+        }
+        else
+        {
+            std::cerr << "Unknown or incomplete argument " << arg << std::endl;
+            return 2;
+        }
+    }
+
     // Keep track of the number of failed tests
     int failed_tests = 0;
     
     failed_tests += sumlist_tests();
 
+    failed_tests += reduce_tests();
+
+    failed_tests += trampoline_tests();
+
+    failed_tests += monoid_tests();
+
     failed_tests += inclist_tests();
 
+#if __has_include(<memory_resource>)
+    failed_tests += memory_resource_tests();
+#endif
+
+    failed_tests += parallel_HOF_tests();
+
+    failed_tests += reproducible_sum_tests();
+
+    failed_tests += persistent_vector_tests();
+
+    failed_tests += mapped_array_tests();
+
     failed_tests += compute_area_tests();
 
+    failed_tests += match_tests();
+
+    failed_tests += shape_columns_tests();
+
+    failed_tests += shape_file_tests();
+
+    failed_tests += shape_analytics_tests();
+
     failed_tests += currying_tests();
 
+    failed_tests += composition_tests();
+
+    failed_tests += money_tests();
+
     failed_tests += lazy_fibonacci_tests();
+
+    failed_tests += sequence_table_tests();
+
+    failed_tests += fibonacci_engine_tests();
+
+    failed_tests += memoize_tests();
+
+    failed_tests += lazy_stream_tests();
+
+    failed_tests += transducer_tests();
     
     failed_tests += maybe_optional_monad_tests();
 
+    failed_tests += async_maybe_tests();
+
+    failed_tests += maybe_batch_tests();
+
+    failed_tests += either_monad_tests();
+
+    failed_tests += trace_tests();
+
+    failed_tests += property_tests(property_options, timings);
+
     // Print out the test summary. Notify of any failures.
     test_summary(failed_tests);
 }